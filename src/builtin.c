@@ -0,0 +1,473 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "mht.h"
+#include "builtin.h"
+#include "str_util.h"
+
+
+/*
+	The operators of builtin_arith, the user data of the builtin is a
+	pointer into this string.
+*/
+static char builtin_ops[] = "+-*/%";
+
+/*
+	The escape modes of builtin_escape, the user data of the builtin is a
+	pointer into this array.
+*/
+static int builtin_esc_modes[] = { STR_ESC_HTML, STR_ESC_ATTR, STR_ESC_URL, STR_ESC_JS };
+
+
+/*
+	Register the string and integer builtins. All of them work on the
+	slices of their arguments and append directly to the output, no
+	memory is allocated per call.
+*/
+void builtin_register_std(void) {
+	mht_register_builtin("len",builtin_len,(void*)NULL);
+	mht_register_builtin("substr",builtin_substr,(void*)NULL);
+	mht_register_builtin("replace",builtin_replace,(void*)NULL);
+	mht_register_builtin("upper",builtin_upper,(void*)NULL);
+	mht_register_builtin("lower",builtin_lower,(void*)NULL);
+	mht_register_builtin("add",builtin_arith,&builtin_ops[0]);
+	mht_register_builtin("sub",builtin_arith,&builtin_ops[1]);
+	mht_register_builtin("mul",builtin_arith,&builtin_ops[2]);
+	mht_register_builtin("div",builtin_arith,&builtin_ops[3]);
+	mht_register_builtin("mod",builtin_arith,&builtin_ops[4]);
+	mht_register_builtin("cmp",builtin_cmp,(void*)NULL);
+	mht_register_builtin("printf",builtin_printf,(void*)NULL);
+	mht_register_builtin("html",builtin_escape,&builtin_esc_modes[0]);
+	mht_register_builtin("attr",builtin_escape,&builtin_esc_modes[1]);
+	mht_register_builtin("url",builtin_escape,&builtin_esc_modes[2]);
+	mht_register_builtin("js",builtin_escape,&builtin_esc_modes[3]);
+}
+
+
+/*
+	Convert an argument to a long. Leading and trailing white spaces are
+	allowed, an empty argument is 0. Returns 1 on success, 0 if the
+	argument is not an integer.
+*/
+int builtin_get_long( MHT_SLICE *arg, long *value ) {
+	char *end = (char*)NULL;
+
+	(*value) = 0;
+
+	if (arg->len==0) {
+		return (1);
+	}
+
+	errno = 0;
+	(*value) = strtol(arg->ptr,&end,10);
+
+	if (end==arg->ptr || errno==ERANGE) {
+		return (0);
+	}
+
+	while (isspace((unsigned char)*end)) {
+		end++;
+	}
+
+	return (end==arg->ptr+arg->len);
+}
+
+
+/*
+	Append a long in decimal notation.
+*/
+void builtin_append_long( MHT_BUILDER *out, long value ) {
+	char num[BUILTIN_NUM_LEN];
+
+	sprintf(num,"%ld",value);
+	mht_builder_append(out,num,(unsigned int)strlen(num));
+}
+
+
+/*
+	<#len|str>
+	The length of str.
+*/
+int builtin_len( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	builtin_append_long(out,(arg_count>1) ? (long)args[1].len : 0L);
+
+	return (1);
+}
+
+
+/*
+	<#substr|str|start|count>
+	count chars of str beginning at start (0 is the first char). A
+	negative start counts from the end of str, without count the rest
+	of str is taken.
+*/
+int builtin_substr( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	long
+		start = 0,
+		count = 0,
+		len = 0;
+
+	if (arg_count<3 || builtin_get_long(&args[2],&start)==0) {
+		return (0);
+	}
+
+	len = (long)args[1].len;
+
+	if (arg_count<4 || args[3].len==0) {
+		count = len;
+	}
+	else if (builtin_get_long(&args[3],&count)==0) {
+		return (0);
+	}
+
+	if (start<0) {
+		start = (start<-len) ? 0 : len+start;
+	}
+
+	if (start<len && count>0) {
+		if (count>len-start) {
+			count = len-start;
+		}
+
+		mht_builder_append(out,args[1].ptr+start,(unsigned int)count);
+	}
+
+	return (1);
+}
+
+
+/*
+	<#replace|str|search|replacement>
+	Replace each occurrence of search in str by replacement, which may
+	be empty.
+*/
+int builtin_replace( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	char
+		*ptr = (char*)NULL,
+		*end = (char*)NULL,
+		*run = (char*)NULL;
+
+	if (arg_count<2) {
+		return (1);
+	}
+
+	if (arg_count<3 || args[2].len==0 || args[2].len>args[1].len) {
+		mht_builder_append(out,args[1].ptr,args[1].len);
+		return (1);
+	}
+
+	ptr = run = args[1].ptr;
+	end = args[1].ptr+args[1].len-args[2].len+1;
+
+	while (ptr<end && (ptr=memchr(ptr,args[2].ptr[0],end-ptr))!=(char*)NULL) {
+		if (memcmp(ptr,args[2].ptr,args[2].len)==0) {
+			mht_builder_append(out,run,ptr-run);
+
+			if (arg_count>3) {
+				mht_builder_append(out,args[3].ptr,args[3].len);
+			}
+
+			ptr += args[2].len;
+			run = ptr;
+		}
+		else {
+			ptr++;
+		}
+	}
+
+	mht_builder_append(out,run,args[1].ptr+args[1].len-run);
+
+	return (1);
+}
+
+
+/*
+	<#upper|str>
+*/
+int builtin_upper( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	unsigned int i = out->len;
+
+	if (arg_count>1) {
+		mht_builder_append(out,args[1].ptr,args[1].len);
+
+		for (; i<out->len; i++) {
+			out->buf[i] = toupper((unsigned char)out->buf[i]);
+		}
+	}
+
+	return (1);
+}
+
+
+/*
+	<#lower|str>
+*/
+int builtin_lower( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	unsigned int i = out->len;
+
+	if (arg_count>1) {
+		mht_builder_append(out,args[1].ptr,args[1].len);
+
+		for (; i<out->len; i++) {
+			out->buf[i] = tolower((unsigned char)out->buf[i]);
+		}
+	}
+
+	return (1);
+}
+
+
+/*
+	Returns 1 if a*b does not fit into a long.
+*/
+int builtin_mul_overflows( long a, long b ) {
+	if (a>0) {
+		return ((b>0) ? (a>LONG_MAX/b) : (b<LONG_MIN/a));
+	}
+
+	if (a<0) {
+		return ((b>0) ? (a<LONG_MIN/b) : (b<0 && a<LONG_MAX/b));
+	}
+
+	return (0);
+}
+
+
+/*
+	<#add|a|b|...>, <#sub|a|b|...>, <#mul|a|b|...>, <#div|a|b|...> and
+	<#mod|a|b|...>
+	The user data points to the operator. Empty arguments are 0, a
+	division by zero, an overflow or a non-integer argument leave the
+	macro unexpanded.
+*/
+int builtin_arith( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	char op = *(char*)user_data;
+	long
+		result = 0,
+		value = 0;
+	int i = 0;
+
+	if (arg_count<2 || builtin_get_long(&args[1],&result)==0) {
+		return (0);
+	}
+
+	for (i=2; i<arg_count; i++) {
+		if (builtin_get_long(&args[i],&value)==0) {
+			return (0);
+		}
+
+		/* The overflows are checked before, they are undefined in C */
+		switch (op) {
+			case '+':
+				if ((value>0 && result>LONG_MAX-value) || (value<0 && result<LONG_MIN-value)) {
+					return (0);
+				}
+				result += value;
+				break;
+			case '-':
+				if ((value<0 && result>LONG_MAX+value) || (value>0 && result<LONG_MIN+value)) {
+					return (0);
+				}
+				result -= value;
+				break;
+			case '*':
+				if (builtin_mul_overflows(result,value)) {
+					return (0);
+				}
+				result *= value;
+				break;
+			case '/':
+				if (value==0 || (value==-1 && result==LONG_MIN)) {
+					return (0);
+				}
+				result /= value;
+				break;
+			case '%':
+				if (value==0 || (value==-1 && result==LONG_MIN)) {
+					return (0);
+				}
+				result %= value;
+				break;
+		}
+	}
+
+	builtin_append_long(out,result);
+
+	return (1);
+}
+
+
+/*
+	<#cmp|a|b|LESS|EQUAL|GREATER>
+	Compare a and b numerically if both are integers, otherwise as
+	strings. Without LESS, EQUAL and GREATER, cmp expands to -1, 0 or 1.
+*/
+int builtin_cmp( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	MHT_SLICE empty;
+	MHT_SLICE
+		*a = (MHT_SLICE*)NULL,
+		*b = (MHT_SLICE*)NULL;
+	long
+		value_a = 0,
+		value_b = 0;
+	int result = 0;
+
+	empty.ptr = "";
+	empty.len = 0;
+
+	a = (arg_count>1) ? &args[1] : &empty;
+	b = (arg_count>2) ? &args[2] : &empty;
+
+	if (builtin_get_long(a,&value_a)==1 && builtin_get_long(b,&value_b)==1) {
+		result = (value_a<value_b) ? -1 : (value_a>value_b);
+	}
+	else {
+		result = memcmp(a->ptr,b->ptr,(a->len<b->len) ? a->len : b->len);
+
+		if (result==0) {
+			result = (a->len<b->len) ? -1 : (a->len>b->len);
+		}
+		else {
+			result = (result<0) ? -1 : 1;
+		}
+	}
+
+	if (arg_count<=3) {
+		builtin_append_long(out,(long)result);
+	}
+	else if (result+4<arg_count) {
+		mht_builder_append(out,args[result+4].ptr,args[result+4].len);
+	}
+
+	return (1);
+}
+
+
+/*
+	<#printf|format|number>
+	Format a number with a single printf conversion d, i, u, o, x, X,
+	f, e, E, g or G. The text around the conversion is copied, %% is a
+	'%'. Flags, width and precision are allowed, width and precision up
+	to 2 digits.
+*/
+int builtin_printf( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	char
+		*ptr = (char*)NULL,
+		*end = (char*)NULL,
+		*run = (char*)NULL,
+		spec[16],
+		num[BUILTIN_NUM_LEN+128];
+
+	unsigned int
+		spec_len = 0,
+		digits = 0,
+		conversions = 0;
+
+	long value = 0;
+	double real = 0.0;
+
+
+	if (arg_count<2) {
+		return (1);
+	}
+
+	ptr = run = args[1].ptr;
+	end = args[1].ptr+args[1].len;
+
+	while ((ptr=memchr(ptr,'%',end-ptr))!=(char*)NULL) {
+		mht_builder_append(out,run,ptr-run);
+
+		if (ptr+1<end && ptr[1]=='%') {
+			mht_builder_append(out,"%",1);
+			run = ptr = ptr+2;
+			continue;
+		}
+
+		/* Copy the conversion specification into spec */
+		spec[0] = *ptr++;
+		spec_len = 1;
+
+		while (ptr<end && strchr("-+ 0#",*ptr)!=(char*)NULL && spec_len<6) {
+			spec[spec_len++] = *ptr++;
+		}
+		for (digits=0; ptr<end && isdigit((unsigned char)*ptr) && digits<2; digits++) {
+			spec[spec_len++] = *ptr++;
+		}
+		if (ptr<end && *ptr=='.') {
+			spec[spec_len++] = *ptr++;
+			for (digits=0; ptr<end && isdigit((unsigned char)*ptr) && digits<2; digits++) {
+				spec[spec_len++] = *ptr++;
+			}
+		}
+
+		if (ptr>=end || conversions>0) {
+			return (0);
+		}
+
+		if (strchr("diuoxX",*ptr)!=(char*)NULL) {
+			if (arg_count<3 || builtin_get_long(&args[2],&value)==0) {
+				return (0);
+			}
+			spec[spec_len++] = 'l';
+			spec[spec_len++] = *ptr++;
+			spec[spec_len] = '\0';
+			sprintf(num,spec,value);
+		}
+		else if (strchr("feEgG",*ptr)!=(char*)NULL) {
+			if (arg_count<3 || args[2].len==0) {
+				return (0);
+			}
+			real = strtod(args[2].ptr,&run);
+			if (run==args[2].ptr || real>1e63 || real<-1e63) {
+				return (0);
+			}
+			spec[spec_len++] = *ptr++;
+			spec[spec_len] = '\0';
+			sprintf(num,spec,real);
+		}
+		else {
+			return (0);
+		}
+
+		mht_builder_append(out,num,(unsigned int)strlen(num));
+		conversions++;
+		run = ptr;
+	}
+
+	mht_builder_append(out,run,end-run);
+
+	return (1);
+}
+
+
+/*
+	<#html|str>, <#attr|str>, <#url|str> and <#js|str>
+	Escape str for HTML text, HTML attributes, URLs or JavaScript strings.
+	The user data points to the escape mode. A '|' in str splits it into
+	several arguments, they are joined again.
+*/
+int builtin_escape( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	int
+		mode = *(int*)user_data,
+		i = 0;
+	char sep[4];
+
+	for (i=1; i<arg_count; i++) {
+		if (i>1) {
+			str_escape(sep,sizeof(sep),"|",1,mode);
+			mht_builder_append(out,sep,(unsigned int)strlen(sep));
+		}
+
+		if (out->len+1<out->size) {
+			out->len += (unsigned int)str_escape(out->buf+out->len,out->size-out->len,args[i].ptr,args[i].len,mode);
+		}
+	}
+
+	return (1);
+}
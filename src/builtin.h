@@ -0,0 +1,23 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/* Definitions: */
+#define BUILTIN_NUM_LEN		64	/* The max. length of a formatted number */
+
+
+/* Prototypes: */
+
+/* Register the string and integer builtins (len, substr, add, printf, ...) */
+void builtin_register_std(void);
+
+int builtin_len( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_substr( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_replace( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_upper( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_lower( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_arith( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_cmp( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_printf( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_escape( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int builtin_get_long( MHT_SLICE *arg, long *value );
+void builtin_append_long( MHT_BUILDER *out, long value );
+int builtin_mul_overflows( long a, long b );
@@ -0,0 +1,229 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "mht.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the builtin macros, each case is a line of a template
+	and its expected output.
+*/
+
+
+typedef struct {
+	char *name;
+	char *line;
+	char *expected;
+} BUILTIN_CASE;
+
+
+BUILTIN_CASE builtin_cases[] = {
+	{ "len", "<#len|hello>", "5" },
+	{ "len of nothing", "<#len>", "0" },
+	{ "substr", "<#substr|hello|1|3>", "ell" },
+	{ "substr from the end", "<#substr|hello|-2>", "lo" },
+	{ "replace", "<#replace|a-b-c|-|+>", "a+b+c" },
+	{ "upper", "<#upper|abc>", "ABC" },
+	{ "lower", "<#lower|ABC>", "abc" },
+
+	{ "add", "<#add|1|2|3>", "6" },
+	{ "sub", "<#sub|10|3>", "7" },
+	{ "mul", "<#mul|4|-5>", "-20" },
+	{ "div", "<#div|7|2>", "3" },
+	{ "mod", "<#mod|7|3>", "1" },
+	{ "empty argument", "<#add| 2 |>", "2" },
+	{ "non-integer argument", "<#add|x|1>", "<#add|x|1>" },
+	{ "division by zero", "<#div|1|0>", "<#div|1|0>" },
+	{ "modulo by zero", "<#mod|1|0>", "<#mod|1|0>" },
+	{ "out of range argument", "<#add|99999999999999999999>", "<#add|99999999999999999999>" },
+
+#if LONG_MAX>2147483647L
+	/* Overflows leave the macro unexpanded, LONG_MIN/-1 would even trap */
+	{ "div overflow", "<#div|-9223372036854775808|-1>", "<#div|-9223372036854775808|-1>" },
+	{ "mod overflow", "<#mod|-9223372036854775808|-1>", "<#mod|-9223372036854775808|-1>" },
+	{ "add overflow", "<#add|9223372036854775807|1>", "<#add|9223372036854775807|1>" },
+	{ "add underflow", "<#add|-9223372036854775808|-1>", "<#add|-9223372036854775808|-1>" },
+	{ "sub overflow", "<#sub|9223372036854775807|-1>", "<#sub|9223372036854775807|-1>" },
+	{ "sub underflow", "<#sub|-9223372036854775808|1>", "<#sub|-9223372036854775808|1>" },
+	{ "mul overflow", "<#mul|9223372036854775807|2>", "<#mul|9223372036854775807|2>" },
+	{ "mul of negatives", "<#mul|-1|-9223372036854775808>", "<#mul|-1|-9223372036854775808>" },
+	{ "mul underflow", "<#mul|-3037000500|3037000500>", "<#mul|-3037000500|3037000500>" },
+	{ "mul at the limit", "<#mul|-1|9223372036854775807>", "-9223372036854775807" },
+	{ "add at the limit", "<#add|-9223372036854775807|-1>", "-9223372036854775808" },
+	{ "div at the limit", "<#div|-9223372036854775808|1>", "-9223372036854775808" },
+#endif
+
+	{ "cmp of numbers", "<#cmp|9|10>", "-1" },
+	{ "cmp of strings", "<#cmp|b|a>", "1" },
+	{ "cmp with results", "<#cmp|10|10|L|E|G>", "E" },
+	{ "printf", "<#printf|%05d|42>", "00042" },
+	{ "printf hex", "<#printf|%x|255>", "ff" },
+	{ "printf of a string", "<#printf|%s|a>", "<#printf|%s|a>" },
+
+	{ "html", "<#html|a \"b\" & 'c'>", "a &quot;b&quot; &amp; &#39;c&#39;" },
+	{ "attr", "<#attr|a\"b>", "a&quot;b" },
+	{ "url", "<#url|a b&c>", "a%20b%26c" },
+	{ "js", "<#js|a'b\"c>", "a\\x27b\\x22c" },
+	{ "escape of several arguments", "<#html|a|b>", "a|b" }
+};
+
+
+void test_builtins(void) {
+	char
+		*output = (char*)NULL,
+		template[256],
+		expected[256];
+	unsigned int i = 0;
+
+	for (i=0; i<sizeof(builtin_cases)/sizeof(BUILTIN_CASE); i++) {
+		sprintf(template,"[%s]\n",builtin_cases[i].line);
+		sprintf(expected,"[%s]\n",builtin_cases[i].expected);
+		output = test_render(template,NULL,(int*)NULL);
+		test_equal(builtin_cases[i].name,output,expected);
+		free(output);
+	}
+}
+
+
+void test_precedence(void) {
+	char *output = (char*)NULL;
+
+	/* Macros defined by a template hide the builtins of the same name */
+	output = test_render(
+		"#def url http://example.com/\n"
+		"#def sub Subtitle\n"
+		"[<#url>][<#sub|3|1>][<#add|1|1>]\n"
+		"#undef url\n"
+		"[<#url|a b>]\n",
+		NULL,(int*)NULL);
+	test_equal("macros hide builtins",output,"[http://example.com/][Subtitle][2]\n[a%20b]\n");
+	free(output);
+
+	output = test_render(
+		"#begin row\n"
+		"[<#len>]\n"
+		"#end row\n"
+		"#foreach row|len|a,bc\n"
+		"#if <#len>==0\n"
+		"zero\n"
+		"#endif\n",
+		NULL,(int*)NULL);
+	test_equal("loop variables hide builtins",output,"[a]\n[bc]\nzero\n");
+	free(output);
+}
+
+
+/*
+	A builtin of the application: the prefix given on registration and
+	the arguments, "none" leaves the macro unexpanded.
+*/
+int builtin_tag( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	char num[16];
+	int i = 0;
+
+	if (arg_count>1 && strcmp(args[1].ptr,"none")==0) {
+		return (0);
+	}
+
+	mht_builder_append(out,(char*)user_data,(unsigned int)strlen((char*)user_data));
+	sprintf(num,"%d",arg_count-1);
+	mht_builder_append(out,num,(unsigned int)strlen(num));
+	for (i=1; i<arg_count; i++) {
+		mht_builder_append(out,":",1);
+		mht_builder_append(out,args[i].ptr,args[i].len);
+	}
+
+	return (1);
+}
+
+
+/*
+	Appends its argument count times.
+*/
+int builtin_repeat( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	long n = atol(args[2].ptr);
+
+	while (n-->0) {
+		mht_builder_append(out,args[1].ptr,args[1].len);
+	}
+
+	return (1);
+}
+
+
+void setup_registry(void) {
+	char name[16];
+	int i = 0;
+
+	mht_register_builtin("tag",builtin_tag,"t");
+	mht_register_builtin("repeat",builtin_repeat,(void*)NULL);
+
+	/* Enough names to grow the table a few times */
+	for (i=0; i<200; i++) {
+		sprintf(name,"tag%d",i);
+		mht_register_builtin(name,builtin_tag,(i%2==0) ? "even" : "odd");
+	}
+}
+
+
+void setup_replace(void) {
+	setup_registry();
+	mht_register_builtin("tag",builtin_tag,"new");
+	mht_register_builtin("len",builtin_tag,"len");
+}
+
+
+void test_registry(void) {
+	char
+		*output = (char*)NULL,
+		expected[1100];
+
+	output = test_render(
+		"[<#tag>][<#tag|a>][<#tag|a|b c|>][<#tag|none>]\n"
+		"[<#tag0|x>][<#tag7>][<#tag199|y>][<#tag200>]\n"
+		"[<#ifequal|a|a|yes|no>][<#len|abc>]\n",
+		setup_registry,(int*)NULL);
+	test_equal("registered builtins",output,
+		"[t0][t1:a][t2:a:b c][<#tag|none>]\n"
+		"[even1:x][odd0][odd1:y][<#tag200>]\n"
+		"[yes][3]\n");
+	free(output);
+
+	output = test_render("[<#tag|a>][<#len|abc>][<#tag1>]\n",setup_replace,(int*)NULL);
+	test_equal("replaced builtins",output,"[new1:a][len1:abc][odd0]\n");
+	free(output);
+
+	/* The builtins of a state are not in another one */
+	output = test_render("[<#tag|a>]\n",NULL,(int*)NULL);
+	test_equal("builtins of another state",output,"[<#tag|a>]\n");
+	free(output);
+
+	output = test_render("[<#repeat|abcdefghij|100>]\n",setup_registry,(int*)NULL);
+	strcpy(expected,"[");
+	while (strlen(expected)<1001) {
+		strcat(expected,"abcdefghij");
+	}
+	strcat(expected,"]\n");
+	test_equal("long output of a builtin",output,expected);
+	free(output);
+
+	test_check("no name",mht_register_builtin("",builtin_tag,"x")==0);
+	test_check("no function",mht_register_builtin("x",(MHT_BUILTIN)NULL,"x")==0);
+}
+
+
+int main( int argc, char **argv ) {
+	mht_init();
+
+	test_builtins();
+	test_precedence();
+	test_registry();
+
+	mht_exit();
+	return (test_result("builtin_test"));
+}
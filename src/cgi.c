@@ -1,18 +1,157 @@
 /* Copyright (C) 2003 Thomas Weckert */
 
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "cgi.h"
 #include "mht.h"
 #include "hash.h"
+#include "sink.h"
+#include "mem.h"
+#include "str_util.h"
 
 /* Prototypes: */
 char *cgi_c2x( char *from, char *to );
 char cgi_x2c( char *hex_str );
-void cgi_register_env_vars(void);
+char *cgi_cache_key( char *fname, char **macros, unsigned int macro_count );
+int cgi_cmp_pairs( const void *el1, const void *el2 );
+int cgi_cache_serve( unsigned int *stale );
+void cgi_cache_copy( FILE *from, FILE *to );
+int cgi_cache_cookie( FILE *page );
+int cgi_header_is( char *line, char *name );
+int cgi_header_line( char *line, size_t len );
+int cgi_etag_match( char *if_none_match, char *etag );
+int cgi_accepts_encoding( char *accept_encoding, char *encoding );
+void cgi_request_scope( char *entry );
+int cgi_init_error( char *status, char *err_msg );
+int cgi_fcgi_read( int fd, unsigned char *buf, size_t len );
+int cgi_fcgi_write( int fd, unsigned char *buf, size_t len );
+int cgi_fcgi_record( int type, int request_id, unsigned char *content, size_t len );
+void cgi_fcgi_end_request( int request_id, int status );
+void cgi_fcgi_params(void);
+void cgi_fcgi_get_values( unsigned char *content, size_t len );
+int cgi_fcgi_start(void);
+
+
+#define CGI_CACHE_MAGIC		"MHTPAGE 1"
+#define CGI_CACHE_PATH_LEN	1024
+#define CGI_READ_CHUNK		65536		/* The request body is read in chunks of this size */
+
+
+/*
+	The state of the page cache of the current request.
+*/
+typedef struct {
+	char *key;		/* The canonical query, the template and the selected macros */
+	char path[CGI_CACHE_PATH_LEN];	/* The cached page */
+	char tmp_path[CGI_CACHE_PATH_LEN];	/* The page being rendered, a unique file */
+	int lock_fd;	/* The lock of the key, -1 if not locked */
+	unsigned int ttl;	/* The seconds a cached page is fresh */
+	unsigned int served;	/* 1 if a stale page was served while the page is rendered again */
+	FILE *out;		/* The stream the page is rendered to */
+} CGI_CACHE;
+
+CGI_CACHE cgi_cache = { (char*)NULL, "", "", -1, 0, 0, (FILE*)NULL };
+
+
+/*
+	The buffered response of the current request.
+*/
+typedef struct {
+	MHT_SINK *sink;		/* The memory sink collecting the response */
+	MHT_SINK *prev;		/* The sink of MHT before cgi_response_begin */
+} CGI_RESPONSE;
+
+CGI_RESPONSE cgi_response = { (MHT_SINK*)NULL, (MHT_SINK*)NULL };
+
+
+/*
+	The compressed response of the current request.
+*/
+typedef struct {
+	MHT_SINK *sink;		/* The deflate sink */
+	MHT_SINK *prev;		/* The sink of MHT before cgi_compress_begin */
+} CGI_COMPRESS;
+
+CGI_COMPRESS cgi_compress = { (MHT_SINK*)NULL, (MHT_SINK*)NULL };
+
+
+/* FastCGI record types, roles and status, see the FastCGI specification */
+#define FCGI_VERSION_1			1
+#define FCGI_BEGIN_REQUEST		1
+#define FCGI_ABORT_REQUEST		2
+#define FCGI_END_REQUEST		3
+#define FCGI_PARAMS				4
+#define FCGI_STDIN				5
+#define FCGI_STDOUT				6
+#define FCGI_GET_VALUES			9
+#define FCGI_GET_VALUES_RESULT	10
+#define FCGI_UNKNOWN_TYPE		11
+#define FCGI_RESPONDER			1
+#define FCGI_KEEP_CONN			1
+#define FCGI_REQUEST_COMPLETE	0
+#define FCGI_CANT_MPX_CONN		1
+#define FCGI_UNKNOWN_ROLE		3
+
+#define CGI_FCGI_HEADER_LEN		8
+#define CGI_FCGI_CHUNK			32768		/* The max. content of a STDOUT record sent */
+#define CGI_FCGI_MAX_CONTENT	65535		/* The max. content of a record read */
+#define CGI_FCGI_MAX_PADDING	255			/* The max. padding of a record read */
+#define CGI_FCGI_MODE_UNKNOWN	0
+#define CGI_FCGI_MODE_CGI		1			/* Not started by FastCGI, a single request from the environment */
+#define CGI_FCGI_MODE_FCGI		2
+#define CGI_FCGI_MODE_NONE		3			/* No more requests, e.g. after errors */
+
+
+/*
+	The FastCGI responder. The input of a request is read from stdin and
+	the response is written to stdout as for a CGI, both are temporary
+	files put on the file descriptors 0 and 1.
+*/
+typedef struct {
+	int mode;
+	int listen_fd;
+	int conn_fd;		/* The connection of the web server, -1 if none */
+	int keep_conn;		/* 1 if the web server keeps the connection open */
+	int request_id;		/* The current request, 0 if none */
+	int in_fd;			/* The file behind stdin */
+	int out_fd;			/* The file behind stdout */
+	unsigned char *params;	/* The PARAMS stream of the request */
+	size_t params_len;
+	size_t params_size;
+	unsigned char rec[CGI_FCGI_HEADER_LEN+CGI_FCGI_MAX_CONTENT+CGI_FCGI_MAX_PADDING];	/* A record read or sent, of any size */
+} CGI_FCGI;
+
+CGI_FCGI cgi_fcgi = { CGI_FCGI_MODE_UNKNOWN, -1, -1, 0, 0, -1, -1, (unsigned char*)NULL, 0, 0 };
+
+
+/*
+	The environment variables and macros of the current request, see
+	cgi_request_reset. An entry is "E" followed by the "NAME=value"
+	string put into the environment, or "M" followed by a macro name.
+*/
+typedef struct {
+	char **entries;
+	unsigned int count;
+	unsigned int size;
+} CGI_SCOPE;
+
+CGI_SCOPE cgi_scope = { (char**)NULL, 0, 0 };
 
 
 #define CGI_ENV_VARS_COUNT		22
@@ -51,39 +190,57 @@ char cgi_env_vars[CGI_ENV_VARS_COUNT][16] = {
 
 
 /*
-	Registers useful CGI environment variables as MHT macros.
+	Registers useful CGI environment variables as MHT macros. The
+	variables are read when the macros are referenced first. Only a
+	CGI value of the same name is overwritten right away.
 */
 void cgi_register_env_vars(void) {
 	int i = 0;
-	char *var = (char *)NULL;
+	char
+		*var = (char *)NULL,
+		*dummy = (char *)NULL;
 
 	for (i=0;i<CGI_ENV_VARS_COUNT;i++) {
-		var = getenv(cgi_env_vars[i]);
-
-		if (var!=(char*)NULL) {
-			mht_register_macro(cgi_env_vars[i], var);
+		if (mht_search_macro(cgi_env_vars[i],&dummy)!=0) {
+			if ((var=getenv(cgi_env_vars[i]))!=(char*)NULL) {
+				mht_register_macro(cgi_env_vars[i], var);
+			}
+		}
+		else {
+			mht_register_env(cgi_env_vars[i], cgi_env_vars[i]);
 		}
+
+		/* The values are sent by the client */
+		mht_taint_macro(cgi_env_vars[i]);
 	}
 }
 
 
 /*
-	Read all the CGI input and store it in a hash- table,
-	no matter what request method was used.
+	Read all the CGI input and store it in a hash- table, no matter
+	what request method was used (HEAD is read like GET). Returns 1 if
+	the request was read. A request with another method, or a body which
+	does not match CONTENT_LENGTH, is answered with an error status. A
+	CGI exits then, a FastCGI responder gets 0 and skips the request:
+
+		while (cgi_fcgi_accept()==1) {
+			if (cgi_init()==1) {
+				mht_process(stdout,"page");
+			}
+		}
 */
-void cgi_init(void) {
-	unsigned int
-		content_length = 0;
+int cgi_init(void) {
+	unsigned long
+		content_length = 0,
+		len = 0,
+		read_len = 0;
 
 	char
-		*tmp_value = (char*)NULL,
-		*dummy = (char*)NULL,
 		*method = (char*)NULL,
 		*qs = (char*)NULL,
-		*content_str = (char*)NULL,
-		*data_pair = (char*)NULL,
-		*eqpos = (char*)NULL,
-		*name = (char*)NULL, *value = (char*)NULL;
+		*length_str = (char*)NULL,
+		*end = (char*)NULL,
+		*content_str = (char*)NULL;
 
 
 	/* Get the request method */
@@ -97,37 +254,91 @@ void cgi_init(void) {
 
 	/* Read in the CGI values, either from the environment or STDIN */
 	if (strcmp(method,"POST")==0) {
-		content_length = atoi(getenv("CONTENT_LENGTH"));
+		/* Without a body there may be no CONTENT_LENGTH */
+		if ((length_str=getenv("CONTENT_LENGTH"))!=(char*)NULL && *length_str!='\0') {
+			content_length = strtoul(length_str,&end,10);
+
+			if (!isdigit((unsigned char)*length_str) || *end!='\0' || content_length==(unsigned long)-1) {
+				return (cgi_init_error("400 Bad Request","Invalid CONTENT_LENGTH of the request!"));
+			}
+		}
 
-		if (content_length==0) return;
+		/* The buffer grows with the input, the length is sent by the client */
+		content_str = (char*)_malloc(1);
+		for (len=0; len<content_length; len+=read_len) {
+			read_len = (content_length-len<CGI_READ_CHUNK) ? content_length-len : CGI_READ_CHUNK;
+			content_str = (char*)_realloc(content_str,len+read_len+1);
 
-		content_str = (char*)malloc( sizeof(char) * (content_length+2) );
-		fread( content_str, content_length, 1, stdin );
-		content_str[content_length] = '\0';
+			if ((read_len=fread(content_str+len,1,read_len,stdin))==0) {
+				free(content_str);
+				return (cgi_init_error("400 Bad Request","The request body is shorter than its CONTENT_LENGTH!"));
+			}
+		}
+		content_str[len] = '\0';
 	}
-	else if (strcmp(method,"GET")==0) {
+	else if (strcmp(method,"GET")==0 || strcmp(method,"HEAD")==0) {
 		qs = getenv("QUERY_STRING");
+		content_str = strdup((qs!=(char*)NULL) ? qs : "");
+	}
+	else {
+		return (cgi_init_error("405 Method Not Allowed","Unknown or not supported request method!"));
+	}
 
-		if (qs==(char*)NULL) {
-			return;
-		}
-		else {
-			content_length = strlen(qs);
-		}
+	/* Store the CGI input values as MHT macros */
+	cgi_request_values(content_str);
+
+	cgi_register_env_vars();
+	free(content_str);
+	content_str = (char*)NULL;
 
-		content_str = (char*)malloc( sizeof(char) * (content_length+2) );
-		strncpy( content_str, qs, content_length );
-		content_str[content_length] = '\0';
+	/* Turn off buffering of stdout, a FastCGI response is sent at its end anyway */
+	if (cgi_fcgi.mode!=CGI_FCGI_MODE_FCGI) {
+		setvbuf(stdout,NULL,_IONBF,0);
 	}
-	else {
-		cgi_err_msg("Unknown or not supported request method!");
+
+	return (1);
+}
+
+
+/*
+	Answer a request cgi_init cannot read with the status and an error
+	page. A CGI exits, a FastCGI responder goes on with the next request.
+	Returns 0.
+*/
+int cgi_init_error( char *status, char *err_msg ) {
+	fprintf(stdout,"Status: %s\n",status);
+	if (strncmp(status,"405",3)==0) {
+		fprintf(stdout,"Allow: GET, HEAD, POST\n");
+	}
+	fprintf(stdout,"Content-type: text/html\n\n");
+	cgi_err_msg(err_msg);
+
+	if (cgi_fcgi.mode!=CGI_FCGI_MODE_FCGI) {
 		exit(1);
 	}
 
-	/* Store the CGI input values as MHT macros */
-	tmp_value = (char*)malloc( sizeof(char) * (content_length+2) );
-	tmp_value[0] = '\0';
-	data_pair = strtok(content_str,"&");
+	return (0);
+}
+
+
+
+/*
+	Store the name-value pairs of a query string or of form data
+	("a=1&b=2") as tainted MHT macros, the values of a repeated name
+	are joined by commas (e.g. checkboxes: &meat=bacon&meat=salami).
+	The content is changed.
+*/
+void cgi_request_values( char *content ) {
+	char
+		*tmp_value = (char*)NULL,
+		*dummy = (char*)NULL,
+		*data_pair = (char*)NULL,
+		*eqpos = (char*)NULL,
+		*name = (char*)NULL,
+		*value = (char*)NULL;
+
+
+	data_pair = strtok(content,"&");
 	while (data_pair!=(char*)NULL) {
 		if ( (eqpos=strchr(data_pair,'='))!=(char*)NULL ) {
 			*eqpos = '\0';
@@ -138,34 +349,93 @@ void cgi_init(void) {
 				cgi_unescape_str(name);
 				cgi_unescape_str(value);
 
-				/*
-					Check if the macro already exists, for
-					example if checkboxes are used: &meat=bacon&meat=salami
-				*/
 				if ((mht_search_macro(name,&dummy))!=0) {
+					tmp_value = (char*)_malloc(strlen(dummy)+strlen(value)+2);
 					sprintf(tmp_value,"%s,%s",dummy,value);
 					mht_register_macro(name,tmp_value);
+					free(tmp_value);
 				}
 				else {
-					sprintf(tmp_value,"%s",value);
 					mht_register_macro(name,value);
 				}
+				mht_taint_macro(name);
+
+				/* A request scope drops its macros itself */
+				if (mht_scope_active()==0) {
+					tmp_value = (char*)_malloc(strlen(name)+2);
+					sprintf(tmp_value,"M%s",name);
+					cgi_request_scope(tmp_value);
+				}
 			}
 		}
 		data_pair = strtok(NULL,"&");
 	}
+}
 
-	cgi_register_env_vars();
-	free(content_str);
-	free(tmp_value);
-	content_str = (char*)NULL;
-	tmp_value = (char*)NULL;
 
-	/* Turn off buffering of stdout */
-	setvbuf(stdout,NULL,_IONBF,0);
+/*
+	Put a variable of the request into the environment, e.g. from the
+	parameters of a FastCGI request. The variable is removed again by
+	cgi_request_reset.
+*/
+void cgi_request_setenv( char *name, char *value ) {
+	char
+		*entry = (char*)_malloc(strlen(name)+strlen(value)+3);
+
+	sprintf(entry,"E%s=%s",name,value);
+	putenv(entry+1);
+	cgi_request_scope(entry);
+}
+
+
+/*
+	Drop the environment variables and macros of the last request, e.g.
+	before the next request of a FastCGI responder is read. The macros
+	of a request scope are left to mht_scope_end.
+*/
+void cgi_request_reset(void) {
+	unsigned int i = 0;
+	char
+		*entry = (char*)NULL,
+		*name = (char*)NULL;
+
+
+	for (i=0; i<cgi_scope.count; i++) {
+		entry = cgi_scope.entries[i];
+
+		if (entry[0]=='E') {
+			/* The entry is in the environment, the name is cut from a copy */
+			name = strdup(entry+1);
+			*strchr(name,'=') = '\0';
+			unsetenv(name);
+			free(name);
+		}
+		else {
+			mht_undef_macro(entry+1);
+		}
+		free(entry);
+	}
+	cgi_scope.count = 0;
+
+	/* The macros of the environment variables are read again */
+	for (i=0; i<CGI_ENV_VARS_COUNT && mht_scope_active()==0; i++) {
+		mht_undef_macro(cgi_env_vars[i]);
+	}
 }
 
 
+/*
+	Remember an entry to drop with the request, see CGI_SCOPE.
+*/
+void cgi_request_scope( char *entry ) {
+	if (cgi_scope.count==cgi_scope.size) {
+		cgi_scope.size = cgi_scope.size*2+32;
+		cgi_scope.entries = (char**)_realloc(cgi_scope.entries,cgi_scope.size*sizeof(char*));
+	}
+
+	cgi_scope.entries[cgi_scope.count++] = entry;
+}
+
 
 /*
 	Show a simple HTML error page.
@@ -212,7 +482,7 @@ char *cgi_c2x( char *from, char *to ) {
 void cgi_unescape_str( char *str ) {
     register unsigned int i, j;
 
-    for (i=0; i<strlen(str); i++) {
+    for (i=0; str[i]; i++) {
 		if (str[i] == '+') {
 			str[i] = ' ';
 		}
@@ -232,37 +502,1104 @@ void cgi_unescape_str( char *str ) {
 	Escape all the unsave characters in a string into their hexadecimal values.
 */
 char *cgi_escape_str( char *str ) {
-	char
-		*result = (char*)NULL,
-		*iptr = (char*)NULL,
-		*rptr = (char*)NULL,
-		hex[4];
+	char *result = (char*)NULL;
+	size_t
+		len = 0,
+		result_len = 0;
 
 
 	if (!str) {
 		return((char*)NULL);
 	}
 
-	result = (char*)malloc( sizeof(char) * ((strlen(str)*4)+1) );
-	rptr = result;
+	/* Allocate exactly the size of the escaped string */
+	len = strlen(str);
+	result_len = str_escape_len(str,len,STR_ESC_QUERY);
+
+	result = (char*)malloc( sizeof(char) * (result_len+1) );
+	str_escape(result,result_len+1,str,len,STR_ESC_QUERY);
+
+	return (result);
+}
+
 
-	for (iptr=str; *iptr; *iptr++) {
-		*rptr = '\0';
+/*
+	A full page cache for CGI programs, which is shared by all processes
+	through the files in dir:
 
-		if (isalnum(*iptr)) {
-			*(rptr++) = *iptr;
+		mht_init();
+		cgi_init();
+		if ((out=cgi_cache_begin("/tmp/mhtcache","page.mht",vary,2,60))!=NULL) {
+			fprintf(out,"Content-type: text/html\n\n");
+			mht_err = mht_quickopen(out,"page.mht");
+			cgi_cache_end(mht_err==MHT_OK);
 		}
-		else {
-			if (*iptr==' ') {
-				*(rptr++) = '+';
+		cgi_exit();
+		mht_exit();
+
+	A page is cached for GET requests only, the key is the template fname,
+	the canonical query string (sorted pairs) and the values of the macros
+	(e.g. taken from cookies). A page is fresh for ttl seconds and as long
+	as no file read by mht_quickopen was modified. Only one process renders
+	a page at a time: the others serve the stale page meanwhile, or wait
+	for the page if there is none. The process which renders a stale page
+	serves the stale page first and closes stdout.
+*/
+FILE *cgi_cache_begin( char *dir, char *fname, char **macros, unsigned int macro_count, unsigned int ttl ) {
+	char
+		*method = getenv("REQUEST_METHOD"),
+		lock_path[CGI_CACHE_PATH_LEN];
+
+	unsigned long hash = 2166136261UL;
+	unsigned int
+		i = 0,
+		stale = 0;
+
+	int
+		found = 0,
+		fd = -1;
+
+
+	cgi_cache.out = stdout;
+	cgi_cache.lock_fd = -1;
+	cgi_cache.served = 0;
+	cgi_cache.ttl = ttl;
+
+	if (dir==(char*)NULL || method==(char*)NULL || strcmp(method,"GET")!=0 || strlen(dir)+32>=CGI_CACHE_PATH_LEN) {
+		return (stdout);
+	}
+
+	cgi_cache.key = cgi_cache_key(fname,macros,macro_count);
+
+	/* FNV-1a of the key, the key itself is stored in the page */
+	for (i=0; cgi_cache.key[i]!='\0'; i++) {
+		hash = ((hash ^ (unsigned char)cgi_cache.key[i]) * 16777619UL) & 0xffffffffUL;
+	}
+
+	sprintf(cgi_cache.path,"%s/%08lx.page",dir,hash);
+	sprintf(cgi_cache.tmp_path,"%s/%08lx.XXXXXX",dir,hash);
+	sprintf(lock_path,"%s/%08lx.lock",dir,hash);
+
+	found = cgi_cache_serve(&stale);
+
+	if (found==1 && stale==0) {
+		cgi_cache_end(0);
+		return ((FILE*)NULL);
+	}
+
+	if ((cgi_cache.lock_fd=open(lock_path,O_RDWR|O_CREAT,0644))<0) {
+		/* The cache is not usable, render the page as usual */
+		if (found==1) {
+			cgi_cache_end(0);
+			return ((FILE*)NULL);
+		}
+		return (stdout);
+	}
+
+	if (flock(cgi_cache.lock_fd,LOCK_EX|LOCK_NB)!=0) {
+		/* Another process renders the page, a stale page will do meanwhile */
+		if (found==1) {
+			cgi_cache_end(0);
+			return ((FILE*)NULL);
+		}
+
+		/* Wait for the other process, it will most likely have rendered the page */
+		flock(cgi_cache.lock_fd,LOCK_EX);
+
+		if ((found=cgi_cache_serve(&stale))==1 && stale==0) {
+			cgi_cache_end(0);
+			return ((FILE*)NULL);
+		}
+	}
+
+	if (found==1) {
+		/* Render the stale page again, but let the client go with the stale page */
+		fflush(stdout);
+		freopen("/dev/null","w",stdout);
+		cgi_cache.served = 1;
+	}
+
+	/* The directory is shared, the file must not exist yet */
+	if ((fd=mkstemp(cgi_cache.tmp_path))<0) {
+		cgi_cache.tmp_path[0] = '\0';
+		return (stdout);
+	}
+	if ((cgi_cache.out=fdopen(fd,"w+"))==(FILE*)NULL) {
+		close(fd);
+		remove(cgi_cache.tmp_path);
+		cgi_cache.tmp_path[0] = '\0';
+		cgi_cache.out = stdout;
+	}
+
+	return (cgi_cache.out);
+}
+
+
+/*
+	Store the page rendered after cgi_cache_begin. The page is sent to
+	the client (unless a stale page was served), and replaces the cached
+	page atomically. Pages which set cookies are not stored, the cookies
+	would be sent to every client.
+*/
+void cgi_cache_end( int ok ) {
+	FILE *fptr = (FILE*)NULL;
+	char
+		*file = (char*)NULL,
+		page_path[CGI_CACHE_PATH_LEN+8];
+
+	unsigned int i = 0;
+	int fd = -1;
+	struct stat st;
+
+
+	if (cgi_cache.out!=stdout && cgi_cache.out!=(FILE*)NULL) {
+		/* Send the page */
+		if (cgi_cache.served==0) {
+			rewind(cgi_cache.out);
+			cgi_cache_copy(cgi_cache.out,stdout);
+		}
+
+		if (ok!=0 && cgi_cache_cookie(cgi_cache.out)==1) {
+			ok = 0;
+		}
+
+		/* Write the header and the page into a new file, and replace the cached page */
+		sprintf(page_path,"%s.XXXXXX",cgi_cache.path);
+		if (ok!=0 && (fd=mkstemp(page_path))>=0) {
+			/* Readable by every process of the cache, as any page */
+			fchmod(fd,0644);
+			if ((fptr=fdopen(fd,"w"))==(FILE*)NULL) {
+				close(fd);
+				remove(page_path);
+			}
+		}
+
+		if (fptr!=(FILE*)NULL) {
+			fprintf(fptr,"%s\n%ld\n",CGI_CACHE_MAGIC,(long)time((time_t*)NULL));
+			fprintf(fptr,"%s\n",cgi_cache.key);
+
+			for (i=0; (file=mht_get_file(i))!=(char*)NULL; i++) {
+				if (stat(file,&st)==0 && strchr(file,'\n')==(char*)NULL) {
+					fprintf(fptr,"%ld %s\n",(long)st.st_mtime,file);
+				}
+			}
+			fprintf(fptr,"\n");
+
+			rewind(cgi_cache.out);
+			cgi_cache_copy(cgi_cache.out,fptr);
+
+			if (fclose(fptr)==0) {
+				rename(page_path,cgi_cache.path);
 			}
 			else {
-				strcat(rptr, cgi_c2x(iptr,hex));
-				rptr += 3;
+				remove(page_path);
 			}
 		}
+
+		fclose(cgi_cache.out);
+		remove(cgi_cache.tmp_path);
 	}
 
-	*rptr = '\0';
-	return (result);
+	if (cgi_cache.lock_fd>=0) {
+		flock(cgi_cache.lock_fd,LOCK_UN);
+		close(cgi_cache.lock_fd);
+	}
+
+	if (cgi_cache.key!=(char*)NULL) {
+		free(cgi_cache.key);
+	}
+
+	cgi_cache.key = (char*)NULL;
+	cgi_cache.lock_fd = -1;
+	cgi_cache.out = (FILE*)NULL;
+}
+
+
+/*
+	Build the key of a page: the template, the query string with its
+	pairs sorted, and the escaped values of the selected macros, each
+	on its own line.
+*/
+char *cgi_cache_key( char *fname, char **macros, unsigned int macro_count ) {
+	char
+		*qs = getenv("QUERY_STRING"),
+		*query = (char*)NULL,
+		*key = (char*)NULL,
+		*value = (char*)NULL,
+		*escaped = (char*)NULL,
+		**pairs = (char**)NULL;
+
+	unsigned int
+		i = 0,
+		pair_count = 0,
+		len = 0;
+
+
+	query = strdup((qs!=(char*)NULL) ? qs : "");
+	len = strlen(fname)+strlen(query)+2;
+
+	/* The order of the pairs doesn't matter */
+	pairs = (char**)_malloc((strlen(query)/2+2)*sizeof(char*));
+	for (value=strtok(query,"&"); value!=(char*)NULL; value=strtok((char*)NULL,"&")) {
+		pairs[pair_count++] = value;
+	}
+	qsort(pairs,pair_count,sizeof(char*),cgi_cmp_pairs);
+
+	key = (char*)_malloc(len);
+	sprintf(key,"%s\n",fname);
+
+	for (i=0; i<pair_count; i++) {
+		strcat(key,pairs[i]);
+		strcat(key,(i+1<pair_count) ? "&" : "");
+	}
+
+	/* The values of the macros, they may contain newlines */
+	for (i=0; i<macro_count; i++) {
+		if (mht_search_macro(macros[i],&value)==0) {
+			value = "";
+		}
+
+		escaped = cgi_escape_str(value);
+		len += strlen(macros[i])+strlen(escaped)+2;
+		key = (char*)_realloc(key,len);
+		strcat(key,"\n");
+		strcat(key,macros[i]);
+		strcat(key,"=");
+		strcat(key,escaped);
+		free(escaped);
+	}
+
+	/* The key is stored as a single line */
+	for (i=0; key[i]!='\0'; i++) {
+		if (key[i]=='\n') {
+			key[i] = '\t';
+		}
+	}
+
+	free(pairs);
+	free(query);
+
+	return (key);
+}
+
+
+int cgi_cmp_pairs( const void *el1, const void *el2 ) {
+	return strcmp( *(char**)el1, *(char**)el2 );
+}
+
+
+/*
+	Send the cached page to stdout, if it exists. stale is set to 1 if
+	the page is older than the ttl, or if a file it was rendered from
+	was modified. Returns 1 if the page was sent, 0 otherwise.
+*/
+int cgi_cache_serve( unsigned int *stale ) {
+	FILE *fptr = (FILE*)NULL;
+	char
+		line[CGI_CACHE_PATH_LEN+32],
+		*file = (char*)NULL,
+		*key = (char*)NULL;
+
+	long
+		created = 0,
+		mtime = 0;
+
+	unsigned int len = 0;
+	struct stat st;
+
+
+	(*stale) = 0;
+
+	if ((fptr=fopen(cgi_cache.path,"r"))==(FILE*)NULL) {
+		return (0);
+	}
+
+	/* The magic, the time the page was rendered and the key */
+	len = strlen(cgi_cache.key)+2;
+	key = (char*)_malloc(len);
+
+	if (fgets(line,sizeof(line),fptr)==(char*)NULL || strncmp(line,CGI_CACHE_MAGIC,strlen(CGI_CACHE_MAGIC))!=0
+		|| fgets(line,sizeof(line),fptr)==(char*)NULL || (created=atol(line))==0
+		|| fgets(key,len,fptr)==(char*)NULL || strncmp(key,cgi_cache.key,len-2)!=0 || key[len-2]!='\n') {
+		/* No page, or the page of another key with the same hash */
+		free(key);
+		fclose(fptr);
+		return (0);
+	}
+	free(key);
+
+	if ((long)time((time_t*)NULL)-created>=(long)cgi_cache.ttl) {
+		(*stale) = 1;
+	}
+
+	/* The files the page was rendered from, up to an empty line */
+	while (fgets(line,sizeof(line),fptr)!=(char*)NULL && line[0]!='\n') {
+		line[strlen(line)-1] = '\0';
+		mtime = atol(line);
+
+		if ((file=strchr(line,' '))==(char*)NULL || stat(file+1,&st)!=0 || (long)st.st_mtime!=mtime) {
+			(*stale) = 1;
+		}
+	}
+
+	cgi_cache_copy(fptr,stdout);
+	fclose(fptr);
+
+	return (1);
+}
+
+
+/*
+	Check if the headers of a rendered page, up to the first empty line,
+	contain a Set-Cookie. Returns 1 if they do, 0 otherwise.
+*/
+int cgi_cache_cookie( FILE *page ) {
+	char line[CGI_CACHE_PATH_LEN];
+	int
+		start = 1,
+		found = 0;
+
+
+	rewind(page);
+
+	while (found==0 && fgets(line,sizeof(line),page)!=(char*)NULL) {
+		if (start==1) {
+			if (line[0]=='\n' || (line[0]=='\r' && line[1]=='\n')) {
+				break;
+			}
+			found = cgi_header_is(line,"Set-Cookie");
+		}
+
+		/* The rest of a long line is no header */
+		start = (strchr(line,'\n')!=(char*)NULL) ? 1 : 0;
+	}
+
+	return (found);
+}
+
+
+/*
+	Check if a header line is of the header name, case insensitive.
+*/
+int cgi_header_is( char *line, char *name ) {
+	size_t i = 0;
+
+
+	for (i=0; name[i]!='\0'; i++) {
+		if (tolower((unsigned char)line[i])!=tolower((unsigned char)name[i])) {
+			return (0);
+		}
+	}
+
+	return ((line[i]==':') ? 1 : 0);
+}
+
+
+/*
+	Copy the rest of a stream to another stream.
+*/
+void cgi_cache_copy( FILE *from, FILE *to ) {
+	char buf[4096];
+	size_t len = 0;
+
+	while ((len=fread(buf,1,sizeof(buf),from))>0) {
+		fwrite(buf,1,len,to);
+	}
+}
+
+
+/*
+	Buffer the response of MHT in memory until cgi_response_end:
+
+		cgi_response_begin();
+		mht_err = mht_quickopen(stdout,"page.mht");
+		cgi_response_end();
+
+	Headers have to be written by the template, ending with an empty
+	line, "Content-type: text/html" is sent if there are none. Don't
+	use it together with cgi_cache_begin.
+*/
+void cgi_response_begin(void) {
+	cgi_response.sink = sink_mem_new();
+	cgi_response.prev = mht_set_sink(cgi_response.sink);
+}
+
+
+/*
+	Send the buffered response with a Content-Length and an ETag (a
+	hash of the body). If the client has the page already (the ETag
+	is in If-None-Match), only "304 Not Modified" is sent, with the
+	caching headers of the page. A page with a "Status:" other than
+	200 is always sent. Returns 1 if the body was sent, 0 otherwise.
+*/
+int cgi_response_end(void) {
+	char
+		*buf = (char*)NULL,
+		*body = (char*)NULL,
+		*line = (char*)NULL,
+		*end = (char*)NULL,
+		*method = getenv("REQUEST_METHOD"),
+		etag[40];
+
+	size_t
+		len = 0,
+		header_len = 0;
+
+	unsigned int h[4];
+	int
+		sent = 0,
+		status = 200;
+
+
+	if (cgi_response.sink==(MHT_SINK*)NULL) {
+		return (0);
+	}
+
+	mht_set_sink(cgi_response.prev);
+	buf = sink_mem_get(cgi_response.sink,&len);
+
+	body = cgi_response_body(buf,&header_len);
+	str_hash128(body,len-(body-buf),h);
+	sprintf(etag,"\"%08x%08x%08x%08x\"",h[0],h[1],h[2],h[3]);
+
+	for (line=buf; line<buf+header_len; line=end+1) {
+		end = memchr(line,'\n',buf+header_len-line);
+		if (cgi_header_is(line,"Status")==1) {
+			status = atoi(line+7);
+		}
+	}
+
+	fflush(stdout);
+
+	if (status==200 && method!=(char*)NULL && strcmp(method,"GET")==0
+		&& cgi_etag_match(getenv("HTTP_IF_NONE_MATCH"),etag)==1) {
+		fprintf(stdout,"Status: 304 Not Modified\n");
+
+		/* The headers a 304 has to repeat */
+		for (line=buf; line<buf+header_len; line=end+1) {
+			end = memchr(line,'\n',buf+header_len-line);
+			if (cgi_header_is(line,"Cache-Control")==1 || cgi_header_is(line,"Content-Location")==1
+				|| cgi_header_is(line,"Expires")==1 || cgi_header_is(line,"Vary")==1) {
+				fwrite(line,1,end+1-line,stdout);
+			}
+		}
+		fprintf(stdout,"ETag: %s\n\n",etag);
+	}
+	else {
+		if (header_len>0) {
+			fwrite(buf,1,header_len,stdout);
+		}
+		else {
+			fprintf(stdout,"Content-type: text/html\n");
+		}
+		fprintf(stdout,"Content-Length: %lu\nETag: %s\n\n",(unsigned long)(len-(body-buf)),etag);
+		fwrite(body,1,len-(body-buf),stdout);
+		sent = 1;
+	}
+
+	fflush(stdout);
+	sink_free(cgi_response.sink);
+	cgi_response.sink = (MHT_SINK*)NULL;
+
+	return (sent);
+}
+
+
+/*
+	Find the body of a response written by a template. Headers written
+	by the template end with an empty line, header_len is set to their
+	length without the empty line, or to 0 if there are none. If a line
+	before the empty line is no header, all of it is the body.
+*/
+char *cgi_response_body( char *buf, size_t *header_len ) {
+	char
+		*line = (char*)NULL,
+		*end = (char*)NULL;
+
+	size_t len = 0;
+
+
+	*header_len = 0;
+
+	for (line=buf; (end=strchr(line,'\n'))!=(char*)NULL; line=end+1) {
+		len = end-line;
+		if (len>0 && line[len-1]=='\r') {
+			len--;
+		}
+
+		if (len==0) {
+			if (line==buf) {
+				break;
+			}
+			*header_len = line-buf;
+			return (end+1);
+		}
+
+		if (cgi_header_line(line,len)==0) {
+			break;
+		}
+	}
+
+	return (buf);
+}
+
+
+/*
+	Check if a line is a header: a name of token chars, and a colon.
+*/
+int cgi_header_line( char *line, size_t len ) {
+	size_t i = 0;
+
+
+	for (i=0; i<len && line[i]!='\0' && (isalnum((unsigned char)line[i]) || strchr("!#$%&'*+-.^_`|~",line[i])!=(char*)NULL); i++);
+
+	return ((i>0 && i<len && line[i]==':') ? 1 : 0);
+}
+
+
+/*
+	Check if an ETag is in the value of an If-None-Match header,
+	e.g. "a", W/"b". Weak ETags match as well.
+*/
+int cgi_etag_match( char *if_none_match, char *etag ) {
+	char *ptr = if_none_match;
+	size_t len = strlen(etag);
+
+
+	if (ptr==(char*)NULL) {
+		return (0);
+	}
+
+	while (*ptr!='\0') {
+		while (*ptr==' ' || *ptr=='\t' || *ptr==',') {
+			ptr++;
+		}
+
+		if (*ptr=='*') {
+			return (1);
+		}
+
+		if (ptr[0]=='W' && ptr[1]=='/') {
+			ptr += 2;
+		}
+
+		if (strncmp(ptr,etag,len)==0 && (ptr[len]=='\0' || ptr[len]==',' || ptr[len]==' ' || ptr[len]=='\t')) {
+			return (1);
+		}
+
+		/* The next entry, commas may be part of an ETag */
+		if (*ptr=='"' && (ptr=strchr(ptr+1,'"'))==(char*)NULL) {
+			break;
+		}
+		while (*ptr!='\0' && *ptr!=',') {
+			ptr++;
+		}
+	}
+
+	return (0);
+}
+
+
+/*
+	Compress the response with gzip or deflate, if the client accepts it:
+
+		fprintf(stdout,"Content-type: text/html\n");
+		cgi_compress_begin(-1);
+		mht_err = mht_quickopen(stdout,"page.mht");
+		cgi_compress_end();
+
+	The headers written before are ended by cgi_compress_begin, with a
+	Content-Encoding if the response is compressed. level is 0 to 9 or
+	-1 for the default, templates may change it by "#mhtvar compress n".
+	"#flush" sends all the output compressed so far. Returns 1 if the
+	response is compressed, 0 otherwise.
+*/
+int cgi_compress_begin( int level ) {
+	char
+		*accept_encoding = getenv("HTTP_ACCEPT_ENCODING"),
+		*encoding = (char*)NULL;
+
+
+	if (cgi_accepts_encoding(accept_encoding,"gzip")==1) {
+		encoding = "gzip";
+	}
+	else if (cgi_accepts_encoding(accept_encoding,"deflate")==1) {
+		encoding = "deflate";
+	}
+
+	cgi_compress.sink = (MHT_SINK*)NULL;
+	if (encoding!=(char*)NULL) {
+		cgi_compress.sink = sink_deflate_new(sink_file_new(stdout),level,(encoding[0]=='g') ? 1 : 0);
+	}
+
+	if (cgi_compress.sink==(MHT_SINK*)NULL) {
+		fprintf(stdout,"Vary: Accept-Encoding\n\n");
+		return (0);
+	}
+
+	fprintf(stdout,"Content-Encoding: %s\nVary: Accept-Encoding\n\n",encoding);
+	fflush(stdout);
+	cgi_compress.prev = mht_set_sink(cgi_compress.sink);
+
+	return (1);
+}
+
+
+/*
+	Send the end of the compressed response.
+*/
+void cgi_compress_end(void) {
+	if (cgi_compress.sink==(MHT_SINK*)NULL) {
+		return;
+	}
+
+	mht_set_sink(cgi_compress.prev);
+	sink_finish(cgi_compress.sink);
+
+	sink_free(cgi_compress.sink->next);
+	sink_free(cgi_compress.sink);
+	cgi_compress.sink = (MHT_SINK*)NULL;
+}
+
+
+/*
+	Check if an encoding is in the value of an Accept-Encoding header,
+	e.g. "gzip, deflate;q=0.5", and not refused by a quality of 0.
+*/
+int cgi_accepts_encoding( char *accept_encoding, char *encoding ) {
+	char *ptr = accept_encoding;
+	size_t len = 0;
+	int accepts = 0;
+
+
+	if (ptr==(char*)NULL) {
+		return (0);
+	}
+
+	while (*ptr!='\0') {
+		while (*ptr==' ' || *ptr=='\t' || *ptr==',') {
+			ptr++;
+		}
+
+		len = strcspn(ptr," \t,;");
+		if ((len==strlen(encoding) && strncmp(ptr,encoding,len)==0) || (len==1 && *ptr=='*' && accepts==0)) {
+			accepts = 1;
+			ptr += len;
+
+			/* A quality of 0 (0, 0.0, 0.00, ...) refuses the encoding */
+			while (*ptr==' ' || *ptr=='\t') {
+				ptr++;
+			}
+			if (*ptr==';') {
+				ptr++;
+				while (*ptr==' ' || *ptr=='\t') {
+					ptr++;
+				}
+				if ((ptr[0]=='q' || ptr[0]=='Q') && ptr[1]=='=' && ptr[2]=='0' && strspn(ptr+3,".0")==strcspn(ptr+3,", \t")) {
+					accepts = 0;
+					if (len>1) {
+						return (0);
+					}
+				}
+			}
+		}
+
+		ptr += strcspn(ptr,",");
+	}
+
+	return (accepts);
+}
+
+
+/*
+	Accept the next request of a FastCGI responder:
+
+		mht_init();
+		mht_quickopen(stdout,"blocks.mht");
+		while (cgi_fcgi_accept()==1) {
+			if (cgi_init()==1) {
+				mht_process(stdout,"page");
+			}
+		}
+		mht_exit();
+
+	The blocks and macros read before the loop stay loaded. The
+	parameters of a request are put into the environment and its input
+	on stdin, so cgi_init and the rest work as for a CGI. The response
+	written to stdout is sent when the next request is accepted. The
+	macros of a request are defined in a request scope (see
+	mht_scope_begin), which is dropped then with the environment
+	variables of the request.
+
+	The web server passes the socket to listen on as stdin, see
+	cgi_fcgi_listen for other sockets. Started as a plain CGI, the
+	first call returns 1 for the request of the CGI. Returns 0 if
+	there are no more requests.
+*/
+int cgi_fcgi_accept(void) {
+	unsigned char *content = cgi_fcgi.rec+CGI_FCGI_HEADER_LEN;
+	size_t len = 0;
+	int
+		type = 0,
+		request_id = 0;
+
+
+	if (cgi_fcgi.mode==CGI_FCGI_MODE_UNKNOWN && cgi_fcgi_start()==CGI_FCGI_MODE_CGI) {
+		return (1);
+	}
+
+	if (cgi_fcgi.mode!=CGI_FCGI_MODE_FCGI) {
+		return (0);
+	}
+
+	cgi_fcgi_finish();
+	cgi_request_reset();
+	mht_scope_end();
+
+	for (;;) {
+		if (cgi_fcgi.conn_fd<0) {
+			while ((cgi_fcgi.conn_fd=accept(cgi_fcgi.listen_fd,(struct sockaddr*)NULL,(socklen_t*)NULL))<0) {
+				if (errno!=EINTR) {
+					return (0);
+				}
+			}
+			cgi_fcgi.request_id = 0;
+		}
+
+		/* The header and the content with its padding */
+		if (cgi_fcgi_read(cgi_fcgi.conn_fd,cgi_fcgi.rec,CGI_FCGI_HEADER_LEN)==0 || cgi_fcgi.rec[0]!=FCGI_VERSION_1
+			|| cgi_fcgi_read(cgi_fcgi.conn_fd,content,((cgi_fcgi.rec[4]<<8)|cgi_fcgi.rec[5])+cgi_fcgi.rec[6])==0) {
+			close(cgi_fcgi.conn_fd);
+			cgi_fcgi.conn_fd = -1;
+			continue;
+		}
+
+		type = cgi_fcgi.rec[1];
+		request_id = (cgi_fcgi.rec[2]<<8)|cgi_fcgi.rec[3];
+		len = (cgi_fcgi.rec[4]<<8)|cgi_fcgi.rec[5];
+
+		if (type==FCGI_GET_VALUES) {
+			cgi_fcgi_get_values(content,len);
+		}
+		else if (type==FCGI_BEGIN_REQUEST) {
+			/* The body has the role and the flags, the web server is broken without */
+			if (len<8) {
+				close(cgi_fcgi.conn_fd);
+				cgi_fcgi.conn_fd = -1;
+				continue;
+			}
+
+			if (((content[0]<<8)|content[1])!=FCGI_RESPONDER) {
+				cgi_fcgi_end_request(request_id,FCGI_UNKNOWN_ROLE);
+			}
+			else if (cgi_fcgi.request_id!=0) {
+				cgi_fcgi_end_request(request_id,FCGI_CANT_MPX_CONN);
+			}
+			else {
+				cgi_fcgi.request_id = request_id;
+				cgi_fcgi.keep_conn = (content[2] & FCGI_KEEP_CONN) ? 1 : 0;
+				cgi_fcgi.params_len = 0;
+				ftruncate(cgi_fcgi.in_fd,0);
+				lseek(cgi_fcgi.in_fd,0,SEEK_SET);
+			}
+		}
+		else if (request_id!=cgi_fcgi.request_id || request_id==0) {
+			/* A record of another request, or an unknown management record */
+			if (request_id==0) {
+				memset(content,0,8);
+				content[0] = (unsigned char)type;
+				cgi_fcgi_record(FCGI_UNKNOWN_TYPE,0,content,8);
+			}
+		}
+		else if (type==FCGI_ABORT_REQUEST) {
+			cgi_fcgi_end_request(request_id,FCGI_REQUEST_COMPLETE);
+			cgi_fcgi.request_id = 0;
+		}
+		else if (type==FCGI_PARAMS) {
+			if (cgi_fcgi.params_len+len>cgi_fcgi.params_size) {
+				cgi_fcgi.params_size = cgi_fcgi.params_len+len+4096;
+				cgi_fcgi.params = (unsigned char*)_realloc(cgi_fcgi.params,cgi_fcgi.params_size);
+			}
+			memcpy(cgi_fcgi.params+cgi_fcgi.params_len,content,len);
+			cgi_fcgi.params_len += len;
+
+			if (len==0) {
+				cgi_fcgi_params();
+			}
+		}
+		else if (type==FCGI_STDIN) {
+			if (len>0) {
+				cgi_fcgi_write(cgi_fcgi.in_fd,content,len);
+				continue;
+			}
+
+			/* The input is complete, the request starts */
+			lseek(cgi_fcgi.in_fd,0,SEEK_SET);
+			dup2(cgi_fcgi.in_fd,0);
+			fseek(stdin,0L,SEEK_SET);
+			clearerr(stdin);
+
+			ftruncate(cgi_fcgi.out_fd,0);
+			lseek(cgi_fcgi.out_fd,0,SEEK_SET);
+			fflush(stdout);
+			dup2(cgi_fcgi.out_fd,1);
+			clearerr(stdout);
+
+			mht_scope_begin();
+			return (1);
+		}
+	}
+}
+
+
+/*
+	Listen on a Unix socket instead of the socket passed by the web
+	server, e.g. for a FastCGI process started on its own. Call it
+	before cgi_fcgi_accept. Returns 1 on success, 0 otherwise.
+*/
+int cgi_fcgi_listen( char *path ) {
+	struct sockaddr_un addr;
+	int fd = -1;
+
+
+	if (strlen(path)>=sizeof(addr.sun_path) || (fd=socket(AF_UNIX,SOCK_STREAM,0))<0) {
+		return (0);
+	}
+
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,path);
+	unlink(path);
+
+	if (bind(fd,(struct sockaddr*)&addr,sizeof(addr))!=0 || listen(fd,128)!=0) {
+		close(fd);
+		return (0);
+	}
+
+	cgi_fcgi.listen_fd = fd;
+	return ((cgi_fcgi_start()==CGI_FCGI_MODE_FCGI) ? 1 : 0);
+}
+
+
+/*
+	Send the response of the current request, see cgi_fcgi_accept.
+*/
+void cgi_fcgi_finish(void) {
+	ssize_t len = 0;
+
+
+	if (cgi_fcgi.mode!=CGI_FCGI_MODE_FCGI || cgi_fcgi.request_id==0) {
+		return;
+	}
+
+	fflush(stdout);
+	lseek(cgi_fcgi.out_fd,0,SEEK_SET);
+
+	while ((len=read(cgi_fcgi.out_fd,cgi_fcgi.rec+CGI_FCGI_HEADER_LEN,CGI_FCGI_CHUNK))>0) {
+		cgi_fcgi_record(FCGI_STDOUT,cgi_fcgi.request_id,cgi_fcgi.rec+CGI_FCGI_HEADER_LEN,(size_t)len);
+	}
+
+	cgi_fcgi_record(FCGI_STDOUT,cgi_fcgi.request_id,cgi_fcgi.rec+CGI_FCGI_HEADER_LEN,0);
+	cgi_fcgi_end_request(cgi_fcgi.request_id,FCGI_REQUEST_COMPLETE);
+	cgi_fcgi.request_id = 0;
+
+	if (cgi_fcgi.keep_conn==0) {
+		close(cgi_fcgi.conn_fd);
+		cgi_fcgi.conn_fd = -1;
+	}
+}
+
+
+/*
+	Find out if the process is a FastCGI responder, i.e. it has a
+	socket to listen on, and set up the files behind stdin and stdout.
+	Returns the mode, see CGI_FCGI_MODE_...
+*/
+int cgi_fcgi_start(void) {
+	char path[] = "/tmp/cgimhtXXXXXX";
+	struct sockaddr_un addr;
+	socklen_t len = sizeof(addr);
+
+
+	/* The web server passes the socket as stdin, it is not connected */
+	if (cgi_fcgi.listen_fd<0) {
+		if (getpeername(0,(struct sockaddr*)&addr,&len)==0 || errno!=ENOTCONN) {
+			cgi_fcgi.mode = CGI_FCGI_MODE_CGI;
+			return (cgi_fcgi.mode);
+		}
+		cgi_fcgi.listen_fd = dup(0);
+	}
+
+	if (cgi_fcgi.in_fd<0) {
+		cgi_fcgi.in_fd = mkstemp(path);
+		unlink(path);
+		strcpy(path,"/tmp/cgimhtXXXXXX");
+		cgi_fcgi.out_fd = mkstemp(path);
+		unlink(path);
+	}
+
+	cgi_fcgi.mode = (cgi_fcgi.in_fd<0 || cgi_fcgi.out_fd<0) ? CGI_FCGI_MODE_NONE : CGI_FCGI_MODE_FCGI;
+	return (cgi_fcgi.mode);
+}
+
+
+/*
+	Put the name-value pairs of the PARAMS stream into the environment.
+	The lengths have 1 byte, or 4 bytes if the high bit is set.
+*/
+void cgi_fcgi_params(void) {
+	unsigned char
+		*ptr = cgi_fcgi.params,
+		*end = cgi_fcgi.params+cgi_fcgi.params_len;
+
+	size_t len[2];
+	char *pair = (char*)NULL;
+	unsigned int i = 0;
+
+
+	while (ptr<end) {
+		for (i=0; i<2 && ptr<end; i++) {
+			if (*ptr & 0x80) {
+				if (ptr+4>end) {
+					return;
+				}
+				len[i] = ((size_t)(ptr[0]&0x7f)<<24)|((size_t)ptr[1]<<16)|((size_t)ptr[2]<<8)|ptr[3];
+				ptr += 4;
+			}
+			else {
+				len[i] = *ptr++;
+			}
+		}
+
+		if (i<2 || len[0]+len[1]>(size_t)(end-ptr)) {
+			return;
+		}
+
+		pair = (char*)_malloc(len[0]+len[1]+2);
+		memcpy(pair,ptr,len[0]);
+		pair[len[0]] = '\0';
+		memcpy(pair+len[0]+1,ptr+len[0],len[1]);
+		pair[len[0]+1+len[1]] = '\0';
+
+		cgi_request_setenv(pair,pair+len[0]+1);
+		free(pair);
+
+		ptr += len[0]+len[1];
+	}
+}
+
+
+/*
+	Answer the FCGI_GET_VALUES query of the web server, one
+	request at a time.
+*/
+void cgi_fcgi_get_values( unsigned char *content, size_t len ) {
+	unsigned char
+		result[128],
+		*ptr = content,
+		*end = content+len;
+
+	size_t result_len = 0;
+	char *value = (char*)NULL;
+
+
+	/* Only names with 1-byte lengths are known, and values are empty */
+	while (ptr+2<=end && ptr+2+ptr[0]+ptr[1]<=end) {
+		value = (char*)NULL;
+		if (ptr[0]==14 && memcmp(ptr+2,"FCGI_MAX_CONNS",14)==0) {
+			value = "1";
+		}
+		else if (ptr[0]==13 && memcmp(ptr+2,"FCGI_MAX_REQS",13)==0) {
+			value = "1";
+		}
+		else if (ptr[0]==15 && memcmp(ptr+2,"FCGI_MPXS_CONNS",15)==0) {
+			value = "0";
+		}
+
+		if (value!=(char*)NULL && result_len+2+ptr[0]+1<=sizeof(result)) {
+			result[result_len++] = ptr[0];
+			result[result_len++] = 1;
+			memcpy(result+result_len,ptr+2,ptr[0]);
+			result_len += ptr[0];
+			result[result_len++] = (unsigned char)value[0];
+		}
+
+		ptr += 2+ptr[0]+ptr[1];
+	}
+
+	cgi_fcgi_record(FCGI_GET_VALUES_RESULT,0,result,result_len);
+}
+
+
+void cgi_fcgi_end_request( int request_id, int status ) {
+	unsigned char content[8];
+
+	/* The application status is 0 */
+	memset(content,0,8);
+	content[4] = (unsigned char)status;
+
+	cgi_fcgi_record(FCGI_END_REQUEST,request_id,content,8);
+}
+
+
+/*
+	Send a record, content may be the content part of cgi_fcgi.rec.
+*/
+int cgi_fcgi_record( int type, int request_id, unsigned char *content, size_t len ) {
+	unsigned char *rec = content-CGI_FCGI_HEADER_LEN;
+
+	if (content!=cgi_fcgi.rec+CGI_FCGI_HEADER_LEN) {
+		rec = cgi_fcgi.rec;
+		memmove(rec+CGI_FCGI_HEADER_LEN,content,len);
+	}
+
+	rec[0] = FCGI_VERSION_1;
+	rec[1] = (unsigned char)type;
+	rec[2] = (unsigned char)(request_id>>8);
+	rec[3] = (unsigned char)request_id;
+	rec[4] = (unsigned char)(len>>8);
+	rec[5] = (unsigned char)len;
+	rec[6] = 0;
+	rec[7] = 0;
+
+	return (cgi_fcgi_write(cgi_fcgi.conn_fd,rec,CGI_FCGI_HEADER_LEN+len));
+}
+
+
+/*
+	Read or write exactly len bytes, returns 0 on errors (or at the end).
+*/
+int cgi_fcgi_read( int fd, unsigned char *buf, size_t len ) {
+	ssize_t n = 0;
+
+	while (len>0) {
+		if ((n=read(fd,buf,len))<=0) {
+			if (n<0 && errno==EINTR) {
+				continue;
+			}
+			return (0);
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+
+	return (1);
+}
+
+
+int cgi_fcgi_write( int fd, unsigned char *buf, size_t len ) {
+	ssize_t n = 0;
+
+	while (len>0) {
+		if ((n=write(fd,buf,len))<0) {
+			if (errno==EINTR) {
+				continue;
+			}
+			return (0);
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+
+	return (1);
 }
@@ -2,8 +2,54 @@
 
 /* Prototypes: */
 void cgi_err_msg( char *err_msg );
-void cgi_init(void);
+int cgi_init(void);
 void cgi_exit(void);
 char *cgi_escape_str( char *str );
 void cgi_unescape_str( char *str );
 
+/*
+	The request: cgi_init reads it from the environment and stdin. A
+	server of its own (e.g. mht2html -serve) puts the variables of a
+	request into the environment with cgi_request_setenv, registers the
+	query and the form data with cgi_request_values and the variables
+	with cgi_register_env_vars. cgi_request_reset drops all of it.
+*/
+void cgi_request_setenv( char *name, char *value );
+void cgi_request_values( char *content );
+void cgi_register_env_vars(void);
+void cgi_request_reset(void);
+
+/*
+	The page cache: cgi_cache_begin serves a cached page and returns
+	NULL, or returns the stream the page has to be rendered to (e.g.
+	by mht_quickopen). cgi_cache_end stores the rendered page, ok is 0
+	if it should not be stored. See cgi.c for details.
+*/
+FILE *cgi_cache_begin( char *dir, char *fname, char **macros, unsigned int macro_count, unsigned int ttl );
+void cgi_cache_end( int ok );
+
+/*
+	The buffered response: the output of MHT is collected between
+	cgi_response_begin and cgi_response_end, and sent with a
+	Content-Length and an ETag, or as "304 Not Modified".
+*/
+void cgi_response_begin(void);
+int cgi_response_end(void);
+char *cgi_response_body( char *buf, size_t *header_len );
+
+/*
+	The compressed response: the output of MHT after cgi_compress_begin
+	is compressed with gzip or deflate, if the client accepts it.
+*/
+int cgi_compress_begin( int level );
+void cgi_compress_end(void);
+
+/*
+	The FastCGI responder: cgi_fcgi_accept waits for the next request,
+	and sends the response of the last one. cgi_init and the rest work
+	as for a CGI, but a request cgi_init answers with an error status
+	(it returns 0) is skipped. See cgi.c for details.
+*/
+int cgi_fcgi_accept(void);
+int cgi_fcgi_listen( char *path );
+void cgi_fcgi_finish(void);
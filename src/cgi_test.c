@@ -0,0 +1,285 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mht.h"
+#include "cgi.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the CGI responses, the output to stdout is captured
+	in a file of the test.
+*/
+
+
+int capture_fd = -1;
+
+
+void capture_begin(void) {
+	fflush(stdout);
+	capture_fd = dup(1);
+	freopen(test_path("stdout"),"w",stdout);
+}
+
+
+/*
+	Returns the output since capture_begin, to be freed.
+*/
+char *capture_end(void) {
+	FILE *fptr = (FILE*)NULL;
+	char *output = (char*)NULL;
+	long len = 0;
+
+	fflush(stdout);
+	dup2(capture_fd,1);
+	close(capture_fd);
+
+	fptr = fopen(test_path("stdout"),"rb");
+	fseek(fptr,0,SEEK_END);
+	len = ftell(fptr);
+	rewind(fptr);
+
+	output = (char*)_malloc(len+1);
+	output[fread(output,1,len,fptr)] = '\0';
+	fclose(fptr);
+
+	return (output);
+}
+
+
+/*
+	Count the files of a directory which are no pages or locks, and
+	remove all of them if clean is 1.
+*/
+unsigned int dir_files( char *dir, int clean ) {
+	DIR *dptr = opendir(dir);
+	struct dirent *entry = (struct dirent*)NULL;
+	char path[1024];
+	unsigned int count = 0;
+
+	while (dptr!=(DIR*)NULL && (entry=readdir(dptr))!=(struct dirent*)NULL) {
+		if (entry->d_name[0]=='.') {
+			continue;
+		}
+		if (strstr(entry->d_name,".page")==(char*)NULL && strstr(entry->d_name,".lock")==(char*)NULL) {
+			count++;
+		}
+		if (clean==1) {
+			sprintf(path,"%s/%s",dir,entry->d_name);
+			unlink(path);
+		}
+	}
+
+	if (dptr!=(DIR*)NULL) {
+		closedir(dptr);
+	}
+	if (clean==1) {
+		rmdir(dir);
+	}
+
+	return (count);
+}
+
+
+/*
+	Request a page through the cache, the page is rendered if out is
+	returned. Returns the output.
+*/
+char *cache_request( char *dir, char *query, char *page ) {
+	FILE *out = (FILE*)NULL;
+
+	setenv("REQUEST_METHOD","GET",1);
+	setenv("QUERY_STRING",query,1);
+
+	capture_begin();
+	if ((out=cgi_cache_begin(dir,"page.mht",(char**)NULL,0,60))!=(FILE*)NULL) {
+		fputs(page,out);
+		cgi_cache_end(1);
+	}
+	return (capture_end());
+}
+
+
+void test_cache(void) {
+	char
+		*dir = test_path("cache"),
+		*output = (char*)NULL;
+
+	mkdir(dir,0700);
+
+	output = cache_request(dir,"a=1","Content-type: text/html\n\nfirst");
+	test_equal("rendered page",output,"Content-type: text/html\n\nfirst");
+	free(output);
+
+	output = cache_request(dir,"a=1","Content-type: text/html\n\nsecond");
+	test_equal("cached page",output,"Content-type: text/html\n\nfirst");
+	free(output);
+
+	test_check("no temporary files",dir_files(dir,0)==0);
+
+	/* Cookies of a client must not be sent to another one */
+	output = cache_request(dir,"a=2","Content-type: text/html\nSET-COOKIE: id=1\n\nmine");
+	test_equal("page with a cookie",output,"Content-type: text/html\nSET-COOKIE: id=1\n\nmine");
+	free(output);
+
+	output = cache_request(dir,"a=2","Content-type: text/html\nSet-Cookie: id=2\n\nyours");
+	test_equal("page with a cookie is not cached",output,"Content-type: text/html\nSet-Cookie: id=2\n\nyours");
+	free(output);
+
+	output = cache_request(dir,"a=3","Content-type: text/html\n\nSet-Cookie: in the body");
+	free(output);
+	output = cache_request(dir,"a=3","Content-type: text/html\n\nagain");
+	test_equal("cookie in the body",output,"Content-type: text/html\n\nSet-Cookie: in the body");
+	free(output);
+
+	test_check("no temporary files left",dir_files(dir,0)==0);
+	dir_files(dir,1);
+
+	unsetenv("QUERY_STRING");
+	unsetenv("REQUEST_METHOD");
+}
+
+
+void test_response_body(void) {
+	char *buf = (char*)NULL;
+	size_t header_len = 0;
+
+	buf = "Content-type: text/plain\r\nX-A: 1\r\n\r\nbody";
+	test_equal("headers and body",cgi_response_body(buf,&header_len),"body");
+	test_check("header length",header_len==strlen("Content-type: text/plain\r\nX-A: 1\r\n"));
+
+	buf = "Dear reader: hello\n\nbody";
+	test_check("text with a colon is the body",cgi_response_body(buf,&header_len)==buf && header_len==0);
+
+	buf = "Content-type: text/html\n<p>a: b</p>\n\nbody";
+	test_check("a line which is no header",cgi_response_body(buf,&header_len)==buf && header_len==0);
+
+	buf = "Content-type: text/html\n";
+	test_check("no empty line",cgi_response_body(buf,&header_len)==buf && header_len==0);
+}
+
+
+/*
+	Send a template through cgi_response_begin/end. Returns the
+	output.
+*/
+char *response( char *template, char *if_none_match, int *sent ) {
+	setenv("REQUEST_METHOD","GET",1);
+	if (if_none_match!=(char*)NULL) {
+		setenv("HTTP_IF_NONE_MATCH",if_none_match,1);
+	}
+	else {
+		unsetenv("HTTP_IF_NONE_MATCH");
+	}
+
+	capture_begin();
+	cgi_response_begin();
+	mht_quickopen(stdout,test_file("response.mht",template,0));
+	*sent = cgi_response_end();
+	return (capture_end());
+}
+
+
+void test_response(void) {
+	char
+		*page = "Cache-Control: max-age=60\nVary: Cookie\nX-Other: 1\n\nhello\n",
+		*output = (char*)NULL,
+		*etag = (char*)NULL;
+
+	int sent = 0;
+
+	output = response(page,(char*)NULL,&sent);
+	test_check("sent",sent==1);
+	test_contains("content length",output,"Content-Length: 6\n");
+	test_contains("body",output,"\n\nhello");
+
+	if ((etag=strstr(output,"ETag: "))!=(char*)NULL) {
+		etag = strdup(etag+6);
+		etag[strcspn(etag,"\n")] = '\0';
+	}
+	free(output);
+	test_check("etag",etag!=(char*)NULL);
+	if (etag==(char*)NULL) {
+		return;
+	}
+
+	output = response(page,etag,&sent);
+	test_check("not modified",sent==0);
+	test_contains("304",output,"Status: 304 Not Modified\n");
+	test_contains("304 keeps Cache-Control",output,"Cache-Control: max-age=60\n");
+	test_contains("304 keeps Vary",output,"Vary: Cookie\n");
+	test_check("304 without other headers",strstr(output,"X-Other")==(char*)NULL);
+	test_check("304 without body",strstr(output,"hello")==(char*)NULL);
+	free(output);
+
+	/* An error page with the same body is sent as it is */
+	output = response("Status: 404 Not Found\n\nhello\n",etag,&sent);
+	test_check("status of the page",sent==1);
+	test_contains("status header",output,"Status: 404 Not Found\n");
+	free(output);
+
+	free(etag);
+	unsetenv("HTTP_IF_NONE_MATCH");
+	unsetenv("REQUEST_METHOD");
+}
+
+
+/*
+	Returns the headers cgi_compress_begin writes for an
+	Accept-Encoding, expected is 1 if the response is compressed.
+*/
+char *compress_headers( char *accept_encoding, int expected ) {
+	int compressed = 0;
+
+	setenv("HTTP_ACCEPT_ENCODING",accept_encoding,1);
+	capture_begin();
+	compressed = cgi_compress_begin(-1);
+	cgi_compress_end();
+	unsetenv("HTTP_ACCEPT_ENCODING");
+
+	test_check(accept_encoding,compressed==expected);
+	return (capture_end());
+}
+
+
+void test_compress(void) {
+	char *output = (char*)NULL;
+
+	output = compress_headers("gzip, deflate",1);
+	test_contains("gzip",output,"Content-Encoding: gzip\n");
+	free(output);
+
+	output = compress_headers("gzip;q=0, deflate;q=0.5",1);
+	test_contains("gzip refused",output,"Content-Encoding: deflate\n");
+	free(output);
+
+	output = compress_headers("identity",0);
+	test_equal("not compressed",output,"Vary: Accept-Encoding\n\n");
+	free(output);
+}
+
+
+int main( int argc, char **argv ) {
+	mht_init();
+
+	test_cache();
+	test_response_body();
+	test_response();
+	test_compress();
+
+	mht_exit();
+
+	return (test_result("cgi_test"));
+}
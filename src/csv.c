@@ -0,0 +1,427 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "csv.h"
+#include "mem.h"
+#include "str_util.h"
+
+
+#define CSV_INDEX_MAGIC		0x5848544dUL	/* "MHTX" */
+
+
+/* Prototypes: */
+char *csv_row_end( char *ptr, char *end );
+unsigned int csv_index_rows( CSV_TABLE *csv, unsigned long upto );
+void csv_load_index( CSV_TABLE *csv );
+void csv_save_index( CSV_TABLE *csv );
+int csv_split_row( CSV_TABLE *csv, unsigned long internal_row, char **fields, int max_fields );
+void csv_free( CSV_TABLE *csv );
+
+
+/* All tables opened so far by the thread, they stay mapped until csv_close_all */
+MHT_THREAD CSV_TABLE *csv_tables = (CSV_TABLE*)NULL;
+
+
+/*
+	Return a pointer to the newline that terminates the row starting
+	at ptr, or end. Newlines inside quoted fields are skipped.
+*/
+char *csv_row_end( char *ptr, char *end ) {
+	while ((ptr=memscan2(ptr,end,'\n','"'))<end) {
+		if (*ptr=='\n') {
+			return (ptr);
+		}
+
+		/* Skip the quoted field, an escaped quote "" is skipped as two fields */
+		ptr = memchr(ptr+1,'"',end-ptr-1);
+		if (ptr==(char*)NULL) {
+			return (end);
+		}
+		ptr++;
+	}
+
+	return (end);
+}
+
+
+/*
+	Extend the row offset index until row "upto" is indexed or the
+	end of the file is reached. Returns 1 if the row exists.
+*/
+unsigned int csv_index_rows( CSV_TABLE *csv, unsigned long upto ) {
+	char
+		*end = csv->data+csv->size,
+		*ptr = (char*)NULL;
+
+	while (csv->indexed==0 && csv->row_count<=upto) {
+		/* Skip empty lines */
+		for (ptr=csv->data+csv->scan_pos; ptr<end && (*ptr=='\n' || *ptr=='\r'); ptr++);
+
+		if (ptr>=end) {
+			csv->indexed = 1;
+			if (csv->options & CSV_OPT_INDEX) {
+				csv_save_index(csv);
+			}
+			break;
+		}
+
+		if (csv->row_count>=csv->row_max) {
+			csv->row_max = (csv->row_max==0) ? 1024 : csv->row_max*2;
+			csv->rows = (unsigned long*)realloc(csv->rows,csv->row_max*sizeof(unsigned long));
+			if (csv->rows==(unsigned long*)NULL) {
+				fprintf(stdout,"FATA ERROR: cannot allocate new memory!");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		csv->rows[csv->row_count++] = ptr-csv->data;
+		ptr = csv_row_end(ptr,end);
+		csv->scan_pos = (ptr<end) ? (unsigned long)(ptr-csv->data)+1 : (unsigned long)csv->size;
+	}
+
+	return (upto<csv->row_count ? 1 : 0);
+}
+
+
+/*
+	Use the index file "fname.idx", if it was written for the
+	current version of the data file. The offsets must ascend within
+	the data file, otherwise the index is built again.
+*/
+void csv_load_index( CSV_TABLE *csv ) {
+	char idx_name[1024];
+	unsigned long
+		*header = (unsigned long*)NULL,
+		i = 0;
+	size_t size = 0;
+
+
+	if (strlen(csv->fname)+5>sizeof(idx_name)) {
+		return;
+	}
+	sprintf(idx_name,"%s.idx",csv->fname);
+
+	if ((header=(unsigned long*)map_file(idx_name,&size,(time_t*)NULL))==(unsigned long*)NULL) {
+		return;
+	}
+
+	/* magic, size and mtime of the data file, row count, offsets... */
+	if (size<4*sizeof(unsigned long)
+		|| header[0]!=CSV_INDEX_MAGIC
+		|| header[1]!=(unsigned long)csv->size
+		|| header[2]!=(unsigned long)csv->mtime
+		|| header[3]!=size/sizeof(unsigned long)-4
+		|| size%sizeof(unsigned long)!=0) {
+		unmap_file(header,size);
+		return;
+	}
+
+	for (i=0; i<header[3]; i++) {
+		if (header[4+i]>=(unsigned long)csv->size || (i>0 && header[4+i]<=header[3+i])) {
+			unmap_file(header,size);
+			return;
+		}
+	}
+
+	csv->index_map = header;
+	csv->index_size = size;
+	csv->rows = header+4;
+	csv->row_count = header[3];
+	csv->row_max = 0;
+	csv->scan_pos = csv->size;
+	csv->indexed = 1;
+}
+
+
+/*
+	Write the complete row offset index to "fname.idx". Errors are
+	ignored, the index is just built again next time.
+*/
+void csv_save_index( CSV_TABLE *csv ) {
+	char idx_name[1024];
+	unsigned long header[4];
+	FILE *fptr = (FILE*)NULL;
+
+
+	if (csv->index_map!=(void*)NULL || strlen(csv->fname)+5>sizeof(idx_name)) {
+		return;
+	}
+	sprintf(idx_name,"%s.idx",csv->fname);
+
+	if ((fptr=fopen(idx_name,"wb"))==(FILE*)NULL) {
+		return;
+	}
+
+	header[0] = CSV_INDEX_MAGIC;
+	header[1] = (unsigned long)csv->size;
+	header[2] = (unsigned long)csv->mtime;
+	header[3] = csv->row_count;
+
+	if (fwrite(header,sizeof(header),1,fptr)!=1 || (csv->row_count>0 && fwrite(csv->rows,csv->row_count*sizeof(unsigned long),1,fptr)!=1)) {
+		fclose(fptr);
+		remove(idx_name);
+		return;
+	}
+
+	fclose(fptr);
+}
+
+
+/*
+	Open a CSV/TSV file. A file is mapped only once, further calls
+	return the same table as long as the file was not modified. Each
+	call is matched by a call of csv_release.
+*/
+CSV_TABLE *csv_open( char *fname, char sepchar, unsigned int options ) {
+	CSV_TABLE
+		*csv = (CSV_TABLE*)NULL,
+		**prev = (CSV_TABLE**)NULL;
+
+	struct stat st;
+	int i = 0;
+
+
+	if (fname==(char*)NULL || stat(fname,&st)!=0) {
+		return ((CSV_TABLE*)NULL);
+	}
+
+	for (prev=&csv_tables; (csv=*prev)!=(CSV_TABLE*)NULL; prev=&csv->next) {
+		if (strcmp(csv->fname,fname)==0 && csv->sepchar==sepchar && csv->options==options) {
+			if (csv->size==(size_t)st.st_size && csv->mtime==st.st_mtime) {
+				csv->users++;
+				return (csv);
+			}
+
+			/* The file was modified, an outer #table keeps the old version */
+			*prev = csv->next;
+			if (csv->users>0) {
+				csv->stale = 1;
+			}
+			else {
+				csv_free(csv);
+			}
+			break;
+		}
+	}
+
+	csv = (CSV_TABLE*)_calloc(1,sizeof(CSV_TABLE));
+	csv->data = (char*)map_file(fname,&csv->size,&csv->mtime);
+
+	if (csv->data==(char*)NULL) {
+		free(csv);
+		return ((CSV_TABLE*)NULL);
+	}
+
+	csv->fname = strdup(fname);
+	csv->sepchar = sepchar;
+	csv->options = options;
+
+	/* Without a valid index file, index the whole file once and write it */
+	if (options & CSV_OPT_INDEX) {
+		csv_load_index(csv);
+		csv_index_rows(csv,(unsigned long)-2);
+	}
+
+	/* Keep a copy of the column names */
+	if (options & CSV_OPT_HEADER) {
+		csv->header_count = csv_split_row(csv,0,csv->header,CSV_MAX_FIELDS);
+
+		if (csv->header_count<0) {
+			csv->header_count = 0;
+		}
+		else {
+			csv->header_buf = (char*)memdup(csv->row_buf,csv->row_buf_len);
+			for (i=0; i<csv->header_count; i++) {
+				csv->header[i] = csv->header_buf+(csv->header[i]-csv->row_buf);
+			}
+		}
+	}
+
+	csv->users = 1;
+	csv->next = csv_tables;
+	csv_tables = csv;
+
+	return (csv);
+}
+
+
+/*
+	Release a table returned by csv_open. The old version of a modified
+	file is freed when it is not read any more.
+*/
+void csv_release( CSV_TABLE *csv ) {
+	if (csv->users>0) {
+		csv->users--;
+	}
+
+	if (csv->users==0 && csv->stale==1) {
+		csv_free(csv);
+	}
+}
+
+
+/*
+	Split a row into its fields. The fields are unquoted and copied into
+	the row buffer of the table, which is reused for each row.
+	Returns the number of fields, or -1 if the row does not exist.
+*/
+int csv_split_row( CSV_TABLE *csv, unsigned long internal_row, char **fields, int max_fields ) {
+	int count = 0;
+
+	char
+		*ptr = (char*)NULL,
+		*end = (char*)NULL,
+		*field_end = (char*)NULL,
+		*out = (char*)NULL;
+
+
+	if (csv_index_rows(csv,internal_row)==0) {
+		return (-1);
+	}
+
+	ptr = csv->data+csv->rows[internal_row];
+	end = csv_row_end(ptr,csv->data+csv->size);
+
+	if (end>ptr && *(end-1)=='\r') {
+		end--;
+	}
+
+	/* The unquoted fields are never longer than the row itself */
+	if (csv->row_buf_len<(size_t)(end-ptr)+1) {
+		free(csv->row_buf);
+		csv->row_buf_len = (size_t)(end-ptr)*2+64;
+		csv->row_buf = (char*)_malloc(csv->row_buf_len);
+	}
+
+	out = csv->row_buf;
+
+	while (count<max_fields) {
+		fields[count++] = out;
+
+		if (ptr<end && *ptr=='"') {
+			/* A quoted field, "" is an escaped quote */
+			for (ptr++; ptr<end; ) {
+				field_end = memchr(ptr,'"',end-ptr);
+				if (field_end==(char*)NULL) {
+					field_end = end;
+				}
+
+				memcpy(out,ptr,field_end-ptr);
+				out += field_end-ptr;
+				ptr = field_end+1;
+
+				if (ptr<end && *ptr=='"') {
+					*out++ = '"';
+					ptr++;
+				}
+				else {
+					break;
+				}
+			}
+		}
+
+		/* The (rest of the) field up to the next separator */
+		if (ptr<end) {
+			field_end = memchr(ptr,csv->sepchar,end-ptr);
+			if (field_end==(char*)NULL) {
+				field_end = end;
+			}
+
+			memcpy(out,ptr,field_end-ptr);
+			out += field_end-ptr;
+			ptr = field_end;
+		}
+
+		*out++ = '\0';
+
+		if (ptr<end && *ptr==csv->sepchar) {
+			ptr++;
+		}
+		else {
+			break;
+		}
+	}
+
+	return (count);
+}
+
+
+/*
+	Read the fields of a data row (the header row is not counted,
+	the first data row is 0). Returns the number of fields, or -1
+	if the row does not exist. The fields are valid until the next
+	row of the table is read.
+*/
+int csv_read_row( CSV_TABLE *csv, unsigned long row, char **fields, int max_fields ) {
+	if (csv==(CSV_TABLE*)NULL) {
+		return (-1);
+	}
+
+	if (csv->options & CSV_OPT_HEADER) {
+		row++;
+	}
+
+	return (csv_split_row(csv,row,fields,max_fields));
+}
+
+
+/*
+	Return the number of data rows. The whole file is indexed.
+*/
+unsigned long csv_row_count( CSV_TABLE *csv ) {
+	csv_index_rows(csv,(unsigned long)-2);
+
+	if ((csv->options & CSV_OPT_HEADER) && csv->row_count>0) {
+		return (csv->row_count-1);
+	}
+
+	return (csv->row_count);
+}
+
+
+void csv_free( CSV_TABLE *csv ) {
+	unmap_file(csv->data,csv->size);
+
+	if (csv->index_map!=(void*)NULL) {
+		unmap_file(csv->index_map,csv->index_size);
+	}
+	else {
+		free(csv->rows);
+	}
+
+	free(csv->row_buf);
+	free(csv->header_buf);
+	free(csv->fname);
+	free(csv);
+}
+
+
+/*
+	Unmap all tables.
+*/
+void csv_close_all(void) {
+	CSV_TABLE *csv = (CSV_TABLE*)NULL;
+
+	while ((csv=csv_tables)!=(CSV_TABLE*)NULL) {
+		csv_tables = csv->next;
+		csv_free(csv);
+	}
+}
+
+
+/*
+	Make a list of tables the one of the thread, returns the previous
+	list. A render keeps a list of its own, see render.c.
+*/
+CSV_TABLE *csv_switch( CSV_TABLE *tables ) {
+	CSV_TABLE *prev = csv_tables;
+
+	csv_tables = tables;
+	return (prev);
+}
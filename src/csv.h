@@ -0,0 +1,42 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/* Definitions: */
+#define CSV_OPT_HEADER		1	/* The first row contains the column names */
+#define CSV_OPT_INDEX		2	/* Keep the row offset index in a file "fname.idx" */
+#define CSV_MAX_FIELDS		32	/* The max. number of fields of a row */
+
+
+/* Data structures: */
+typedef struct CSV_PTR csv_ptr;
+typedef struct CSV_PTR {
+	char *fname;		/* The name of the data file */
+	char *data;			/* The mapped data file */
+	size_t size;		/* The size of the data file */
+	time_t mtime;		/* The modification time of the data file */
+	char sepchar;		/* The field separator */
+	unsigned int options;	/* CSV_OPT_* flags */
+	unsigned long *rows;	/* The offsets of all rows indexed so far */
+	unsigned long row_count;	/* The number of rows indexed so far */
+	unsigned long row_max;	/* The number of allocated row offsets, 0 if the index file is mapped */
+	unsigned long scan_pos;	/* The offset of the next row that is not indexed yet */
+	unsigned int indexed;	/* 1 if all rows are indexed */
+	void *index_map;	/* The mapped index file */
+	size_t index_size;	/* The size of the mapped index file */
+	char *row_buf;		/* The fields of the current row, each terminated by '\0' */
+	size_t row_buf_len;	/* The size of row_buf */
+	char *header_buf;	/* The column names */
+	char *header[CSV_MAX_FIELDS];
+	int header_count;
+	unsigned int users;	/* The number of #table directives reading the table */
+	unsigned int stale;	/* 1 if the file was modified while the table was read */
+	csv_ptr *next;
+} CSV_TABLE;
+
+
+/* Prototypes: */
+CSV_TABLE *csv_open( char *fname, char sepchar, unsigned int options );
+int csv_read_row( CSV_TABLE *csv, unsigned long row, char **fields, int max_fields );
+unsigned long csv_row_count( CSV_TABLE *csv );
+void csv_release( CSV_TABLE *csv );
+void csv_close_all(void);
+CSV_TABLE *csv_switch( CSV_TABLE *tables );
@@ -0,0 +1,208 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "csv.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the CSV/TSV reader.
+*/
+
+
+void test_fields(void) {
+	CSV_TABLE *csv = (CSV_TABLE*)NULL;
+	char *fields[CSV_MAX_FIELDS];
+	int count = 0;
+
+	csv = csv_open(test_file("fields.csv",
+		"a,b,c\r\n"
+		"\"x, y\",\"say \"\"hi\"\"\",\n"
+		"\n"
+		"\"multi\nline\",2\n"
+		"last",0),',',0);
+
+	test_check("open",csv!=(CSV_TABLE*)NULL);
+	if (csv==(CSV_TABLE*)NULL) {
+		return;
+	}
+
+	count = csv_read_row(csv,0,fields,CSV_MAX_FIELDS);
+	test_check("CRLF row",count==3);
+	test_equal("CRLF row, last field",fields[2],"c");
+
+	count = csv_read_row(csv,1,fields,CSV_MAX_FIELDS);
+	test_check("quoted row",count==3);
+	test_equal("quoted separator",fields[0],"x, y");
+	test_equal("escaped quote",fields[1],"say \"hi\"");
+	test_equal("empty last field",fields[2],"");
+
+	count = csv_read_row(csv,2,fields,CSV_MAX_FIELDS);
+	test_check("empty lines are skipped",count==2);
+	test_equal("quoted newline",fields[0],"multi\nline");
+
+	count = csv_read_row(csv,3,fields,CSV_MAX_FIELDS);
+	test_equal("row without newline",fields[0],"last");
+
+	test_check("missing row",csv_read_row(csv,4,fields,CSV_MAX_FIELDS)==-1);
+	test_check("row count",csv_row_count(csv)==4);
+	test_check("max. fields",csv_read_row(csv,0,fields,2)==2);
+
+	csv_release(csv);
+}
+
+
+void test_options(void) {
+	CSV_TABLE *csv = (CSV_TABLE*)NULL;
+	char
+		*fname = test_file("options.tsv","name\tqty\npear\t3\napple\t5\n",0),
+		*idx_name = (char*)NULL,
+		*fields[CSV_MAX_FIELDS];
+	FILE *fptr = (FILE*)NULL;
+
+	csv = csv_open(fname,'\t',CSV_OPT_HEADER | CSV_OPT_INDEX);
+	test_check("header columns",csv!=(CSV_TABLE*)NULL && csv->header_count==2);
+	if (csv==(CSV_TABLE*)NULL) {
+		return;
+	}
+
+	test_equal("header name",csv->header[1],"qty");
+	test_check("rows without the header",csv_row_count(csv)==2);
+	csv_read_row(csv,1,fields,CSV_MAX_FIELDS);
+	test_equal("tab separated",fields[0],"apple");
+
+	/* The index file is written and used */
+	idx_name = test_path("options.tsv.idx");
+	csv_release(csv);
+	csv_close_all();
+
+	fptr = fopen(idx_name,"rb");
+	test_check("index file written",fptr!=(FILE*)NULL && fgetc(fptr)!=EOF);
+	if (fptr!=(FILE*)NULL) {
+		fclose(fptr);
+	}
+
+	csv = csv_open(fname,'\t',CSV_OPT_HEADER | CSV_OPT_INDEX);
+	test_check("index file used",csv!=(CSV_TABLE*)NULL && csv->index_map!=(void*)NULL && csv->row_count==3);
+	if (csv!=(CSV_TABLE*)NULL) {
+		csv_read_row(csv,0,fields,CSV_MAX_FIELDS);
+		test_equal("row read with the index file",fields[1],"3");
+		csv_release(csv);
+	}
+
+	test_check("missing file",csv_open("/nonexistent/none.csv",',',0)==(CSV_TABLE*)NULL);
+}
+
+
+/*
+	Write an index file for the data file fname with the given offsets.
+*/
+void write_index( char *fname, unsigned long *offsets, unsigned long count ) {
+	struct stat st;
+	unsigned long header[4];
+	FILE *fptr = (FILE*)NULL;
+	char idx_name[1024];
+
+	stat(fname,&st);
+	sprintf(idx_name,"%s.idx",fname);
+
+	header[0] = 0x5848544dUL;
+	header[1] = (unsigned long)st.st_size;
+	header[2] = (unsigned long)st.st_mtime;
+	header[3] = count;
+
+	fptr = fopen(idx_name,"wb");
+	fwrite(header,sizeof(header),1,fptr);
+	fwrite(offsets,count*sizeof(unsigned long),1,fptr);
+	fclose(fptr);
+}
+
+
+void test_bad_index(void) {
+	CSV_TABLE *csv = (CSV_TABLE*)NULL;
+	char
+		*fname = test_file("bad_index.csv","a\nb\nc\n",0),
+		*fields[CSV_MAX_FIELDS];
+	unsigned long
+		beyond[3] = { 0, 2, 4096 },
+		descending[3] = { 0, 4, 2 };
+
+	/* Offsets outside the file or out of order are not used */
+	write_index(fname,beyond,3);
+	csv = csv_open(fname,',',CSV_OPT_INDEX);
+	test_check("offset beyond the file",csv!=(CSV_TABLE*)NULL && csv->index_map==(void*)NULL && csv_row_count(csv)==3);
+	if (csv!=(CSV_TABLE*)NULL) {
+		csv_read_row(csv,2,fields,CSV_MAX_FIELDS);
+		test_equal("row indexed again",fields[0],"c");
+		csv_release(csv);
+	}
+	csv_close_all();
+
+	write_index(fname,descending,3);
+	csv = csv_open(fname,',',CSV_OPT_INDEX);
+	test_check("descending offsets",csv!=(CSV_TABLE*)NULL && csv->index_map==(void*)NULL && csv_row_count(csv)==3);
+	if (csv!=(CSV_TABLE*)NULL) {
+		csv_read_row(csv,1,fields,CSV_MAX_FIELDS);
+		test_equal("row indexed again",fields[0],"b");
+		csv_release(csv);
+	}
+	csv_close_all();
+
+	/* The index was written again */
+	csv = csv_open(fname,',',CSV_OPT_INDEX);
+	test_check("index file rewritten",csv!=(CSV_TABLE*)NULL && csv->index_map!=(void*)NULL);
+	if (csv!=(CSV_TABLE*)NULL) {
+		csv_release(csv);
+	}
+}
+
+
+void test_reopen(void) {
+	CSV_TABLE
+		*csv = (CSV_TABLE*)NULL,
+		*same = (CSV_TABLE*)NULL,
+		*modified = (CSV_TABLE*)NULL;
+	char
+		*fname = test_file("reopen.csv","old\n",0),
+		*fields[CSV_MAX_FIELDS];
+
+	csv = csv_open(fname,',',0);
+	same = csv_open(fname,',',0);
+	test_check("a file is mapped once",csv!=(CSV_TABLE*)NULL && csv==same);
+	if (csv==(CSV_TABLE*)NULL) {
+		return;
+	}
+	csv_release(same);
+
+	/* A replaced file is opened again, the table in use stays valid */
+	rename(test_file("reopen.new","new row\n",0),fname);
+	modified = csv_open(fname,',',0);
+	test_check("modified file",modified!=(CSV_TABLE*)NULL && modified!=csv);
+
+	csv_read_row(csv,0,fields,CSV_MAX_FIELDS);
+	test_equal("table in use",fields[0],"old");
+	csv_release(csv);
+
+	if (modified!=(CSV_TABLE*)NULL) {
+		csv_read_row(modified,0,fields,CSV_MAX_FIELDS);
+		test_equal("modified table",fields[0],"new row");
+		csv_release(modified);
+	}
+}
+
+
+int main( int argc, char **argv ) {
+	test_fields();
+	test_options();
+	test_reopen();
+	test_bad_index();
+
+	csv_close_all();
+	return (test_result("csv_test"));
+}
@@ -0,0 +1,270 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "dict.h"
+#include "mem.h"
+#include "mht_defs.h"
+
+
+/*
+	FNV-1a, it has to be the same for building and reading
+	a dictionary.
+*/
+unsigned int dict_hash( char *key ) {
+	unsigned int hashval = 2166136261U;
+
+	while (*key!='\0') {
+		hashval ^= (unsigned char)*key++;
+		hashval *= 16777619U;
+	}
+
+	return (hashval);
+}
+
+
+/*
+	Check the header, the slots and the entries of a dictionary against
+	the size of the file, so that the lookups never leave the file.
+	Returns 1 if the dictionary is valid.
+*/
+unsigned int dict_check( char *data, size_t size ) {
+	DICT_HEADER *header = (DICT_HEADER*)data;
+	DICT_SLOT *slots = (DICT_SLOT*)(data+sizeof(DICT_HEADER));
+	size_t table_end = 0;
+	char *key_end = (char*)NULL;
+	unsigned int
+		slot = 0,
+		used = 0;
+
+
+	if (size<sizeof(DICT_HEADER)
+		|| header->magic!=DICT_MAGIC
+		|| header->version!=DICT_VERSION
+		|| header->slot_count==0
+		|| (header->slot_count & (header->slot_count-1))!=0
+		|| header->slot_count>(size-sizeof(DICT_HEADER))/sizeof(DICT_SLOT)) {
+		return (0);
+	}
+
+	table_end = sizeof(DICT_HEADER)+header->slot_count*sizeof(DICT_SLOT);
+
+	for (slot=0; slot<header->slot_count; slot++) {
+		if (slots[slot].offset==0) {
+			continue;
+		}
+
+		/* key\0value\0 inside of the file, behind the slots */
+		if (slots[slot].offset<table_end || slots[slot].offset>=size
+			|| (key_end=memchr(data+slots[slot].offset,'\0',size-slots[slot].offset))==(char*)NULL
+			|| key_end+1>=data+size
+			|| memchr(key_end+1,'\0',data+size-key_end-1)==(void*)NULL) {
+			return (0);
+		}
+		used++;
+	}
+
+	/* A lookup of a missing key stops at an empty slot */
+	return ((used==header->entry_count && used<header->slot_count) ? 1 : 0);
+}
+
+
+/*
+	Map a compiled dictionary. The slots and the entries are checked
+	once, so a corrupt or truncated file is refused here.
+*/
+MHT_DICT *dict_open( char *fname ) {
+	MHT_DICT *dict = (MHT_DICT*)NULL;
+	size_t size = 0;
+	char *data = (char*)NULL;
+
+
+	if ((data=(char*)map_file(fname,&size,(time_t*)NULL))==(char*)NULL) {
+		return ((MHT_DICT*)NULL);
+	}
+
+	if (dict_check(data,size)==0) {
+		unmap_file(data,size);
+		return ((MHT_DICT*)NULL);
+	}
+
+	dict = (MHT_DICT*)_malloc(sizeof(MHT_DICT));
+	dict->fname = strdup(fname);
+	dict->data = data;
+	dict->size = size;
+	dict->header = (DICT_HEADER*)data;
+	dict->slots = (DICT_SLOT*)(data+sizeof(DICT_HEADER));
+	dict->next = (MHT_DICT*)NULL;
+
+	return (dict);
+}
+
+
+/*
+	Return the value of a key, or NULL. The value points into
+	the mapped file and must not be modified.
+*/
+char *dict_lookup( MHT_DICT *dict, char *key ) {
+	unsigned int
+		hashval = dict_hash(key),
+		mask = dict->header->slot_count-1,
+		slot = 0;
+
+	char *entry = (char*)NULL;
+
+
+	for (slot=hashval&mask; dict->slots[slot].offset!=0; slot=(slot+1)&mask) {
+		if (dict->slots[slot].hash==hashval) {
+			entry = dict->data+dict->slots[slot].offset;
+			if (strcmp(entry,key)==0) {
+				return (entry+strlen(entry)+1);
+			}
+		}
+	}
+
+	return ((char*)NULL);
+}
+
+
+void dict_close( MHT_DICT *dict ) {
+	unmap_file(dict->data,dict->size);
+	free(dict->fname);
+	free(dict);
+}
+
+
+/*
+	Compile a text file with lines "key=value" into a dictionary.
+	Empty lines and lines starting with '#' are skipped, a key
+	defined twice gets the last value. Returns the number of
+	entries, or -1 on an I/O error.
+*/
+int dict_build( char *src_fname, char *dict_fname ) {
+	FILE
+		*src = (FILE*)NULL,
+		*dst = (FILE*)NULL;
+
+	char
+		line[MAX_LEN],
+		*key = (char*)NULL,
+		*value = (char*)NULL,
+		*end = (char*)NULL,
+		**keys = (char**)NULL,
+		**values = (char**)NULL;
+
+	unsigned int
+		count = 0,
+		max = 0,
+		i = 0,
+		slot = 0,
+		offset = 0,
+		*entries = (unsigned int*)NULL;
+
+	DICT_HEADER header;
+	DICT_SLOT *slots = (DICT_SLOT*)NULL;
+
+
+	if ((src=fopen(src_fname,"r"))==(FILE*)NULL) {
+		return (-1);
+	}
+
+	while (fgets(line,MAX_LEN,src)!=(char*)NULL) {
+		for (key=line; isspace((unsigned char)*key); key++);
+
+		if (*key=='\0' || *key=='#' || (value=strchr(key,'='))==(char*)NULL) {
+			continue;
+		}
+
+		/* Trim the key and the start of the value */
+		for (end=value; end>key && isspace((unsigned char)*(end-1)); end--);
+		*end = '\0';
+		for (value++; *value==' ' || *value=='\t'; value++);
+		value[strcspn(value,"\r\n")] = '\0';
+
+		if (*key=='\0') {
+			continue;
+		}
+
+		if (count>=max) {
+			max = (max==0) ? 256 : max*2;
+			keys = (char**)realloc(keys,max*sizeof(char*));
+			values = (char**)realloc(values,max*sizeof(char*));
+			if (keys==(char**)NULL || values==(char**)NULL) {
+				fprintf(stdout,"FATA ERROR: cannot allocate new memory!");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		keys[count] = strdup(key);
+		values[count] = strdup(value);
+		count++;
+	}
+	fclose(src);
+
+	/* At most half of the slots are used */
+	header.magic = DICT_MAGIC;
+	header.version = DICT_VERSION;
+	header.entry_count = 0;
+	for (header.slot_count=16; header.slot_count<count*2; header.slot_count*=2);
+
+	/* entries[slot] is the number of the line+1 stored in the slot */
+	slots = (DICT_SLOT*)_calloc(header.slot_count,sizeof(DICT_SLOT));
+	entries = (unsigned int*)_calloc(header.slot_count,sizeof(unsigned int));
+
+	for (i=0; i<count; i++) {
+		for (slot=dict_hash(keys[i])&(header.slot_count-1); entries[slot]!=0; slot=(slot+1)&(header.slot_count-1)) {
+			if (strcmp(keys[entries[slot]-1],keys[i])==0) {
+				break;
+			}
+		}
+
+		if (entries[slot]==0) {
+			header.entry_count++;
+		}
+		slots[slot].hash = dict_hash(keys[i]);
+		entries[slot] = i+1;
+	}
+
+	offset = sizeof(DICT_HEADER)+header.slot_count*sizeof(DICT_SLOT);
+	for (slot=0; slot<header.slot_count; slot++) {
+		if (entries[slot]!=0) {
+			slots[slot].offset = offset;
+			offset += strlen(keys[entries[slot]-1])+strlen(values[entries[slot]-1])+2;
+		}
+	}
+
+	if ((dst=fopen(dict_fname,"wb"))!=(FILE*)NULL) {
+		fwrite(&header,sizeof(DICT_HEADER),1,dst);
+		fwrite(slots,sizeof(DICT_SLOT),header.slot_count,dst);
+
+		for (slot=0; slot<header.slot_count; slot++) {
+			if (entries[slot]!=0) {
+				fwrite(keys[entries[slot]-1],strlen(keys[entries[slot]-1])+1,1,dst);
+				fwrite(values[entries[slot]-1],strlen(values[entries[slot]-1])+1,1,dst);
+			}
+		}
+
+		if (ferror(dst)) {
+			fclose(dst);
+			dst = (FILE*)NULL;
+		}
+		else {
+			fclose(dst);
+		}
+	}
+
+	for (i=0; i<count; i++) {
+		free(keys[i]);
+		free(values[i]);
+	}
+	free(keys);
+	free(values);
+	free(slots);
+	free(entries);
+
+	return ((dst==(FILE*)NULL) ? -1 : (int)header.entry_count);
+}
@@ -0,0 +1,45 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/* Definitions: */
+#define DICT_MAGIC		0x4454484dU	/* "MHTD" */
+#define DICT_VERSION	1
+
+
+/* Data structures: */
+
+/*
+	A compiled dictionary file is an open addressed hash with the
+	keys and values stored inline:
+	header | slot_count slots | key\0value\0 key\0value\0 ...
+	All numbers are unsigned ints in the byte order of the machine
+	that built the dictionary, the magic number reveals a mismatch.
+*/
+typedef struct {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int slot_count;	/* A power of 2 */
+	unsigned int entry_count;
+} DICT_HEADER;
+
+typedef struct {
+	unsigned int hash;		/* The hash value of the key */
+	unsigned int offset;	/* The offset of the key in the file, 0 for an empty slot */
+} DICT_SLOT;
+
+typedef struct DICT_PTR dict_ptr;
+typedef struct DICT_PTR {
+	char *fname;		/* The name of the dictionary file */
+	char *data;			/* The mapped dictionary file */
+	size_t size;		/* The size of the dictionary file */
+	DICT_HEADER *header;
+	DICT_SLOT *slots;
+	dict_ptr *next;
+} MHT_DICT;
+
+
+/* Prototypes: */
+MHT_DICT *dict_open( char *fname );
+char *dict_lookup( MHT_DICT *dict, char *key );
+void dict_close( MHT_DICT *dict );
+int dict_build( char *src_fname, char *dict_fname );
+unsigned int dict_hash( char *key );
@@ -0,0 +1,181 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dict.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the compiled macro dictionaries.
+*/
+
+
+char *dict_src = "# comment\ntitle = Hello\n\nempty=\nkey=first\nkey = last\nnot a definition\nurl=a=b\n";
+
+
+/*
+	Read a file written by the test.
+*/
+char *read_file( char *fname, size_t *size ) {
+	char *data = (char*)NULL;
+	FILE *fptr = fopen(fname,"rb");
+
+	(*size) = 0;
+	if (fptr==(FILE*)NULL) {
+		return ((char*)NULL);
+	}
+
+	fseek(fptr,0,SEEK_END);
+	(*size) = (size_t)ftell(fptr);
+	fseek(fptr,0,SEEK_SET);
+
+	data = (char*)_malloc((*size)+1);
+	if (fread(data,1,*size,fptr)!=(*size)) {
+		(*size) = 0;
+	}
+	fclose(fptr);
+
+	return (data);
+}
+
+
+void test_lookup(void) {
+	MHT_DICT *dict = (MHT_DICT*)NULL;
+	char *fname = test_path("strings.dict");
+
+	test_check("build",dict_build(test_file("strings.txt",dict_src,0),fname)==4);
+
+	dict = dict_open(fname);
+	test_check("open",dict!=(MHT_DICT*)NULL);
+	if (dict==(MHT_DICT*)NULL) {
+		return;
+	}
+
+	test_equal("value",dict_lookup(dict,"title"),"Hello");
+	test_equal("empty value",dict_lookup(dict,"empty"),"");
+	test_equal("key defined twice",dict_lookup(dict,"key"),"last");
+	test_equal("value with '='",dict_lookup(dict,"url"),"a=b");
+	test_check("missing key",dict_lookup(dict,"nope")==(char*)NULL);
+	test_check("comment",dict_lookup(dict,"# comment")==(char*)NULL);
+
+	dict_close(dict);
+	test_check("missing file",dict_open("/nonexistent/none.dict")==(MHT_DICT*)NULL);
+	test_check("missing source",dict_build("/nonexistent/none.txt",fname)==-1);
+}
+
+
+void test_corrupt(void) {
+	char
+		*data = (char*)NULL,
+		*fname = test_path("strings.dict"),
+		*corrupt = (char*)NULL;
+	size_t
+		size = 0,
+		len = 0;
+	unsigned int
+		slot = 0,
+		refused = 1;
+	DICT_HEADER *header = (DICT_HEADER*)NULL;
+	DICT_SLOT *slots = (DICT_SLOT*)NULL;
+	MHT_DICT *dict = (MHT_DICT*)NULL;
+
+
+	dict_build(test_file("strings.txt",dict_src,0),fname);
+	if ((data=read_file(fname,&size))==(char*)NULL || size==0) {
+		test_check("read the dictionary",0);
+		return;
+	}
+
+	/* Each truncated file is refused */
+	for (len=1; len<size; len++) {
+		corrupt = test_file("corrupt.dict",data,len);
+		if ((dict=dict_open(corrupt))!=(MHT_DICT*)NULL) {
+			refused = 0;
+			dict_close(dict);
+		}
+	}
+	test_check("truncated files",refused);
+
+	header = (DICT_HEADER*)data;
+	slots = (DICT_SLOT*)(data+sizeof(DICT_HEADER));
+	for (slot=0; slots[slot].offset==0; slot++);
+
+	slots[slot].offset = (unsigned int)size;
+	test_check("offset beyond the end",dict_open(test_file("corrupt.dict",data,size))==(MHT_DICT*)NULL);
+
+	slots[slot].offset = 4;
+	test_check("offset into the header",dict_open(test_file("corrupt.dict",data,size))==(MHT_DICT*)NULL);
+
+	slots[slot].offset = (unsigned int)size-1;
+	test_check("entry without a value",dict_open(test_file("corrupt.dict",data,size))==(MHT_DICT*)NULL);
+
+	header->slot_count = 0x40000000U;
+	test_check("too many slots",dict_open(test_file("corrupt.dict",data,size))==(MHT_DICT*)NULL);
+
+	header->slot_count = 3;
+	test_check("slot count not a power of 2",dict_open(test_file("corrupt.dict",data,size))==(MHT_DICT*)NULL);
+
+	header->magic = 0;
+	test_check("magic number",dict_open(test_file("corrupt.dict",data,size))==(MHT_DICT*)NULL);
+
+	free(data);
+}
+
+
+void test_full(void) {
+	char
+		*data = (char*)NULL,
+		*src = (char*)NULL,
+		*fname = test_path("full.dict");
+	size_t size = 0;
+	unsigned int
+		i = 0,
+		slot = 0;
+	DICT_HEADER *header = (DICT_HEADER*)NULL;
+	DICT_SLOT *slots = (DICT_SLOT*)NULL;
+
+	/* A table without an empty slot would never end a lookup of a missing key */
+	src = (char*)_malloc(16*16);
+	src[0] = '\0';
+	for (i=0; i<8; i++) {
+		sprintf(src+strlen(src),"k%u=v\n",i);
+	}
+	dict_build(test_file("full.txt",src,0),fname);
+	free(src);
+
+	if ((data=read_file(fname,&size))==(char*)NULL || size==0) {
+		test_check("read the dictionary",0);
+		return;
+	}
+
+	header = (DICT_HEADER*)data;
+	slots = (DICT_SLOT*)(data+sizeof(DICT_HEADER));
+	for (slot=0,i=0; slot<header->slot_count; slot++) {
+		if (slots[slot].offset!=0) {
+			i = slots[slot].offset;
+		}
+	}
+	for (slot=0; slot<header->slot_count; slot++) {
+		if (slots[slot].offset==0) {
+			slots[slot].offset = i;
+		}
+	}
+	header->entry_count = header->slot_count;
+
+	test_check("table without an empty slot",dict_open(test_file("full.dict",data,size))==(MHT_DICT*)NULL);
+	free(data);
+}
+
+
+int main( int argc, char **argv ) {
+	test_lookup();
+	test_corrupt();
+	test_full();
+
+	return (test_result("dict_test"));
+}
@@ -0,0 +1,213 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mht.h"
+#include "cgi.h"
+
+
+/*
+	The requests per second of a small page, served by a FastCGI
+	responder over one kept connection, and by mht2html started for
+	each request as a CGI would be, see "make bench".
+
+		fcgi_bench [requests]
+*/
+
+
+char *bench_page =
+	"#def name World\n"
+	"#begin page\n"
+	"Content-type: text/html\n"
+	"\n"
+	"<html><head><title>Hello</title></head><body>\n"
+	"<h1>Hello <#name></h1>\n"
+	"#loop item|i|1|10\n"
+	"</body></html>\n"
+	"#end page\n"
+	"#begin item\n"
+	"<p>Item <#i></p>\n"
+	"#end item\n";
+
+
+double bench_now(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv,(struct timezone*)NULL);
+	return (tv.tv_sec+tv.tv_usec/1e6);
+}
+
+
+/*
+	The responder: the blocks are read once, each request renders
+	the page.
+*/
+void bench_responder( char *sock_path, char *fname ) {
+	mht_init();
+	mht_quickopen(stdout,fname);
+
+	if (cgi_fcgi_listen(sock_path)==0) {
+		_exit(1);
+	}
+
+	while (cgi_fcgi_accept()==1) {
+		if (cgi_init()==1) {
+			mht_process(stdout,"page");
+		}
+	}
+
+	_exit(0);
+}
+
+
+void bench_record( unsigned char *buf, size_t *len, int type, char *content, size_t content_len ) {
+	unsigned char *rec = buf+*len;
+
+	memset(rec,0,8);
+	rec[0] = 1;
+	rec[1] = (unsigned char)type;
+	rec[3] = 1;
+	rec[4] = (unsigned char)(content_len>>8);
+	rec[5] = (unsigned char)content_len;
+	memcpy(rec+8,content,content_len);
+
+	*len += 8+content_len;
+}
+
+
+/*
+	Send requests over one connection, each waits for its response.
+	Returns the requests per second.
+*/
+double bench_fcgi( char *sock_path, unsigned int requests ) {
+	struct sockaddr_un addr;
+	unsigned char
+		request[256],
+		buf[65536];
+
+	size_t len = 0;
+	ssize_t n = 0;
+	double start = 0;
+	unsigned int i = 0;
+	int
+		fd = socket(AF_UNIX,SOCK_STREAM,0),
+		ended = 0;
+
+
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,sock_path);
+	for (i=0; i<100 && connect(fd,(struct sockaddr*)&addr,sizeof(addr))!=0; i++) {
+		usleep(20000);
+	}
+
+	/* BEGIN_REQUEST (responder, keep the connection), the params and an empty input */
+	bench_record(request,&len,1,"\000\001\001\000\000\000\000\000",8);
+	bench_record(request,&len,4,"\016\003REQUEST_METHODGET",19);
+	bench_record(request,&len,4,"",0);
+	bench_record(request,&len,5,"",0);
+
+	start = bench_now();
+	for (i=0; i<requests; i++) {
+		write(fd,request,len);
+
+		/* The END_REQUEST record is the last one of a response */
+		for (ended=0; ended==0 && (n=read(fd,buf,sizeof(buf)))>0; ) {
+			ended = (n>=16 && buf[n-16+1]==3) ? 1 : 0;
+		}
+		if (n<=0) {
+			break;
+		}
+	}
+
+	close(fd);
+	return (i/(bench_now()-start));
+}
+
+
+/*
+	Start mht2html for each request. Returns the requests per second.
+*/
+double bench_cgi( char *fname, unsigned int requests ) {
+	double start = 0;
+	unsigned int i = 0;
+	pid_t pid = 0;
+
+
+	/* The children would write the buffered output again */
+	fflush(stdout);
+
+	start = bench_now();
+	for (i=0; i<requests; i++) {
+		if ((pid=fork())==0) {
+			freopen("/dev/null","w",stdout);
+			execl("./mht2html","mht2html","-p",fname,(char*)NULL);
+			_exit(1);
+		}
+		waitpid(pid,(int*)NULL,0);
+	}
+
+	return (requests/(bench_now()-start));
+}
+
+
+int main( int argc, char **argv ) {
+	FILE *fptr = (FILE*)NULL;
+	char
+		fname[64],
+		cgi_fname[64],
+		sock_path[64];
+
+	unsigned int requests = (argc>1) ? (unsigned int)atoi(argv[1]) : 10000;
+	pid_t pid = 0;
+
+
+	sprintf(fname,"/tmp/fcgi_bench.%ld.mht",(long)getpid());
+	sprintf(cgi_fname,"/tmp/fcgi_bench.%ld.cgi.mht",(long)getpid());
+	sprintf(sock_path,"/tmp/fcgi_bench.%ld.sock",(long)getpid());
+
+	if ((fptr=fopen(fname,"w"))==(FILE*)NULL) {
+		return (1);
+	}
+	fputs(bench_page,fptr);
+	fclose(fptr);
+
+	fptr = fopen(cgi_fname,"w");
+	fprintf(fptr,"%s#process page\n",bench_page);
+	fclose(fptr);
+
+	if (requests==0) {
+		requests = 1;
+	}
+
+	fflush(stdout);
+	if ((pid=fork())==0) {
+		bench_responder(sock_path,fname);
+	}
+
+	printf("%u requests of a small page\n",requests);
+	printf("  FastCGI, 1 connection  %8.0f req/s\n",bench_fcgi(sock_path,requests));
+	printf("  mht2html per request   %8.0f req/s\n",bench_cgi(cgi_fname,(requests/20>0) ? requests/20 : 1));
+
+	kill(pid,SIGTERM);
+	waitpid(pid,(int*)NULL,0);
+
+	remove(fname);
+	remove(cgi_fname);
+	remove(sock_path);
+
+	return (0);
+}
@@ -0,0 +1,363 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mht.h"
+#include "cgi.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the FastCGI responder: a child process serves the
+	requests on a Unix socket, the test is the web server.
+*/
+
+
+#define FCGI_BEGIN_REQUEST		1
+#define FCGI_ABORT_REQUEST		2
+#define FCGI_END_REQUEST		3
+#define FCGI_PARAMS				4
+#define FCGI_STDIN				5
+#define FCGI_STDOUT				6
+#define FCGI_GET_VALUES			9
+#define FCGI_GET_VALUES_RESULT	10
+
+
+/*
+	The responder: the query string and the size of the input.
+*/
+void responder( char *path ) {
+	char buf[4096];
+	size_t
+		len = 0,
+		total = 0;
+
+	mht_init();
+	if (cgi_fcgi_listen(path)==0) {
+		_exit(1);
+	}
+
+	while (cgi_fcgi_accept()==1) {
+		for (total=0; (len=fread(buf,1,sizeof(buf),stdin))>0; total+=len);
+		printf("Content-type: text/plain\n\nquery=%s input=%lu\n",(getenv("QUERY_STRING")!=(char*)NULL) ? getenv("QUERY_STRING") : "",(unsigned long)total);
+	}
+
+	_exit(0);
+}
+
+
+/*
+	A responder reading the requests with cgi_init: the value of a.
+*/
+void init_responder( char *path ) {
+	char *value = (char*)NULL;
+
+	mht_init();
+	if (cgi_fcgi_listen(path)==0) {
+		_exit(1);
+	}
+
+	while (cgi_fcgi_accept()==1) {
+		if (cgi_init()==1) {
+			printf("Content-type: text/plain\n\na=%s\n",(mht_search_macro("a",&value)==1) ? value : "");
+		}
+	}
+
+	_exit(0);
+}
+
+
+int client( char *path ) {
+	struct sockaddr_un addr;
+	int
+		fd = socket(AF_UNIX,SOCK_STREAM,0),
+		i = 0;
+
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,path);
+
+	/* The responder may not listen yet */
+	for (i=0; i<100 && connect(fd,(struct sockaddr*)&addr,sizeof(addr))!=0; i++) {
+		usleep(20000);
+	}
+
+	return (fd);
+}
+
+
+void send_record( int fd, int type, int request_id, char *content, size_t len, size_t padding ) {
+	unsigned char header[8];
+	char pad[256];
+
+	header[0] = 1;
+	header[1] = (unsigned char)type;
+	header[2] = (unsigned char)(request_id>>8);
+	header[3] = (unsigned char)request_id;
+	header[4] = (unsigned char)(len>>8);
+	header[5] = (unsigned char)len;
+	header[6] = (unsigned char)padding;
+	header[7] = 0;
+
+	memset(pad,0,sizeof(pad));
+	write(fd,header,8);
+	write(fd,content,len);
+	write(fd,pad,padding);
+}
+
+
+void send_begin( int fd, int request_id, int role, int keep_conn ) {
+	char body[8];
+
+	memset(body,0,sizeof(body));
+	body[1] = (char)role;
+	body[2] = (char)keep_conn;
+	send_record(fd,FCGI_BEGIN_REQUEST,request_id,body,8,0);
+}
+
+
+/*
+	A PARAMS record of one pair, with 1-byte lengths.
+*/
+void send_param( int fd, int request_id, char *name, char *value ) {
+	char buf[256];
+
+	buf[0] = (char)strlen(name);
+	buf[1] = (char)strlen(value);
+	memcpy(buf+2,name,buf[0]);
+	memcpy(buf+2+buf[0],value,buf[1]);
+	send_record(fd,FCGI_PARAMS,request_id,buf,2+buf[0]+buf[1],0);
+}
+
+
+int read_full( int fd, unsigned char *buf, size_t len ) {
+	ssize_t n = 0;
+
+	while (len>0) {
+		if ((n=read(fd,buf,len))<=0) {
+			return (0);
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+
+	return (1);
+}
+
+
+/*
+	Read the records of a response up to the end of the request, or
+	the record of type until. Returns the content of the STDOUT (or
+	GET_VALUES_RESULT) records, NULL if the connection was closed.
+	status is set to the protocol status of END_REQUEST.
+*/
+char *read_response( int fd, int until, int *status ) {
+	unsigned char
+		header[8],
+		content[65536+256];
+
+	char *output = (char*)_calloc(1,1);
+	size_t
+		len = 0,
+		output_len = 0;
+
+
+	while (read_full(fd,header,8)==1) {
+		len = (header[4]<<8)|header[5];
+		if (read_full(fd,content,len+header[6])==0) {
+			break;
+		}
+
+		if (header[1]==FCGI_STDOUT || header[1]==FCGI_GET_VALUES_RESULT) {
+			output = (char*)_realloc(output,output_len+len+1);
+			memcpy(output+output_len,content,len);
+			output_len += len;
+			output[output_len] = '\0';
+		}
+		if (header[1]==FCGI_END_REQUEST) {
+			*status = content[4];
+		}
+		if (header[1]==until) {
+			return (output);
+		}
+	}
+
+	free(output);
+	return ((char*)NULL);
+}
+
+
+void test_requests( char *path ) {
+	char
+		*big = (char*)_malloc(65535),
+		*output = (char*)NULL;
+
+	int
+		fd = client(path),
+		status = -1;
+
+
+	memset(big,'x',65535);
+
+	send_begin(fd,1,1,1);
+	send_param(fd,1,"QUERY_STRING","a=1");
+	send_param(fd,1,"REQUEST_METHOD","GET");
+	send_record(fd,FCGI_PARAMS,1,"",0,0);
+	send_record(fd,FCGI_STDIN,1,"",0,0);
+	output = read_response(fd,FCGI_END_REQUEST,&status);
+	test_contains("request",output,"query=a=1 input=0\n");
+	test_check("request complete",status==0);
+	free(output);
+
+	/* Records of the max. size, with the max. padding */
+	send_begin(fd,2,1,1);
+	send_param(fd,2,"QUERY_STRING","b=2");
+	send_record(fd,FCGI_PARAMS,2,"",0,0);
+	send_record(fd,FCGI_STDIN,2,big,65535,255);
+	send_record(fd,FCGI_STDIN,2,big,65535,255);
+	send_record(fd,FCGI_STDIN,2,"",0,0);
+	output = read_response(fd,FCGI_END_REQUEST,&status);
+	test_contains("records of the max. size",output,"query=b=2 input=131070\n");
+	free(output);
+
+	/* The variables of a request are gone with it */
+	send_begin(fd,3,1,1);
+	send_record(fd,FCGI_PARAMS,3,"",0,0);
+	send_record(fd,FCGI_STDIN,3,"",0,0);
+	output = read_response(fd,FCGI_END_REQUEST,&status);
+	test_contains("next request",output,"query= input=0\n");
+	free(output);
+
+	/* Only the responder role is known */
+	send_begin(fd,4,2,1);
+	output = read_response(fd,FCGI_END_REQUEST,&status);
+	test_check("unknown role",output!=(char*)NULL && status==3);
+	free(output);
+
+	send_record(fd,FCGI_GET_VALUES,0,"\017\000FCGI_MPXS_CONNS",17,0);
+	output = read_response(fd,FCGI_GET_VALUES_RESULT,&status);
+	test_check("get values",output!=(char*)NULL && memcmp(output,"\017\001FCGI_MPXS_CONNS0",18)==0);
+	free(output);
+
+	/* A BEGIN_REQUEST without its body ends the connection */
+	send_record(fd,FCGI_BEGIN_REQUEST,5,"\000\001",2,0);
+	test_check("short BEGIN_REQUEST",read_response(fd,FCGI_END_REQUEST,&status)==(char*)NULL);
+	close(fd);
+
+	fd = client(path);
+	send_begin(fd,1,1,0);
+	send_record(fd,FCGI_PARAMS,1,"",0,0);
+	send_record(fd,FCGI_STDIN,1,"",0,0);
+	output = read_response(fd,FCGI_END_REQUEST,&status);
+	test_contains("request after a broken connection",output,"input=0\n");
+	free(output);
+	close(fd);
+
+	free(big);
+}
+
+
+/*
+	A request of method with the parameters of cgi_init, and a body.
+*/
+char *init_request( int fd, int request_id, char *method, char *content_length, char *body ) {
+	int status = -1;
+
+	send_begin(fd,request_id,1,1);
+	send_param(fd,request_id,"REQUEST_METHOD",method);
+	send_param(fd,request_id,"QUERY_STRING","a=query");
+	if (content_length!=(char*)NULL) {
+		send_param(fd,request_id,"CONTENT_LENGTH",content_length);
+	}
+	send_record(fd,FCGI_PARAMS,request_id,"",0,0);
+	if (body!=(char*)NULL) {
+		send_record(fd,FCGI_STDIN,request_id,body,strlen(body),0);
+	}
+	send_record(fd,FCGI_STDIN,request_id,"",0,0);
+
+	return (read_response(fd,FCGI_END_REQUEST,&status));
+}
+
+
+void test_init( char *path ) {
+	char *output = (char*)NULL;
+	int fd = client(path);
+
+	output = init_request(fd,1,"GET",(char*)NULL,(char*)NULL);
+	test_contains("GET",output,"a=query\n");
+	free(output);
+
+	output = init_request(fd,2,"HEAD",(char*)NULL,(char*)NULL);
+	test_contains("HEAD is read like GET",output,"a=query\n");
+	free(output);
+
+	output = init_request(fd,3,"POST","6","a=form");
+	test_contains("POST",output,"a=form\n");
+	free(output);
+
+	/* Bad requests are answered, the responder goes on */
+	output = init_request(fd,4,"DELETE",(char*)NULL,(char*)NULL);
+	test_contains("unknown method",output,"Status: 405 Method Not Allowed\nAllow: GET, HEAD, POST\n");
+	free(output);
+
+	output = init_request(fd,5,"POST",(char*)NULL,(char*)NULL);
+	test_contains("POST without CONTENT_LENGTH",output,"\n\na=\n");
+	free(output);
+
+	output = init_request(fd,6,"POST","6x","a=form");
+	test_contains("invalid CONTENT_LENGTH",output,"Status: 400 Bad Request\n");
+	free(output);
+
+	output = init_request(fd,7,"POST","4294967296","a=form");
+	test_contains("body shorter than CONTENT_LENGTH",output,"Status: 400 Bad Request\n");
+	free(output);
+
+	output = init_request(fd,8,"GET",(char*)NULL,(char*)NULL);
+	test_contains("request after bad requests",output,"a=query\n");
+	free(output);
+
+	close(fd);
+}
+
+
+int main( int argc, char **argv ) {
+	char
+		*path = test_path("fcgi.sock"),
+		*init_path = test_path("fcgi_init.sock");
+	pid_t
+		pid = 0,
+		init_pid = 0;
+
+
+	signal(SIGPIPE,SIG_IGN);
+
+	if ((pid=fork())==0) {
+		responder(path);
+	}
+	if ((init_pid=fork())==0) {
+		init_responder(init_path);
+	}
+
+	test_requests(path);
+	test_init(init_path);
+
+	kill(pid,SIGTERM);
+	kill(init_pid,SIGTERM);
+	waitpid(pid,(int*)NULL,0);
+	waitpid(init_pid,(int*)NULL,0);
+
+	return (test_result("fcgi_test"));
+}
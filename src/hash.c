@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "hash.h"
 #include "mem.h"
@@ -115,7 +116,7 @@ unsigned int del_hash_item( HASH_ITEM **hashtab, char *key ) {
 		previous = hashtab[hashval];
 
 		while (current!=(HASH_ITEM*)NULL)  {
-			if (strcmp(current->data,key)==0) {
+			if (strcmp(current->key,key)==0) {
 				/* The item that should be deleted is found! */
 				previous->next = current->next;
 
@@ -127,7 +128,7 @@ unsigned int del_hash_item( HASH_ITEM **hashtab, char *key ) {
 					current->data = (void*)NULL;
 				}
 				else if(current->type==ITEM_TYPE_LBUF) {
-					free_lbuf(tmp_item->data);
+					free_lbuf(current->data);
 				}
 
 				free(current);
@@ -181,6 +182,9 @@ HASH_ITEM *add_hash_item( HASH_ITEM **hashtab, char *key, void *data, size_t siz
 		else if(item_type==ITEM_TYPE_LBUF) {
 			item->data = (LINE_BUFFER*)data;
 		}
+		else if(item_type==ITEM_TYPE_PTR) {
+			item->data = data;
+		}
 
 		/* Insert the new item into the hashtab */
 		hashval = hash(key);
@@ -189,6 +193,8 @@ HASH_ITEM *add_hash_item( HASH_ITEM **hashtab, char *key, void *data, size_t siz
 
 		/* Set the type of the item */
 		item->type = item_type;
+		item->flags = 0;
+		item->version = 0;
 	}
 	else {
 		/* The item IS already in the hashtable */
@@ -214,6 +220,12 @@ HASH_ITEM *add_hash_item( HASH_ITEM **hashtab, char *key, void *data, size_t siz
 				item->data = (LINE_BUFFER*)data;
 			}
 		}
+		else if (item_type==ITEM_TYPE_PTR) {
+			item->data = data;
+		}
+
+		item->flags = 0;
+		item->version = 0;
 	}
 
 	return (item);
@@ -275,6 +287,10 @@ void free_lbuf( LINE_BUFFER *lbuf ) {
 
 		free(tmp->content);
 		tmp->content = (char*)NULL;
+		if (tmp->data!=(void*)NULL) {
+			free(tmp->data);
+			tmp->data = (void*)NULL;
+		}
 		tmp->next = (LINE_BUFFER*)NULL;
 		free(tmp);
 		tmp = (LINE_BUFFER*)NULL;
@@ -4,6 +4,14 @@
 #define MAX_HASHSIZE		16384
 #define ITEM_TYPE_STRING	1
 #define ITEM_TYPE_LBUF		2
+#define ITEM_TYPE_PTR		3	/* The data is owned by the caller, it is never freed by the hash */
+#define LINE_TYPE_TEXT		0	/* A text line with macros, it has to be expanded */
+#define LINE_TYPE_STATIC	1	/* A text line without any macros, it can be printed as is */
+#define LINE_TYPE_DIRECTIVE	2	/* A line starting with '#' */
+#define LINE_TYPE_IF		3	/* A #if line, data is the compiled expression */
+#define LINE_TYPE_ELIF		4	/* A #elif line, data is the compiled expression */
+#define LINE_TYPE_FOLDED	5	/* A text line folded into static text, data covers span lines */
+#define LINE_TYPE_PARTIAL	6	/* A text line, data is the line with its stable macros folded in */
 
 
 /* Data structures: */
@@ -13,12 +21,19 @@ typedef struct HASH_PTR {
    char *key;
    void *data;
    unsigned int type;
+   unsigned int flags;	/* Set by the user of the hashtab, reset when the data is replaced */
+   unsigned long version;	/* Set by the user of the hashtab, reset when the data is replaced */
 } HASH_ITEM;
 
 typedef struct LBUF_PTR lbuf_ptr;
 typedef struct LBUF_PTR {
 	char *content;
 	lbuf_ptr *next;
+	unsigned int len;	/* The length of content */
+	unsigned int type;	/* One of the LINE_TYPE_* constants, set when the block is compiled */
+	void *data;		/* The compiled form of the line (one memory block) or NULL */
+	unsigned int span;	/* The number of lines covered by a folded line, 0 otherwise */
+	unsigned long generation;	/* The fold generation the data of a text line belongs to */
 } LINE_BUFFER;
 
 
@@ -0,0 +1,724 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "json.h"
+#include "mem.h"
+#include "str_util.h"
+
+
+#define JSON_NO_CODE		0xffffffffUL	/* Returned by json_hex4 for invalid digits */
+#define JSON_REPLACEMENT	0xfffdUL		/* Replaces invalid \u escapes */
+
+
+/* Prototypes: */
+char *json_skip_ws( char *ptr, char *end );
+char *json_skip_string( char *ptr, char *end );
+char *json_skip_value( char *ptr, char *end );
+JSON_NODE *json_node( JSON_DOC *doc, unsigned long offset );
+unsigned int json_index_member( JSON_DOC *doc, JSON_NODE *node );
+unsigned int json_key_equal( char *raw_key, char *end, char *key, unsigned int key_len );
+void json_value_at( JSON_DOC *doc, unsigned long offset, JSON_VALUE *value );
+unsigned long json_hex4( char *ptr, char *end );
+void json_free( JSON_DOC *doc );
+
+
+/* All documents opened via #jsonsource by the thread */
+MHT_THREAD JSON_DOC *json_docs = (JSON_DOC*)NULL;
+
+
+char *json_skip_ws( char *ptr, char *end ) {
+	while (ptr<end && (*ptr==' ' || *ptr=='\t' || *ptr=='\n' || *ptr=='\r')) {
+		ptr++;
+	}
+	return (ptr);
+}
+
+
+/*
+	Skip a string starting at the opening quote. Returns a pointer
+	behind the closing quote.
+*/
+char *json_skip_string( char *ptr, char *end ) {
+	for (ptr++; (ptr=memscan2(ptr,end,'"','\\'))<end; ) {
+		if (*ptr=='"') {
+			return (ptr+1);
+		}
+		ptr += 2;
+	}
+	return (end);
+}
+
+
+/*
+	Skip a value without looking at it any closer. Inside of objects
+	and arrays, runs of chars that are neither quotes nor brackets
+	are skipped a word at a time.
+*/
+char *json_skip_value( char *ptr, char *end ) {
+	unsigned long
+		word = 0,
+		folded = 0;
+
+	unsigned int
+		depth = 0;
+
+
+	if (ptr>=end) {
+		return (end);
+	}
+
+	if (*ptr=='"') {
+		return (json_skip_string(ptr,end));
+	}
+
+	if (*ptr!='{' && *ptr!='[') {
+		/* number, true, false or null */
+		while (ptr<end && *ptr!=',' && *ptr!='}' && *ptr!=']' && !isspace((unsigned char)*ptr)) {
+			ptr++;
+		}
+		return (ptr);
+	}
+
+	while (ptr<end) {
+		/* '[' | 0x20 is '{', ']' | 0x20 is '}' */
+		while (ptr+sizeof(unsigned long)<=end) {
+			memcpy(&word,ptr,sizeof(unsigned long));
+			folded = word | (WORD_ONES*0x20);
+			if (HASZERO(word^(WORD_ONES*'"')) | HASZERO(folded^(WORD_ONES*'{')) | HASZERO(folded^(WORD_ONES*'}'))) {
+				break;
+			}
+			ptr += sizeof(unsigned long);
+		}
+
+		if (ptr>=end) {
+			break;
+		}
+
+		switch (*ptr) {
+			case '"':
+				ptr = json_skip_string(ptr,end);
+				continue;
+			case '{':
+			case '[':
+				depth++;
+				break;
+			case '}':
+			case ']':
+				if (--depth==0) {
+					return (ptr+1);
+				}
+				break;
+		}
+		ptr++;
+	}
+
+	return (end);
+}
+
+
+/*
+	Return the index of the object or array at offset. The node is
+	created empty, members are added by json_index_member.
+*/
+JSON_NODE *json_node( JSON_DOC *doc, unsigned long offset ) {
+	unsigned int
+		i = 0,
+		slot = 0,
+		old_max = 0;
+
+	JSON_NODE
+		**old_nodes = (JSON_NODE**)NULL,
+		*node = (JSON_NODE*)NULL;
+
+
+	if (doc->node_count*2>=doc->node_max) {
+		old_nodes = doc->nodes;
+		old_max = doc->node_max;
+		doc->node_max = (old_max==0) ? 64 : old_max*2;
+		doc->nodes = (JSON_NODE**)_calloc(doc->node_max,sizeof(JSON_NODE*));
+
+		for (i=0; i<old_max; i++) {
+			if (old_nodes[i]!=(JSON_NODE*)NULL) {
+				for (slot=(unsigned int)(old_nodes[i]->offset*2654435761UL)&(doc->node_max-1); doc->nodes[slot]!=(JSON_NODE*)NULL; slot=(slot+1)&(doc->node_max-1));
+				doc->nodes[slot] = old_nodes[i];
+			}
+		}
+		free(old_nodes);
+	}
+
+	for (slot=(unsigned int)(offset*2654435761UL)&(doc->node_max-1); (node=doc->nodes[slot])!=(JSON_NODE*)NULL; slot=(slot+1)&(doc->node_max-1)) {
+		if (node->offset==offset) {
+			return (node);
+		}
+	}
+
+	node = (JSON_NODE*)_calloc(1,sizeof(JSON_NODE));
+	node->offset = offset;
+	node->scan_pos = offset+1;
+	doc->nodes[slot] = node;
+	doc->node_count++;
+
+	return (node);
+}
+
+
+/*
+	Index the next member of an object or the next item of an array.
+	Returns 0 if all members are indexed.
+*/
+unsigned int json_index_member( JSON_DOC *doc, JSON_NODE *node ) {
+	char
+		*end = doc->data+doc->size,
+		*ptr = (char*)NULL,
+		*key = (char*)NULL;
+
+	unsigned int
+		is_object = (doc->data[node->offset]=='{');
+
+
+	if (node->complete) {
+		return (0);
+	}
+
+	ptr = json_skip_ws(doc->data+node->scan_pos,end);
+
+	if (ptr>=end || *ptr=='}' || *ptr==']') {
+		node->complete = 1;
+		return (0);
+	}
+
+	if (is_object) {
+		if (*ptr!='"') {
+			node->complete = 1;
+			return (0);
+		}
+		key = ptr;
+		ptr = json_skip_ws(json_skip_string(ptr,end),end);
+		if (ptr>=end || *ptr!=':') {
+			node->complete = 1;
+			return (0);
+		}
+		ptr = json_skip_ws(ptr+1,end);
+	}
+
+	/* A truncated document */
+	if (ptr>=end) {
+		node->complete = 1;
+		return (0);
+	}
+
+	if (node->count>=node->max) {
+		node->max = (node->max==0) ? 8 : node->max*2;
+		node->values = (unsigned long*)realloc(node->values,node->max*sizeof(unsigned long));
+		node->keys = (unsigned long*)realloc(node->keys,node->max*sizeof(unsigned long));
+		if (node->values==(unsigned long*)NULL || node->keys==(unsigned long*)NULL) {
+			fprintf(stdout,"FATA ERROR: cannot allocate new memory!");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	node->keys[node->count] = is_object ? (unsigned long)(key-doc->data) : 0;
+	node->values[node->count] = ptr-doc->data;
+	node->count++;
+
+	ptr = json_skip_ws(json_skip_value(ptr,end),end);
+	if (ptr<end && *ptr==',') {
+		ptr++;
+	}
+	node->scan_pos = ptr-doc->data;
+
+	return (1);
+}
+
+
+/*
+	Compare a key in the document (starting at the quote) with a
+	key of a path.
+*/
+unsigned int json_key_equal( char *raw_key, char *end, char *key, unsigned int key_len ) {
+	char
+		decoded[1024];
+
+	JSON_VALUE
+		value;
+
+
+	raw_key++;
+	if (raw_key+key_len<end && memcmp(raw_key,key,key_len)==0 && raw_key[key_len]=='"') {
+		return (1);
+	}
+
+	/* Maybe the key contains escapes */
+	if (memchr(raw_key,'\\',(size_t)(json_skip_string(raw_key-1,end)-raw_key))==(void*)NULL || key_len>=sizeof(decoded)) {
+		return (0);
+	}
+
+	value.type = JSON_STRING;
+	value.doc_end = end;
+	value.ptr = raw_key-1;
+	value.len = json_skip_string(raw_key-1,end)-(raw_key-1);
+	json_to_str(&value,decoded,sizeof(decoded));
+
+	return (strlen(decoded)==key_len && memcmp(decoded,key,key_len)==0);
+}
+
+
+/*
+	Get type and extent of the value at offset. The extent of objects
+	and arrays is not determined here, they are indexed lazily.
+*/
+void json_value_at( JSON_DOC *doc, unsigned long offset, JSON_VALUE *value ) {
+	char
+		*ptr = doc->data+offset,
+		*end = doc->data+doc->size;
+
+
+	value->ptr = ptr;
+	value->doc_end = end;
+	value->len = 0;
+
+	if (ptr>=end) {
+		value->type = JSON_NONE;
+		return;
+	}
+
+	switch (*ptr) {
+		case '"':
+			value->type = JSON_STRING;
+			value->len = json_skip_string(ptr,end)-ptr;
+			break;
+		case '{':
+			value->type = JSON_OBJECT;
+			break;
+		case '[':
+			value->type = JSON_ARRAY;
+			break;
+		case 't':
+			value->type = JSON_TRUE;
+			break;
+		case 'f':
+			value->type = JSON_FALSE;
+			break;
+		case 'n':
+			value->type = JSON_NULL;
+			break;
+		default:
+			value->type = JSON_NUMBER;
+			break;
+	}
+
+	/* Scalars end at the next delimiter, a truncated literal is not read beyond the end */
+	if (value->type!=JSON_OBJECT && value->type!=JSON_ARRAY) {
+		value->len = json_skip_value(ptr,end)-ptr;
+	}
+}
+
+
+/*
+	Open a JSON file as the document "name". The file is only mapped,
+	nothing is parsed before the first lookup. If the name is opened
+	again while the document is iterated, the old document is kept
+	until json_release.
+*/
+JSON_DOC *json_open( char *name, char *fname ) {
+	JSON_DOC
+		*doc = (JSON_DOC*)NULL,
+		**prev = (JSON_DOC**)NULL;
+
+	struct stat st;
+
+
+	if (name==(char*)NULL || fname==(char*)NULL || stat(fname,&st)!=0) {
+		return ((JSON_DOC*)NULL);
+	}
+
+	for (prev=&json_docs; (doc=*prev)!=(JSON_DOC*)NULL; prev=&doc->next) {
+		if (strcmp(doc->name,name)==0) {
+			if (strcmp(doc->fname,fname)==0 && doc->size==(size_t)st.st_size && doc->mtime==st.st_mtime) {
+				return (doc);
+			}
+
+			*prev = doc->next;
+			if (doc->users>0) {
+				doc->stale = 1;
+			}
+			else {
+				json_free(doc);
+			}
+			break;
+		}
+	}
+
+	doc = (JSON_DOC*)_calloc(1,sizeof(JSON_DOC));
+	doc->data = (char*)map_file(fname,&doc->size,&doc->mtime);
+
+	if (doc->data==(char*)NULL) {
+		free(doc);
+		return ((JSON_DOC*)NULL);
+	}
+
+	doc->name = strdup(name);
+	doc->fname = strdup(fname);
+	doc->next = json_docs;
+	json_docs = doc;
+
+	return (doc);
+}
+
+
+/*
+	Return the document registered as "name", or NULL.
+*/
+JSON_DOC *json_find( char *name ) {
+	JSON_DOC *doc = (JSON_DOC*)NULL;
+
+	for (doc=json_docs; doc!=(JSON_DOC*)NULL; doc=doc->next) {
+		if (strcmp(doc->name,name)==0) {
+			return (doc);
+		}
+	}
+
+	return ((JSON_DOC*)NULL);
+}
+
+
+/*
+	Keep a document while it is iterated, see json_open.
+*/
+void json_retain( JSON_DOC *doc ) {
+	doc->users++;
+}
+
+
+void json_release( JSON_DOC *doc ) {
+	if (doc->users>0) {
+		doc->users--;
+	}
+
+	if (doc->users==0 && doc->stale==1) {
+		json_free(doc);
+	}
+}
+
+
+/*
+	Look up a value by a path like "a.b[3].c". An empty path is the
+	root value. Returns 1 if the value exists, 0 otherwise. Only the
+	containers along the path are indexed, and only as far as needed.
+*/
+int json_lookup( JSON_DOC *doc, char *path, JSON_VALUE *value ) {
+	char
+		*end = (char*)NULL,
+		*key = (char*)NULL,
+		*ptr = (char*)NULL;
+
+	unsigned int
+		key_len = 0,
+		index = 0,
+		i = 0;
+
+	JSON_NODE
+		*node = (JSON_NODE*)NULL;
+
+
+	if (doc==(JSON_DOC*)NULL) {
+		return (0);
+	}
+
+	end = doc->data+doc->size;
+	ptr = json_skip_ws(doc->data,end);
+
+	if (ptr>=end) {
+		return (0);
+	}
+
+	json_value_at(doc,ptr-doc->data,value);
+
+	while (path!=(char*)NULL && *path!='\0') {
+		if (*path=='.') {
+			path++;
+			continue;
+		}
+
+		if (*path=='[') {
+			/* An array item */
+			if (value->type!=JSON_ARRAY) {
+				return (0);
+			}
+
+			index = (unsigned int)strtoul(path+1,&path,10);
+			if (*path!=']') {
+				return (0);
+			}
+			path++;
+
+			if (json_item(doc,value,index,value)==0) {
+				return (0);
+			}
+			continue;
+		}
+
+		/* An object member */
+		if (value->type!=JSON_OBJECT) {
+			return (0);
+		}
+
+		key = path;
+		key_len = strcspn(path,".[");
+		path += key_len;
+
+		node = json_node(doc,value->ptr-doc->data);
+
+		for (i=0; ; i++) {
+			if (i>=node->count && json_index_member(doc,node)==0) {
+				return (0);
+			}
+
+			if (json_key_equal(doc->data+node->keys[i],end,key,key_len)) {
+				json_value_at(doc,node->values[i],value);
+				break;
+			}
+		}
+	}
+
+	return (1);
+}
+
+
+/*
+	Get the index-th item (starting with 0) of an array or the
+	value of the index-th member of an object.
+*/
+int json_item( JSON_DOC *doc, JSON_VALUE *container, unsigned int index, JSON_VALUE *item ) {
+	JSON_NODE *node = (JSON_NODE*)NULL;
+
+	if (container->type!=JSON_ARRAY && container->type!=JSON_OBJECT) {
+		return (0);
+	}
+
+	node = json_node(doc,container->ptr-doc->data);
+
+	while (index>=node->count) {
+		if (json_index_member(doc,node)==0) {
+			return (0);
+		}
+	}
+
+	json_value_at(doc,node->values[index],item);
+	return (1);
+}
+
+
+/*
+	Return the number of items of an array or members of an object.
+*/
+unsigned int json_length( JSON_DOC *doc, JSON_VALUE *container ) {
+	JSON_NODE *node = (JSON_NODE*)NULL;
+
+	if (container->type!=JSON_ARRAY && container->type!=JSON_OBJECT) {
+		return (0);
+	}
+
+	node = json_node(doc,container->ptr-doc->data);
+	while (json_index_member(doc,node)==1);
+
+	return (node->count);
+}
+
+
+/*
+	Read the four hex digits of a \u escape at ptr. Returns
+	JSON_NO_CODE if there are less than four hex digits before end.
+*/
+unsigned long json_hex4( char *ptr, char *end ) {
+	char hex[5];
+	int i = 0;
+
+	if (end-ptr<4) {
+		return (JSON_NO_CODE);
+	}
+
+	for (i=0; i<4; i++) {
+		if (!isxdigit((unsigned char)ptr[i])) {
+			return (JSON_NO_CODE);
+		}
+		hex[i] = ptr[i];
+	}
+	hex[4] = '\0';
+
+	return (strtoul(hex,(char**)NULL,16));
+}
+
+
+/*
+	Copy a value as text into buf: strings are unescaped, null is
+	an empty string, everything else is copied as is. A \u escape
+	of U+0000, a lone surrogate or an escape without four hex digits
+	is replaced by U+FFFD.
+*/
+char *json_to_str( JSON_VALUE *value, char *buf, size_t size ) {
+	char
+		*ptr = value->ptr,
+		*end = (char*)NULL,
+		*out = buf,
+		*out_end = buf+size-1,
+		*run = (char*)NULL;
+
+	unsigned long
+		code = 0,
+		low = 0;
+
+
+	if (value->type==JSON_OBJECT || value->type==JSON_ARRAY) {
+		/* The extent of containers is determined only when really needed */
+		value->len = json_skip_value(ptr,value->doc_end)-ptr;
+	}
+
+	if (value->type==JSON_NULL || value->type==JSON_NONE) {
+		*buf = '\0';
+		return (buf);
+	}
+
+	if (value->type!=JSON_STRING) {
+		if (value->len>(unsigned long)(size-1)) {
+			memcpy(buf,ptr,size-1);
+			buf[size-1] = '\0';
+		}
+		else {
+			memcpy(buf,ptr,value->len);
+			buf[value->len] = '\0';
+		}
+		return (buf);
+	}
+
+	end = ptr+value->len-1;
+
+	for (ptr++; ptr<end && out<out_end; ) {
+		/* Copy the run up to the next escape at once */
+		run = memchr(ptr,'\\',end-ptr);
+		if (run==(char*)NULL) {
+			run = end;
+		}
+		if (run-ptr>out_end-out) {
+			run = ptr+(out_end-out);
+		}
+
+		memcpy(out,ptr,run-ptr);
+		out += run-ptr;
+		ptr = run;
+
+		if (ptr+1>=end || out>=out_end) {
+			break;
+		}
+
+		switch (ptr[1]) {
+			case 'b': *out++ = '\b'; break;
+			case 'f': *out++ = '\f'; break;
+			case 'n': *out++ = '\n'; break;
+			case 'r': *out++ = '\r'; break;
+			case 't': *out++ = '\t'; break;
+			case 'u':
+				/* Without four hex digits only the "\u" is replaced */
+				if ((code=json_hex4(ptr+2,end))==JSON_NO_CODE) {
+					code = JSON_REPLACEMENT;
+				}
+				else {
+					ptr += 4;
+
+					/* A surrogate pair, a lone surrogate has no code point */
+					if (code>=0xd800 && code<0xdc00) {
+						low = (ptr+8<=end && ptr[2]=='\\' && ptr[3]=='u') ? json_hex4(ptr+4,end) : JSON_NO_CODE;
+						if (low>=0xdc00 && low<0xe000) {
+							code = 0x10000+((code-0xd800)<<10)+(low-0xdc00);
+							ptr += 6;
+						}
+						else {
+							code = JSON_REPLACEMENT;
+						}
+					}
+					else if ((code>=0xdc00 && code<0xe000) || code==0) {
+						code = JSON_REPLACEMENT;
+					}
+				}
+
+				/* Encode the code point as UTF-8 */
+				if (code<0x80) {
+					*out++ = (char)code;
+				}
+				else if (code<0x800 && out+2<=out_end) {
+					*out++ = (char)(0xc0|(code>>6));
+					*out++ = (char)(0x80|(code&0x3f));
+				}
+				else if (code<0x10000 && out+3<=out_end) {
+					*out++ = (char)(0xe0|(code>>12));
+					*out++ = (char)(0x80|((code>>6)&0x3f));
+					*out++ = (char)(0x80|(code&0x3f));
+				}
+				else if (out+4<=out_end) {
+					*out++ = (char)(0xf0|(code>>18));
+					*out++ = (char)(0x80|((code>>12)&0x3f));
+					*out++ = (char)(0x80|((code>>6)&0x3f));
+					*out++ = (char)(0x80|(code&0x3f));
+				}
+				break;
+			default:
+				*out++ = ptr[1];
+				break;
+		}
+		ptr += 2;
+	}
+
+	*out = '\0';
+	return (buf);
+}
+
+
+void json_free( JSON_DOC *doc ) {
+	unsigned int i = 0;
+
+	for (i=0; i<doc->node_max; i++) {
+		if (doc->nodes[i]!=(JSON_NODE*)NULL) {
+			free(doc->nodes[i]->keys);
+			free(doc->nodes[i]->values);
+			free(doc->nodes[i]);
+		}
+	}
+
+	unmap_file(doc->data,doc->size);
+	free(doc->nodes);
+	free(doc->name);
+	free(doc->fname);
+	free(doc);
+}
+
+
+/*
+	Unmap all documents.
+*/
+void json_close_all(void) {
+	JSON_DOC *doc = (JSON_DOC*)NULL;
+
+	while ((doc=json_docs)!=(JSON_DOC*)NULL) {
+		json_docs = doc->next;
+		json_free(doc);
+	}
+}
+
+
+/*
+	Make a list of documents the one of the thread, returns the
+	previous list. A render keeps a list of its own, see render.c.
+*/
+JSON_DOC *json_switch( JSON_DOC *docs ) {
+	JSON_DOC *prev = json_docs;
+
+	json_docs = docs;
+	return (prev);
+}
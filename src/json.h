@@ -0,0 +1,63 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/* Definitions: */
+#define JSON_NONE		0
+#define JSON_STRING		1
+#define JSON_NUMBER		2
+#define JSON_OBJECT		3
+#define JSON_ARRAY		4
+#define JSON_TRUE		5
+#define JSON_FALSE		6
+#define JSON_NULL		7
+
+
+/* Data structures: */
+
+/*
+	The members of an object or the items of an array. Containers
+	are indexed lazily: only as far as a lookup had to scan them.
+*/
+typedef struct {
+	unsigned long offset;	/* The offset of the '{' or '[' */
+	unsigned long scan_pos;	/* The offset where the next member starts */
+	unsigned int complete;	/* 1 if all members are indexed */
+	unsigned int count;		/* The number of members indexed so far */
+	unsigned int max;		/* The number of allocated members */
+	unsigned long *keys;	/* The offsets of the keys (objects only) */
+	unsigned long *values;	/* The offsets of the values */
+} JSON_NODE;
+
+typedef struct JSON_PTR json_ptr;
+typedef struct JSON_PTR {
+	char *name;			/* The name given in #jsonsource */
+	char *fname;		/* The name of the JSON file */
+	char *data;			/* The mapped JSON file */
+	size_t size;		/* The size of the JSON file */
+	time_t mtime;		/* The modification time of the JSON file */
+	JSON_NODE **nodes;	/* Hash of all indexed containers, by offset */
+	unsigned int node_count;
+	unsigned int node_max;
+	unsigned int users;	/* The number of #foreach directives iterating over the document */
+	unsigned int stale;	/* 1 if the name was opened again while the document was iterated */
+	json_ptr *next;
+} JSON_DOC;
+
+typedef struct {
+	unsigned int type;	/* One of the JSON_* constants */
+	char *ptr;			/* The first char of the value */
+	unsigned long len;	/* The length of the value in the document, 0 for objects and arrays until needed */
+	char *doc_end;		/* The end of the document */
+} JSON_VALUE;
+
+
+/* Prototypes: */
+JSON_DOC *json_open( char *name, char *fname );
+JSON_DOC *json_find( char *name );
+void json_retain( JSON_DOC *doc );
+void json_release( JSON_DOC *doc );
+int json_lookup( JSON_DOC *doc, char *path, JSON_VALUE *value );
+int json_item( JSON_DOC *doc, JSON_VALUE *container, unsigned int index, JSON_VALUE *item );
+unsigned int json_length( JSON_DOC *doc, JSON_VALUE *container );
+char *json_to_str( JSON_VALUE *value, char *buf, size_t size );
+void json_close_all(void);
+JSON_DOC *json_switch( JSON_DOC *docs );
@@ -0,0 +1,195 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "json.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the JSON reader.
+*/
+
+
+char *doc_text = "{\"a\": [1, true, \"x\\\"y\", {\"b\": null}], \"c\": \"\\u00e9\\n\", \"d\\u0065\": -2.5e3}";
+
+
+/*
+	A document in a heap block of its exact size, so that reading
+	beyond its end is noticed by a memory checker.
+*/
+JSON_DOC *doc_new( char *data, size_t size ) {
+	JSON_DOC *doc = (JSON_DOC*)_calloc(1,sizeof(JSON_DOC));
+
+	doc->data = (char*)memdup(data,size);
+	doc->size = size;
+	return (doc);
+}
+
+
+void doc_free( JSON_DOC *doc ) {
+	unsigned int i = 0;
+
+	for (i=0; i<doc->node_max; i++) {
+		if (doc->nodes[i]!=(JSON_NODE*)NULL) {
+			free(doc->nodes[i]->keys);
+			free(doc->nodes[i]->values);
+			free(doc->nodes[i]);
+		}
+	}
+
+	free(doc->nodes);
+	free(doc->data);
+	free(doc);
+}
+
+
+char *lookup( JSON_DOC *doc, char *path ) {
+	static char buf[256];
+	JSON_VALUE value;
+
+	if (json_lookup(doc,path,&value)==0) {
+		return ("(none)");
+	}
+	return (json_to_str(&value,buf,sizeof(buf)));
+}
+
+
+void test_lookup(void) {
+	JSON_DOC *doc = doc_new(doc_text,strlen(doc_text));
+	JSON_VALUE value;
+
+	test_equal("number",lookup(doc,"a[0]"),"1");
+	test_equal("true",lookup(doc,"a[1]"),"true");
+	test_equal("escaped quote",lookup(doc,"a[2]"),"x\"y");
+	test_equal("null",lookup(doc,"a[3].b"),"");
+	test_equal("unicode escape",lookup(doc,"c"),"\xc3\xa9\n");
+	test_equal("escaped key",lookup(doc,"de"),"-2.5e3");
+	test_equal("missing member",lookup(doc,"x"),"(none)");
+	test_equal("missing item",lookup(doc,"a[4]"),"(none)");
+	test_equal("member of an array",lookup(doc,"a.b"),"(none)");
+	test_equal("object",lookup(doc,"a[3]"),"{\"b\": null}");
+
+	json_lookup(doc,"a",&value);
+	test_check("array length",json_length(doc,&value)==4);
+	json_lookup(doc,"",&value);
+	test_check("object length",json_length(doc,&value)==3);
+
+	doc_free(doc);
+}
+
+
+void test_escapes(void) {
+	char *text =
+		"{\"nul\": \"a\\u0000b\", \"hex\": \"a\\uzz41b\", \"short\": \"a\\u41\", "
+		"\"pair\": \"\\ud83d\\ude00\", \"high\": \"a\\ud83db\", \"low\": \"a\\ude00b\", "
+		"\"two\": \"\\ud83d\\ud83d\\ude00\"}";
+	JSON_DOC *doc = doc_new(text,strlen(text));
+
+	/* Invalid escapes are replaced by U+FFFD, never by a NUL */
+	test_equal("escaped NUL",lookup(doc,"nul"),"a\xef\xbf\xbd" "b");
+	test_equal("non-hex escape",lookup(doc,"hex"),"a\xef\xbf\xbdzz41b");
+	test_equal("short escape",lookup(doc,"short"),"a\xef\xbf\xbd" "41");
+	test_equal("surrogate pair",lookup(doc,"pair"),"\xf0\x9f\x98\x80");
+	test_equal("lone high surrogate",lookup(doc,"high"),"a\xef\xbf\xbd" "b");
+	test_equal("lone low surrogate",lookup(doc,"low"),"a\xef\xbf\xbd" "b");
+	test_equal("high surrogate before a pair",lookup(doc,"two"),"\xef\xbf\xbd\xf0\x9f\x98\x80");
+
+	doc_free(doc);
+}
+
+
+void test_truncated(void) {
+	JSON_DOC *doc = (JSON_DOC*)NULL;
+	JSON_VALUE
+		value,
+		item;
+	char buf[256];
+	size_t len = 0;
+	unsigned int
+		i = 0,
+		count = 0,
+		ok = 1;
+	char *paths[] = { "", "a", "a[3].b", "c", "de", "x" };
+
+	/* Each prefix of the document is read without reading beyond its end */
+	for (len=1; len<strlen(doc_text); len++) {
+		doc = doc_new(doc_text,len);
+
+		for (i=0; i<sizeof(paths)/sizeof(char*); i++) {
+			if (json_lookup(doc,paths[i],&value)==1) {
+				json_to_str(&value,buf,sizeof(buf));
+			}
+		}
+
+		if (json_lookup(doc,"a",&value)==1) {
+			count = json_length(doc,&value);
+			for (i=0; i<count; i++) {
+				if (json_item(doc,&value,i,&item)==0) {
+					ok = 0;
+				}
+				json_to_str(&item,buf,sizeof(buf));
+			}
+		}
+
+		doc_free(doc);
+	}
+
+	test_check("truncated documents",ok);
+
+	doc = doc_new("{\"a\":",5);
+	test_equal("member without a value",lookup(doc,"a"),"(none)");
+	doc_free(doc);
+
+	doc = doc_new("[tr",3);
+	test_equal("truncated literal",lookup(doc,"[0]"),"tr");
+	doc_free(doc);
+
+	doc = doc_new("[\"ab\\",5);
+	test_equal("truncated escape",lookup(doc,"[0]"),"ab");
+	doc_free(doc);
+}
+
+
+void test_open(void) {
+	JSON_DOC
+		*doc = (JSON_DOC*)NULL,
+		*reopened = (JSON_DOC*)NULL;
+	char *fname = test_file("doc.json",doc_text,0);
+
+	doc = json_open("doc",fname);
+	test_check("open",doc!=(JSON_DOC*)NULL && json_find("doc")==doc);
+	test_check("open again",json_open("doc",fname)==doc);
+	test_check("missing file",json_open("none","/nonexistent/none.json")==(JSON_DOC*)NULL);
+	if (doc==(JSON_DOC*)NULL) {
+		return;
+	}
+
+	/* A document in use stays valid when its name is opened again */
+	json_retain(doc);
+	reopened = json_open("doc",test_file("other.json","[\"other\"]",0));
+	test_check("reopened",reopened!=(JSON_DOC*)NULL && reopened!=doc && json_find("doc")==reopened);
+	test_equal("document in use",lookup(doc,"a[2]"),"x\"y");
+	json_release(doc);
+
+	if (reopened!=(JSON_DOC*)NULL) {
+		test_equal("reopened document",lookup(reopened,"[0]"),"other");
+	}
+
+	json_close_all();
+	test_check("closed",json_find("doc")==(JSON_DOC*)NULL);
+}
+
+
+int main( int argc, char **argv ) {
+	test_lookup();
+	test_escapes();
+	test_truncated();
+	test_open();
+
+	return (test_result("json_test"));
+}
@@ -1,8 +1,21 @@
 /* Copyright (C) 2003 Thomas Weckert */
 
+#ifndef WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 #include "mem.h"
 
@@ -43,6 +56,17 @@ void *_malloc( size_t size ) {
 }
 
 
+void *_realloc( void *ptr, size_t size ) {
+	ptr = (void*)realloc(ptr,size);
+	if (ptr==(void*)NULL) {
+		fprintf(stdout,"FATA ERROR: cannot allocate new memory!");
+		exit(EXIT_FAILURE);
+	}
+
+	return (ptr);
+}
+
+
 void *_calloc( unsigned int count, size_t size ) {
 	void *ptr = (void*)NULL;
 
@@ -55,3 +79,77 @@ void *_calloc( unsigned int count, size_t size ) {
 	return (ptr);
 }
 
+
+
+/*
+	Map a file read-only into memory. Returns NULL if the file
+	cannot be opened or is empty. size and mtime are set to the
+	size and the modification time of the file.
+*/
+void *map_file( char *fname, size_t *size, time_t *mtime ) {
+	struct stat st;
+	void *data = (void*)NULL;
+#ifndef WIN32
+	int fd = -1;
+
+
+	if ((fd=open(fname,O_RDONLY))<0) {
+		return ((void*)NULL);
+	}
+
+	if (fstat(fd,&st)!=0 || st.st_size==0) {
+		close(fd);
+		return ((void*)NULL);
+	}
+
+	data = mmap((void*)NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+
+	if (data==MAP_FAILED) {
+		return ((void*)NULL);
+	}
+#else
+	FILE *fptr = (FILE*)NULL;
+
+
+	if (stat(fname,&st)!=0 || st.st_size==0) {
+		return ((void*)NULL);
+	}
+
+	if ((fptr=fopen(fname,"rb"))==(FILE*)NULL) {
+		return ((void*)NULL);
+	}
+
+	data = _malloc((size_t)st.st_size);
+	if (fread(data,(size_t)st.st_size,1,fptr)!=1) {
+		free(data);
+		data = (void*)NULL;
+	}
+	fclose(fptr);
+#endif
+
+	if (size!=(size_t*)NULL) {
+		(*size) = (size_t)st.st_size;
+	}
+
+	if (mtime!=(time_t*)NULL) {
+		(*mtime) = st.st_mtime;
+	}
+
+	return (data);
+}
+
+
+/*
+	Release a file mapped by map_file.
+*/
+void unmap_file( void *data, size_t size ) {
+	if (data==(void*)NULL) {
+		return;
+	}
+#ifndef WIN32
+	munmap(data,size);
+#else
+	free(data);
+#endif
+}
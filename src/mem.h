@@ -1,7 +1,17 @@
 /* Copyright (C) 2003 Thomas Weckert */
 
+/* The state of the engine is kept per thread, see pool.h */
+#if defined(__GNUC__) && !defined(WIN32)
+#define MHT_THREAD __thread
+#else
+#define MHT_THREAD
+#endif
+
 /* Prototypes: */
 void *memdup( const void *original, size_t size );
 char *strdup( const char *original );
 void *_calloc( unsigned int count, size_t size );
 void *_malloc( size_t size );
+void *_realloc( void *ptr, size_t size );
+void *map_file( char *fname, size_t *size, time_t *mtime );
+void unmap_file( void *data, size_t size );
@@ -1,5 +1,9 @@
 /* Copyright (C) 2003 Thomas Weckert */
 
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,7 +12,12 @@
 #include <errno.h>
 
 #include "hash.h"
+#include "csv.h"
+#include "json.h"
+#include "dict.h"
+#include "sink.h"
 #include "mht.h"
+#include "builtin.h"
 #include "mht_defs.h"
 #include "mem.h"
 #include "str_util.h"
@@ -19,10 +28,32 @@
 #define	MHT_UMLAUT_COUNT		7			/* The number of currently supported umlauts */
 #define MAX_IF_COUNT			128			/* The max. number of nested if-conditionals */
 #define MAX_MHT_KEYW_LEN		15			/* The max. length of a MHT keyword */
-#define MAX_MHT_KEYW_COUNT		22			/* The number of currently supported MHT keywords */
+#define MAX_MHT_KEYW_COUNT		28			/* The number of currently supported MHT keywords */
 #define MHT_VERSION				"1.2"		/* The current MHT version string */
 #define	MAX_OUTFILE_HANDLES		65			/* 0 is a imaginary file handle to print to all file handles! */
 #define MAX_FILE_INCLUSION		128			/* The max. number of included files (file 1 includes file 2, file 2 includes file 3, ..., file 127 includes file 128 */
+#define MAX_LOOP_BINDINGS		32			/* The max. number of nested #foreach (and of nested #table) loops */
+#define MAX_BLOCK_DEPTH			64			/* The max. nesting of processed blocks (#process, #loop, #foreach, #table, #cache) */
+#define MAX_EXPAND_DEPTH		64			/* The max. nesting of macro expansions, deeper macros stay unexpanded */
+#define MHT_AUTOESCAPE_OFF		-1			/* mht->autoescape if tainted macros are not escaped */
+#define MAX_FOLD_DEPTH			16			/* The max. nesting of macro definitions that are folded */
+#define MHT_MACRO_FOLDED		0x100		/* Item flag: the definition was folded into a block */
+#define MHT_MACRO_REDEFINED		0x200		/* Item flag: the macro was redefined, it is never folded */
+#define MAX_CACHE_DEPTH			8			/* The max. number of nested #cache directives being rendered */
+#define MAX_CACHE_DEPS			64			/* The max. number of macros a cached block may read */
+#define MHT_CACHE_LIMIT			1048576		/* The default memory limit of the fragment cache in bytes */
+#define MAX_MEMO_ENTRIES		1024		/* The max. number of memoized macro expansions */
+#define MAX_FILTERS				8			/* The max. number of filters of an output */
+#define MHT_FILTER_UMLAUTS		1			/* Filter: German umlauts into their HTML equivalents */
+#define MHT_FILTER_KILLSPACE	2			/* Filter: cut off the whitespace around lines */
+#define MHT_FILTER_MINIFY		3			/* Filter: minify the HTML output */
+#define MHT_MACRO_MEMO			0x400		/* Item flag: a memoized expansion depends on the macro */
+#define MHT_MACRO_IMPURE		0x800		/* Item flag: the definition of the macro can't be memoized */
+#define MHT_MEMO_NOT_PURE		0			/* Results of mht_memo_pure_str */
+#define MHT_MEMO_PURE			1
+#define MHT_MEMO_NEVER_PURE		2
+#define MAX_SCOPE_HASHSIZE		1024		/* The number of hash slots of a request scope, a power of 2 */
+#define SCOPE_CHUNK_SIZE		16384		/* The min. size of a memory chunk of a request scope */
 
 
 /* Error codes: */
@@ -66,15 +97,53 @@
 #define MHT_ERR_LOOP_NO_INTEGER_PARAMETERS			37
 #define MHT_ERR_TOO_DEEP_FILE_INCLUSION				38
 #define MHT_ERR_END_DIRECTIVE_OUTSIDE_BLOCK			39
+#define MHT_ERR_FOREACH_DIRECTIVE_WITHOUT_ARGS		40
+#define MHT_ERR_FOREACH_WITHOUT_ENOUGH_PARAMETERS	41
+#define MHT_ERR_FOREACH_TOO_MANY_LEVELS				42
+#define MHT_ERR_TABLE_DIRECTIVE_WITHOUT_ARGS		43
+#define MHT_ERR_TABLE_WITHOUT_ENOUGH_PARAMETERS		44
+#define MHT_ERR_TABLE_FILE_NOT_FOUND				45
+#define MHT_ERR_JSONSOURCE_DIRECTIVE_WITHOUT_ARGS	46
+#define MHT_ERR_JSONSOURCE_FILE_NOT_FOUND			47
+#define MHT_ERR_CACHE_DIRECTIVE_WITHOUT_ARGS		48
+#define MHT_ERR_DICT_DIRECTIVE_WITHOUT_ARGS			49
+#define MHT_ERR_DICT_FILE_INVALID					50
+#define MHT_ERR_TABLE_TOO_MANY_LEVELS				51
+#define MHT_ERR_TOO_DEEP_BLOCK_NESTING				52
+
+
+/* Values of #if and #elif arguments for mht_set_if_value: */
+#define MHT_IF_FALSE		0
+#define MHT_IF_TRUE			1
+#define MHT_IF_WRONG_ARG	-1			/* Neither true/1 nor false/0 */
+#define MHT_IF_NO_ARG		-2
+
+
+/* Node types of compiled #if expressions: */
+#define EXPR_ROOT			0			/* The first node of a compiled expression, left is the expression */
+#define EXPR_LITERAL		1			/* A bare word or a quoted string */
+#define EXPR_MACRO			2			/* <#name>, looked up directly */
+#define EXPR_REF			3			/* Any other macro reference, it is expanded as usual */
+#define EXPR_DEFINED		4			/* defined(name) */
+#define EXPR_IN				5			/* in(x,set,...), right is the list of the set items */
+#define EXPR_NOT			6
+#define EXPR_AND			7
+#define EXPR_OR				8
+#define EXPR_EQ				9
+#define EXPR_NE				10
+#define EXPR_LT				11
+#define EXPR_GT				12
+#define EXPR_LE				13
+#define EXPR_GE				14
 
 
 /* These macros make the code to maintain the if-contexts/levels correct more readable: */
-#define INC_IF_CONTEXT		mht.current_if_context++
-#define DEC_IF_CONTEXT		mht.current_if_context--
-#define GET_IF_CONTEXT		mht.current_if_context
-#define INC_IF_LEVEL		mht.if_context[mht.current_if_context].current_if_level++
-#define DEC_IF_LEVEL		mht.if_context[mht.current_if_context].current_if_level--
-#define GET_IF_LEVEL		mht.if_context[mht.current_if_context].current_if_level
+#define INC_IF_CONTEXT		mht->current_if_context++
+#define DEC_IF_CONTEXT		mht->current_if_context--
+#define GET_IF_CONTEXT		mht->current_if_context
+#define INC_IF_LEVEL		mht->if_context[mht->current_if_context].current_if_level++
+#define DEC_IF_LEVEL		mht->if_context[mht->current_if_context].current_if_level--
+#define GET_IF_LEVEL		mht->if_context[mht->current_if_context].current_if_level
 
 
 /*
@@ -105,35 +174,261 @@ typedef struct {
 } COND_CONTEXT;
 
 
-/* Global data structure of the MHT processor */
+/*
+	The loop variable of a #foreach directive. The variable is
+	not registered as a macro, mht_search_macro looks it up here
+	before the macro hash is searched.
+*/
+typedef struct {
+	char *name;		/* The name of the loop variable */
+	unsigned int name_len;	/* The length of the name */
+	char *value;	/* The current item */
+	char *key;		/* The full macro name of the current item if a map is iterated, NULL otherwise */
+	char *path;		/* The path of the current item if a JSON array is iterated, NULL otherwise */
+	unsigned int index;	/* The index of the current item, starting with 1 */
+	unsigned int count;	/* The number of items */
+	unsigned int tainted;	/* MHT_PROVIDER_TAINTED if the current item comes from an untrusted source (CGI values, JSON files) */
+	char index_str[16];	/* Buffer for the <#var.index> and <#var.count> helpers */
+} LOOP_BINDING;
+
+
+/*
+	The current row of a #table directive. The fields are bound as
+	parameters of the block, they are not registered in the hash of
+	the block parameters.
+*/
+typedef struct {
+	char *block_name;	/* The name of the processed block */
+	unsigned int name_len;	/* The length of the name */
+	CSV_TABLE *csv;	/* The table, for the column names */
+	char *fields[CSV_MAX_FIELDS];	/* The fields of the current row */
+	int field_count;	/* The number of fields of the current row */
+	unsigned long row;	/* The number of the current row, starting with 1 */
+	char row_str[16];	/* Buffer for <#block.%0> */
+} ROW_BINDING;
+
+
+/*
+	A macro which is defined the first time it is referenced.
+*/
+typedef struct PROVIDER_PTR provider_ptr;
+typedef struct PROVIDER_PTR {
+	char *name;		/* The name of the macro */
+	MHT_PROVIDER func;	/* The function which computes the definition */
+	char *arg;		/* The argument for func */
+	unsigned int flags;	/* MHT_PROVIDER_* flags */
+	unsigned int defined;	/* 1 if the definition was computed and registered */
+	unsigned int undefined;	/* 1 after a #undef of the macro, the provider is not asked any more */
+	void *data;		/* The registered definition, to recognize it after a #def */
+	unsigned long scope;	/* The generation of the request scope holding the definition, 0 if none */
+	provider_ptr *next;
+} PROVIDER_INFO;
+
+
+/*
+	The memory of a request scope: the macros of a scope, their names
+	and definitions are allocated from chunks, which are reused by the
+	next scope. The data follows the header.
+*/
+typedef union {
+	long l;
+	double d;
+	void *p;
+} SCOPE_ALIGN;
+
+#define SCOPE_ROUND(size)	(((size)+sizeof(SCOPE_ALIGN)-1)/sizeof(SCOPE_ALIGN)*sizeof(SCOPE_ALIGN))
+
+typedef struct SCOPE_CHUNK_PTR scope_chunk_ptr;
+typedef struct SCOPE_CHUNK_PTR {
+	scope_chunk_ptr *next;
+	size_t size;	/* The size of the data */
+	size_t used;	/* The bytes of the data used by the current scope */
+} SCOPE_CHUNK;
+
+
+/*
+	A request scope, see mht_scope_begin. The macros defined or undefined
+	in the scope are kept in slots over the macros of the state, an
+	undefined macro has no data (a tombstone). A slot is valid only if
+	its stamp is the generation of the scope, so all slots are dropped
+	at once when the generation changes.
+*/
+typedef struct {
+	HASH_ITEM **slots;	/* MAX_SCOPE_HASHSIZE lists of macros, allocated when used first */
+	unsigned long *stamps;	/* The generation of each list */
+	unsigned long generation;	/* Incremented by mht_scope_begin and mht_scope_end */
+	unsigned int active;	/* 1 between mht_scope_begin and mht_scope_end, 0 otherwise */
+	unsigned int count;	/* The number of macros in the scope */
+	unsigned int memo;	/* 1 if a memoized expansion depends on a macro of the scope */
+	SCOPE_CHUNK *first;	/* The memory of the scope */
+	SCOPE_CHUNK *chunk;	/* The chunk being used */
+} MHT_SCOPE;
+
+
+/*
+	A node of a compiled #if expression. All nodes and their strings
+	are allocated in one memory block, which starts with the EXPR_ROOT
+	node, so a compiled expression is freed with a single free().
+*/
+typedef struct EXPR_PTR expr_ptr;
+typedef struct EXPR_PTR {
+	int op;			/* One of the EXPR_* constants */
+	char *str;		/* The literal, the macro name or the macro reference */
+	unsigned int len;	/* The length of str */
+	expr_ptr *left;
+	expr_ptr *right;
+	expr_ptr *next;		/* The next item of the set of in() */
+} MHT_EXPR;
+
+/* The state of the #if expression parser */
+typedef struct {
+	char *pos;		/* The current position in the expression */
+	MHT_EXPR *nodes;
+	unsigned int node_count;
+	unsigned int max_nodes;
+	char *strs;		/* The strings of the nodes are copied to here */
+} EXPR_PARSER;
+
+
+/*
+	A macro read by a block of the fragment cache, and its version
+	(0 if the macro was undefined).
+*/
+typedef struct {
+	char *name;
+	unsigned long version;
+} CACHE_DEP;
+
+
+/*
+	A rendered block of the fragment cache, see mht_cache_process.
+	The entries form a LRU list, the most recently used entry first.
+*/
+typedef struct CACHE_PTR cache_ptr;
+typedef struct CACHE_PTR {
+	char *key;		/* The block name, its parameters and the output settings */
+	char *output;	/* The rendered block */
+	unsigned int len;	/* The length of output */
+	CACHE_DEP *deps;	/* The macros read while the block was rendered */
+	unsigned int dep_count;
+	unsigned long fold_generation;	/* The fold generation of the folded lines in output */
+	time_t expires;	/* When the entry expires, 0 if it never expires */
+	size_t size;	/* The memory used by the entry */
+	cache_ptr *prev;
+	cache_ptr *next;
+} CACHE_ENTRY;
+
+
+/*
+	A block which is rendered for the fragment cache. The output and the
+	macros read are collected, the block is cached only if it had no
+	other effects and read nothing that is not part of the key.
+*/
+typedef struct {
+	char *output;
+	unsigned int len;
+	unsigned int size;
+	CACHE_DEP deps[MAX_CACHE_DEPS];
+	unsigned int dep_count;
+	unsigned long version;	/* mht->macro_version when the block was started */
+	unsigned long fold_generation;	/* mht->fold_generation when the block was started */
+	unsigned int binding_count;	/* The loop bindings active when the block was started */
+	unsigned int row_binding_count;
+	int active_fhandle;
+	unsigned int cacheable;	/* 0 if the block must not be cached */
+} CACHE_FRAME;
+
+
+/*
+	A builtin macro, see mht_register_builtin.
+*/
+typedef struct {
+	char *name;
+	unsigned int name_len;
+	MHT_BUILTIN func;
+	void *user_data;
+} BUILTIN_INFO;
+
+
+/*
+	The filters of an output, e.g. "#mhtvar filter umlauts,killspace".
+	The sinks of the filters are set up when something is printed.
+*/
 typedef struct {
+	unsigned int filters[MAX_FILTERS];	/* The filters in the order of the chain, see MHT_FILTER_... */
+	unsigned int filter_count;
+	unsigned int own;		/* 1 if a file handle has filters of its own, 0 if it uses those of the output */
+	unsigned int sinks;		/* The number of filter sinks set up */
+	MHT_SINK *first;		/* The first filter sink, NULL if not set up */
+	MHT_SINK *out;			/* The sink of the output stream behind the filters, if there is no other sink */
+} FILTER_CHAIN;
+
+
+/* Global data structure of the MHT processor */
+typedef struct MHT_INFO_S {
 	HASH_ITEM **macros;		/* All MHT macros are stored in this hash */
 	HASH_ITEM **blocks;		/* All MHT blocks are stored in this hash */
 	HASH_ITEM **block_params;	/* All parameters of invoked blocks are stored in this hash */
 	FILE *out;		/* The current MHT output stream */
 	FILE *out_bak;	/* In case a new output stream was choosen, the previous one is saved here to switch back */
-	unsigned int conv_umlauts;	/* 1 if German umlauts should be converted into their HTML equivalents, 0 otherwise */
+	MHT_SINK *sink;	/* If not NULL, the output is pushed to this sink instead of the output stream */
+	FILTER_CHAIN chain;	/* The filters of the output, see "#mhtvar filter" */
 	unsigned int write_to_file;	/* 1 if one or more file handle(s) are opened, 0 otherwise */
 	unsigned int read_block;	/* 1 if MHT reads the lines of a block in quickopen, 0 otherwise */
-	unsigned int killspace;		/* 1 if MHT should remove all whitespaces, 0 otherwise */
 	unsigned int writeoutput;	/* 0 if MHT shouldn't write to the output stream(s), 1 otherwise */
 	int active_fhandle;		/* The currently active file handle to which MHT is writing */
 	unsigned int fhandles;	/* The number of "typed" file handles */
 	char **fhandle_type;	/* Pointer array of all file types */
 	FILE **fhandle_fptr;	/* Pointer array of all file handles */
+	FILTER_CHAIN *fhandle_chain;	/* The filters of all file handles */
 	COND_CONTEXT if_context[MAX_FILE_INCLUSION];	/* All if-conditional contexts are stored in this array */
 	unsigned int current_if_context;	/* The level of the current if-conditional context */
 	unsigned int recursive_file_inclusion;	/* How many files (a includes b, b, includes c,...) have been included so far? */
+	unsigned int block_depth;	/* The number of blocks being processed, see MAX_BLOCK_DEPTH */
+	unsigned int expand_depth;	/* The nesting of mht_expand, see MAX_EXPAND_DEPTH */
+	unsigned int load;	/* 1 if mht_load reads a file, its lines outside the blocks are kept then */
+	LINE_BUFFER *load_first;	/* The lines kept by mht_load */
+	LINE_BUFFER *load_last;
 	unsigned int error_macros_registered;
+	LOOP_BINDING bindings[MAX_LOOP_BINDINGS];	/* The loop variables of all active #foreach directives */
+	unsigned int binding_count;	/* The number of active #foreach directives */
+	ROW_BINDING row_bindings[MAX_LOOP_BINDINGS];	/* The current rows of all active #table directives */
+	unsigned int row_binding_count;	/* The number of active #table directives */
+	MHT_DICT *dicts;	/* The attached read-only macro dictionaries, the last attached first */
+	HASH_ITEM **providers;	/* All macro providers are stored in this hash */
+	PROVIDER_INFO *provider_list;	/* All macro providers, for mht_refresh_providers */
+	BUILTIN_INFO *builtins;	/* All registered builtin macros */
+	unsigned int builtin_count;	/* The number of registered builtin macros */
+	BUILTIN_INFO **builtin_table;	/* Perfect hash table of the builtins, builtin_mask+1 slots */
+	unsigned int builtin_mask;	/* The number of slots in builtin_table minus 1 */
+	unsigned int builtin_seed;	/* The seed which maps all builtins to distinct slots */
+	int autoescape;	/* The STR_ESC_* mode for tainted macros, or MHT_AUTOESCAPE_OFF */
+	unsigned int fold;	/* 1 if stable macros should be folded into the static text of blocks, 0 otherwise */
+	unsigned long fold_generation;	/* Incremented whenever a folded macro changes */
+	unsigned long macro_version;	/* The last version given to a macro or a block parameter */
+	HASH_ITEM **cache;	/* The entries of the fragment cache by key, allocated when used first */
+	CACHE_ENTRY *cache_first;	/* The most recently used entry */
+	CACHE_ENTRY *cache_last;	/* The least recently used entry */
+	size_t cache_used;	/* The memory used by all entries */
+	size_t cache_limit;	/* The memory limit of the fragment cache, 0 disables it */
+	CACHE_FRAME cache_frames[MAX_CACHE_DEPTH];	/* The #cache directives being rendered */
+	unsigned int cache_depth;	/* The number of #cache directives being rendered */
+	HASH_ITEM **memo;	/* The memoized expansions of pure macros by "name|arg1|...", allocated when used first */
+	unsigned int memo_count;	/* The number of memoized expansions */
+	unsigned int memo_slots[MAX_MEMO_ENTRIES];	/* The hash slots of the memoized expansions, for mht_memo_flush */
+	char **files;	/* The names of all files read by mht_quickopen */
+	unsigned int file_count;
+	struct MHT_INFO_S *shared;	/* The state whose blocks are found if this state has none of the name, see mht_state_share */
+	MHT_SCOPE scope;	/* The macros of the current request, see mht_scope_begin */
+	char tmp_str[MAX_LEN];	/* Scratch buffers of the state, renders interleaved on a thread have their own */
+	char tmp_str1[MAX_LEN];
+	char *strtok_next;	/* The rest of the string split by mht_strtok */
 } MHT_INFO;
 
 
 /* Global vars: */
-char
-	tmp_str[MAX_LEN],
-	tmp_str1[MAX_LEN];
-
-MHT_INFO mht;
+MHT_INFO mht_main;
+MHT_THREAD MHT_INFO *mht = &mht_main;	/* The state of the current render of a thread, see mht_render_begin and pool.h */
 
 char *mht_html_umlauts[MHT_UMLAUT_COUNT] = {
 	"&auml;", "&ouml;", "&uuml;", "&Auml;", "&Ouml;", "&Uuml;", "&szlig;"
@@ -172,10 +467,10 @@ char mht_eng_month[12][10] = {
 
 /* All MHT keywords in alphabetical order */
 char mht_keyw[MAX_MHT_KEYW_COUNT][MAX_MHT_KEYW_LEN] = {
-	"begin", "def", "defex", "echo", "echoln",
-	"elif", "else", "end", "endif", "file", "if", "include",
+	"begin", "cache", "def", "defex", "dict", "echo", "echoln",
+	"elif", "else", "end", "endif", "file", "flush", "foreach", "if", "include", "jsonsource",
 	"loop", "mhtexit", "mhtfile", "mhtvar", "pause",
-	"process", "undef", "undefblock", "write", "writeln"
+	"process", "table", "undef", "undefblock", "write", "writeln"
 };
 
 /* MHT error messages */
@@ -219,7 +514,20 @@ char *mht_error_str[] = {
 	"There is a #loop directive with insufficient parameters found!",
 	"There is a #loop directive with non-digit parameters found!",
 	"Too many recursive file inclusions!",
-	"#end directive without a opening #begin directive found!"
+	"#end directive without a opening #begin directive found!",
+	"Empty #foreach directive without any arguments found!",
+	"There is a #foreach directive with insufficient parameters found!",
+	"You have too many cascaded #foreach directives!",
+	"Empty #table directive without any arguments found!",
+	"There is a #table directive with insufficient or non-digit parameters found!",
+	"Data file in #table directive not found!",
+	"There is a #jsonsource directive without a name or a file found!",
+	"JSON file in #jsonsource directive not found!",
+	"Empty #cache directive without any arguments found!",
+	"Empty #dict directive without any arguments found!",
+	"Macro dictionary in #dict directive not found or corrupt!",
+	"You have too many cascaded #table directives!",
+	"Too many nested blocks (#process, #loop, #foreach, #table or #cache)!"
 };
 
 
@@ -228,11 +536,38 @@ int mht_register_block( char *block_name, LINE_BUFFER *first_line );
 LINE_BUFFER *mht_search_block( char *block_name );
 int mht_process_line( char *line );
 void mht_print_line( char *line );
+void mht_free_state(void);
+void mht_print_static( char *text );
+void mht_release_refs(void);
+char *mht_strtok( char *str, char *delim );
+MHT_SINK *mht_set_sink( MHT_SINK *sink );
+FILTER_CHAIN *mht_filter_chain(void);
+MHT_SINK *mht_filter_sink( FILTER_CHAIN *chain, FILE *fptr, MHT_SINK *sink );
+void mht_filter_end( FILTER_CHAIN *chain );
+void mht_filter_end_all(void);
+int mht_filter_set( FILTER_CHAIN *chain, char *list );
+void mht_filter_switch( unsigned int filter, unsigned int on );
+unsigned int mht_filter_has( FILTER_CHAIN *chain, unsigned int filter );
+void mht_print_to( FILTER_CHAIN *chain, FILE *fptr, MHT_SINK *sink, char *line );
 int mht_setvar( char *mhtvar, char *value );
 char *mht_replace_macro_params( int macro_arg_count, char **macro_args, char *expanded_macro );
 char *mht_replace_umlauts( char *str );
 int mht_setfile_io( char *action, char *type, char *fname );
 int mht_set_if_count( char *if_directive, char *if_arg );
+int mht_set_if_value( char *if_directive, int if_value );
+MHT_EXPR *mht_expr_compile( char *text );
+MHT_EXPR *mht_expr_node( EXPR_PARSER *parser, int op, char *str, unsigned int len );
+MHT_EXPR *mht_expr_or( EXPR_PARSER *parser );
+MHT_EXPR *mht_expr_and( EXPR_PARSER *parser );
+MHT_EXPR *mht_expr_not( EXPR_PARSER *parser );
+MHT_EXPR *mht_expr_cmp( EXPR_PARSER *parser );
+MHT_EXPR *mht_expr_operand( EXPR_PARSER *parser );
+int mht_expr_eval( MHT_EXPR *expr );
+int mht_expr_compare( MHT_EXPR *expr );
+void mht_expr_value( MHT_EXPR *expr, char *buf, MHT_SLICE *value );
+int mht_expr_truth( MHT_SLICE *value );
+int mht_expr_cmp_values( MHT_SLICE *a, MHT_SLICE *b );
+void mht_compile_if( LINE_BUFFER *line, char *directive );
 unsigned int mht_search_block_param( char *block_param, char **result );
 int mht_register_block_param( char *block_param, char *param );
 int mht_undef_block_param( char *block_param );
@@ -242,11 +577,61 @@ int keyw_strcmp( const void *el1, const void *el2 );
 char *mht_expand( char *input );
 int mht_free_block( char *block );
 int mht_get_block_params( char *str, char **args );
+void mht_free_block_params( char **args, int arg_count );
 void mht_replace_unexpanded_params( int macro_arg_count, char **macro_args );
 int mht_process_with_params( FILE *out, char *blockname, char **block_params, int block_param_count );
 char *mht_trim( char *line );
 int mht_loop( FILE *out, char *blockname, char **block_params, int block_param_count );
 void mht_register_error_macros( char *err_msg, char *err_line, int err_code );
+int mht_foreach( FILE *out, char *blockname, char **block_params, int block_param_count );
+unsigned int mht_search_binding( char *name, char **result, unsigned int *flags );
+void mht_compile_block( LINE_BUFFER *first_line );
+LINE_BUFFER *mht_new_line( char *line );
+int mht_process_compiled_line( LINE_BUFFER *line, unsigned int *lines );
+void mht_fold_invalidate( char *name );
+void mht_fold_reset(void);
+unsigned int mht_fold_stable( char *name, unsigned int depth );
+unsigned int mht_fold_refs( char *str, unsigned int depth );
+void mht_fold_line( LINE_BUFFER *line );
+void mht_fold_block( LINE_BUFFER *first_line );
+int mht_cache_process( FILE *out, char **block_params, int block_param_count, long ttl );
+unsigned long mht_cache_version( char *name );
+void mht_cache_add_dep( CACHE_FRAME *frame, char *name, unsigned long version );
+void mht_cache_read( char *name, unsigned int bound );
+void mht_cache_read_param( HASH_ITEM *param );
+void mht_cache_capture( char *line );
+void mht_cache_spoil(void);
+unsigned int mht_cache_pure( char *mht_keyw );
+void mht_cache_drop( CACHE_ENTRY *entry );
+void mht_cache_flush(void);
+unsigned int mht_memo_pure( char *name, unsigned int depth );
+unsigned int mht_memo_pure_str( char *str, unsigned int len, unsigned int depth );
+void mht_memo_store( char *key, char *expansion );
+void mht_memo_flush(void);
+unsigned int mht_search_row_binding( char *block_param, char **result );
+int mht_table( FILE *out, char **block_params, int block_param_count );
+int mht_cmp_keys( const void *el1, const void *el2 );
+unsigned int mht_map_keys( char *prefix, unsigned int prefix_len, char **key_list, char *keys, unsigned int *key_len );
+unsigned int mht_search_provider( char *name, char **result );
+int mht_search_macro_flags( char *name, char **result, unsigned int *flags );
+HASH_ITEM *mht_macro_item( char *name );
+HASH_ITEM *mht_scope_item( char *name );
+HASH_ITEM *mht_scope_add( char *name, char *definition );
+void *mht_scope_alloc( size_t size );
+void mht_scope_reset(void);
+char *mht_date_provider( char *arg, char *buf, unsigned int size );
+char *mht_const_provider( char *arg, char *buf, unsigned int size );
+char *mht_env_provider( char *arg, char *buf, unsigned int size );
+unsigned int mht_builtin_hash( char *name, unsigned int *len, unsigned int seed );
+int mht_build_builtin_table(void);
+BUILTIN_INFO *mht_search_builtin( char *name );
+BUILTIN_INFO *mht_call_builtin( char *name );
+void mht_builder_append_arg( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, int arg );
+int mht_builtin_ifequal( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int mht_builtin_ifdef( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int mht_builtin_isin( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int mht_builtin_ifblock( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+int mht_builtin_json( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
 
 
 /* Implementation: */
@@ -256,90 +641,111 @@ void mht_register_error_macros( char *err_msg, char *err_line, int err_code );
 */
 void mht_init(void) {
 	unsigned int
-		year = 0,
-		month = 0,
-		wday = 0,
-		mday = 0,
 		i = 0, j = 0;
 
-	time_t rawtime;
-	struct tm *timeinfo;
-	char time_string[128];
-
-
-	mht.macros = init_hashtab();
-	mht.blocks = init_hashtab();
-	mht.block_params = init_hashtab();
 
-	/* register some basic macros */
-	time(&rawtime);
-	timeinfo = localtime(&rawtime);
-
-	strftime(time_string, 128, "%m/%d/%Y", timeinfo);
-	mht_register_macro("short_date",time_string);
-	strftime(time_string,128,"%d.%m.%Y", timeinfo);
-	mht_register_macro("kurzes_datum",time_string);
-
-	year = (timeinfo->tm_year < 2000) ? 1900 + timeinfo->tm_year : timeinfo->tm_year;
-	month = timeinfo->tm_mon;
-	wday = timeinfo->tm_wday;
-	mday = timeinfo->tm_mday;
-
-	sprintf(time_string,"%s, %s %d, %d", mht_eng_wday[wday], mht_eng_month[month], mday, year);
-	mht_register_macro("long_date",time_string);
-	sprintf(time_string,"%s, %d. %s %d", mht_ger_wday[wday], mday, mht_ger_month[month], year);
-	mht_register_macro("langes_datum",time_string);
-
-	if (timeinfo->tm_min<10) {
-		sprintf(tmp_str,"0%d",timeinfo->tm_min);
-	}
-	else {
-		sprintf(tmp_str,"%d",timeinfo->tm_min);
-	}
-	sprintf(time_string,"%d:%s",timeinfo->tm_hour,tmp_str);
-	mht_register_macro("time",time_string);
-
-	mht_register_macro("crlf","\n");
-	mht_register_macro("space"," ");
-	mht_register_macro("tab","\t");
-	mht_register_macro("null","");
-	sprintf(tmp_str,"MHT macro processor version %s, compiled %s",MHT_VERSION,__DATE__);
-	mht_register_macro("mht_version_msg",tmp_str);
+	mht->macros = init_hashtab();
+	mht->blocks = init_hashtab();
+	mht->block_params = init_hashtab();
+	mht->providers = init_hashtab();
+	mht->provider_list = (PROVIDER_INFO*)NULL;
+
+	mht->builtins = (BUILTIN_INFO*)NULL;
+	mht->builtin_count = 0;
+	mht->builtin_table = (BUILTIN_INFO**)NULL;
+	mht->builtin_mask = 0;
+	mht->builtin_seed = 0;
+
+	/* register the standard builtin macros */
+	mht_register_builtin("ifequal",mht_builtin_ifequal,(void*)NULL);
+	mht_register_builtin("ifdef",mht_builtin_ifdef,(void*)NULL);
+	mht_register_builtin("isin",mht_builtin_isin,(void*)NULL);
+	mht_register_builtin("ifblock",mht_builtin_ifblock,(void*)NULL);
+	mht_register_builtin("json",mht_builtin_json,(void*)NULL);
+	builtin_register_std();
+
+	/* register some basic macros, they are computed when they are used first */
+	mht_register_provider("short_date",mht_date_provider,"short_date",MHT_PROVIDER_VOLATILE);
+	mht_register_provider("kurzes_datum",mht_date_provider,"kurzes_datum",MHT_PROVIDER_VOLATILE);
+	mht_register_provider("long_date",mht_date_provider,"long_date",MHT_PROVIDER_VOLATILE);
+	mht_register_provider("langes_datum",mht_date_provider,"langes_datum",MHT_PROVIDER_VOLATILE);
+	mht_register_provider("time",mht_date_provider,"time",MHT_PROVIDER_VOLATILE);
+
+	mht_register_provider("crlf",mht_const_provider,"\n",0);
+	mht_register_provider("space",mht_const_provider," ",0);
+	mht_register_provider("tab",mht_const_provider,"\t",0);
+	mht_register_provider("null",mht_const_provider,"",0);
+	mht_register_provider("mht_version_msg",mht_const_provider,"MHT macro processor version " MHT_VERSION ", compiled " __DATE__,0);
 
 	/* Default settings of the MHT vars */
-	mht.out = stdout;
-	mht.out_bak = (FILE*)NULL;
-	mht.conv_umlauts = 0;
-	mht.write_to_file = 0;
-	mht.killspace = 0;
-	mht.writeoutput = 1;
+	mht->out = stdout;
+	mht->out_bak = (FILE*)NULL;
+	mht->sink = (MHT_SINK*)NULL;
+	mht->chain.filter_count = 0;
+	mht->chain.own = 1;
+	mht->chain.sinks = 0;
+	mht->chain.first = (MHT_SINK*)NULL;
+	mht->chain.out = (MHT_SINK*)NULL;
+	mht->write_to_file = 0;
+	mht->writeoutput = 1;
+	mht->autoescape = MHT_AUTOESCAPE_OFF;
+	mht->fold = 1;
+	mht->fold_generation = 1;
+	mht->macro_version = 0;
+	mht->cache = (HASH_ITEM**)NULL;
+	mht->cache_first = (CACHE_ENTRY*)NULL;
+	mht->cache_last = (CACHE_ENTRY*)NULL;
+	mht->cache_used = 0;
+	mht->cache_limit = MHT_CACHE_LIMIT;
+	mht->cache_depth = 0;
+	mht->memo = (HASH_ITEM**)NULL;
+	mht->memo_count = 0;
+	mht->files = (char**)NULL;
+	mht->file_count = 0;
+	mht->scope.slots = (HASH_ITEM**)NULL;
+	mht->scope.stamps = (unsigned long*)NULL;
+	mht->scope.generation = 0;
+	mht->scope.active = 0;
+	mht->scope.count = 0;
+	mht->scope.memo = 0;
+	mht->scope.first = (SCOPE_CHUNK*)NULL;
+	mht->scope.chunk = (SCOPE_CHUNK*)NULL;
 
 	/* Set the IF-stack to default values */
 	for (i=0;i<MAX_FILE_INCLUSION;i++) {
 		for (j=0;j<MAX_IF_COUNT;j++) {
-			mht.if_context[i].if_stack[j].is_true = 0;
-			mht.if_context[i].if_stack[j].was_true = 0;
-			mht.if_context[i].if_stack[j].there_is_an_if = 0;
+			mht->if_context[i].if_stack[j].is_true = 0;
+			mht->if_context[i].if_stack[j].was_true = 0;
+			mht->if_context[i].if_stack[j].there_is_an_if = 0;
 		}
-		mht.if_context[i].current_if_level = 0;
+		mht->if_context[i].current_if_level = 0;
 	}
 
-	mht.current_if_context = 0;
-	mht.read_block = 0;
-	mht.recursive_file_inclusion = 0;
-	mht.error_macros_registered = 0;
+	mht->current_if_context = 0;
+	mht->read_block = 0;
+	mht->recursive_file_inclusion = 0;
+	mht->block_depth = 0;
+	mht->expand_depth = 0;
+	mht->load = 0;
+	mht->load_first = (LINE_BUFFER*)NULL;
+	mht->load_last = (LINE_BUFFER*)NULL;
+	mht->error_macros_registered = 0;
+	mht->binding_count = 0;
+	mht->row_binding_count = 0;
+	mht->dicts = (MHT_DICT*)NULL;
 
 	/* Initialize output file handles */
-	mht.active_fhandle = -1;
-	mht.fhandles = 0;
-	mht.fhandle_fptr = (FILE **)_calloc(MAX_OUTFILE_HANDLES,sizeof(FILE*));
-	mht.fhandle_type = (char **)_calloc(MAX_OUTFILE_HANDLES,sizeof(char*));
+	mht->active_fhandle = -1;
+	mht->fhandles = 0;
+	mht->fhandle_fptr = (FILE **)_calloc(MAX_OUTFILE_HANDLES,sizeof(FILE*));
+	mht->fhandle_type = (char **)_calloc(MAX_OUTFILE_HANDLES,sizeof(char*));
+	mht->fhandle_chain = (FILTER_CHAIN *)_calloc(MAX_OUTFILE_HANDLES,sizeof(FILTER_CHAIN));
 
 	for (i=0;i<MAX_OUTFILE_HANDLES;i++) {
-		mht.fhandle_fptr[i] = (FILE*)NULL;
-		mht.fhandle_type[i] = (char*)NULL;
+		mht->fhandle_fptr[i] = (FILE*)NULL;
+		mht->fhandle_type[i] = (char*)NULL;
 	}
-	mht.fhandle_type[0] = strdup("all");
+	mht->fhandle_type[0] = strdup("all");
 }
 
 
@@ -347,24 +753,187 @@ void mht_init(void) {
 	Trash the MHT structure.
 */
 void mht_exit(void) {
+	mht_free_state();
+
+	/* Unmap the data files of #table and #jsonsource directives */
+	csv_close_all();
+	json_close_all();
+}
+
+
+/*
+	Create a state of its own for a render, as after mht_init. The
+	current state stays as it is.
+*/
+MHT_INFO *mht_state_new(void) {
+	MHT_INFO
+		*prev = mht,
+		*state = (MHT_INFO*)_calloc(1,sizeof(MHT_INFO));
+
+	mht = state;
+	mht_init();
+	mht = prev;
+
+	return (state);
+}
+
+
+/*
+	Make a state the current one, returns the previous one.
+*/
+MHT_INFO *mht_state_switch( MHT_INFO *state ) {
+	MHT_INFO *prev = mht;
+
+	mht = state;
+	return (prev);
+}
+
+
+/*
+	Let a state find the blocks and macros of another one (e.g. a
+	template read by mht_load) if it has none of the name itself. The
+	shared state is only read then, so the state folds no macros into
+	blocks, and neither must the other one: mht_state_share(shared,NULL)
+	switches that off. NULL ends the sharing.
+*/
+void mht_state_share( MHT_INFO *state, MHT_INFO *shared ) {
+	MHT_INFO *prev = (MHT_INFO*)NULL;
+
+	/* Fragments cached for the blocks of another state are not valid */
+	if (state->shared!=shared) {
+		prev = mht_state_switch(state);
+		mht_cache_flush();
+		mht = prev;
+		state->shared = shared;
+	}
+
+	state->fold = 0;
+}
+
+
+/*
+	Free a state created by mht_state_new, it must not be the current one.
+*/
+void mht_state_free( MHT_INFO *state ) {
+	MHT_INFO *prev = mht_state_switch(state);
+
+	mht_free_state();
+	mht = prev;
+	free(state);
+}
+
+
+/*
+	Free the macros, blocks, settings... of the current state.
+*/
+void mht_free_state(void) {
 	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	MHT_DICT *dict = (MHT_DICT*)NULL;
+	PROVIDER_INFO *provider = (PROVIDER_INFO*)NULL;
 	register unsigned int i = 0;
 
 
+	/* The output held back by the filters, e.g. after an error */
+	mht_filter_end_all();
+	free(mht->fhandle_chain);
+
+	/* Free the output file handles */
+	if (mht->fhandle_type!=(char**)NULL) {
+		for (i=0; i<MAX_OUTFILE_HANDLES; i++) {
+			if (mht->fhandle_type[i]!=(char*)NULL) {
+				free(mht->fhandle_type[i]);
+			}
+		}
+		free(mht->fhandle_type);
+		free(mht->fhandle_fptr);
+	}
+	mht->fhandle_chain = (FILTER_CHAIN*)NULL;
+	mht->fhandle_type = (char**)NULL;
+	mht->fhandle_fptr = (FILE**)NULL;
+
 	/* Free the MHT macros */
-	free_hashtab(mht.macros);
+	free_hashtab(mht->macros);
+
+	/* Free the request scope */
+	if (mht->scope.slots!=(HASH_ITEM**)NULL) {
+		free(mht->scope.slots);
+		free(mht->scope.stamps);
+	}
+	while (mht->scope.first!=(SCOPE_CHUNK*)NULL) {
+		mht->scope.chunk = mht->scope.first->next;
+		free(mht->scope.first);
+		mht->scope.first = mht->scope.chunk;
+	}
+	mht->scope.slots = (HASH_ITEM**)NULL;
+	mht->scope.stamps = (unsigned long*)NULL;
+	mht->scope.active = 0;
+	mht->scope.count = 0;
 
 	/* Free the MHT block parameters */
-	free_hashtab(mht.block_params);
+	free_hashtab(mht->block_params);
+
+	/* Free the builtin macros */
+	for (i=0; i<mht->builtin_count; i++) {
+		free(mht->builtins[i].name);
+	}
+	if (mht->builtins!=(BUILTIN_INFO*)NULL) {
+		free(mht->builtins);
+	}
+	if (mht->builtin_table!=(BUILTIN_INFO**)NULL) {
+		free(mht->builtin_table);
+	}
+	mht->builtins = (BUILTIN_INFO*)NULL;
+	mht->builtin_table = (BUILTIN_INFO**)NULL;
+	mht->builtin_count = 0;
+
+	/* Free the macro providers */
+	while (mht->provider_list!=(PROVIDER_INFO*)NULL) {
+		provider = mht->provider_list;
+		mht->provider_list = provider->next;
+		free(provider->name);
+		free(provider->arg);
+		free(provider);
+	}
+	free_hashtab(mht->providers);
+
+	/* Free the fragment cache */
+	if (mht->cache!=(HASH_ITEM**)NULL) {
+		mht_cache_flush();
+		free_hashtab(mht->cache);
+		mht->cache = (HASH_ITEM**)NULL;
+	}
+
+	/* Free the memoized macro expansions */
+	free_hashtab(mht->memo);
+	mht->memo = (HASH_ITEM**)NULL;
+	mht->memo_count = 0;
+
+	/* Free the names of the files read */
+	for (i=0; i<mht->file_count; i++) {
+		free(mht->files[i]);
+	}
+	if (mht->files!=(char**)NULL) {
+		free(mht->files);
+	}
+	mht->files = (char**)NULL;
+	mht->file_count = 0;
+
+	/* Detach the macro dictionaries */
+	while (mht->dicts!=(MHT_DICT*)NULL) {
+		dict = mht->dicts;
+		mht->dicts = dict->next;
+		dict_close(dict);
+	}
 
 	/* Check if we have to free the MHT blocks */
-	if (mht.blocks==(HASH_ITEM**)NULL) {
+	mht_release_refs();
+	if (mht->blocks==(HASH_ITEM**)NULL) {
 		return;
 	}
 
 	/* Each MHT block is a line buffer, go and free each block separately! */
 	for (i=0; i<MAX_HASHSIZE; i++) {
-		tmp_item = mht.blocks[i];
+		tmp_item = mht->blocks[i];
 
 		if (tmp_item!=(HASH_ITEM*)NULL) {
 			free_lbuf( tmp_item->data );
@@ -372,1173 +941,4747 @@ void mht_exit(void) {
 	}
 
 	/* Free the hashtable data structure of the MHT blocks */
-	free_hashtab(mht.blocks);
+	free_hashtab(mht->blocks);
 }
 
 
 /*
-	Register a new macro. If the macro is already registered,
-	the macro is overwritten wit the new definition. Returns
-	1 if the macro was successful registered, 0 otherwise.
+	Begin a request scope: the macros defined, undefined or tainted
+	from now on are kept apart, the macros of the state are only read
+	(the prologue of a server, see serve.c). mht_scope_end drops them
+	all at once, a new scope ends the current one.
 */
-int mht_register_macro( char *name, char *definition ) {
-	return( (add_hash_item(mht.macros,name,(char*)definition,(size_t)_str_len(definition)+1,ITEM_TYPE_STRING))!=(HASH_ITEM*)NULL ? 1 : 0 );
+void mht_scope_begin(void) {
+	if (mht->scope.active==1) {
+		mht_scope_end();
+	}
+
+	if (mht->scope.slots==(HASH_ITEM**)NULL) {
+		mht->scope.slots = (HASH_ITEM**)_calloc(MAX_SCOPE_HASHSIZE,sizeof(HASH_ITEM*));
+		mht->scope.stamps = (unsigned long*)_calloc(MAX_SCOPE_HASHSIZE,sizeof(unsigned long));
+	}
+
+	mht->scope.generation++;
+	mht->scope.active = 1;
+	mht_scope_reset();
 }
 
 
 /*
-	Search for a macro. Returns 1 if the macro is registered, 0 otherwise.
-	If the macro is registered, result will point to the definition string
-	of the macro.
+	End the request scope, the macros of the state are as before
+	mht_scope_begin then. The slots and the memory of the scope are
+	kept for the next one, so this takes the same time for any number
+	of macros.
 */
-int mht_search_macro( char *name, char **result ) {
-	unsigned int found = 0;
-	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+void mht_scope_end(void) {
+	if (mht->scope.active==0) {
+		return;
+	}
 
-	if ((tmp_item=get_hash_item(mht.macros,name))==(HASH_ITEM*)NULL) {
-		found = 0;
-		(*result) = (char*)NULL;
+	/* A cached block must not outlive the macros it read */
+	if (mht->cache_depth>0) {
+		mht_cache_spoil();
 	}
-	else {
-		found = 1;
-		(*result) = (char*)tmp_item->data;
+
+	if (mht->scope.memo==1) {
+		mht_memo_flush();
 	}
 
-	return (found);
+	mht->scope.generation++;
+	mht->scope.active = 0;
+	mht_scope_reset();
 }
 
 
 /*
-	Register a new MHT block.
+	Returns 1 between mht_scope_begin and mht_scope_end, 0 otherwise.
 */
-int mht_register_block( char *block_name, LINE_BUFFER *first_line ) {
-	return ( (add_hash_item(mht.blocks,(char*)block_name,(LINE_BUFFER*)first_line,sizeof(LINE_BUFFER),ITEM_TYPE_LBUF))!=(HASH_ITEM*)NULL ? 1 : 0 );
+int mht_scope_active(void) {
+	return (mht->scope.active);
 }
 
 
 /*
-	Search for a registered block.
+	Forget the macros and the memory of the scope.
 */
-LINE_BUFFER *mht_search_block( char *block_name ) {
-	HASH_ITEM
-		*tmp_item = (HASH_ITEM*)NULL;
+void mht_scope_reset(void) {
+	mht->scope.count = 0;
+	mht->scope.memo = 0;
+	mht->scope.chunk = mht->scope.first;
 
-	tmp_item = get_hash_item(mht.blocks,block_name);
-	return ( (tmp_item==(HASH_ITEM*)NULL) ? (LINE_BUFFER*)NULL : (LINE_BUFFER*)tmp_item->data );
+	if (mht->scope.first!=(SCOPE_CHUNK*)NULL) {
+		mht->scope.first->used = 0;
+	}
 }
 
 
 /*
-	Register a block parameter. If the parameter is already registered,
-	the parameter is overwritten wit the new definition. Returns 1 if
-	the parameter was successful registered, 0 otherwise. The name of a
-	block parameter is "block.%n" for the n-th parameter of block "block".
+	Allocate memory of the request scope, it is valid until the scope
+	ends.
 */
-int mht_register_block_param( char *block_param, char *param ) {
-	return( (add_hash_item(mht.block_params,block_param,(char*)param,(size_t)_str_len(param)+1,ITEM_TYPE_STRING))!=(HASH_ITEM*)NULL ? 1 : 0 );
-}
+void *mht_scope_alloc( size_t size ) {
+	SCOPE_CHUNK
+		*chunk = mht->scope.chunk,
+		*new_chunk = (SCOPE_CHUNK*)NULL;
 
+	size = SCOPE_ROUND(size);
 
-/*
-	Undef (erase) a registered block parameter.
-*/
-int mht_undef_block_param( char *block_param ) {
-	return( del_hash_item(mht.block_params,block_param) );
+	if (chunk==(SCOPE_CHUNK*)NULL || chunk->used+size>chunk->size) {
+		if (chunk!=(SCOPE_CHUNK*)NULL && chunk->next!=(SCOPE_CHUNK*)NULL && chunk->next->size>=size) {
+			chunk = chunk->next;
+		}
+		else {
+			/* A chunk of an earlier scope that is too small stays behind the new one */
+			new_chunk = (SCOPE_CHUNK*)_malloc(SCOPE_ROUND(sizeof(SCOPE_CHUNK))+((size>SCOPE_CHUNK_SIZE) ? size : SCOPE_CHUNK_SIZE));
+			new_chunk->size = (size>SCOPE_CHUNK_SIZE) ? size : SCOPE_CHUNK_SIZE;
+
+			if (chunk==(SCOPE_CHUNK*)NULL) {
+				new_chunk->next = mht->scope.first;
+				mht->scope.first = new_chunk;
+			}
+			else {
+				new_chunk->next = chunk->next;
+				chunk->next = new_chunk;
+			}
+			chunk = new_chunk;
+		}
+
+		chunk->used = 0;
+		mht->scope.chunk = chunk;
+	}
+
+	chunk->used += size;
+	return ((char*)chunk+SCOPE_ROUND(sizeof(SCOPE_CHUNK))+chunk->used-size);
 }
 
 
 /*
-	Search for a block parameter. Returns 1 if the parameter is registered,
-	0 otherwise. If the parameter is registered, result will point to the
-	definition string of the parameter.
+	Returns the macro of the request scope, a tombstone (without data)
+	if it was undefined in the scope, or NULL if the scope has none of
+	the name.
 */
-unsigned int mht_search_block_param( char *block_param, char **result ) {
-	unsigned int found = 0;
+HASH_ITEM *mht_scope_item( char *name ) {
+	unsigned int slot = 0;
 	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
 
-	if ((tmp_item=get_hash_item(mht.block_params,block_param))==(HASH_ITEM*)NULL) {
-		found = 0;
-		(*result) = (char*)NULL;
+	if (mht->scope.count==0) {
+		return ((HASH_ITEM*)NULL);
 	}
-	else {
-		found = 1;
-		(*result) = (char*)tmp_item->data;
+
+	slot = hash(name) & (MAX_SCOPE_HASHSIZE-1);
+	if (mht->scope.stamps[slot]!=mht->scope.generation) {
+		return ((HASH_ITEM*)NULL);
 	}
 
-	return (found);
+	for (tmp_item=mht->scope.slots[slot]; tmp_item!=(HASH_ITEM*)NULL; tmp_item=tmp_item->next) {
+		if (QUICK_STRCMP(tmp_item->key,name)==0) {
+			return (tmp_item);
+		}
+	}
+
+	return ((HASH_ITEM*)NULL);
 }
 
 
 /*
-	Undef (erase) a registered macro.
+	Define a macro in the request scope, a NULL definition leaves a
+	tombstone which hides the macro of the state. The flags and the
+	version of the macro are reset.
 */
-int mht_undef_macro( char *name ) {
-	return( del_hash_item(mht.macros,name) );
-}
+HASH_ITEM *mht_scope_add( char *name, char *definition ) {
+	unsigned int slot = 0;
+	size_t len = 0;
+	HASH_ITEM *tmp_item = mht_scope_item(name);
+
+	if (tmp_item==(HASH_ITEM*)NULL) {
+		slot = hash(name) & (MAX_SCOPE_HASHSIZE-1);
+		if (mht->scope.stamps[slot]!=mht->scope.generation) {
+			mht->scope.stamps[slot] = mht->scope.generation;
+			mht->scope.slots[slot] = (HASH_ITEM*)NULL;
+		}
 
+		len = _str_len(name)+1;
+		tmp_item = (HASH_ITEM*)mht_scope_alloc(sizeof(HASH_ITEM));
+		tmp_item->key = (char*)memcpy(mht_scope_alloc(len),name,len);
+		tmp_item->type = ITEM_TYPE_PTR;
+		tmp_item->next = mht->scope.slots[slot];
+		mht->scope.slots[slot] = tmp_item;
+		mht->scope.count++;
+	}
 
-/*
-	Free (erase) a MHT block.
-*/
-int mht_undef_block( char *block ) {
-	return( del_hash_item(mht.blocks,block) );
-}
+	if (definition!=(char*)NULL) {
+		len = _str_len(definition)+1;
+		tmp_item->data = memcpy(mht_scope_alloc(len),definition,len);
+	}
+	else {
+		tmp_item->data = (void*)NULL;
+	}
+	tmp_item->flags = 0;
+	tmp_item->version = 0;
 
+	return (tmp_item);
+}
 
 
 /*
-	Load a MHT source file. All MHT directives outside a block
-	a processed immediately after they are read in, blocks are
-	stored in a hash.
+	Returns the macro of the request scope, or of the state if the scope
+	has none of the name. Returns NULL if the macro is undefined.
 */
-int mht_quickopen( FILE *out, char *fname ) {
-	FILE
-		*fptr = (FILE*)NULL;
+HASH_ITEM *mht_macro_item( char *name ) {
+	HASH_ITEM *tmp_item = mht_scope_item(name);
 
-	LINE_BUFFER
-		*current_line = (LINE_BUFFER*)NULL,
-		*current_mht_block = (LINE_BUFFER*)NULL;
+	if (tmp_item!=(HASH_ITEM*)NULL) {
+		return ((tmp_item->data!=(void*)NULL) ? tmp_item : (HASH_ITEM*)NULL);
+	}
 
-	char
-		line[MAX_LEN],
-		block_name[128],
-		*tmp = (char*)NULL,
-		*token_ptr = (char*)NULL;
+	return (get_hash_item(mht->macros,name));
+}
 
-	unsigned int
-		mht_err = MHT_OK,
-		first_line = 0,
-		last_line = 0,
-		line_count = 0,
-		i = 0;
 
+/*
+	Register a new macro. If the macro is already registered,
+	the macro is overwritten wit the new definition. Returns
+	1 if the macro was successful registered, 0 otherwise.
+*/
+int mht_register_macro( char *name, char *definition ) {
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	unsigned int redefined = 0;
 
-	mht.out = out;
-	fptr = fopen( fname, "r" );
+	/* A macro defined more than once is never folded into a block */
+	if (mht_macro_item(name)!=(HASH_ITEM*)NULL) {
+		mht_fold_invalidate(name);
+		redefined = 1;
+	}
 
-	if (fptr==NULL) {
-		mht_register_macro("mht_err_msg",mht_error_str[MHT_ERR_FILE_NOT_FOUND]);
-		return (MHT_ERR_FILE_NOT_FOUND);
+	/* A cached block must not define macros */
+	if (mht->cache_depth>0) {
+		mht_cache_spoil();
 	}
 
-	if (mht.recursive_file_inclusion>=MAX_FILE_INCLUSION) {
-		return (MHT_ERR_TOO_DEEP_FILE_INCLUSION);
+	if (mht->scope.active==1) {
+		tmp_item = mht_scope_add(name,definition);
+	}
+	else if ((tmp_item=add_hash_item(mht->macros,name,(char*)definition,(size_t)_str_len(definition)+1,ITEM_TYPE_STRING))==(HASH_ITEM*)NULL) {
+		return (0);
 	}
 
-	block_name[0] = '\0';
-	line[0] = '\0';
-	mht.recursive_file_inclusion++;
+	if (redefined==1) {
+		tmp_item->flags = MHT_MACRO_REDEFINED;
+	}
+	tmp_item->version = ++mht->macro_version;
 
-	/*
-		Switch to a new if-context for this MHT file.
-		Everything outside the MHT blocks, before any
-		if-conditional, is TRUE per default (evident).
-	*/
-	INC_IF_CONTEXT;
-	mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+	return (1);
+}
 
-	while (!feof(fptr)) {
-		line_count++;
-		fgets( line, MAX_LEN, fptr );
-
-		strcpy(tmp_str,line);
-		tmp = tmp_str;
-		while (isspace(*tmp)) {
-			tmp++;
-		}
-
-		token_ptr = strtok(tmp," \t\n\r\0");
-		last_line = 0;
-
-		if (token_ptr!=(char*)NULL) {
-			if ( QUICK_STRCMP(strlwr(token_ptr),"#begin")==0 ) {
-				/* A block cannot contain another block */
-				if (mht.read_block==1) {
-					mht_register_error_macros(mht_error_str[MHT_ERR_BEGIN_DIRECTIVE_INSIDE_BLOCK],line,MHT_ERR_BEGIN_DIRECTIVE_INSIDE_BLOCK);
-					return (MHT_ERR_BEGIN_DIRECTIVE_INSIDE_BLOCK);
-				}
-
-				/* Filehandles must be closed before reading a block */
-				if (mht.write_to_file==1) {
-					mht_register_error_macros(mht_error_str[MHT_ERR_BEGIN_DIRECTIVE_FHANDLE_NOT_CLOSED],line,MHT_ERR_BEGIN_DIRECTIVE_FHANDLE_NOT_CLOSED);
-					return (MHT_ERR_BEGIN_DIRECTIVE_FHANDLE_NOT_CLOSED);
-				}
 
-				token_ptr = strtok( (char*)NULL, " \t\n\r\0" );
-				sprintf(block_name,"%s",token_ptr);
-				mht.read_block = 1;
-				first_line = 1;
-				last_line = 0;
-			}
+/*
+	Search for a macro. Returns 1 if the macro is registered, 0 otherwise.
+	If the macro is registered, result will point to the definition string
+	of the macro.
+*/
+int mht_search_macro( char *name, char **result ) {
+	unsigned int flags = 0;
 
-			else if ( QUICK_STRCMP(strlwr(token_ptr),"#end")==0 ) {
-				/* A block cannot be closed if there wasn't a #begin directive before */
-				if (mht.read_block==0) {
-					mht_register_error_macros(mht_error_str[MHT_ERR_END_DIRECTIVE_OUTSIDE_BLOCK],line,MHT_ERR_END_DIRECTIVE_OUTSIDE_BLOCK);
-					return (MHT_ERR_END_DIRECTIVE_OUTSIDE_BLOCK);
-				}
+	return (mht_search_macro_flags(name,result,&flags));
+}
 
-				token_ptr = strtok( (char*)NULL, " \t\n\r\0" );
 
-				/* the blocknames of the #begin and #end directive do not match */
-				if (QUICK_STRCMP(block_name,token_ptr)!=0) {
-					mht_register_error_macros(mht_error_str[MHT_ERR_END_DIRECTIVE_BLOCKNAME_WRONG],line,MHT_ERR_END_DIRECTIVE_BLOCKNAME_WRONG);
-					return (MHT_ERR_END_DIRECTIVE_BLOCKNAME_WRONG);
-				}
+/*
+	Search for a macro and return its definition and its flags
+	(MHT_PROVIDER_TAINTED).
+*/
+int mht_search_macro_flags( char *name, char **result, unsigned int *flags ) {
+	unsigned int found = 0;
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	MHT_DICT *dict = (MHT_DICT*)NULL;
 
-				/* Before reading a block is finished, a possible open filehandle must be closed */
-				if (mht.write_to_file==1) {
-					mht_register_error_macros(mht_error_str[MHT_ERR_END_DIRECTIVE_FHANDLE_NOT_CLOSED],line,MHT_ERR_END_DIRECTIVE_FHANDLE_NOT_CLOSED);
-					return (MHT_ERR_END_DIRECTIVE_FHANDLE_NOT_CLOSED);
-				}
+	(*flags) = 0;
 
-				mht_register_block(block_name,(LINE_BUFFER*)current_mht_block);
-				mht.read_block = 0;
-				block_name[0] = '\0';
-				current_line = (LINE_BUFFER*)NULL;
-				last_line = 1;
-			}
+	/* The loop variables of #foreach directives hide "usual" macros */
+	if (mht->binding_count>0 && mht_search_binding(name,result,flags)==1) {
+		if (mht->cache_depth>0) {
+			mht_cache_read(name,1);
 		}
+		return (1);
+	}
 
-		if (mht.read_block==1) {
-			/* The lines of a block are stored in a simple linked list */
-			if (first_line==0) {
-				if( current_line!=(LINE_BUFFER*)NULL ) {
-					current_line->next = (LINE_BUFFER*)_malloc(sizeof(LINE_BUFFER));
-					current_line = current_line->next;
-				}
-				else {
-					current_mht_block = current_line = (LINE_BUFFER*)_malloc(sizeof(LINE_BUFFER));
-				}
+	if ((tmp_item=mht_macro_item(name))==(HASH_ITEM*)NULL) {
+		found = 0;
+		(*result) = (char*)NULL;
 
-				current_line->content = (char*)_calloc( (size_t)_str_len(line)+1, sizeof(char) );
-				strncpy(current_line->content,line,_str_len(line));
-				current_line->content[_str_len(current_line->content)] = '\0';
-				current_line->next = (LINE_BUFFER*)NULL;
+		/* Maybe the macro is computed when it is used first */
+		if (mht_search_provider(name,result)==1) {
+			if ((tmp_item=mht_macro_item(name))!=(HASH_ITEM*)NULL) {
+				(*flags) = tmp_item->flags;
 			}
-			else {
-				first_line = 0;
+			if (mht->cache_depth>0) {
+				mht_cache_read(name,0);
 			}
+			return (1);
 		}
-		else if (last_line==0) {
-			/*
-				If we do not read the lines of a block currently, go ahead
-				and process the line directly.
-			*/
-			mht_err = mht_process_line(line);
 
-			if (mht_err!=MHT_OK) {
-				fclose(fptr);
-				mht_register_error_macros(mht_error_str[mht_err],line,mht_err);
-				return (mht_err);
+		/* Fall back to the read-only dictionaries */
+		for (dict=mht->dicts; dict!=(MHT_DICT*)NULL; dict=dict->next) {
+			if (((*result)=dict_lookup(dict,name))!=(char*)NULL) {
+				found = 1;
+				break;
 			}
 		}
 
-		line[0] = '\0';
+		/* And to the macros of a shared state, see mht_state_share */
+		if (found==0 && mht->shared!=(MHT_INFO*)NULL && (tmp_item=get_hash_item(mht->shared->macros,name))!=(HASH_ITEM*)NULL) {
+			found = 1;
+			(*result) = (char*)tmp_item->data;
+			(*flags) = tmp_item->flags;
+		}
 	}
-
-	fclose(fptr);
-	mht.recursive_file_inclusion--;
-
-	i=GET_IF_LEVEL;
-	if (i>0) {
-		mht_register_macro("mht_err_msg",mht_error_str[MHT_ERR_IF_COUNT_ENDIF_IS_MISSING]);
-		return (MHT_ERR_IF_COUNT_ENDIF_IS_MISSING);
+	else {
+		found = 1;
+		(*result) = (char*)tmp_item->data;
+		(*flags) = tmp_item->flags;
 	}
 
-	/*
-		Reset the if-stack of the current if-context
-		back to default values, and decrement the
-		if-context level to process further the
-		previous if-context.
-	*/
-	mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
-	mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
-	mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 0;
-	DEC_IF_CONTEXT;
+	if (mht->cache_depth>0) {
+		mht_cache_read(name,0);
+	}
 
-	return (MHT_OK);
+	return (found);
 }
 
 
 /*
-	Process the lines of a block with optional arguments.
+	Mark a macro as tainted. If the macro has a provider which did not
+	compute the macro yet, the provider is marked. Returns 1 if the
+	macro or a provider was found.
 */
-int mht_process_with_params( FILE *out, char *blockname, char **block_params, int block_param_count ) {
-	int
-		i = 0,
-		mht_err = MHT_OK;
-
-	char
-		block_param[MACRO_LEN];
+int mht_taint_macro( char *name ) {
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	int found = 0;
 
+	if ((tmp_item=mht_macro_item(name))!=(HASH_ITEM*)NULL) {
+		mht_fold_invalidate(name);
 
-	/*
-		Pls. refer to mht_process to read why this is done here...!
-	*/
-	if (GET_IF_CONTEXT==0 && GET_IF_LEVEL==0) {
-		INC_IF_CONTEXT;
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+		/* In a request scope, the macros of the state are only read */
+		if (mht->scope.active==1 && mht_scope_item(name)==(HASH_ITEM*)NULL) {
+			tmp_item = mht_scope_add(name,(char*)tmp_item->data);
+		}
+		tmp_item->flags |= MHT_PROVIDER_TAINTED;
+		tmp_item->version = ++mht->macro_version;
+		found = 1;
 	}
 
-	if (block_params==(char**)NULL) {
-		/* The block was called without any parameter, process the block... */
-		mht_err = mht_process(out,blockname);
-		return (mht_err);
+	if ((tmp_item=get_hash_item(mht->providers,name))!=(HASH_ITEM*)NULL) {
+		((PROVIDER_INFO*)tmp_item->data)->flags |= MHT_PROVIDER_TAINTED;
+		found = 1;
 	}
 
-	/*
-		If the block was called with parameters, go and register
-		each parameter as its own macro.
-	*/
-	if (block_param_count>0) {
-		for (i=1; i<block_param_count; i++) {
-			if (block_params[i]!=(char*)NULL) {
-				/* Block parameters are registered under the name "block.%n" */
-				block_param[0] = '\0';
-				sprintf(block_param,"%s.%%%d",blockname,i);
-				mht_register_block_param(block_param,block_params[i]);
-			}
-		}
-	}
+	return (found);
+}
 
-	/* Process the block... */
-	mht_err = mht_process(mht.out,block_params[0]);
 
-	/*
-		If the block was called with parameters, go and undefine
-		all previously registered block parameters.
-	*/
-	if (block_param_count>0) {
-		for (i=1; i<block_param_count; i++) {
-			if (block_params[i]!=(char*)NULL) {
-				/* Block parameters are registered under the name "block.%n" */
-				block_param[0] = '\0';
-				sprintf(block_param,"%s.%%%d",blockname,i);
-				mht_undef_block_param(block_param);
-			}
-		}
+/*
+	Register a provider for a macro. The macro is defined by the provider
+	the first time it is referenced, a later #def overrides it as usual.
+	The argument (a string or NULL) is copied. Returns 1 if the provider
+	was registered, 0 otherwise.
+*/
+int mht_register_provider( char *name, MHT_PROVIDER provider, char *arg, unsigned int flags ) {
+	PROVIDER_INFO *info = (PROVIDER_INFO*)NULL;
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+
+	if (name==(char*)NULL || provider==(MHT_PROVIDER)NULL) {
+		return (0);
 	}
 
-	if (GET_IF_CONTEXT==0 && GET_IF_LEVEL==0) {
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 0;
-		DEC_IF_CONTEXT;
+	if ((tmp_item=get_hash_item(mht->providers,name))!=(HASH_ITEM*)NULL) {
+		info = (PROVIDER_INFO*)tmp_item->data;
+		free(info->arg);
+	}
+	else {
+		info = (PROVIDER_INFO*)_malloc(sizeof(PROVIDER_INFO));
+		info->name = strdup(name);
+		info->next = mht->provider_list;
+		mht->provider_list = info;
+		add_hash_item(mht->providers,name,info,sizeof(PROVIDER_INFO),ITEM_TYPE_PTR);
 	}
 
-	return (mht_err);
+	info->func = provider;
+	info->arg = (arg!=(char*)NULL) ? strdup(arg) : (char*)NULL;
+	info->flags = flags;
+	info->defined = 0;
+	info->undefined = 0;
+	info->data = (void*)NULL;
+	info->scope = 0;
+
+	return (1);
 }
 
 
 /*
-	Process the lines of a block with optional arguments.
+	Compute and register the definition of a macro that has a provider.
+	A provider is asked only once and never after a #undef of the macro
+	(volatile providers are asked again after mht_refresh_providers).
+	The definition of a tainted provider belongs to the request scope,
+	if any, the provider is asked again in the next scope.
 */
-int mht_loop( FILE *out, char *blockname, char **block_params, int block_param_count ) {
-	int
-		strlen_block_param2 = 0,
-		strlen_block_param3 = 0,
-		i = 0,
-		start = 0,
-		end = 0,
-		mht_err = MHT_OK;
-
-	char index_str[16];
-
+unsigned int mht_search_provider( char *name, char **result ) {
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	PROVIDER_INFO *info = (PROVIDER_INFO*)NULL;
+	char value[MAX_LEN];
 
-	if ( (block_params==(char**)NULL) || (block_param_count<4) ) {
-		/* The loop was called without any parameter... */
-		return (MHT_ERR_LOOP_WITHOUT_ENOUGH_PARAMETERS);
+	if ((tmp_item=get_hash_item(mht->providers,name))==(HASH_ITEM*)NULL) {
+		return (0);
 	}
 
-	/* Check whether the start/end indices are decimal numbers: */
-	for (i=0,strlen_block_param2=(int)_str_len(block_params[2]);i<strlen_block_param2;i++) {
-		if (!isdigit(block_params[2][i])) {
-			return (MHT_ERR_LOOP_NO_INTEGER_PARAMETERS);
-		}
+	info = (PROVIDER_INFO*)tmp_item->data;
+	if (info->undefined==1 || (info->defined==1 && (info->scope==0 || info->scope==mht->scope.generation))) {
+		return (0);
 	}
 
-	for (i=0,strlen_block_param3=(int)_str_len(block_params[3]);i<strlen_block_param3;i++) {
-		if (!isdigit(block_params[3][i])) {
-			return (MHT_ERR_LOOP_NO_INTEGER_PARAMETERS);
-		}
+	/* Undefined in the request scope (but not dropped by mht_refresh_providers) */
+	if (mht->scope.active==1 && info->scope!=mht->scope.generation && (tmp_item=mht_scope_item(name))!=(HASH_ITEM*)NULL) {
+		return (0);
 	}
 
-	/* Get the start/end indices for the for-loop: */
-	start = (int)strtol( block_params[2], (char **)NULL, 10 );
-	end = (int)strtol( block_params[3], (char **)NULL, 10 );
-
-	index_str[0] = '\0';
+	info->defined = 1;
+	info->scope = 0;
+	value[0] = '\0';
 
-	/* Loop the block: */
-	for (i=start;i<=end;i++) {
-		sprintf( index_str, "%d", i );
-		mht_register_macro( block_params[1], index_str );
-		mht_err = mht_process( out, block_params[0] );
+	if ((*result=info->func(info->arg,value,MAX_LEN))==(char*)NULL) {
+		return (0);
+	}
 
-		if (mht_err!=MHT_OK) {
-			return (mht_err);
-		}
+	if (mht->scope.active==1 && (info->flags & MHT_PROVIDER_TAINTED)) {
+		info->scope = mht->scope.generation;
+		tmp_item = mht_scope_add(name,*result);
+	}
+	else if ((tmp_item=add_hash_item(mht->macros,name,*result,(size_t)_str_len(*result)+1,ITEM_TYPE_STRING))==(HASH_ITEM*)NULL) {
+		return (0);
 	}
 
-	return (mht_err);
+	info->data = tmp_item->data;
+	tmp_item->flags = info->flags & MHT_PROVIDER_TAINTED;
+	tmp_item->version = ++mht->macro_version;
+	(*result) = (char*)tmp_item->data;
+
+	return (1);
 }
 
 
 /*
-	Process the lines of a MHT block.
+	Drop the definitions computed by volatile providers (the date and
+	time macros), so that they are computed again when used next time.
+	Long running programs may call this on a clock tick. Definitions
+	replaced via #def or undefined in the meantime are left alone.
 */
-int mht_process( FILE *out, char *block_name ) {
-	int
-		mht_err = MHT_OK;
+void mht_refresh_providers(void) {
+	PROVIDER_INFO *info = (PROVIDER_INFO*)NULL;
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
 
-	LINE_BUFFER
-		*line_of_block = (LINE_BUFFER*)NULL;
+	for (info=mht->provider_list; info!=(PROVIDER_INFO*)NULL; info=info->next) {
+		if ((info->flags & MHT_PROVIDER_VOLATILE) && info->defined==1 && info->undefined==0) {
+			tmp_item = (info->scope==0) ? get_hash_item(mht->macros,info->name) : mht_scope_item(info->name);
 
-	/*
-		Every MHT template has its own if-context (recursion!).
-		So if quickopen reads in a new template, it swithes to
-		a new if-context which is TRUE per default. After the
-		template is read in, the if-context is decremented again,
-		and so always FALSE in case we want to process a block from
-		a CGI program!
-		So if the if-context and if-level are both 0, it is assumed
-		that a block from within a template is processed out of a
-		CGI program. In this case, we will do the same as in quickopen:
-		increment the if-context, and afterwards decerement it again.
-	*/
-	if (GET_IF_CONTEXT==0 && GET_IF_LEVEL==0) {
-		INC_IF_CONTEXT;
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+			if (tmp_item!=(HASH_ITEM*)NULL && tmp_item->data==info->data) {
+				if (info->scope==0) {
+					/* A definition of the state, not of the request scope */
+					mht_fold_invalidate(info->name);
+					del_hash_item(mht->macros,info->name);
+				}
+				else {
+					/* The provider is asked again in the scope, see mht_search_provider */
+					mht_undef_macro(info->name);
+					info->scope = mht->scope.generation;
+				}
+				info->defined = 0;
+			}
+			else if (tmp_item==(HASH_ITEM*)NULL) {
+				info->defined = 0;
+			}
+		}
 	}
+}
 
-	mht.out = out;
-	line_of_block = mht_search_block(block_name);
 
-	if (line_of_block==(LINE_BUFFER*)NULL) {
-		mht_register_error_macros(mht_error_str[MHT_ERR_PROCESS_BLOCK_NOT_FOUND],"",MHT_ERR_PROCESS_BLOCK_NOT_FOUND);
-		return (MHT_ERR_PROCESS_BLOCK_NOT_FOUND);
-	}
+/*
+	The provider of the date and time macros, arg is the name of the macro.
+*/
+char *mht_date_provider( char *arg, char *buf, unsigned int size ) {
+	unsigned int
+		year = 0,
+		month = 0,
+		wday = 0,
+		mday = 0;
 
-	while (line_of_block!=(LINE_BUFFER*)NULL) {
-		mht_err = mht_process_line(line_of_block->content);
+	time_t rawtime;
+	struct tm
+		*timeinfo = (struct tm*)NULL,
+		tm_buf;
 
-		if (mht_err!=MHT_OK) {
-			mht_register_error_macros(mht_error_str[mht_err],line_of_block->content,mht_err);
-			return (mht_err);
-		}
 
-		line_of_block = line_of_block->next;
-	}
+	time(&rawtime);
+#ifndef WIN32
+	timeinfo = localtime_r(&rawtime,&tm_buf);
+#else
+	timeinfo = localtime(&rawtime);
+#endif
 
-	if (GET_IF_CONTEXT==0 && GET_IF_LEVEL==0) {
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 0;
-		DEC_IF_CONTEXT;
-	}
+	year = (timeinfo->tm_year < 2000) ? 1900 + timeinfo->tm_year : timeinfo->tm_year;
+	month = timeinfo->tm_mon;
+	wday = timeinfo->tm_wday;
+	mday = timeinfo->tm_mday;
 
-	return (MHT_OK);
-}
-
-void mht_register_error_macros( char *err_msg, char *err_line, int err_code ) {
-	if (!mht.error_macros_registered) {
-		mht_register_macro("mht_err_msg",err_msg);
-		mht_register_macro("mht_err_line",err_line);
-		sprintf(tmp_str,"%d",err_code);
-		mht_register_macro("mht_err_code",tmp_str);
-		mht.error_macros_registered = 1;
+	if (QUICK_STRCMP(arg,"short_date")==0) {
+		strftime(buf,size,"%m/%d/%Y",timeinfo);
+	}
+	else if (QUICK_STRCMP(arg,"kurzes_datum")==0) {
+		strftime(buf,size,"%d.%m.%Y",timeinfo);
+	}
+	else if (QUICK_STRCMP(arg,"long_date")==0) {
+		sprintf(buf,"%s, %s %d, %d", mht_eng_wday[wday], mht_eng_month[month], mday, year);
+	}
+	else if (QUICK_STRCMP(arg,"langes_datum")==0) {
+		sprintf(buf,"%s, %d. %s %d", mht_ger_wday[wday], mday, mht_ger_month[month], year);
+	}
+	else if (QUICK_STRCMP(arg,"time")==0) {
+		sprintf(buf,"%d:%02d",timeinfo->tm_hour,timeinfo->tm_min);
+	}
+	else {
+		return ((char*)NULL);
 	}
-}
 
-int keyw_strcmp( const void *el1, const void *el2 ) {
-  return QUICK_STRCMP( (char*)el1, (char*)el2 );
+	return (buf);
 }
 
 
-char *is_mht_keyword( char *pos ) {
-  char test_id[MAX_MHT_KEYW_LEN];
-  register unsigned int i = 0;
+/*
+	The provider of constant macros, arg is the definition.
+*/
+char *mht_const_provider( char *arg, char *buf, unsigned int size ) {
+	return (arg);
+}
 
-  test_id[0]='\0';
-  for (i=0;i<MAX_MHT_KEYW_LEN && isalnum(*pos);test_id[i++]=*(pos++));
-  test_id[i]='\0';
 
-  return bsearch(test_id,mht_keyw,MAX_MHT_KEYW_COUNT,sizeof(char[MAX_MHT_KEYW_LEN]),keyw_strcmp);
+/*
+	The provider of environment variables, arg is the name of the variable.
+*/
+char *mht_env_provider( char *arg, char *buf, unsigned int size ) {
+	return (getenv(arg));
 }
 
 
 /*
-	Process the directives in a single MHT line.
+	Hash a builtin name (FNV-1a, the basis is mixed with seed) and
+	return its length in len.
 */
-int mht_process_line( char *line ) {
-	int
-		result = 0,
-		param_start = 0,
-		fence = 0,
-		mht_err = MHT_OK,
-		block_param_count = 0;
+unsigned int mht_builtin_hash( char *name, unsigned int *len, unsigned int seed ) {
+	unsigned int
+		hash = 2166136261U ^ (seed * 0x9e3779b9U),
+		i = 0;
 
-	char
-		*mht_keyw = (char*)NULL,
-		tmp_line[MAX_LEN],
-		*tmp = (char*)NULL,
-		*token_ptr = (char*)NULL,
-		token1[MACRO_LEN], token2[MAX_LEN], token3[MAX_LEN],
-		*block_params[MAX_ARG_COUNT];
+	for (i=0; name[i]!='\0'; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619U;
+	}
 
+	hash ^= hash >> 15;
+	(*len) = i;
 
-	strcpy(tmp_line,line);
-	tmp_line[_str_len(line)] = '\0';
-	tmp = tmp_line;
-	token1[0] = '\0';
-	token2[0] = '\0';
-	token3[0] = '\0';
+	return (hash);
+}
 
-	while (isspace(*tmp)) {
-		tmp++;
-	}
 
-	if (*tmp=='#') {
-		/* Check if it is delayed directive (fence>1) */
-		while (*tmp=='#') {
-			fence++;
-			tmp++;
-		}
+/*
+	Build the perfect hash table of the builtins: search a seed which
+	maps every builtin into its own slot, so a lookup needs exactly one
+	hash and one string compare. The table grows if no seed is found.
+	Returns 1 on success, 0 otherwise.
+*/
+int mht_build_builtin_table(void) {
+	unsigned int
+		size = 8,
+		seed = 0,
+		slot = 0,
+		len = 0,
+		i = 0,
+		collision = 0;
 
-		if ((token_ptr=strtok(tmp," \t\n\r\0"))==(char*)NULL) return (MHT_OK);
+	BUILTIN_INFO **table = (BUILTIN_INFO**)NULL;
 
-		strlwr(token_ptr);
-		if ((mht_keyw=is_mht_keyword(token_ptr))==(char*)NULL) {
-			/* The token with a leading '#' is NOT a MHT directive/keyword! */
-			return (MHT_OK);
-		}
 
-		if (fence>1) {
-			/* Ok, it is a delayed directive/keyword, do it from the start again! */
-			if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true==1) {
-				strcpy(tmp_line,line);
-				tmp = tmp_line;
+	while (size < mht->builtin_count*2) {
+		size <<= 1;
+	}
 
-				while (isspace(*tmp)) {
-					tmp++;
-				}
+	for (; size<=65536; size<<=1) {
+		table = (BUILTIN_INFO**)_realloc(table,size*sizeof(BUILTIN_INFO*));
 
-				memmove(tmp,tmp+1,_str_len(tmp));
-				tmp_line[_str_len(tmp_line)] = '\0';
+		for (seed=1; seed<=64; seed++) {
+			memset(table,0,size*sizeof(BUILTIN_INFO*));
 
-				mht_expand(tmp_line);
+			for (i=0,collision=0; i<mht->builtin_count && collision==0; i++) {
+				slot = mht_builtin_hash(mht->builtins[i].name,&len,seed) & (size-1);
 
-				if (mht.conv_umlauts==1) {
-					mht_replace_umlauts(tmp_line);
+				if (table[slot]!=(BUILTIN_INFO*)NULL) {
+					collision = 1;
 				}
-
-				if (mht.killspace==1) {
-					mht_killspace(tmp_line);
+				else {
+					table[slot] = &mht->builtins[i];
 				}
+			}
 
-				if (mht.writeoutput==1) {
-					mht_print_line(tmp_line);
+			if (collision==0) {
+				if (mht->builtin_table!=(BUILTIN_INFO**)NULL) {
+					free(mht->builtin_table);
 				}
+
+				mht->builtin_table = table;
+				mht->builtin_mask = size-1;
+				mht->builtin_seed = seed;
+
+				return (1);
 			}
-			return (MHT_OK);
 		}
+	}
 
-		/* #if, #elif, #else or #endif directive. */
-		if (QUICK_STRCMP(mht_keyw,"if")==0
-			|| QUICK_STRCMP(mht_keyw,"elif")==0
-			|| QUICK_STRCMP(mht_keyw,"else")==0
-			|| QUICK_STRCMP(mht_keyw,"endif")==0) {
+	free(table);
 
-			/*
-				That is a bit too difficult to do it all in here!
-				Just set the if_count correct and then we will see
-				if we have to continue right here or return back.
-			*/
-			sprintf(token1,"%s",mht_keyw);
-			token_ptr = strtok((char*)NULL," \t\n\r\0");
+	return (0);
+}
 
-			if (token_ptr!=(char*)NULL) {
-				sprintf(token2,"%s",token_ptr);
-				mht_expand(token2);
-			}
-			else {
-				token2[0] = '\0';
-			}
 
-			mht_err = mht_set_if_count(token1,token2);
-			return (mht_err);
-		}
+/*
+	Register a builtin macro <#name|...>. A user defined macro or block
+	parameter of the same name hides the builtin. Returns 1 if the builtin
+	was registered, 0 otherwise.
+*/
+int mht_register_builtin( char *name, MHT_BUILTIN func, void *user_data ) {
+	BUILTIN_INFO *builtin = (BUILTIN_INFO*)NULL;
 
 
-		if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true==1) {
-			/* macro definition */
-			if (QUICK_STRCMP(mht_keyw,"def")==0) {
-				token_ptr = strtok((char*)NULL," \t\n\r\0");
+	if (name==(char*)NULL || name[0]=='\0' || func==(MHT_BUILTIN)NULL) {
+		return (0);
+	}
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_DEF_DIRECTIVE_WITHOUT_ARGS);
-				}
+	/* A builtin defines names which were undefined, so nothing folded or cached is valid anymore */
+	mht_fold_reset();
+	mht_cache_flush();
+	mht_memo_flush();
 
-				sprintf(token1,"%s",token_ptr);
-				mht_expand(token1);
+	/* Replace an existing builtin */
+	if ((builtin=mht_search_builtin(name))!=(BUILTIN_INFO*)NULL) {
+		builtin->func = func;
+		builtin->user_data = user_data;
+		return (1);
+	}
 
-				token_ptr = strtok((char*)NULL,"\t\n\r\0");
+	/* The table holds pointers into mht->builtins, so it is rebuilt after growing */
+	mht->builtins = (BUILTIN_INFO*)_realloc(mht->builtins,(mht->builtin_count+1)*sizeof(BUILTIN_INFO));
 
-				if (token_ptr!=(char*)NULL) {
-					sprintf(token2,"%s",token_ptr);
-					result = mht_register_macro(token1,token2);
-				}
-				else {
-					return (MHT_ERR_DEF_DIRECTIVE_WITHOUT_DEFINITION);
-				}
+	builtin = &mht->builtins[mht->builtin_count++];
+	builtin->name = strdup(name);
+	builtin->name_len = (unsigned int)strlen(name);
+	builtin->func = func;
+	builtin->user_data = user_data;
 
-				return (MHT_OK);
-			}
+	if (mht_build_builtin_table()==0) {
+		/* Drop the new builtin, the old table pointed into the reallocated array */
+		free(builtin->name);
+		mht->builtin_count--;
+		mht_build_builtin_table();
 
+		return (0);
+	}
 
-			/* macro definition, but with already expanded_ptr definition! */
-			else if (QUICK_STRCMP(mht_keyw,"defex")==0) {
-				token_ptr = strtok((char*)NULL," \t\n\r\0");
+	return (1);
+}
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_DEFEX_DIRECTIVE_WITHOUT_ARGS);
-				}
 
-				sprintf(token1,"%s",token_ptr);
-				mht_expand(token1);
+/*
+	Search a builtin macro, returns NULL if name is not a builtin.
+	Whether a reference calls the builtin is told by mht_call_builtin.
+*/
+BUILTIN_INFO *mht_search_builtin( char *name ) {
+	unsigned int
+		hash = 0,
+		len = 0;
 
-				token_ptr = strtok((char*)NULL,"\t\n\r\0");
+	BUILTIN_INFO *builtin = (BUILTIN_INFO*)NULL;
 
-				if (token_ptr!=(char*)NULL) {
-					sprintf(token2,"%s",token_ptr);
-					mht_register_macro(token1, mht_expand(token2));
-				}
-				else {
-					return (MHT_ERR_DEFEX_DIRECTIVE_WITHOUT_DEFINITION);
-				}
 
-				return (MHT_OK);
-			}
+	if (name==(char*)NULL || mht->builtin_table==(BUILTIN_INFO**)NULL) {
+		return ((BUILTIN_INFO*)NULL);
+	}
 
+	hash = mht_builtin_hash(name,&len,mht->builtin_seed);
+	builtin = mht->builtin_table[hash & mht->builtin_mask];
 
-			/* macro undefinition */
-			else if (QUICK_STRCMP(mht_keyw,"undef")==0) {
-				token_ptr = strtok((char*)NULL," \t\n\r\0");
+	if (builtin!=(BUILTIN_INFO*)NULL && builtin->name_len==len && memcmp(builtin->name,name,len)==0) {
+		return (builtin);
+	}
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_UNDEF_DIRECTIVE_WITHOUT_ARGS);
-				}
+	return ((BUILTIN_INFO*)NULL);
+}
 
-				sprintf(token1,"%s",token_ptr);
-				mht_expand(token1);
 
-				/* the macro might be a block parameter or a "usual" macro */
-				if ((strstr(token1,".%"))!=(char*)NULL) {
-					mht_undef_block_param(token1);
-				}
-				else {
-					mht_undef_macro(token1);
-				}
+/*
+	Search the builtin macro a reference to name calls: a macro or a block
+	parameter of the same name hides the builtin. Returns NULL if the
+	reference calls no builtin.
+*/
+BUILTIN_INFO *mht_call_builtin( char *name ) {
+	BUILTIN_INFO *builtin = mht_search_builtin(name);
+	char *dummy = (char*)NULL;
 
-				return (MHT_OK);
-			}
+	if (builtin==(BUILTIN_INFO*)NULL || mht_search_macro(name,&dummy)==1 || mht_search_block_param(name,&dummy)==1) {
+		return ((BUILTIN_INFO*)NULL);
+	}
 
+	return (builtin);
+}
 
-			/* free a MHT block */
-			else if (QUICK_STRCMP(mht_keyw,"undefblock")==0) {
-				token_ptr = strtok((char*)NULL," \t\n\r\0");
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_UNDEF_BLOCK_DIRECTIVE_WITHOUT_ARGS);
-				}
+/*
+	Append a string to the output of a builtin macro. The output is
+	truncated silently at the size of the builder.
+*/
+void mht_builder_append( MHT_BUILDER *out, char *str, unsigned int len ) {
+	if (str==(char*)NULL || out->len+1>=out->size) {
+		return;
+	}
 
-				sprintf(token1,"%s",token_ptr);
-				mht_expand(token1);
-				mht_undef_block(token1);
+	if (len > out->size-out->len-1) {
+		len = out->size-out->len-1;
+	}
 
-				return (MHT_OK);
-			}
+	memcpy(out->buf+out->len,str,len);
+	out->len += len;
+	out->buf[out->len] = '\0';
+}
 
 
-			/* process a block */
-			else if (QUICK_STRCMP(mht_keyw,"process")==0) {
-				token_ptr = strtok((char*)NULL,"\n\r\0");
+/*
+	Append the argument arg of a builtin, if it was given.
+*/
+void mht_builder_append_arg( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, int arg ) {
+	if (arg<arg_count) {
+		mht_builder_append(out,args[arg].ptr,args[arg].len);
+	}
+}
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_PROCESS_DIRECTIVE_WITHOUT_ARGS);
-				}
 
-				/*
-					Expand the name of the block to be processed and all
-					possible block parameters...
-				*/
-				sprintf(token1,"%s",token_ptr);
-				mht_expand(token1);
-				mht_trim(token1);
+/*
+	<#ifequal|str1|str2|TRUE|FALSE>
+	Any unexpanded macro parameters in str1 and str2 are treated as empty
+	strings, see mht_replace_unexpanded_params.
+*/
+int mht_builtin_ifequal( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	char *strs[3];
+	unsigned int
+		len1 = 0,
+		len2 = 0;
 
-				param_start = strcspn(token1,"|:");
+	strs[0] = args[0].ptr;
+	strs[1] = (arg_count>1) ? args[1].ptr : "";
+	strs[2] = (arg_count>2) ? args[2].ptr : "";
 
-				if (*(token1 + param_start)=='|') {
-					/* New form: block|param1|param2|... */
-					block_param_count = strsplit(token1,block_params,'|',MAX_ARG_COUNT);
-					/* Process the block with optional arguments */
-					mht_err = mht_process_with_params(mht.out,block_params[0],block_params,block_param_count);
-				}
-				else if (*(token1 + param_start)==':') {
-					/* Old form: block : param1 param2 ... */
-					block_param_count = mht_get_block_params(token1,block_params);
-					/* Process the block with optional arguments */
-					mht_err = mht_process_with_params(mht.out,block_params[0],block_params,block_param_count);
-				}
-				else {
-					/* The block is called without any parameters: */
-					mht_err = mht_process(mht.out,token1);
-				}
+	mht_replace_unexpanded_params( (arg_count<3) ? arg_count : 3, strs );
 
-				return (mht_err);
-			}
+	len1 = (unsigned int)strlen(strs[1]);
+	len2 = (unsigned int)strlen(strs[2]);
 
+	/* str1 AND str2 are NULL, <#null>, empty or undefined */
+	if (len1==0 && len2==0) {
+		mht_builder_append_arg(out,args,arg_count,3);
+	}
 
-			/* include another MHT file */
-			else if (QUICK_STRCMP(mht_keyw,"include")==0) {
-				token_ptr = strtok((char*)NULL," \t\n\r\0");
+	/* str1 OR str2 are NULL, <#null>, empty or undefined */
+	else if (len1==0 || len2==0) {
+		mht_builder_append_arg(out,args,arg_count,4);
+	}
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_INCLUDE_DIRECTIVE_WITHOUT_ARGS);
-				}
+	/* str1==str2 */
+	else if (len1==len2 && memcmp(strs[1],strs[2],len1)==0) {
+		mht_builder_append_arg(out,args,arg_count,3);
+	}
 
-				sprintf(token1,"%s",token_ptr);
-				mht_expand(token1);
+	/* str1!=str2 */
+	else {
+		mht_builder_append_arg(out,args,arg_count,4);
+	}
 
-				mht_err = mht_quickopen(mht.out,token1);
-				return (mht_err);
-			}
+	/* #ifequal is always expanded, at least to an empty string */
+	return (1);
+}
 
 
-			/* set a MHT var */
-			else if (QUICK_STRCMP(mht_keyw,"mhtvar")==0) {
-				token_ptr = strtok((char*)NULL," \t\n\r\0");
+/*
+	<#ifdef|str1|TRUE|FALSE>
+*/
+int mht_builtin_ifdef( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	char *dummy_ptr = (char*)NULL;
+
+	/* str1 is NULL or empty (bit stupid) */
+	if (arg_count<2 || args[1].len==0) {
+		return (1);
+	}
+
+	mht_search_macro(args[1].ptr,&dummy_ptr);
+
+	/*
+		If we did not find a definition for that macro,
+		it might be a block parameter!
+	*/
+	if (dummy_ptr==(char*)NULL) {
+		mht_search_block_param(args[1].ptr,&dummy_ptr);
+	}
+
+	if (dummy_ptr!=(char*)NULL) {
+		/* str1 IS defined as a macro */
+		mht_builder_append_arg(out,args,arg_count,2);
+	}
+	else {
+		/* str1 is NOT defined as a macro */
+		mht_builder_append_arg(out,args,arg_count,3);
+	}
+
+	return (1);
+}
+
+
+/*
+	<#isin|str1|str2|TRUE|FALSE>
+*/
+int mht_builtin_isin( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	unsigned int
+		len1 = (arg_count>1) ? args[1].len : 0,
+		len2 = (arg_count>2) ? args[2].len : 0;
+
+	/* str1 AND str2 are NULL, <#null>, empty or undefined */
+	if (len1==0 && len2==0) {
+		mht_builder_append_arg(out,args,arg_count,3);
+	}
+
+	/* str1 OR str2 are NULL, <#null>, empty or undefined */
+	else if (len1==0 || len2==0) {
+		mht_builder_append_arg(out,args,arg_count,4);
+	}
+
+	/* str1 IS in str2 */
+	else if (strstr(args[2].ptr,args[1].ptr)!=(char*)NULL) {
+		mht_builder_append_arg(out,args,arg_count,3);
+	}
+
+	/* str1 is NOT in str2 */
+	else {
+		mht_builder_append_arg(out,args,arg_count,4);
+	}
+
+	return (1);
+}
+
+
+/*
+	<#ifblock|str1|TRUE|FALSE>
+*/
+int mht_builtin_ifblock( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	if (arg_count>1 && args[1].len>0 && mht_search_block(args[1].ptr)!=(LINE_BUFFER*)NULL) {
+		/* str1 IS a existing block */
+		mht_builder_append_arg(out,args,arg_count,2);
+	}
+	else {
+		/* str1 is NOT a existing block */
+		mht_builder_append_arg(out,args,arg_count,3);
+	}
+
+	return (1);
+}
+
+
+/*
+	<#json|name|path|DEFAULT>
+	The values of a document are escaped as tainted macros are, see
+	"#mhtvar autoescape".
+*/
+int mht_builtin_json( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	JSON_DOC *json_doc = (JSON_DOC*)NULL;
+	JSON_VALUE json_value;
+	char value[MAX_LEN];
+
+	json_doc = (arg_count>1 && args[1].len>0) ? json_find(args[1].ptr) : (JSON_DOC*)NULL;
+
+	if (json_doc!=(JSON_DOC*)NULL && json_lookup(json_doc,(arg_count>2) ? args[2].ptr : "",&json_value)==1) {
+		if (mht->autoescape!=MHT_AUTOESCAPE_OFF) {
+			json_to_str(&json_value,value,MAX_LEN);
+			out->len += (unsigned int)str_escape(out->buf+out->len,out->size-out->len,value,strlen(value),mht->autoescape);
+		}
+		else {
+			json_to_str(&json_value,out->buf+out->len,out->size-out->len);
+			out->len += (unsigned int)strlen(out->buf+out->len);
+		}
+	}
+	else {
+		mht_builder_append_arg(out,args,arg_count,3);
+	}
+
+	/* <#json> is always expanded, at least to an empty string */
+	return (1);
+}
+
+
+/*
+	Attach a compiled macro dictionary (see mht2html -d). Its macros
+	are found by mht_search_macro if they are not defined via #def.
+	The file is only mapped, a file attached before is kept as it is.
+	Returns 1 on success, 0 otherwise.
+*/
+int mht_dict_attach( char *fname ) {
+	MHT_DICT *dict = (MHT_DICT*)NULL;
+
+	for (dict=mht->dicts; dict!=(MHT_DICT*)NULL; dict=dict->next) {
+		if (strcmp(dict->fname,fname)==0) {
+			return (1);
+		}
+	}
+
+	if ((dict=dict_open(fname))==(MHT_DICT*)NULL) {
+		return (0);
+	}
+
+	dict->next = mht->dicts;
+	mht->dicts = dict;
+
+	/* The dictionary may define macros the cached blocks found undefined */
+	mht_cache_flush();
+
+	return (1);
+}
+
+
+/*
+	Register a new MHT block.
+*/
+int mht_register_block( char *block_name, LINE_BUFFER *first_line ) {
+	mht_cache_flush();
+	mht_release_refs();
+	return ( (add_hash_item(mht->blocks,(char*)block_name,(LINE_BUFFER*)first_line,sizeof(LINE_BUFFER),ITEM_TYPE_LBUF))!=(HASH_ITEM*)NULL ? 1 : 0 );
+}
+
+
+/*
+	Search for a registered block.
+*/
+LINE_BUFFER *mht_search_block( char *block_name ) {
+	HASH_ITEM
+		*tmp_item = (HASH_ITEM*)NULL;
+
+	tmp_item = get_hash_item(mht->blocks,block_name);
+
+	/* The blocks of a shared state are only read, see mht_state_share */
+	if (tmp_item==(HASH_ITEM*)NULL && mht->shared!=(MHT_INFO*)NULL) {
+		tmp_item = get_hash_item(mht->shared->blocks,block_name);
+	}
+
+	return ( (tmp_item==(HASH_ITEM*)NULL) ? (LINE_BUFFER*)NULL : (LINE_BUFFER*)tmp_item->data );
+}
+
+
+/*
+	Split a string into tokens like strtok, but the rest of the string
+	is kept for the current thread only.
+*/
+char *mht_strtok( char *str, char *delim ) {
+	char *end = (char*)NULL;
+
+	if (str==(char*)NULL && (str=mht->strtok_next)==(char*)NULL) {
+		return ((char*)NULL);
+	}
+
+	str += strspn(str,delim);
+	if (*str=='\0') {
+		mht->strtok_next = (char*)NULL;
+		return ((char*)NULL);
+	}
+
+	end = str+strcspn(str,delim);
+	if (*end!='\0') {
+		*end++ = '\0';
+	}
+	mht->strtok_next = end;
+
+	return (str);
+}
+
+
+/*
+	Register a block parameter. If the parameter is already registered,
+	the parameter is overwritten wit the new definition. Returns 1 if
+	the parameter was successful registered, 0 otherwise. The name of a
+	block parameter is "block.%n" for the n-th parameter of block "block".
+*/
+int mht_register_block_param( char *block_param, char *param ) {
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+
+	if ((tmp_item=add_hash_item(mht->block_params,block_param,(char*)param,(size_t)_str_len(param)+1,ITEM_TYPE_STRING))==(HASH_ITEM*)NULL) {
+		return (0);
+	}
+
+	tmp_item->version = ++mht->macro_version;
+
+	return (1);
+}
+
+
+/*
+	Undef (erase) a registered block parameter.
+*/
+int mht_undef_block_param( char *block_param ) {
+	return( del_hash_item(mht->block_params,block_param) );
+}
+
+
+/*
+	Search for a block parameter. Returns 1 if the parameter is registered,
+	0 otherwise. If the parameter is registered, result will point to the
+	definition string of the parameter.
+*/
+unsigned int mht_search_block_param( char *block_param, char **result ) {
+	unsigned int found = 0;
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+
+	if (mht->row_binding_count>0 && mht_search_row_binding(block_param,result)==1) {
+		if (mht->cache_depth>0) {
+			mht_cache_read_param((HASH_ITEM*)NULL);
+		}
+		return (1);
+	}
+
+	if ((tmp_item=get_hash_item(mht->block_params,block_param))==(HASH_ITEM*)NULL) {
+		found = 0;
+		(*result) = (char*)NULL;
+	}
+	else {
+		found = 1;
+		(*result) = (char*)tmp_item->data;
+
+		if (mht->cache_depth>0) {
+			mht_cache_read_param(tmp_item);
+		}
+	}
+
+	return (found);
+}
+
+
+/*
+	Search for the loop variable of an active #foreach directive. Returns 1
+	if the name is a loop variable or one of its helpers, 0 otherwise:
+	<#var>			the current item
+	<#var.index>	the index of the current item, starting with 1
+	<#var.count>	the number of items
+	<#var.first>	1 for the first item, 0 otherwise
+	<#var.last>		1 for the last item, 0 otherwise
+	<#var.value>	the definition of the current macro, if a map is iterated
+	<#var.path>		the path of the current item, if a JSON array is iterated
+	The flags (if not NULL) tell whether the result is tainted.
+*/
+unsigned int mht_search_binding( char *name, char **result, unsigned int *flags ) {
+	unsigned int
+		i = 0,
+		dummy_flags = 0;
+	char *helper = (char*)NULL;
+	LOOP_BINDING *binding = (LOOP_BINDING*)NULL;
+
+	if (flags==(unsigned int*)NULL) {
+		flags = &dummy_flags;
+	}
+	(*flags) = 0;
+
+	/* The innermost loop variable wins */
+	for (i=mht->binding_count; i>0; i--) {
+		binding = &mht->bindings[i-1];
+
+		if (*name!=*binding->name || strncmp(name,binding->name,binding->name_len)!=0) {
+			continue;
+		}
+
+		helper = name+binding->name_len;
+
+		if (*helper=='\0') {
+			(*result) = binding->value;
+			(*flags) = binding->tainted;
+			return (1);
+		}
+
+		if (*helper!='.') {
+			continue;
+		}
+
+		helper++;
+		if (QUICK_STRCMP(helper,"index")==0) {
+			sprintf(binding->index_str,"%u",binding->index);
+			(*result) = binding->index_str;
+			return (1);
+		}
+		else if (QUICK_STRCMP(helper,"count")==0) {
+			sprintf(binding->index_str,"%u",binding->count);
+			(*result) = binding->index_str;
+			return (1);
+		}
+		else if (QUICK_STRCMP(helper,"first")==0) {
+			(*result) = (binding->index==1) ? "1" : "0";
+			return (1);
+		}
+		else if (QUICK_STRCMP(helper,"last")==0) {
+			(*result) = (binding->index==binding->count) ? "1" : "0";
+			return (1);
+		}
+		else if (QUICK_STRCMP(helper,"path")==0 && binding->path!=(char*)NULL) {
+			(*result) = binding->path;
+			return (1);
+		}
+		else if (QUICK_STRCMP(helper,"value")==0 && binding->key!=(char*)NULL) {
+			HASH_ITEM *tmp_item = mht_macro_item(binding->key);
+			(*result) = (tmp_item!=(HASH_ITEM*)NULL) ? (char*)tmp_item->data : "";
+			(*flags) = (tmp_item!=(HASH_ITEM*)NULL) ? (tmp_item->flags & MHT_PROVIDER_TAINTED) : 0;
+			return (1);
+		}
+	}
+
+	(*result) = (char*)NULL;
+	return (0);
+}
+
+
+/*
+	Search for a field of the current row of an active #table directive:
+	<#block.%n>		the n-th field, starting with 1 (the fields of the row only)
+	<#block.%0>		the number of the row, starting with 1
+	<#block.name>	the field in the column "name", if the table has a header row
+*/
+unsigned int mht_search_row_binding( char *block_param, char **result ) {
+	unsigned int i = 0;
+	unsigned long field = 0;
+	int column = 0;
+	char
+		*name = (char*)NULL,
+		*end = (char*)NULL;
+	ROW_BINDING *binding = (ROW_BINDING*)NULL;
+
+	for (i=mht->row_binding_count; i>0; i--) {
+		binding = &mht->row_bindings[i-1];
+
+		if (*block_param!=*binding->block_name || strncmp(block_param,binding->block_name,binding->name_len)!=0 || block_param[binding->name_len]!='.') {
+			continue;
+		}
+
+		name = block_param+binding->name_len+1;
+
+		if (*name=='%' && isdigit(name[1])) {
+			field = strtoul(name+1,&end,10);
+
+			/* Only the fields of the row exist */
+			if (*end!='\0' || field>(unsigned long)binding->field_count) {
+				break;
+			}
+
+			if (field==0) {
+				sprintf(binding->row_str,"%lu",binding->row);
+				(*result) = binding->row_str;
+				return (1);
+			}
+
+			(*result) = binding->fields[field-1];
+			return (1);
+		}
+
+		for (column=0; column<binding->csv->header_count; column++) {
+			if (QUICK_STRCMP(name,binding->csv->header[column])==0) {
+				(*result) = (column<binding->field_count) ? binding->fields[column] : "";
+				return (1);
+			}
+		}
+	}
+
+	(*result) = (char*)NULL;
+	return (0);
+}
+
+
+/*
+	Undef (erase) a registered macro. The provider of the macro, if any,
+	is not asked any more (in a request scope: until the scope ends).
+*/
+int mht_undef_macro( char *name ) {
+	HASH_ITEM *tmp_item = get_hash_item(mht->providers,name);
+	PROVIDER_INFO *info = (tmp_item!=(HASH_ITEM*)NULL) ? (PROVIDER_INFO*)tmp_item->data : (PROVIDER_INFO*)NULL;
+
+	mht_fold_invalidate(name);
+
+	if (mht->cache_depth>0) {
+		mht_cache_spoil();
+	}
+
+	/* In a request scope, the macro is hidden until the scope ends */
+	if (mht->scope.active==1) {
+		if (mht_macro_item(name)==(HASH_ITEM*)NULL && (info==(PROVIDER_INFO*)NULL || info->undefined==1)) {
+			return (0);
+		}
+		mht_scope_add(name,(char*)NULL);
+
+		/* A definition of the scope is computed again in the next scope */
+		if (info!=(PROVIDER_INFO*)NULL && info->scope==mht->scope.generation) {
+			info->defined = 0;
+			info->scope = 0;
+		}
+		return (1);
+	}
+
+	if (info!=(PROVIDER_INFO*)NULL && info->undefined==0) {
+		info->undefined = 1;
+		del_hash_item(mht->macros,name);
+		return (1);
+	}
+
+	return( del_hash_item(mht->macros,name) );
+}
+
+
+/*
+	Free (erase) a MHT block.
+*/
+int mht_undef_block( char *block ) {
+	mht_cache_flush();
+	mht_release_refs();
+	return( del_hash_item(mht->blocks,block) );
+}
+
+
+
+/*
+	Push the output to a sink instead of the output stream given to
+	mht_quickopen/mht_process, NULL switches back to the stream.
+	Returns the previous sink.
+*/
+MHT_SINK *mht_set_sink( MHT_SINK *sink ) {
+	MHT_SINK *prev = mht->sink;
+
+	/* The filters pass on to the previous sink what they hold back */
+	mht_filter_end(&mht->chain);
+	mht_release_refs();
+	mht->sink = sink;
+
+	return (prev);
+}
+
+
+/*
+	Returns the name of the n-th file read by mht_quickopen (including
+	the files of #include directives), or NULL if there is none.
+*/
+char *mht_get_file( unsigned int n ) {
+	return ((n<mht->file_count) ? mht->files[n] : (char*)NULL);
+}
+
+
+/*
+	Load a MHT source file. All MHT directives outside a block
+	a processed immediately after they are read in, blocks are
+	stored in a hash.
+*/
+int mht_quickopen( FILE *out, char *fname ) {
+	FILE
+		*fptr = (FILE*)NULL;
+
+	LINE_BUFFER
+		*current_line = (LINE_BUFFER*)NULL,
+		*current_mht_block = (LINE_BUFFER*)NULL;
+
+	char
+		line[MAX_LEN],
+		block_name[128],
+		*tmp = (char*)NULL,
+		*token_ptr = (char*)NULL;
+
+	unsigned int
+		mht_err = MHT_OK,
+		first_line = 0,
+		last_line = 0,
+		line_count = 0,
+		i = 0;
+
+
+	mht->out = out;
+	fptr = fopen( fname, "r" );
+
+	if (fptr==NULL) {
+		mht_register_macro("mht_err_msg",mht_error_str[MHT_ERR_FILE_NOT_FOUND]);
+		return (MHT_ERR_FILE_NOT_FOUND);
+	}
+
+	if (mht->recursive_file_inclusion>=MAX_FILE_INCLUSION) {
+		return (MHT_ERR_TOO_DEEP_FILE_INCLUSION);
+	}
+
+	block_name[0] = '\0';
+	line[0] = '\0';
+
+	/* A new render starts with an empty memo */
+	if (mht->recursive_file_inclusion==0) {
+		mht_memo_flush();
+	}
+
+	/* Remember the file, a page cache depends on it */
+	for (i=0; i<mht->file_count && strcmp(mht->files[i],fname)!=0; i++);
+	if (i==mht->file_count) {
+		mht->files = (char**)_realloc(mht->files,(mht->file_count+1)*sizeof(char*));
+		mht->files[mht->file_count++] = strdup(fname);
+	}
+
+	mht->recursive_file_inclusion++;
+
+	/*
+		Switch to a new if-context for this MHT file.
+		Everything outside the MHT blocks, before any
+		if-conditional, is TRUE per default (evident).
+	*/
+	INC_IF_CONTEXT;
+	mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+
+	while (!feof(fptr)) {
+		line_count++;
+		fgets( line, MAX_LEN, fptr );
+
+		strcpy(mht->tmp_str,line);
+		tmp = mht->tmp_str;
+		while (isspace(*tmp)) {
+			tmp++;
+		}
+
+		token_ptr = mht_strtok(tmp," \t\n\r\0");
+		last_line = 0;
+
+		if (token_ptr!=(char*)NULL) {
+			if ( QUICK_STRCMP(strlwr(token_ptr),"#begin")==0 ) {
+				/* A block cannot contain another block */
+				if (mht->read_block==1) {
+					mht_register_error_macros(mht_error_str[MHT_ERR_BEGIN_DIRECTIVE_INSIDE_BLOCK],line,MHT_ERR_BEGIN_DIRECTIVE_INSIDE_BLOCK);
+					return (MHT_ERR_BEGIN_DIRECTIVE_INSIDE_BLOCK);
+				}
+
+				/* Filehandles must be closed before reading a block */
+				if (mht->write_to_file==1) {
+					mht_register_error_macros(mht_error_str[MHT_ERR_BEGIN_DIRECTIVE_FHANDLE_NOT_CLOSED],line,MHT_ERR_BEGIN_DIRECTIVE_FHANDLE_NOT_CLOSED);
+					return (MHT_ERR_BEGIN_DIRECTIVE_FHANDLE_NOT_CLOSED);
+				}
+
+				token_ptr = mht_strtok( (char*)NULL, " \t\n\r\0" );
+				sprintf(block_name,"%s",token_ptr);
+				mht->read_block = 1;
+				first_line = 1;
+				last_line = 0;
+			}
+
+			else if ( QUICK_STRCMP(strlwr(token_ptr),"#end")==0 ) {
+				/* A block cannot be closed if there wasn't a #begin directive before */
+				if (mht->read_block==0) {
+					mht_register_error_macros(mht_error_str[MHT_ERR_END_DIRECTIVE_OUTSIDE_BLOCK],line,MHT_ERR_END_DIRECTIVE_OUTSIDE_BLOCK);
+					return (MHT_ERR_END_DIRECTIVE_OUTSIDE_BLOCK);
+				}
+
+				token_ptr = mht_strtok( (char*)NULL, " \t\n\r\0" );
+
+				/* the blocknames of the #begin and #end directive do not match */
+				if (QUICK_STRCMP(block_name,token_ptr)!=0) {
+					mht_register_error_macros(mht_error_str[MHT_ERR_END_DIRECTIVE_BLOCKNAME_WRONG],line,MHT_ERR_END_DIRECTIVE_BLOCKNAME_WRONG);
+					return (MHT_ERR_END_DIRECTIVE_BLOCKNAME_WRONG);
+				}
+
+				/* Before reading a block is finished, a possible open filehandle must be closed */
+				if (mht->write_to_file==1) {
+					mht_register_error_macros(mht_error_str[MHT_ERR_END_DIRECTIVE_FHANDLE_NOT_CLOSED],line,MHT_ERR_END_DIRECTIVE_FHANDLE_NOT_CLOSED);
+					return (MHT_ERR_END_DIRECTIVE_FHANDLE_NOT_CLOSED);
+				}
+
+				mht_compile_block(current_mht_block);
+				mht_register_block(block_name,(LINE_BUFFER*)current_mht_block);
+				mht->read_block = 0;
+				block_name[0] = '\0';
+				current_line = (LINE_BUFFER*)NULL;
+				last_line = 1;
+			}
+		}
+
+		if (mht->read_block==1) {
+			/* The lines of a block are stored in a simple linked list */
+			if (first_line==0) {
+				if( current_line!=(LINE_BUFFER*)NULL ) {
+					current_line = current_line->next = mht_new_line(line);
+				}
+				else {
+					current_mht_block = current_line = mht_new_line(line);
+				}
+			}
+			else {
+				first_line = 0;
+			}
+		}
+		else if (last_line==0 && mht->load==1) {
+			/* mht_load keeps the lines to process them later on */
+			if (mht->load_last!=(LINE_BUFFER*)NULL) {
+				mht->load_last = mht->load_last->next = mht_new_line(line);
+			}
+			else {
+				mht->load_first = mht->load_last = mht_new_line(line);
+			}
+		}
+		else if (last_line==0) {
+			/*
+				If we do not read the lines of a block currently, go ahead
+				and process the line directly.
+			*/
+			mht_err = mht_process_line(line);
+
+			if (mht_err!=MHT_OK) {
+				fclose(fptr);
+				mht_register_error_macros(mht_error_str[mht_err],line,mht_err);
+				return (mht_err);
+			}
+		}
+
+		line[0] = '\0';
+	}
+
+	fclose(fptr);
+	mht->recursive_file_inclusion--;
+
+	/* The filters pass on what they hold back at the end of a page */
+	if (mht->recursive_file_inclusion==0) {
+		mht_filter_end_all();
+	}
+
+	i=GET_IF_LEVEL;
+	if (i>0) {
+		mht_register_macro("mht_err_msg",mht_error_str[MHT_ERR_IF_COUNT_ENDIF_IS_MISSING]);
+		return (MHT_ERR_IF_COUNT_ENDIF_IS_MISSING);
+	}
+
+	/*
+		Reset the if-stack of the current if-context
+		back to default values, and decrement the
+		if-context level to process further the
+		previous if-context.
+	*/
+	mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
+	mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
+	mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 0;
+	DEC_IF_CONTEXT;
+
+	return (MHT_OK);
+}
+
+
+/*
+	Read a MHT source file like mht_quickopen, but keep the lines
+	outside the blocks as the block block_name instead of processing
+	them. mht_process(out,block_name) renders the file then, as often
+	as needed, without reading and parsing it again.
+*/
+int mht_load( char *fname, char *block_name ) {
+	int mht_err = MHT_OK;
+
+
+	mht->load = 1;
+	mht->load_first = mht->load_last = (LINE_BUFFER*)NULL;
+	mht_err = mht_quickopen(mht->out,fname);
+	mht->load = 0;
+
+	if (mht_err!=MHT_OK) {
+		if (mht->load_first!=(LINE_BUFFER*)NULL) {
+			free_lbuf(mht->load_first);
+		}
+		mht->load_first = mht->load_last = (LINE_BUFFER*)NULL;
+		return (mht_err);
+	}
+
+	/* An empty file is an empty page */
+	if (mht->load_first==(LINE_BUFFER*)NULL) {
+		mht->load_first = mht_new_line("");
+	}
+
+	mht_compile_block(mht->load_first);
+	mht_register_block(block_name,mht->load_first);
+	mht->load_first = mht->load_last = (LINE_BUFFER*)NULL;
+
+	return (MHT_OK);
+}
+
+
+/*
+	Create a line of a block, the line is not compiled yet.
+*/
+LINE_BUFFER *mht_new_line( char *line ) {
+	LINE_BUFFER
+		*new_line = (LINE_BUFFER*)_malloc(sizeof(LINE_BUFFER));
+
+	new_line->content = (char*)_calloc( (size_t)_str_len(line)+1, sizeof(char) );
+	strncpy(new_line->content,line,_str_len(line));
+	new_line->next = (LINE_BUFFER*)NULL;
+	new_line->len = 0;
+	new_line->type = LINE_TYPE_TEXT;
+	new_line->data = (void*)NULL;
+	new_line->span = 0;
+	new_line->generation = 0;
+
+	return (new_line);
+}
+
+
+/*
+	Process the lines of a block with optional arguments.
+*/
+int mht_process_with_params( FILE *out, char *blockname, char **block_params, int block_param_count ) {
+	int
+		i = 0,
+		mht_err = MHT_OK;
+
+	char
+		block_param[MACRO_LEN];
+
+
+	/*
+		Pls. refer to mht_process to read why this is done here...!
+	*/
+	if (GET_IF_CONTEXT==0 && GET_IF_LEVEL==0) {
+		INC_IF_CONTEXT;
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+		mht_memo_flush();
+	}
+
+	if (block_params==(char**)NULL) {
+		/* The block was called without any parameter, process the block... */
+		mht_err = mht_process(out,blockname);
+		return (mht_err);
+	}
+
+	/*
+		If the block was called with parameters, go and register
+		each parameter as its own macro.
+	*/
+	if (block_param_count>0) {
+		for (i=1; i<block_param_count; i++) {
+			if (block_params[i]!=(char*)NULL) {
+				/* Block parameters are registered under the name "block.%n" */
+				block_param[0] = '\0';
+				sprintf(block_param,"%s.%%%d",blockname,i);
+				mht_register_block_param(block_param,block_params[i]);
+			}
+		}
+	}
+
+	/* Process the block... */
+	mht_err = mht_process(mht->out,block_params[0]);
+
+	/*
+		If the block was called with parameters, go and undefine
+		all previously registered block parameters.
+	*/
+	if (block_param_count>0) {
+		for (i=1; i<block_param_count; i++) {
+			if (block_params[i]!=(char*)NULL) {
+				/* Block parameters are registered under the name "block.%n" */
+				block_param[0] = '\0';
+				sprintf(block_param,"%s.%%%d",blockname,i);
+				mht_undef_block_param(block_param);
+			}
+		}
+	}
+
+	if (GET_IF_CONTEXT==0 && GET_IF_LEVEL==0) {
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 0;
+		DEC_IF_CONTEXT;
+	}
+
+	return (mht_err);
+}
+
+
+/*
+	Process the lines of a block with optional arguments.
+*/
+int mht_loop( FILE *out, char *blockname, char **block_params, int block_param_count ) {
+	int
+		strlen_block_param2 = 0,
+		strlen_block_param3 = 0,
+		i = 0,
+		start = 0,
+		end = 0,
+		mht_err = MHT_OK;
+
+	char index_str[16];
+
+
+	if ( (block_params==(char**)NULL) || (block_param_count<4) ) {
+		/* The loop was called without any parameter... */
+		return (MHT_ERR_LOOP_WITHOUT_ENOUGH_PARAMETERS);
+	}
+
+	/* Check whether the start/end indices are decimal numbers: */
+	for (i=0,strlen_block_param2=(int)_str_len(block_params[2]);i<strlen_block_param2;i++) {
+		if (!isdigit(block_params[2][i])) {
+			return (MHT_ERR_LOOP_NO_INTEGER_PARAMETERS);
+		}
+	}
+
+	for (i=0,strlen_block_param3=(int)_str_len(block_params[3]);i<strlen_block_param3;i++) {
+		if (!isdigit(block_params[3][i])) {
+			return (MHT_ERR_LOOP_NO_INTEGER_PARAMETERS);
+		}
+	}
+
+	/* Get the start/end indices for the for-loop: */
+	start = (int)strtol( block_params[2], (char **)NULL, 10 );
+	end = (int)strtol( block_params[3], (char **)NULL, 10 );
+
+	index_str[0] = '\0';
+
+	/* Loop the block: */
+	for (i=start;i<=end;i++) {
+		sprintf( index_str, "%d", i );
+		mht_register_macro( block_params[1], index_str );
+		mht_err = mht_process( out, block_params[0] );
+
+		if (mht_err!=MHT_OK) {
+			return (mht_err);
+		}
+	}
+
+	return (mht_err);
+}
+
+
+/*
+	Iterate over a list and process a block for each item:
+	#foreach block|var|source[|sepchar]
+	The source may be a list of items separated by sepchar (',' per
+	default), "$macro" to split the definition of a macro (CGI values
+	of the same name are registered comma separated), "@prefix" to
+	iterate over all macros "prefix.key" in alphabetical order, or
+	"json:name:path" to iterate over a JSON array of #jsonsource name.
+	Scalar JSON items are bound as text; for objects and arrays the
+	loop variable is their path, e.g. <#json|name|<#var>.title>.
+	The loop variable is bound in place, the macro hash is not touched.
+*/
+int mht_foreach( FILE *out, char *blockname, char **block_params, int block_param_count ) {
+	int
+		mht_err = MHT_OK;
+
+	unsigned int
+		i = 0,
+		key_len = 0,
+		prefix_len = 0;
+
+	char
+		sepchar = ',',
+		*source = (char*)NULL,
+		*item = (char*)NULL,
+		*next_item = (char*)NULL,
+		*keys = (char*)NULL,
+		*list = (char*)NULL,
+		**key_list = (char**)NULL,
+		items[MAX_LEN],
+		path[MAX_LEN];
+
+	LOOP_BINDING
+		*binding = (LOOP_BINDING*)NULL;
+
+	HASH_ITEM
+		*tmp_item = (HASH_ITEM*)NULL;
+
+	JSON_DOC
+		*doc = (JSON_DOC*)NULL;
+
+	JSON_VALUE
+		array,
+		json_item_value;
+
+
+	if ( (block_params==(char**)NULL) || (block_param_count<3) || (block_params[1]==(char*)NULL) ) {
+		return (MHT_ERR_FOREACH_WITHOUT_ENOUGH_PARAMETERS);
+	}
+
+	if (mht_search_block(blockname)==(LINE_BUFFER*)NULL) {
+		return (MHT_ERR_PROCESS_BLOCK_NOT_FOUND);
+	}
+
+	if (mht->binding_count>=MAX_LOOP_BINDINGS) {
+		return (MHT_ERR_FOREACH_TOO_MANY_LEVELS);
+	}
+
+	if (block_param_count>3 && block_params[3]!=(char*)NULL) {
+		sepchar = block_params[3][0];
+	}
+
+	source = block_params[2];
+	items[0] = '\0';
+
+	/* The loop variable hides a macro of the same name */
+	mht_fold_invalidate(block_params[1]);
+
+	binding = &mht->bindings[mht->binding_count];
+	binding->name = block_params[1];
+	binding->name_len = _str_len(block_params[1]);
+	binding->value = (char*)NULL;
+	binding->key = (char*)NULL;
+	binding->path = (char*)NULL;
+	binding->index = 0;
+	binding->count = 0;
+	binding->tainted = 0;
+
+	if (source!=(char*)NULL && strncmp(source,"json:",5)==0) {
+		/* Iterate over a JSON array: "json:name:path" */
+		strncpy(path,source+5,MAX_LEN-16);
+		path[MAX_LEN-16] = '\0';
+
+		if ((source=strchr(path,':'))!=(char*)NULL) {
+			*source++ = '\0';
+		}
+
+		doc = json_find(path);
+		if (doc==(JSON_DOC*)NULL || json_lookup(doc,source,&array)==0 || array.type!=JSON_ARRAY) {
+			return (MHT_OK);
+		}
+
+		/* The path of the array is kept in front of the item index */
+		prefix_len = _str_len(source);
+		if (prefix_len>0) {
+			memmove(path,source,prefix_len+1);
+		}
+		else {
+			path[0] = '\0';
+		}
+
+		binding->count = json_length(doc,&array);
+		binding->path = path;
+
+		/* The block might open the name again */
+		json_retain(doc);
+		mht->binding_count++;
+		for (i=0; i<binding->count && mht_err==MHT_OK; i++) {
+			json_item(doc,&array,i,&json_item_value);
+			sprintf(path+prefix_len,"[%u]",i);
+
+			/* The values of the document are tainted, but not the paths */
+			if (json_item_value.type==JSON_OBJECT || json_item_value.type==JSON_ARRAY) {
+				binding->value = path;
+				binding->tainted = 0;
+			}
+			else {
+				binding->value = json_to_str(&json_item_value,items,MAX_LEN);
+				binding->tainted = MHT_PROVIDER_TAINTED;
+			}
+
+			binding->index = i+1;
+			mht_err = mht_process(out,blockname);
+		}
+		mht->binding_count--;
+		json_release(doc);
+
+		return (mht_err);
+	}
+
+	if (source!=(char*)NULL && *source=='@') {
+		/*
+			Iterate over a map: collect the names of all macros "prefix.key".
+			The names are copied, because the block might (re-)define them.
+		*/
+		prefix_len = _str_len(source+1);
+
+		/* The macros of a map are not recorded for the fragment cache */
+		if (mht->cache_depth>0) {
+			mht_cache_spoil();
+		}
+
+		if ((binding->count=mht_map_keys(source+1,prefix_len,(char**)NULL,(char*)NULL,&key_len))==0) {
+			return (MHT_OK);
+		}
+
+		keys = (char*)_malloc(key_len);
+		key_list = (char**)_malloc(binding->count*sizeof(char*));
+
+		key_len = 0;
+		mht_map_keys(source+1,prefix_len,key_list,keys,&key_len);
+
+		qsort(key_list,binding->count,sizeof(char*),mht_cmp_keys);
+
+		mht->binding_count++;
+		for (i=0; i<binding->count && mht_err==MHT_OK; i++) {
+			binding->key = key_list[i];
+			binding->value = key_list[i]+prefix_len+1;
+
+			/* The key of a CGI value is sent by the client, too */
+			tmp_item = mht_macro_item(binding->key);
+			binding->tainted = (tmp_item!=(HASH_ITEM*)NULL) ? (tmp_item->flags & MHT_PROVIDER_TAINTED) : 0;
+			binding->index = i+1;
+			mht_err = mht_process(out,blockname);
+		}
+		mht->binding_count--;
+
+		free(key_list);
+		free(keys);
+		return (mht_err);
+	}
+
+	/* Iterate over a list, either given inline or as the definition of a macro */
+	if (source!=(char*)NULL && *source=='$') {
+		mht_search_macro_flags(source+1,&source,&binding->tainted);
+		binding->tainted &= MHT_PROVIDER_TAINTED;
+	}
+
+	if (source==(char*)NULL || *source=='\0') {
+		return (MHT_OK);
+	}
+
+	/* The list is copied, because the block might (re-)define its macro */
+	list = strdup(source);
+
+	for (item=list,binding->count=1; *item!='\0'; item++) {
+		if (*item==sepchar) {
+			binding->count++;
+		}
+	}
+
+	/* Each item is terminated in place, so no item has to be copied */
+	mht->binding_count++;
+	for (item=list; item!=(char*)NULL && mht_err==MHT_OK; item=next_item) {
+		if ((next_item=strchr(item,sepchar))!=(char*)NULL) {
+			*next_item++ = '\0';
+		}
+
+		binding->value = item;
+		binding->index++;
+		mht_err = mht_process(out,blockname);
+	}
+	mht->binding_count--;
+
+	free(list);
+	return (mht_err);
+}
+
+
+/*
+	Process a block for the rows first..last of a CSV/TSV file:
+	#table block|file[|first[|last[|options]]]
+	first and last start with 1 and default to the first and the last
+	row. The options are any of "header" (the first row contains the
+	column names), "tab" or "semicolon" (the field separator, ',' per
+	default) and "index" (keep the row offset index in "file.idx").
+*/
+int mht_table( FILE *out, char **block_params, int block_param_count ) {
+	unsigned long
+		first = 1,
+		last = 0;
+
+	unsigned int
+		options = 0,
+		i = 0;
+
+	char
+		sepchar = ',',
+		*opts = (char*)NULL;
+
+
+	if ( (block_params==(char**)NULL) || (block_param_count<2) || (block_params[1]==(char*)NULL) ) {
+		return (MHT_ERR_TABLE_WITHOUT_ENOUGH_PARAMETERS);
+	}
+
+	/* Check whether the first/last rows are decimal numbers: */
+	for (i=2; i<4 && (int)i<block_param_count; i++) {
+		for (opts=block_params[i]; opts!=(char*)NULL && *opts!='\0'; opts++) {
+			if (!isdigit(*opts)) {
+				return (MHT_ERR_TABLE_WITHOUT_ENOUGH_PARAMETERS);
+			}
+		}
+	}
+
+	if (block_param_count>2 && _str_len(block_params[2])>0) {
+		first = strtoul(block_params[2],(char**)NULL,10);
+	}
+
+	if (block_param_count>3 && _str_len(block_params[3])>0) {
+		last = strtoul(block_params[3],(char**)NULL,10);
+	}
+
+	if (block_param_count>4 && (opts=block_params[4])!=(char*)NULL) {
+		strlwr(opts);
+		if (strstr(opts,"header")!=(char*)NULL) {
+			options |= CSV_OPT_HEADER;
+		}
+		if (strstr(opts,"index")!=(char*)NULL) {
+			options |= CSV_OPT_INDEX;
+		}
+		if (strstr(opts,"tab")!=(char*)NULL) {
+			sepchar = '\t';
+		}
+		else if (strstr(opts,"semicolon")!=(char*)NULL) {
+			sepchar = ';';
+		}
+	}
+
+	return (mht_process_table(out,block_params[0],block_params[1],sepchar,options,first,last));
+}
+
+
+/*
+	Process a block for the rows first..last (starting with 1, last 0
+	means up to the last row) of a CSV/TSV file. The fields of each row
+	are available as the block parameters <#block.%1>, <#block.%2>, ...
+	and, if the file has a header row, as <#block.column>.
+*/
+int mht_process_table( FILE *out, char *block_name, char *fname, char sepchar, unsigned int options, unsigned long first, unsigned long last ) {
+	int mht_err = MHT_OK;
+	unsigned long row = 0;
+	CSV_TABLE *csv = (CSV_TABLE*)NULL;
+	ROW_BINDING *binding = (ROW_BINDING*)NULL;
+
+
+	if (mht_search_block(block_name)==(LINE_BUFFER*)NULL) {
+		return (MHT_ERR_PROCESS_BLOCK_NOT_FOUND);
+	}
+
+	if (mht->row_binding_count>=MAX_LOOP_BINDINGS) {
+		return (MHT_ERR_TABLE_TOO_MANY_LEVELS);
+	}
+
+	if ((csv=csv_open(fname,sepchar,options))==(CSV_TABLE*)NULL) {
+		return (MHT_ERR_TABLE_FILE_NOT_FOUND);
+	}
+
+	binding = &mht->row_bindings[mht->row_binding_count++];
+	binding->block_name = block_name;
+	binding->name_len = _str_len(block_name);
+	binding->csv = csv;
+
+	for (row=(first>0 ? first : 1); (last==0 || row<=last) && mht_err==MHT_OK; row++) {
+		binding->field_count = csv_read_row(csv,row-1,binding->fields,CSV_MAX_FIELDS);
+
+		if (binding->field_count<0) {
+			break;
+		}
+
+		binding->row = row;
+		mht_err = mht_process(out,block_name);
+	}
+
+	mht->row_binding_count--;
+	csv_release(csv);
+
+	return (mht_err);
+}
+
+
+int mht_cmp_keys( const void *el1, const void *el2 ) {
+	return strcmp( *(char**)el1, *(char**)el2 );
+}
+
+
+/*
+	Classify the lines of a block once after it was read in, so
+	that static text lines don't have to be copied and expanded
+	each time the block is processed.
+*/
+void mht_compile_block( LINE_BUFFER *first_line ) {
+	LINE_BUFFER *line = (LINE_BUFFER*)NULL;
+	char *tmp = (char*)NULL;
+
+	for (line=first_line; line!=(LINE_BUFFER*)NULL; line=line->next) {
+		line->len = _str_len(line->content);
+
+		for (tmp=line->content; isspace(*tmp); tmp++);
+
+		if (*tmp=='#') {
+			line->type = LINE_TYPE_DIRECTIVE;
+			mht_compile_if(line,tmp+1);
+		}
+		else if (strstr(tmp,"<#")!=(char*)NULL) {
+			line->type = LINE_TYPE_TEXT;
+		}
+		else {
+			line->type = LINE_TYPE_STATIC;
+		}
+	}
+}
+
+
+/*
+	Collect the names of the macros "prefix.key", those of the request
+	scope hide those of the state. The names are copied to keys and
+	listed in key_list, if key_list is NULL they are only counted. The
+	length of the names is added to key_len. Returns the number of names.
+*/
+unsigned int mht_map_keys( char *prefix, unsigned int prefix_len, char **key_list, char *keys, unsigned int *key_len ) {
+	unsigned int
+		i = 0,
+		count = 0;
+
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+
+
+	for (i=0; i<MAX_HASHSIZE; i++) {
+		for (tmp_item=mht->macros[i]; tmp_item!=(HASH_ITEM*)NULL; tmp_item=tmp_item->next) {
+			if (strncmp(tmp_item->key,prefix,prefix_len)==0 && tmp_item->key[prefix_len]=='.' && mht_scope_item(tmp_item->key)==(HASH_ITEM*)NULL) {
+				if (key_list!=(char**)NULL) {
+					key_list[count] = strcpy(keys+(*key_len),tmp_item->key);
+				}
+				count++;
+				(*key_len) += _str_len(tmp_item->key)+1;
+			}
+		}
+	}
+
+	/* The macros of the scope, but not its tombstones */
+	for (i=0; i<MAX_SCOPE_HASHSIZE && mht->scope.count>0; i++) {
+		if (mht->scope.stamps[i]!=mht->scope.generation) {
+			continue;
+		}
+
+		for (tmp_item=mht->scope.slots[i]; tmp_item!=(HASH_ITEM*)NULL; tmp_item=tmp_item->next) {
+			if (tmp_item->data!=(void*)NULL && strncmp(tmp_item->key,prefix,prefix_len)==0 && tmp_item->key[prefix_len]=='.') {
+				if (key_list!=(char**)NULL) {
+					key_list[count] = strcpy(keys+(*key_len),tmp_item->key);
+				}
+				count++;
+				(*key_len) += _str_len(tmp_item->key)+1;
+			}
+		}
+	}
+
+	return (count);
+}
+
+
+/*
+	A macro is about to change (#def, #undef, a loop variable, ...).
+	If its definition was folded into a block, all folded lines are
+	outdated. The macro itself is never folded again. If a memoized
+	expansion depends on it, the memoized expansions are dropped.
+*/
+void mht_fold_invalidate( char *name ) {
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+
+	/* The macros of a request scope are never folded */
+	if ((tmp_item=mht_scope_item(name))!=(HASH_ITEM*)NULL && (tmp_item->flags & MHT_MACRO_MEMO)) {
+		mht_memo_flush();
+		tmp_item->flags &= ~MHT_MACRO_MEMO;
+	}
+
+	if ((tmp_item=get_hash_item(mht->macros,name))==(HASH_ITEM*)NULL) {
+		return;
+	}
+
+	if (tmp_item->flags & MHT_MACRO_FOLDED) {
+		mht_fold_reset();
+	}
+
+	if (tmp_item->flags & MHT_MACRO_MEMO) {
+		mht_memo_flush();
+	}
+
+	tmp_item->flags = (tmp_item->flags & ~(MHT_MACRO_FOLDED | MHT_MACRO_MEMO)) | MHT_MACRO_REDEFINED;
+}
+
+
+/*
+	Outdate all folded lines. The macros folded so far are checked
+	again when they are folded next, since a macro they refer to may
+	have changed.
+*/
+void mht_fold_reset(void) {
+	unsigned int i = 0;
+
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+
+
+	mht->fold_generation++;
+
+	for (i=0; i<MAX_HASHSIZE; i++) {
+		for (tmp_item=mht->macros[i]; tmp_item!=(HASH_ITEM*)NULL; tmp_item=tmp_item->next) {
+			tmp_item->flags &= ~MHT_MACRO_FOLDED;
+		}
+	}
+}
+
+
+/*
+	Returns 1 if the macro name expands to the same text each time a
+	block is processed: it is defined only once, it is no builtin,
+	loop variable, block parameter or volatile/tainted macro, and its
+	definition refers to stable macros only. The macro is marked as
+	folded then, so that redefining it invalidates the folded blocks.
+*/
+unsigned int mht_fold_stable( char *name, unsigned int depth ) {
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	char *result = (char*)NULL;
+
+	if (depth>MAX_FOLD_DEPTH || *name=='\0' || strpbrk(name,".%#|")!=(char*)NULL) {
+		return (0);
+	}
+
+	if (mht_call_builtin(name)!=(BUILTIN_INFO*)NULL) {
+		return (0);
+	}
+
+	if (mht->binding_count>0 && mht_search_binding(name,&result,(unsigned int*)NULL)==1) {
+		return (0);
+	}
+
+	/* Volatile macros (date and time) change between two requests */
+	if ((tmp_item=get_hash_item(mht->providers,name))!=(HASH_ITEM*)NULL && (((PROVIDER_INFO*)tmp_item->data)->flags & MHT_PROVIDER_VOLATILE)) {
+		return (0);
+	}
+
+	/* Let a provider define the macro before it is checked */
+	if (mht_search_macro(name,&result)==0 || mht_scope_item(name)!=(HASH_ITEM*)NULL || (tmp_item=get_hash_item(mht->macros,name))==(HASH_ITEM*)NULL) {
+		return (0);
+	}
+
+	if (tmp_item->flags & (MHT_PROVIDER_TAINTED | MHT_MACRO_REDEFINED)) {
+		return (0);
+	}
+
+	if ((tmp_item->flags & MHT_MACRO_FOLDED)==0) {
+		if (mht_fold_refs((char*)tmp_item->data,depth+1)==0) {
+			return (0);
+		}
+		tmp_item->flags |= MHT_MACRO_FOLDED;
+	}
+
+	return (1);
+}
+
+
+/*
+	Returns 1 if all macros referenced in str are stable, so that
+	str can be expanded once and for all.
+*/
+unsigned int mht_fold_refs( char *str, unsigned int depth ) {
+	char
+		*start = (char*)NULL,
+		*end = (char*)NULL,
+		name[MACRO_LEN];
+
+	int bracket = 0;
+
+	while ((start=strstr(str,"<#"))!=(char*)NULL) {
+		for (bracket=0,end=start; *end!='\0'; end++) {
+			if (*end=='<') bracket++;
+			if (*end=='>') bracket--;
+			if (bracket==0) break;
+		}
+
+		/* Only simple references "<#name>" are folded */
+		if (bracket!=0 || end-start-2>=MACRO_LEN || end-start<3) {
+			return (0);
+		}
+
+		strncpy(name,start+2,end-start-2);
+		name[end-start-2] = '\0';
+
+		if (strchr(name,'<')!=(char*)NULL || mht_fold_stable(name,depth)==0) {
+			return (0);
+		}
+
+		str = end+1;
+	}
+
+	return (1);
+}
+
+
+/*
+	Fold the stable macros of a text line. If the line refers only to
+	stable macros, it is expanded once and printed as is afterwards.
+	Otherwise the stable macros are replaced by their definitions, as
+	long as the definitions can't change the expansion of the rest.
+*/
+void mht_fold_line( LINE_BUFFER *line ) {
+	char
+		*start = (char*)NULL,
+		*end = (char*)NULL,
+		*str = (char*)NULL,
+		*result = (char*)NULL,
+		name[MACRO_LEN],
+		folded[MAX_LEN];
+
+	int bracket = 0;
+	unsigned int
+		len = 0,
+		partial = 0;
+
+	if (line->len>=MAX_LEN) {
+		return;
+	}
+
+	if (mht_fold_refs(line->content,0)==1) {
+		strcpy(folded,line->content);
+		mht_expand(folded);
+
+		line->data = strdup(folded);
+		line->type = LINE_TYPE_FOLDED;
+		return;
+	}
+
+	folded[0] = '\0';
+	for (str=line->content; (start=strstr(str,"<#"))!=(char*)NULL; str=end+1) {
+		for (bracket=0,end=start; *end!='\0'; end++) {
+			if (*end=='<') bracket++;
+			if (*end=='>') bracket--;
+			if (bracket==0) break;
+		}
+
+		if (bracket!=0) {
+			break;
+		}
+
+		/* Copy the text before the macro and the macro itself... */
+		if (len+(end-str)+1>=MAX_LEN) {
+			return;
+		}
+		strncpy(folded+len,str,end-str+1);
+		len += end-str+1;
+		folded[len] = '\0';
+
+		/* ...and replace a stable macro by its plain definition */
+		if (end-start-2<MACRO_LEN && end-start>=3) {
+			strncpy(name,start+2,end-start-2);
+			name[end-start-2] = '\0';
+
+			if (strchr(name,'<')==(char*)NULL && mht_fold_stable(name,0)==1
+				&& mht_search_macro(name,&result)==1 && strpbrk(result,"<>#")==(char*)NULL) {
+				len -= end-start+1;
+				if (len+_str_len(result)>=MAX_LEN) {
+					return;
+				}
+				strcpy(folded+len,result);
+				len += _str_len(result);
+				partial = 1;
+			}
+		}
+	}
+
+	if (partial==1 && len+_str_len(str)<MAX_LEN) {
+		strcpy(folded+len,str);
+		line->data = strdup(folded);
+		line->type = LINE_TYPE_PARTIAL;
+	}
+}
+
+
+/*
+	Fold a block for the current fold generation: the stable macros are
+	folded into the text lines, and each run of static lines is merged
+	into its first line, so that it is printed with a single write.
+	Lines folded for an outdated generation are restored first.
+*/
+void mht_fold_block( LINE_BUFFER *first_line ) {
+	LINE_BUFFER
+		*line = (LINE_BUFFER*)NULL,
+		*run = (LINE_BUFFER*)NULL;
+
+	char *merged = (char*)NULL;
+	unsigned int len = 0;
+
+	/* The folded text is rebuilt */
+	mht_release_refs();
+
+	for (line=first_line; line!=(LINE_BUFFER*)NULL; line=line->next) {
+		line->generation = mht->fold_generation;
+
+		if (line->type!=LINE_TYPE_TEXT && line->type!=LINE_TYPE_STATIC
+			&& line->type!=LINE_TYPE_FOLDED && line->type!=LINE_TYPE_PARTIAL) {
+			continue;
+		}
+
+		if (line->data!=(void*)NULL) {
+			free(line->data);
+			line->data = (void*)NULL;
+		}
+		line->span = 0;
+		line->type = (strstr(line->content,"<#")!=(char*)NULL) ? LINE_TYPE_TEXT : LINE_TYPE_STATIC;
+
+		if (line->type==LINE_TYPE_TEXT) {
+			mht_fold_line(line);
+		}
+	}
+
+	/* Merge the runs of static and folded lines */
+	for (line=first_line; line!=(LINE_BUFFER*)NULL; line=line->next) {
+		if (line->type!=LINE_TYPE_STATIC && line->type!=LINE_TYPE_FOLDED) {
+			run = (LINE_BUFFER*)NULL;
+			continue;
+		}
+
+		if (run==(LINE_BUFFER*)NULL) {
+			run = line;
+			continue;
+		}
+
+		/* The first line of the run holds the merged text... */
+		if (run->span==0) {
+			merged = (run->type==LINE_TYPE_FOLDED) ? (char*)run->data : run->content;
+			len = _str_len(merged);
+			run->data = (run->type==LINE_TYPE_FOLDED) ? _realloc(run->data,len+1) : strdup(merged);
+			run->type = LINE_TYPE_FOLDED;
+			run->span = 1;
+		}
+
+		merged = (line->type==LINE_TYPE_FOLDED) ? (char*)line->data : line->content;
+		run->data = _realloc(run->data,len+_str_len(merged)+1);
+		strcpy((char*)run->data+len,merged);
+		len += _str_len(merged);
+		run->span++;
+
+		/* ...the other lines are processed as usual if the run is outdated */
+		if (line->type==LINE_TYPE_FOLDED) {
+			free(line->data);
+			line->data = (void*)NULL;
+			line->type = LINE_TYPE_TEXT;
+		}
+	}
+}
+
+
+/*
+	Process a compiled line of a block. Static lines are printed
+	directly, everything else is handled by mht_process_line. lines
+	is set to the number of lines processed (folded lines cover more
+	than one line).
+*/
+int mht_process_compiled_line( LINE_BUFFER *line, unsigned int *lines ) {
+	int
+		parent = 0,
+		if_value = MHT_IF_FALSE;
+
+	(*lines) = 1;
+
+	/* The expression is evaluated only if the enclosing level is true */
+	if (line->type==LINE_TYPE_IF || line->type==LINE_TYPE_ELIF) {
+		parent = (line->type==LINE_TYPE_IF) ? GET_IF_LEVEL : GET_IF_LEVEL-1;
+
+		if (parent>=0 && mht->if_context[ GET_IF_CONTEXT ].if_stack[ parent ].is_true==1) {
+			if_value = mht_expr_eval((MHT_EXPR*)line->data);
+		}
+
+		return (mht_set_if_value((line->type==LINE_TYPE_IF) ? "if" : "elif",if_value));
+	}
+
+	if (line->type==LINE_TYPE_STATIC) {
+		if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true==1 && mht->writeoutput==1) {
+			mht_print_static(line->content);
+		}
+		return (MHT_OK);
+	}
+
+	/* Folded lines are valid as long as no folded macro changed */
+	if (line->generation==mht->fold_generation && mht->fold==1) {
+		if (line->type==LINE_TYPE_FOLDED) {
+			if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true==1 && mht->writeoutput==1) {
+				mht_print_static((char*)line->data);
+			}
+			(*lines) = (line->span>0) ? line->span : 1;
+			return (MHT_OK);
+		}
+
+		if (line->type==LINE_TYPE_PARTIAL) {
+			return (mht_process_line((char*)line->data));
+		}
+	}
+
+	return (mht_process_line(line->content));
+}
+
+
+/*
+	Process the lines of a MHT block.
+*/
+int mht_process( FILE *out, char *block_name ) {
+	int
+		mht_err = MHT_OK;
+
+	LINE_BUFFER
+		*line_of_block = (LINE_BUFFER*)NULL;
+
+	unsigned int lines = 0;
+
+	/*
+		Every MHT template has its own if-context (recursion!).
+		So if quickopen reads in a new template, it swithes to
+		a new if-context which is TRUE per default. After the
+		template is read in, the if-context is decremented again,
+		and so always FALSE in case we want to process a block from
+		a CGI program!
+		So if the if-context and if-level are both 0, it is assumed
+		that a block from within a template is processed out of a
+		CGI program. In this case, we will do the same as in quickopen:
+		increment the if-context, and afterwards decerement it again.
+	*/
+	if (GET_IF_CONTEXT==0 && GET_IF_LEVEL==0) {
+		INC_IF_CONTEXT;
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+		mht_memo_flush();
+	}
+
+	mht->out = out;
+	line_of_block = mht_search_block(block_name);
+
+	if (line_of_block==(LINE_BUFFER*)NULL) {
+		mht_register_error_macros(mht_error_str[MHT_ERR_PROCESS_BLOCK_NOT_FOUND],"",MHT_ERR_PROCESS_BLOCK_NOT_FOUND);
+		return (MHT_ERR_PROCESS_BLOCK_NOT_FOUND);
+	}
+
+	/* A block processing itself would run until the stack is exhausted */
+	if (mht->block_depth>=MAX_BLOCK_DEPTH) {
+		mht_register_error_macros(mht_error_str[MHT_ERR_TOO_DEEP_BLOCK_NESTING],"",MHT_ERR_TOO_DEEP_BLOCK_NESTING);
+		return (MHT_ERR_TOO_DEEP_BLOCK_NESTING);
+	}
+	mht->block_depth++;
+
+	/* The macros of the prologue are known now, fold them into the block */
+	if (mht->fold==1 && line_of_block->generation!=mht->fold_generation) {
+		mht_fold_block(line_of_block);
+	}
+
+	while (line_of_block!=(LINE_BUFFER*)NULL) {
+		mht_err = mht_process_compiled_line(line_of_block,&lines);
+
+		if (mht_err!=MHT_OK) {
+			mht->block_depth--;
+			mht_register_error_macros(mht_error_str[mht_err],line_of_block->content,mht_err);
+			return (mht_err);
+		}
+
+		while (lines-->0 && line_of_block!=(LINE_BUFFER*)NULL) {
+			line_of_block = line_of_block->next;
+		}
+	}
+
+	mht->block_depth--;
+
+	if (GET_IF_CONTEXT==0 && GET_IF_LEVEL==0) {
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 0;
+		DEC_IF_CONTEXT;
+	}
+
+	return (MHT_OK);
+}
+
+/*
+	Returns 1 if the expansion of the macro name depends only on its
+	arguments: its definition refers only to its parameters <#.%n> and
+	to other pure macros. The macro and the macros it refers to are
+	marked, so that changing one of them drops the memoized expansions.
+*/
+unsigned int mht_memo_pure( char *name, unsigned int depth ) {
+	HASH_ITEM
+		*tmp_item = (HASH_ITEM*)NULL,
+		*provider = (HASH_ITEM*)NULL;
+
+	char *result = (char*)NULL;
+	unsigned int pure = MHT_MEMO_NOT_PURE;
+
+
+	if (name==(char*)NULL || depth>MAX_FOLD_DEPTH || *name=='\0' || strpbrk(name,".%#<")!=(char*)NULL) {
+		return (0);
+	}
+
+	if (mht_call_builtin(name)!=(BUILTIN_INFO*)NULL) {
+		return (0);
+	}
+
+	if (mht->binding_count>0 && mht_search_binding(name,&result,(unsigned int*)NULL)==1) {
+		return (0);
+	}
+
+	if ((tmp_item=mht_macro_item(name))==(HASH_ITEM*)NULL || (tmp_item->flags & (MHT_PROVIDER_TAINTED | MHT_MACRO_IMPURE))) {
+		return (0);
+	}
+
+	/* Volatile macros (date and time) change during a render */
+	if ((provider=get_hash_item(mht->providers,name))!=(HASH_ITEM*)NULL && (((PROVIDER_INFO*)provider->data)->flags & MHT_PROVIDER_VOLATILE)) {
+		tmp_item->flags |= MHT_MACRO_IMPURE;
+		return (0);
+	}
+
+	pure = mht_memo_pure_str((char*)tmp_item->data,_str_len((char*)tmp_item->data),depth);
+
+	if (pure==MHT_MEMO_NEVER_PURE) {
+		tmp_item->flags |= MHT_MACRO_IMPURE;
+	}
+	else if (pure==MHT_MEMO_PURE) {
+		tmp_item->flags |= MHT_MACRO_MEMO;
+
+		/* The expansions are dropped with the request scope */
+		if (tmp_item==mht_scope_item(name)) {
+			mht->scope.memo = 1;
+		}
+	}
+
+	return ((pure==MHT_MEMO_PURE) ? 1 : 0);
+}
+
+
+/*
+	Returns MHT_MEMO_PURE if the first len chars of str refer only to
+	parameters <#.%n> and to pure macros <#name> or <#name|arg1|...>, whose
+	arguments are pure as well. Returns MHT_MEMO_NEVER_PURE if str refers
+	to builtins, block parameters, delayed or computed macros, and
+	MHT_MEMO_NOT_PURE if a macro refered to is not pure right now.
+*/
+unsigned int mht_memo_pure_str( char *str, unsigned int len, unsigned int depth ) {
+	char
+		*end = str+len,
+		*start = (char*)NULL,
+		*ref_end = (char*)NULL,
+		*args = (char*)NULL,
+		name[MACRO_LEN];
+
+	int bracket = 0;
+	unsigned int pure = MHT_MEMO_PURE;
+
+
+	for (start=str; start+1<end; start++) {
+		if (start[0]!='<' || start[1]!='#') {
+			continue;
+		}
+
+		for (bracket=0,ref_end=start; ref_end<end; ref_end++) {
+			if (*ref_end=='<') bracket++;
+			if (*ref_end=='>') bracket--;
+			if (bracket==0) break;
+		}
+
+		if (bracket!=0) {
+			return (MHT_MEMO_NEVER_PURE);
+		}
+
+		/* The name ends at the first '|', the arguments follow */
+		for (args=start+2; args<ref_end && *args!='|'; args++);
+
+		if (args==start+2 || args-start-2>=MACRO_LEN) {
+			return (MHT_MEMO_NEVER_PURE);
+		}
+
+		strncpy(name,start+2,args-start-2);
+		name[args-start-2] = '\0';
+
+		/* A parameter of the macro */
+		if (name[0]=='.' && name[1]=='%' && name[2]!='\0' && strspn(name+2,"0123456789")==_str_len(name+2) && args==ref_end) {
+			start = ref_end;
+			continue;
+		}
+
+		/* Builtins, block parameters, delayed and computed macros are never pure */
+		if (strpbrk(name,".%#<")!=(char*)NULL || mht_call_builtin(name)!=(BUILTIN_INFO*)NULL) {
+			return (MHT_MEMO_NEVER_PURE);
+		}
+
+		if (mht_memo_pure(name,depth+1)==0) {
+			return (MHT_MEMO_NOT_PURE);
+		}
+
+		if (args<ref_end && (pure=mht_memo_pure_str(args,ref_end-args,depth+1))!=MHT_MEMO_PURE) {
+			return (pure);
+		}
+
+		start = ref_end;
+	}
+
+	return (MHT_MEMO_PURE);
+}
+
+
+/*
+	Memoize the expansion of a pure macro, key is "name|arg1|arg2|...".
+*/
+void mht_memo_store( char *key, char *expansion ) {
+	if (mht->memo==(HASH_ITEM**)NULL) {
+		mht->memo = init_hashtab();
+	}
+
+	if (mht->memo_count>=MAX_MEMO_ENTRIES) {
+		mht_memo_flush();
+	}
+
+	/* A key stored again replaces its expansion */
+	if (get_hash_item(mht->memo,key)!=(HASH_ITEM*)NULL) {
+		add_hash_item(mht->memo,key,expansion,(size_t)_str_len(expansion)+1,ITEM_TYPE_STRING);
+	}
+	else if (add_hash_item(mht->memo,key,expansion,(size_t)_str_len(expansion)+1,ITEM_TYPE_STRING)!=(HASH_ITEM*)NULL) {
+		mht->memo_slots[mht->memo_count++] = hash(key);
+	}
+}
+
+
+/*
+	Drop all memoized macro expansions. Only the slots of the hash
+	used by the memo are visited, it is flushed at each render.
+*/
+void mht_memo_flush(void) {
+	unsigned int i = 0;
+
+	for (i=0; i<mht->memo_count; i++) {
+		while (mht->memo[mht->memo_slots[i]]!=(HASH_ITEM*)NULL) {
+			del_hash_item(mht->memo,mht->memo[mht->memo_slots[i]]->key);
+		}
+	}
+	mht->memo_count = 0;
+}
+
+
+/*
+	Process a block with parameters like #process, but keep its output
+	in the fragment cache. The cache key is the block name, the parameters
+	and the output settings; an entry is valid as long as no macro read by
+	the block was changed since (or its ttl in seconds elapsed). Blocks
+	with other effects than their output (#def, #mhtfile, ...) or which
+	read loop variables and parameters of enclosing blocks are not cached.
+*/
+int mht_cache_process( FILE *out, char **block_params, int block_param_count, long ttl ) {
+	int
+		i = 0,
+		mht_err = MHT_OK;
+
+	char key[MAX_LEN];
+
+	unsigned int
+		j = 0,
+		len = 0,
+		valid = 0;
+
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	CACHE_ENTRY *entry = (CACHE_ENTRY*)NULL;
+	CACHE_FRAME
+		*frame = (CACHE_FRAME*)NULL,
+		*parent = (CACHE_FRAME*)NULL;
+
+
+	if (mht->cache_limit==0 || mht->writeoutput==0 || mht->cache_depth>=MAX_CACHE_DEPTH) {
+		return (mht_process_with_params(out,block_params[0],block_params,block_param_count));
+	}
+
+	/* The output settings are part of the key, the filters come after the cache */
+	sprintf(key,"%d",mht->autoescape+1);
+	len = _str_len(key);
+
+	for (i=0; i<block_param_count; i++) {
+		if (len+_str_len(block_params[i])+2>=MAX_LEN) {
+			return (mht_process_with_params(out,block_params[0],block_params,block_param_count));
+		}
+
+		key[len++] = '|';
+		if (block_params[i]!=(char*)NULL) {
+			strcpy(key+len,block_params[i]);
+			len += _str_len(block_params[i]);
+		}
+		key[len] = '\0';
+	}
+
+	if (mht->cache==(HASH_ITEM**)NULL) {
+		mht->cache = init_hashtab();
+	}
+
+	if ((tmp_item=get_hash_item(mht->cache,key))!=(HASH_ITEM*)NULL) {
+		entry = (CACHE_ENTRY*)tmp_item->data;
+
+		valid = (entry->fold_generation==mht->fold_generation && (entry->expires==0 || entry->expires>time((time_t*)NULL))) ? 1 : 0;
+		for (j=0; j<entry->dep_count && valid==1; j++) {
+			valid = (mht_cache_version(entry->deps[j].name)==entry->deps[j].version) ? 1 : 0;
+		}
+
+		if (valid==1) {
+			/* Move the entry to the front of the LRU list */
+			if (entry!=mht->cache_first) {
+				entry->prev->next = entry->next;
+				if (entry->next!=(CACHE_ENTRY*)NULL) {
+					entry->next->prev = entry->prev;
+				}
+				else {
+					mht->cache_last = entry->prev;
+				}
+
+				entry->prev = (CACHE_ENTRY*)NULL;
+				entry->next = mht->cache_first;
+				mht->cache_first->prev = entry;
+				mht->cache_first = entry;
+			}
+
+			/* An enclosing cached block depends on the same macros */
+			if (mht->cache_depth>0) {
+				for (j=0; j<entry->dep_count; j++) {
+					mht_cache_add_dep(&mht->cache_frames[mht->cache_depth-1],entry->deps[j].name,entry->deps[j].version);
+				}
+			}
+
+			mht_print_line(entry->output);
+			return (MHT_OK);
+		}
+
+		mht_cache_drop(entry);
+	}
+
+	/* Render the block and collect its output */
+	frame = &mht->cache_frames[mht->cache_depth++];
+	frame->output = (char*)NULL;
+	frame->len = 0;
+	frame->size = 0;
+	frame->dep_count = 0;
+	frame->version = mht->macro_version;
+	frame->fold_generation = mht->fold_generation;
+	frame->binding_count = mht->binding_count;
+	frame->row_binding_count = mht->row_binding_count;
+	frame->active_fhandle = mht->active_fhandle;
+	frame->cacheable = 1;
+
+	mht_err = mht_process_with_params(out,block_params[0],block_params,block_param_count);
+
+	mht->cache_depth--;
+
+	if (mht_err!=MHT_OK || frame->fold_generation!=mht->fold_generation) {
+		frame->cacheable = 0;
+	}
+
+	/* The enclosing cached block gets the output and the macros read */
+	if (mht->cache_depth>0) {
+		parent = &mht->cache_frames[mht->cache_depth-1];
+
+		if (frame->len>0) {
+			mht_cache_capture(frame->output);
+		}
+
+		for (j=0; j<frame->dep_count; j++) {
+			mht_cache_add_dep(parent,frame->deps[j].name,frame->deps[j].version);
+		}
+
+		if (frame->cacheable==0) {
+			parent->cacheable = 0;
+		}
+	}
+
+	if (frame->cacheable==1) {
+		entry = (CACHE_ENTRY*)_malloc(sizeof(CACHE_ENTRY));
+		entry->key = strdup(key);
+		entry->output = (frame->output!=(char*)NULL) ? frame->output : strdup("");
+		entry->len = frame->len;
+		entry->deps = (frame->dep_count>0) ? (CACHE_DEP*)_malloc(frame->dep_count*sizeof(CACHE_DEP)) : (CACHE_DEP*)NULL;
+		entry->dep_count = frame->dep_count;
+		entry->fold_generation = frame->fold_generation;
+		entry->expires = (ttl>0) ? time((time_t*)NULL)+ttl : 0;
+		entry->size = sizeof(CACHE_ENTRY)+_str_len(key)+1+frame->size;
+
+		for (j=0; j<frame->dep_count; j++) {
+			entry->deps[j] = frame->deps[j];
+			entry->size += sizeof(CACHE_DEP)+_str_len(frame->deps[j].name)+1;
+		}
+
+		frame->output = (char*)NULL;
+		frame->dep_count = 0;
+
+		/* Make room for the new entry, the least recently used entries first */
+		while (entry->size<=mht->cache_limit && mht->cache_last!=(CACHE_ENTRY*)NULL && mht->cache_used+entry->size>mht->cache_limit) {
+			mht_cache_drop(mht->cache_last);
+		}
+
+		entry->prev = (CACHE_ENTRY*)NULL;
+		entry->next = mht->cache_first;
+
+		if (entry->size>mht->cache_limit || add_hash_item(mht->cache,key,entry,sizeof(CACHE_ENTRY),ITEM_TYPE_PTR)==(HASH_ITEM*)NULL) {
+			/* The entry is too large, it was never linked */
+			entry->size = 0;
+			mht_cache_drop(entry);
+		}
+		else {
+			if (mht->cache_first!=(CACHE_ENTRY*)NULL) {
+				mht->cache_first->prev = entry;
+			}
+			else {
+				mht->cache_last = entry;
+			}
+			mht->cache_first = entry;
+			mht->cache_used += entry->size;
+		}
+	}
+
+	/* Free what was not moved into the cache */
+	for (j=0; j<frame->dep_count; j++) {
+		free(frame->deps[j].name);
+	}
+	if (frame->output!=(char*)NULL) {
+		free(frame->output);
+	}
+
+	return (mht_err);
+}
+
+
+/*
+	The current version of a macro for the fragment cache: 0 if it is
+	undefined, and a version no macro has if a loop variable hides it.
+*/
+unsigned long mht_cache_version( char *name ) {
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	char *result = (char*)NULL;
+
+	if (mht->binding_count>0 && mht_search_binding(name,&result,(unsigned int*)NULL)==1) {
+		return (~0UL);
+	}
+
+	if ((tmp_item=mht_macro_item(name))==(HASH_ITEM*)NULL) {
+		return (0);
+	}
+
+	return (tmp_item->version);
+}
+
+
+/*
+	Add a macro to the macros read by a cached block.
+*/
+void mht_cache_add_dep( CACHE_FRAME *frame, char *name, unsigned long version ) {
+	unsigned int i = 0;
+
+	for (i=0; i<frame->dep_count; i++) {
+		if (QUICK_STRCMP(frame->deps[i].name,name)==0) {
+			return;
+		}
+	}
+
+	if (frame->dep_count>=MAX_CACHE_DEPS) {
+		frame->cacheable = 0;
+		return;
+	}
+
+	frame->deps[frame->dep_count].name = strdup(name);
+	frame->deps[frame->dep_count].version = version;
+	frame->dep_count++;
+}
+
+
+/*
+	A macro was read while a cached block is rendered. bound is 1 if
+	the macro is a loop variable.
+*/
+void mht_cache_read( char *name, unsigned int bound ) {
+	HASH_ITEM *tmp_item = (HASH_ITEM*)NULL;
+	unsigned int i = 0;
+
+	/* Loop variables of enclosing loops are not part of the key */
+	if (bound==1) {
+		for (i=0; i<mht->cache_depth; i++) {
+			if (mht->cache_frames[i].binding_count>0) {
+				mht->cache_frames[i].cacheable = 0;
+			}
+		}
+		return;
+	}
+
+	tmp_item = mht_macro_item(name);
+	mht_cache_add_dep(&mht->cache_frames[mht->cache_depth-1],name,(tmp_item!=(HASH_ITEM*)NULL) ? tmp_item->version : 0);
+}
+
+
+/*
+	A block parameter was read while a cached block is rendered. The
+	parameters of the cached block and of the blocks it processes are
+	part of the key, all other parameters (and #table rows) are not.
+	param is NULL for a #table row.
+*/
+void mht_cache_read_param( HASH_ITEM *param ) {
+	unsigned int i = 0;
+
+	for (i=0; i<mht->cache_depth; i++) {
+		if (param==(HASH_ITEM*)NULL) {
+			if (mht->cache_frames[i].row_binding_count>0) {
+				mht->cache_frames[i].cacheable = 0;
+			}
+		}
+		else if (param->version<=mht->cache_frames[i].version) {
+			mht->cache_frames[i].cacheable = 0;
+		}
+	}
+}
+
+
+/*
+	Collect a printed line for the cached block being rendered.
+*/
+void mht_cache_capture( char *line ) {
+	CACHE_FRAME *frame = &mht->cache_frames[mht->cache_depth-1];
+	unsigned int len = _str_len(line);
+
+	/* The output went to another file handle */
+	if (frame->active_fhandle!=mht->active_fhandle) {
+		frame->cacheable = 0;
+	}
+
+	if (frame->cacheable==0) {
+		return;
+	}
+
+	if (frame->len+len+1>frame->size) {
+		frame->size = (frame->size==0) ? 256 : frame->size;
+		while (frame->len+len+1>frame->size) {
+			frame->size *= 2;
+		}
+		frame->output = (char*)_realloc(frame->output,frame->size);
+	}
+
+	memcpy(frame->output+frame->len,line,len+1);
+	frame->len += len;
+}
+
+
+/*
+	The block being rendered had an effect besides its output, so it
+	can't be cached, nor the cached blocks it was processed from.
+*/
+void mht_cache_spoil(void) {
+	unsigned int i = 0;
+
+	for (i=0; i<mht->cache_depth; i++) {
+		mht->cache_frames[i].cacheable = 0;
+	}
+}
+
+
+/*
+	Returns 1 if the directive has no effects besides the output, so
+	that it may be used in a cached block.
+*/
+unsigned int mht_cache_pure( char *mht_keyw ) {
+	return (QUICK_STRCMP(mht_keyw,"process")==0
+		|| QUICK_STRCMP(mht_keyw,"cache")==0
+		|| QUICK_STRCMP(mht_keyw,"flush")==0
+		|| QUICK_STRCMP(mht_keyw,"foreach")==0
+		|| QUICK_STRCMP(mht_keyw,"write")==0
+		|| QUICK_STRCMP(mht_keyw,"writeln")==0) ? 1 : 0;
+}
+
+
+/*
+	Remove an entry from the fragment cache.
+*/
+void mht_cache_drop( CACHE_ENTRY *entry ) {
+	unsigned int i = 0;
+
+	if (entry->size>0) {
+		if (entry->prev!=(CACHE_ENTRY*)NULL) {
+			entry->prev->next = entry->next;
+		}
+		else {
+			mht->cache_first = entry->next;
+		}
+
+		if (entry->next!=(CACHE_ENTRY*)NULL) {
+			entry->next->prev = entry->prev;
+		}
+		else {
+			mht->cache_last = entry->prev;
+		}
+
+		mht->cache_used -= entry->size;
+		del_hash_item(mht->cache,entry->key);
+	}
+
+	for (i=0; i<entry->dep_count; i++) {
+		free(entry->deps[i].name);
+	}
+	if (entry->deps!=(CACHE_DEP*)NULL) {
+		free(entry->deps);
+	}
+	free(entry->output);
+	free(entry->key);
+	free(entry);
+}
+
+
+/*
+	Remove all entries from the fragment cache, e.g. after a block was
+	(re-)defined.
+*/
+void mht_cache_flush(void) {
+	while (mht->cache_last!=(CACHE_ENTRY*)NULL) {
+		mht_cache_drop(mht->cache_last);
+	}
+}
+
+
+void mht_register_error_macros( char *err_msg, char *err_line, int err_code ) {
+	if (!mht->error_macros_registered) {
+		mht_register_macro("mht_err_msg",err_msg);
+		mht_register_macro("mht_err_line",err_line);
+		sprintf(mht->tmp_str,"%d",err_code);
+		mht_register_macro("mht_err_code",mht->tmp_str);
+		mht->error_macros_registered = 1;
+	}
+}
+
+int keyw_strcmp( const void *el1, const void *el2 ) {
+  return QUICK_STRCMP( (char*)el1, (char*)el2 );
+}
+
+
+char *is_mht_keyword( char *pos ) {
+  char test_id[MAX_MHT_KEYW_LEN];
+  register unsigned int i = 0;
+
+  test_id[0]='\0';
+  for (i=0;i<MAX_MHT_KEYW_LEN && isalnum(*pos);test_id[i++]=*(pos++));
+  test_id[i]='\0';
+
+  return bsearch(test_id,mht_keyw,MAX_MHT_KEYW_COUNT,sizeof(char[MAX_MHT_KEYW_LEN]),keyw_strcmp);
+}
+
+
+/*
+	Process the directives in a single MHT line.
+*/
+int mht_process_line( char *line ) {
+	int
+		result = 0,
+		param_start = 0,
+		fence = 0,
+		mht_err = MHT_OK,
+		block_param_count = 0;
+
+	char
+		*mht_keyw = (char*)NULL,
+		tmp_line[MAX_LEN],
+		*tmp = (char*)NULL,
+		*token_ptr = (char*)NULL,
+		token1[MACRO_LEN], token2[MAX_LEN], token3[MAX_LEN],
+		*block_params[MAX_ARG_COUNT];
+
+	MHT_EXPR *expr = (MHT_EXPR*)NULL;
+	long ttl = 0;
+
+
+	strcpy(tmp_line,line);
+	tmp_line[_str_len(line)] = '\0';
+	tmp = tmp_line;
+	token1[0] = '\0';
+	token2[0] = '\0';
+	token3[0] = '\0';
+
+	while (isspace(*tmp)) {
+		tmp++;
+	}
+
+	if (*tmp=='#') {
+		/* Check if it is delayed directive (fence>1) */
+		while (*tmp=='#') {
+			fence++;
+			tmp++;
+		}
+
+		if ((token_ptr=mht_strtok(tmp," \t\n\r\0"))==(char*)NULL) return (MHT_OK);
+
+		strlwr(token_ptr);
+		if ((mht_keyw=is_mht_keyword(token_ptr))==(char*)NULL) {
+			/* The token with a leading '#' is NOT a MHT directive/keyword! */
+			return (MHT_OK);
+		}
+
+		if (fence>1) {
+			/* Ok, it is a delayed directive/keyword, do it from the start again! */
+			if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true==1) {
+				strcpy(tmp_line,line);
+				tmp = tmp_line;
+
+				while (isspace(*tmp)) {
+					tmp++;
+				}
+
+				memmove(tmp,tmp+1,_str_len(tmp));
+				tmp_line[_str_len(tmp_line)] = '\0';
+
+				mht_expand(tmp_line);
+
+				if (mht->writeoutput==1) {
+					mht_print_line(tmp_line);
+				}
+			}
+			return (MHT_OK);
+		}
+
+		/* #if, #elif, #else or #endif directive. */
+		if (QUICK_STRCMP(mht_keyw,"if")==0
+			|| QUICK_STRCMP(mht_keyw,"elif")==0
+			|| QUICK_STRCMP(mht_keyw,"else")==0
+			|| QUICK_STRCMP(mht_keyw,"endif")==0) {
+
+			/*
+				That is a bit too difficult to do it all in here!
+				Just set the if_count correct and then we will see
+				if we have to continue right here or return back.
+			*/
+			sprintf(token1,"%s",mht_keyw);
+
+			/* The rest of the line might be an expression */
+			if (QUICK_STRCMP(token1,"if")==0 || QUICK_STRCMP(token1,"elif")==0) {
+				if ((expr=mht_expr_compile(line+(token_ptr-tmp_line)+_str_len(token_ptr)))!=(MHT_EXPR*)NULL) {
+					mht_err = mht_set_if_value(token1,mht_expr_eval(expr));
+					free(expr);
+					return (mht_err);
+				}
+			}
+
+			token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+			if (token_ptr!=(char*)NULL) {
+				sprintf(token2,"%s",token_ptr);
+				mht_expand(token2);
+			}
+			else {
+				token2[0] = '\0';
+			}
+
+			mht_err = mht_set_if_count(token1,token2);
+			return (mht_err);
+		}
+
+
+		if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true==1) {
+			/* A cached block must not have any effects besides its output */
+			if (mht->cache_depth>0 && mht_cache_pure(mht_keyw)==0) {
+				mht_cache_spoil();
+			}
+
+			/* macro definition */
+			if (QUICK_STRCMP(mht_keyw,"def")==0) {
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_DEF_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr!=(char*)NULL) {
+					sprintf(token2,"%s",token_ptr);
+					result = mht_register_macro(token1,token2);
+				}
+				else {
+					return (MHT_ERR_DEF_DIRECTIVE_WITHOUT_DEFINITION);
+				}
+
+				return (MHT_OK);
+			}
+
+
+			/* macro definition, but with already expanded_ptr definition! */
+			else if (QUICK_STRCMP(mht_keyw,"defex")==0) {
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_DEFEX_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr!=(char*)NULL) {
+					sprintf(token2,"%s",token_ptr);
+					mht_register_macro(token1, mht_expand(token2));
+				}
+				else {
+					return (MHT_ERR_DEFEX_DIRECTIVE_WITHOUT_DEFINITION);
+				}
+
+				return (MHT_OK);
+			}
+
+
+			/* macro undefinition */
+			else if (QUICK_STRCMP(mht_keyw,"undef")==0) {
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_UNDEF_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+
+				/* the macro might be a block parameter or a "usual" macro */
+				if ((strstr(token1,".%"))!=(char*)NULL) {
+					mht_undef_block_param(token1);
+				}
+				else {
+					mht_undef_macro(token1);
+				}
+
+				return (MHT_OK);
+			}
+
+
+			/* free a MHT block */
+			else if (QUICK_STRCMP(mht_keyw,"undefblock")==0) {
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_UNDEF_BLOCK_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+				mht_undef_block(token1);
+
+				return (MHT_OK);
+			}
+
+
+			/* process a block and cache its output: #cache block|param1|... [ttl] */
+			else if (QUICK_STRCMP(mht_keyw,"cache")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_CACHE_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+				mht_trim(token1);
+
+				/* An optional time to live in seconds follows the parameters */
+				ttl = 0;
+				for (tmp=token1+_str_len(token1); tmp>token1 && !isspace(*(tmp-1)); tmp--);
+
+				if (tmp>token1 && *tmp!='\0' && strspn(tmp,"0123456789")==_str_len(tmp)) {
+					ttl = atol(tmp);
+					*tmp = '\0';
+					mht_trim(token1);
+				}
+
+				block_param_count = strsplit(token1,block_params,'|',MAX_ARG_COUNT);
+
+				if (block_param_count<1 || block_params[0]==(char*)NULL) {
+					mht_free_block_params(block_params,block_param_count);
+					return (MHT_ERR_CACHE_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				mht_err = mht_cache_process(mht->out,block_params,block_param_count,ttl);
+				mht_free_block_params(block_params,block_param_count);
+
+				return (mht_err);
+			}
+
+
+			/* process a block */
+			else if (QUICK_STRCMP(mht_keyw,"process")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_PROCESS_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				/*
+					Expand the name of the block to be processed and all
+					possible block parameters...
+				*/
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+				mht_trim(token1);
+
+				param_start = strcspn(token1,"|:");
+
+				if (*(token1 + param_start)=='|') {
+					/* New form: block|param1|param2|... */
+					block_param_count = strsplit(token1,block_params,'|',MAX_ARG_COUNT);
+					/* Process the block with optional arguments */
+					mht_err = mht_process_with_params(mht->out,block_params[0],block_params,block_param_count);
+					mht_free_block_params(block_params,block_param_count);
+				}
+				else if (*(token1 + param_start)==':') {
+					/* Old form: block : param1 param2 ... */
+					block_param_count = mht_get_block_params(token1,block_params);
+					/* Process the block with optional arguments */
+					mht_err = mht_process_with_params(mht->out,block_params[0],block_params,block_param_count);
+					mht_free_block_params(block_params,block_param_count);
+				}
+				else {
+					/* The block is called without any parameters: */
+					mht_err = mht_process(mht->out,token1);
+				}
+
+				return (mht_err);
+			}
+
+
+			/* include another MHT file */
+			else if (QUICK_STRCMP(mht_keyw,"include")==0) {
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_INCLUDE_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+
+				mht_err = mht_quickopen(mht->out,token1);
+				return (mht_err);
+			}
+
+
+			/* map a JSON file as a data source */
+			else if (QUICK_STRCMP(mht_keyw,"jsonsource")==0) {
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_JSONSOURCE_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_JSONSOURCE_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token2,"%s",token_ptr);
+				mht_expand(token2);
+				mht_trim(token2);
+
+				if (json_open(token1,token2)==(JSON_DOC*)NULL) {
+					return (MHT_ERR_JSONSOURCE_FILE_NOT_FOUND);
+				}
+
+				/* The cached blocks may refer to the previous document */
+				mht_cache_flush();
+
+				return (MHT_OK);
+			}
+
+
+			/* attach a macro dictionary compiled by mht2html -d */
+			else if (QUICK_STRCMP(mht_keyw,"dict")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_DICT_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+				mht_trim(token1);
+
+				if (mht_dict_attach(token1)==0) {
+					return (MHT_ERR_DICT_FILE_INVALID);
+				}
+
+				return (MHT_OK);
+			}
+
+
+			/* set a MHT var */
+			else if (QUICK_STRCMP(mht_keyw,"mhtvar")==0) {
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_MHTVAR_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_MHTVAR_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token2,"%s",token_ptr);
+				return (mht_setvar(token1,token2));
+			}
+
+
+			/* exit */
+			else if (QUICK_STRCMP(mht_keyw,"mhtexit")==0) {
+				mht_exit();
+				exit(0);
+			}
+
+
+			/* set to which file handle(s) the output should be printed */
+			else if (QUICK_STRCMP(mht_keyw,"file")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_SETFILE_IO_FHANDLE_MISSING);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+
+				return (mht_setfile_io(mht_keyw,token1,(char*)NULL));
+			}
+
+			/* set MHT file I/O */
+			else if (QUICK_STRCMP(mht_keyw,"mhtfile")==0) {
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_SETFILE_IO_OPERATION_MISSING);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+
+				token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+				if (token_ptr==(char*)NULL) {
+					/* #mhtfile close doesn't need the file name as a 2nd/3rd parameter */
+					return (mht_setfile_io(token1,(char*)NULL,(char*)NULL));
+				}
+
+				sprintf(token2,"%s",token_ptr);
+				mht_expand(token2);
+
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+				if (token_ptr==(char*)NULL) {
+					/* #mhtfile type doesn't need a 3rd parameter */
+					return (mht_setfile_io(token1,token2,(char*)NULL));
+				}
+
+				sprintf(token3,"%s",token_ptr);
+				mht_expand(token3);
+
+				/* Finally, it could only be #mhtfile open */
+				return (mht_setfile_io(token1,token2,token3));
+			}
+
+
+			/* Echo a expanded line to stdout */
+			else if (QUICK_STRCMP(mht_keyw,"echo")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\n\r\0");
+				mht_release_refs();
+
+				if (token_ptr!=(char*)NULL) {
+					sprintf(mht->tmp_str1,"%s",token_ptr);
+					fprintf(stdout,"%s",mht_expand(mht->tmp_str1));
+				}
+
+				return (MHT_OK);
+			}
+
+
+			/* Echo a expanded line to stdout with a trailing newline */
+			else if (QUICK_STRCMP(mht_keyw,"echoln")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\r\0");
+				mht_release_refs();
+
+				/*
+				if (token_ptr!=(char*)NULL) {
+					sprintf(mht->tmp_str1,"%s",token_ptr);
+					fprintf(stdout,"%s\n",mht_expand(mht->tmp_str1));
+				}
+				else {
+					fprintf(stdout,"\n");
+				}
+				*/
+
+				if (token_ptr!=(char*)NULL) {
+					sprintf(mht->tmp_str1,"%s",token_ptr);
+					mht_expand(mht->tmp_str1);
+
+					if (mht_filter_has(&mht->chain,MHT_FILTER_KILLSPACE)==1) {
+						fprintf(stdout,"%s",mht_killspace(mht->tmp_str1));
+					}
+					else {
+						fprintf(stdout,"%s",mht->tmp_str1);
+					}
+					/*fprintf(stdout,"\n");*/
+				}
+				else /*if (mht->killspace==0)*/ {
+					fprintf(stdout,"\n");
+				}
+
+				return (MHT_OK);
+			}
+
+
+			/*
+				Write an expanded line to the current MHT output stream,
+				even outside a block! The difference to #echo is, that
+				#echo writes to stdout, whereas #write can also write
+				to a file, if it was opened via #mhtfile before.
+			*/
+			else if (QUICK_STRCMP(mht_keyw,"write")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\n\r\0");
+
+				if (token_ptr!=(char*)NULL) {
+					sprintf(mht->tmp_str1,"%s",token_ptr);
+					mht_expand(mht->tmp_str1);
+					mht_print_line(mht->tmp_str1);
+				}
+
+				return (MHT_OK);
+			}
+
+
+			/*
+				Write a expanded_ptr line to the current MHT output stream
+				with a trailing newline.
+			*/
+			else if (QUICK_STRCMP(mht_keyw,"writeln")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\r\0");
+
+				if (token_ptr!=(char*)NULL) {
+					sprintf(mht->tmp_str1,"%s",token_ptr);
+					mht_expand(mht->tmp_str1);
+					mht_print_line(mht->tmp_str1);
+				}
+				else {
+					mht_print_line("\n");
+				}
+
+				return (MHT_OK);
+			}
+
+
+			/*
+				Interrupt the MHT processing until a key is pressed.
+			*/
+			else if (QUICK_STRCMP(mht_keyw,"pause")==0) {
+				fprintf(stdout,"\nMHT paused: press return to continue...\n");
+				fgetc(stdin);
+				return (MHT_OK);
+			}
+
+
+			/*
+				Send the output so far to the client, e.g. the head of
+				a page before a slow part. A compressed output is flushed
+				as well.
+			*/
+			else if (QUICK_STRCMP(mht_keyw,"flush")==0) {
+				if (mht->chain.first!=(MHT_SINK*)NULL) {
+					sink_flush(mht->chain.first);
+				}
+				else if (mht->sink!=(MHT_SINK*)NULL) {
+					sink_flush(mht->sink);
+				}
+				else if (mht->out!=(FILE*)NULL) {
+					fflush(mht->out);
+				}
+				return (MHT_OK);
+			}
+
+
+			/*
+				Call a block n-times (looping)
+			*/
+			else if (QUICK_STRCMP(mht_keyw,"loop")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_LOOP_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				/*
+					Expand the name of the block to be processed and all
+					possible block parameters...
+				*/
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+
+				param_start = strcspn(token1,"|:");
+
+				if (*(token1 + param_start)=='|') {
+					/* New form: block|param1|param2|... */
+					block_param_count = strsplit(token1,block_params,'|',MAX_ARG_COUNT);
+					/* Process the block with optional arguments */
+					mht_err = mht_loop(mht->out,block_params[0],block_params,block_param_count);
+					mht_free_block_params(block_params,block_param_count);
+				}
+				else if (*(token1 + param_start)==':') {
+					/* Old form: block : param1 param2 ... */
+					block_param_count = mht_get_block_params(token1,block_params);
+					/* Process the block with optional arguments */
+					mht_err = mht_loop(mht->out,block_params[0],block_params,block_param_count);
+					mht_free_block_params(block_params,block_param_count);
+				}
+
+				return (mht_err);
+			}
+
+
+			/*
+				Call a block for each item of a list
+			*/
+			else if (QUICK_STRCMP(mht_keyw,"foreach")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_FOREACH_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+
+				block_param_count = strsplit(token1,block_params,'|',MAX_ARG_COUNT);
+
+				if (block_param_count<1 || block_params[0]==(char*)NULL) {
+					mht_free_block_params(block_params,block_param_count);
+					return (MHT_ERR_FOREACH_WITHOUT_ENOUGH_PARAMETERS);
+				}
+
+				mht_err = mht_foreach(mht->out,block_params[0],block_params,block_param_count);
+				mht_free_block_params(block_params,block_param_count);
+
+				return (mht_err);
+			}
+
+
+			/*
+				Call a block for each row of a CSV/TSV file
+			*/
+			else if (QUICK_STRCMP(mht_keyw,"table")==0) {
+				token_ptr = mht_strtok((char*)NULL,"\t\n\r\0");
+
+				if (token_ptr==(char*)NULL) {
+					return (MHT_ERR_TABLE_DIRECTIVE_WITHOUT_ARGS);
+				}
+
+				sprintf(token1,"%s",token_ptr);
+				mht_expand(token1);
+				mht_trim(token1);
+
+				block_param_count = strsplit(token1,block_params,'|',MAX_ARG_COUNT);
+
+				if (block_param_count<1 || block_params[0]==(char*)NULL) {
+					mht_free_block_params(block_params,block_param_count);
+					return (MHT_ERR_TABLE_WITHOUT_ENOUGH_PARAMETERS);
+				}
+
+				mht_err = mht_table(mht->out,block_params,block_param_count);
+				mht_free_block_params(block_params,block_param_count);
+
+				return (mht_err);
+			}
+		}
+	}
+	else if ( (*tmp_line!='\0' && tmp_line!=(char*)NULL) && (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true==1) ) {
+		/*
+			The line doesn't start with a MHT directive! If we are
+			inside a MHT block, expand all macros, replace the umlauts
+			and print it to the current MHT output stream.
+		*/
+		mht_expand(tmp_line);
+
+		if (mht->writeoutput==1) {
+			mht_print_line(tmp_line);
+		}
+	}
+
+	return (MHT_OK);
+}
+
+
+/*
+	After a line is processed, print it to the output sink(s).
+*/
+void mht_print_line( char *line ) {
+	unsigned int i = 0;
+
+	if (mht->active_fhandle>0) {
+		/* Print to a specific file handle */
+		if (mht->fhandle_fptr[mht->active_fhandle]!=(FILE*)NULL) {
+			mht_print_to(&mht->fhandle_chain[mht->active_fhandle],mht->fhandle_fptr[mht->active_fhandle],(MHT_SINK*)NULL,line);
+		}
+	}
+	else if (mht->active_fhandle==0) {
+		/* Print to all open file handles */
+		for (i=1;i<=mht->fhandles;i++) {
+			if (mht->fhandle_fptr[i]!=(FILE*)NULL) {
+				mht_print_to(&mht->fhandle_chain[i],mht->fhandle_fptr[i],(MHT_SINK*)NULL,line);
+			}
+		}
+	}
+	else if (mht->active_fhandle<0) {
+		/*
+			No file handle registered, print to the output
+			sink, which is stdout unless other specified.
+		*/
+		if (mht->sink!=(MHT_SINK*)NULL || mht->out!=(FILE*)NULL) {
+			mht_print_to(&mht->chain,mht->out,mht->sink,line);
+		}
+	}
+
+	if (mht->cache_depth>0) {
+		mht_cache_capture(line);
+	}
+}
+
+
+/*
+	Print the text of a static or folded line. Without filters the
+	sink may keep a reference to the text instead of a copy (e.g. the
+	writev sink), the text stays valid until the blocks are changed.
+*/
+void mht_print_static( char *text ) {
+	if (mht->active_fhandle<0 && mht->sink!=(MHT_SINK*)NULL && mht->sink->ref!=NULL && mht->chain.filter_count==0) {
+		sink_push_ref(mht->sink,text,strlen(text));
+
+		if (mht->cache_depth>0) {
+			mht_cache_capture(text);
+		}
+		return;
+	}
+
+	mht_print_line(text);
+}
+
+
+/*
+	Pass on the output batched by a sink keeping references, before
+	the lines of a block are freed or folded again, or before some
+	output bypasses the sink (#echo).
+*/
+void mht_release_refs(void) {
+	if (mht->sink!=(MHT_SINK*)NULL && mht->sink->ref!=NULL && mht->sink->flush!=NULL) {
+		mht->sink->flush(mht->sink);
+	}
+}
+
+
+/*
+	Print a line through the filters of an output to a sink, or to
+	the stream fptr if sink is NULL.
+*/
+void mht_print_to( FILTER_CHAIN *chain, FILE *fptr, MHT_SINK *sink, char *line ) {
+	MHT_SINK *first = mht_filter_sink(chain,fptr,sink);
+
+	if (first!=(MHT_SINK*)NULL) {
+		sink_push(first,line,strlen(line));
+	}
+	else if (sink!=(MHT_SINK*)NULL) {
+		sink_push(sink,line,strlen(line));
+	}
+	else {
+		fprintf(fptr,"%s",line);
+	}
+}
+
+
+/*
+	The filters of the current output: those of the active file
+	handle, or those of the output stream.
+*/
+FILTER_CHAIN *mht_filter_chain(void) {
+	if (mht->active_fhandle>0) {
+		return (&mht->fhandle_chain[mht->active_fhandle]);
+	}
+
+	return (&mht->chain);
+}
+
+
+/*
+	Returns the first filter of an output, the filters are set up in
+	front of sink (or fptr) when needed. Returns NULL without filters.
+*/
+MHT_SINK *mht_filter_sink( FILTER_CHAIN *chain, FILE *fptr, MHT_SINK *sink ) {
+	FILTER_CHAIN *filters = (chain->own==1) ? chain : &mht->chain;
+	unsigned int i = 0;
+
+
+	if (chain->first!=(MHT_SINK*)NULL) {
+		return (chain->first);
+	}
+
+	if (filters->filter_count==0) {
+		return ((MHT_SINK*)NULL);
+	}
+
+	if (sink==(MHT_SINK*)NULL) {
+		chain->out = sink_file_new(fptr);
+		sink = chain->out;
+	}
+
+	/* From the last filter to the first one */
+	for (i=filters->filter_count; i>0; i--) {
+		switch (filters->filters[i-1]) {
+			case MHT_FILTER_UMLAUTS:
+				sink = sink_replace_new(sink,mht_html_replace_chars,mht_html_umlauts,MHT_UMLAUT_COUNT);
+				break;
+			case MHT_FILTER_KILLSPACE:
+				sink = sink_killspace_new(sink);
+				break;
+			case MHT_FILTER_MINIFY:
+				sink = sink_minify_new(sink);
+				break;
+		}
+	}
+
+	chain->first = sink;
+	chain->sinks = filters->filter_count;
+
+	return (chain->first);
+}
+
+
+/*
+	Tear down the filter sinks of an output, all they hold back is
+	passed on. The sinks behind them go on.
+*/
+void mht_filter_end( FILTER_CHAIN *chain ) {
+	MHT_SINK
+		*sink = chain->first,
+		*next = (MHT_SINK*)NULL;
+
+	unsigned int i = 0;
+
+
+	for (i=0; i<chain->sinks && sink!=(MHT_SINK*)NULL; i++) {
+		if (sink->finish!=NULL) {
+			sink->finish(sink);
+		}
+		else if (sink->flush!=NULL) {
+			sink->flush(sink);
+		}
+
+		next = sink->next;
+		sink_free(sink);
+		sink = next;
+	}
+
+	sink_free(chain->out);
+	chain->first = (MHT_SINK*)NULL;
+	chain->out = (MHT_SINK*)NULL;
+	chain->sinks = 0;
+}
+
+
+void mht_filter_end_all(void) {
+	unsigned int i = 0;
+
+	mht_filter_end(&mht->chain);
+
+	for (i=1; i<MAX_OUTFILE_HANDLES; i++) {
+		mht_filter_end(&mht->fhandle_chain[i]);
+	}
+}
+
+
+/*
+	Set the filters of an output from a list like "umlauts,killspace",
+	or "none". The output to a file handle goes through the filters
+	of the output stream until it gets filters of its own.
+*/
+int mht_filter_set( FILTER_CHAIN *chain, char *list ) {
+	unsigned int
+		filters[MAX_FILTERS],
+		filter_count = 0,
+		len = 0;
+
+
+	if (QUICK_STRCMP(list,"none")!=0) {
+		while (*list!='\0') {
+			if (filter_count>=MAX_FILTERS) {
+				return (MHT_ERR_SETVAR_PARAM_UNRECOGNIZED);
+			}
+
+			len = strcspn(list,",");
+			if (len==7 && strncmp(list,"umlauts",len)==0) {
+				filters[filter_count++] = MHT_FILTER_UMLAUTS;
+			}
+			else if (len==9 && strncmp(list,"killspace",len)==0) {
+				filters[filter_count++] = MHT_FILTER_KILLSPACE;
+			}
+			else if (len==6 && strncmp(list,"minify",len)==0) {
+				filters[filter_count++] = MHT_FILTER_MINIFY;
+			}
+			else {
+				return (MHT_ERR_SETVAR_PARAM_UNRECOGNIZED);
+			}
+
+			list += (list[len]==',') ? len+1 : len;
+		}
+	}
+
+	/* The file handles without filters of their own change as well */
+	if (chain==&mht->chain) {
+		mht_filter_end_all();
+	}
+	else {
+		mht_filter_end(chain);
+		chain->own = 1;
+	}
+
+	memcpy(chain->filters,filters,filter_count*sizeof(unsigned int));
+	chain->filter_count = filter_count;
+
+	return (MHT_OK);
+}
+
+
+/*
+	Switch a filter of the output stream on or off, see the switches
+	like "#mhtvar killspace true". The filters are kept in the order of
+	their numbers, so the umlauts are replaced before space is killed.
+*/
+void mht_filter_switch( unsigned int filter, unsigned int on ) {
+	FILTER_CHAIN *chain = &mht->chain;
+	unsigned int i = 0;
+
+
+	for (i=0; i<chain->filter_count && chain->filters[i]<filter; i++);
+
+	if (on==1 && (i==chain->filter_count || chain->filters[i]!=filter) && chain->filter_count<MAX_FILTERS) {
+		mht_filter_end_all();
+		memmove(chain->filters+i+1,chain->filters+i,(chain->filter_count-i)*sizeof(unsigned int));
+		chain->filters[i] = filter;
+		chain->filter_count++;
+	}
+	else if (on==0 && i<chain->filter_count && chain->filters[i]==filter) {
+		mht_filter_end_all();
+		memmove(chain->filters+i,chain->filters+i+1,(chain->filter_count-i-1)*sizeof(unsigned int));
+		chain->filter_count--;
+	}
+}
+
+
+/*
+	Returns 1 if a filter is in the chain of an output, 0 otherwise.
+*/
+unsigned int mht_filter_has( FILTER_CHAIN *chain, unsigned int filter ) {
+	unsigned int i = 0;
+
+	for (i=0; i<chain->filter_count; i++) {
+		if (chain->filters[i]==filter) {
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+
+/*
+	Register a environment variable as a MHT macro. The variable is read
+	when the macro is referenced first. Returns 1 if the variable is set.
+*/
+int mht_register_env( char *env_var, char *mht_macro ) {
+	if ( (env_var!=(char*)NULL) && (getenv(env_var)!=(char*)NULL) ) {
+		return (mht_register_provider(mht_macro,mht_env_provider,env_var,0));
+	}
+
+	return (0);
+}
+
+
+/*
+	Free the arguments split by strsplit or mht_get_block_params.
+*/
+void mht_free_block_params( char **args, int arg_count ) {
+	int i = 0;
+
+	for (i=0; i<arg_count; i++) {
+		if (args[i]!=(char*)NULL) {
+			free(args[i]);
+			args[i] = (char*)NULL;
+		}
+	}
+}
+
+
+/*
+	Split the arguments of a #process directive of the form
+	block : param1 param2 param3 ...
+	and store the tokens in args.
+*/
+int mht_get_block_params( char *str, char **args ) {
+	unsigned int
+		arg_count = 0;
+
+	char
+		*token_ptr = (char*)NULL;
+
+
+	token_ptr = mht_strtok(str," :\t\n\r\0");
+
+	while (token_ptr!=(char*)NULL) {
+		if (QUICK_STRCMP(token_ptr,":")!=0) {
+			args[arg_count++] = strdup(token_ptr);
+		}
+		token_ptr = mht_strtok((char*)NULL," \t\n\r\0");
+	}
+
+	return (arg_count);
+}
+
+
+/*
+	Process a line with a #if, #elif, #else or #endif
+	directive and set the if_count correct. The argument
+	for the directive is already expanded_ptr!
+*/
+int mht_set_if_count( char *if_directive, char *if_arg ) {
+	int if_value = MHT_IF_NO_ARG;
+
+	if (if_arg!=(char*)NULL) {
+		strlwr(if_arg);
+
+		if ( (QUICK_STRCMP(if_arg,"true")==0) || (QUICK_STRCMP(if_arg,"1")==0) ) {
+			if_value = MHT_IF_TRUE;
+		}
+		else if ( (QUICK_STRCMP(if_arg,"false")==0) || (QUICK_STRCMP(if_arg,"0")==0) ) {
+			if_value = MHT_IF_FALSE;
+		}
+		else {
+			if_value = MHT_IF_WRONG_ARG;
+		}
+	}
+
+	return (mht_set_if_value(if_directive,if_value));
+}
+
+
+/*
+	Maintain the if stack for #if, #elif, #else and #endif. if_value is
+	one of the MHT_IF_* constants.
+*/
+int mht_set_if_value( char *if_directive, int if_value ) {
+	if (GET_IF_LEVEL==MAX_IF_COUNT-1) {
+		/* We have too many if levels (128 cascaded #if's should be enough!) */
+		return (MHT_ERR_IF_COUNT_TOO_MANY_LEVELS);
+	}
+
+
+	/* A if block is splitted here */
+	if (QUICK_STRCMP(if_directive,"else")==0) {
+		/* An #else without an #if before is not allowed! */
+		if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if==0) {
+			return (MHT_ERR_IF_COUNT_IF_IS_MISSING);
+		}
+
+		if ( (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true==0) && (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL-1 ].is_true==1) ) {
+			mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+			mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 1;
+		}
+		else {
+			mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
+		}
+
+		return (MHT_OK);
+	}
+
+
+	/* Go down in the if stack */
+	else if (QUICK_STRCMP(if_directive,"endif")==0) {
+		/* An #endif without an #if before is not allowed! */
+		if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if==0) {
+			return (MHT_ERR_IF_COUNT_IF_IS_MISSING);
+		}
+
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
+		mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 0;
+		DEC_IF_LEVEL;
+
+		/* Oops, there was one #endif too much! */
+		if (GET_IF_LEVEL<0) {
+			return (MHT_ERR_IF_COUNT_TOO_MANY_ENDIF);
+		}
+
+		return (MHT_OK);
+	}
+
+
+	/* Set everything for "#if if_arg" or "#elif if_arg" */
+	else if ( (if_value!=MHT_IF_NO_ARG) && ((QUICK_STRCMP(if_directive,"if")==0) || (QUICK_STRCMP(if_directive,"elif")==0)) ) {
+		if (QUICK_STRCMP(if_directive,"if")==0) {
+			INC_IF_LEVEL;
+			mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 1;
+
+			if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL-1 ].is_true==1) {
+				if (if_value==MHT_IF_TRUE) {
+					mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+					mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 1;
+				}
+				else if (if_value==MHT_IF_FALSE) {
+					mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
+					mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
+				}
+				else {
+					return (MHT_ERR_IF_COUNT_ARGUMENT_WRONG_ARG);
+				}
+			}
+		}
+		else if (QUICK_STRCMP(if_directive,"elif")==0) {
+			/* An #elif without an #if before is not allowed! */
+			if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if==0) {
+				return (MHT_ERR_IF_COUNT_IF_IS_MISSING);
+			}
+
+			if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL-1 ].is_true==1) {
+				if (if_value==MHT_IF_TRUE) {
+					if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true==0) {
+						mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
+						mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 1;
+					}
+					else if (mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true==1) {
+						mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
+					}
+				}
+				else if (if_value==MHT_IF_FALSE) {
+					mht->if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
+				}
+				else {
+					return (MHT_ERR_IF_COUNT_ARGUMENT_WRONG_ARG);
+				}
+			}
+		}
+	}
+	else {
+		/* if_arg was missing */
+		return (MHT_ERR_IF_COUNT_IF_OR_ELIF_WITHOUT_ARG);
+	}
+
+	return (MHT_OK);
+}
+
+
+/*
+	Compile the argument of #if or #elif into an expression tree:
+
+		expr := and { "||" and }
+		and  := not { "&&" not }
+		not  := "!" not | cmp
+		cmp  := operand [ ("=="|"!="|"<"|">"|"<="|">=") operand ]
+		operand := "(" expr ")" | defined(name) | in(operand,operand,...)
+			| "string" | 'string' | <#macro...> | word
+
+	Returns NULL if text is not an expression, the caller falls back to
+	the old "#if true|false|1|0" handling then. The result is one memory
+	block, it is freed with free().
+*/
+MHT_EXPR *mht_expr_compile( char *text ) {
+	EXPR_PARSER parser;
+	MHT_EXPR *expr = (MHT_EXPR*)NULL;
+	unsigned int len = 0;
+
+
+	if (text==(char*)NULL) {
+		return ((MHT_EXPR*)NULL);
+	}
+
+	/* Each node takes at least one char of text, each string is copied at most once */
+	len = (unsigned int)strlen(text);
+	parser.max_nodes = len+2;
+	parser.nodes = (MHT_EXPR*)_malloc(parser.max_nodes*sizeof(MHT_EXPR) + 2*len+2);
+	parser.strs = (char*)(parser.nodes+parser.max_nodes);
+	parser.node_count = 0;
+	parser.pos = text;
+
+	mht_expr_node(&parser,EXPR_ROOT,(char*)NULL,0);
+	parser.nodes[0].left = expr = mht_expr_or(&parser);
+
+	while (isspace((unsigned char)*parser.pos)) {
+		parser.pos++;
+	}
+
+	if (expr==(MHT_EXPR*)NULL || *parser.pos!='\0') {
+		free(parser.nodes);
+		return ((MHT_EXPR*)NULL);
+	}
+
+	return (parser.nodes);
+}
+
+
+/*
+	Get a new node of a compiled expression, str is copied.
+*/
+MHT_EXPR *mht_expr_node( EXPR_PARSER *parser, int op, char *str, unsigned int len ) {
+	MHT_EXPR *node = (MHT_EXPR*)NULL;
+
+	if (parser->node_count>=parser->max_nodes) {
+		return ((MHT_EXPR*)NULL);
+	}
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_MHTVAR_DIRECTIVE_WITHOUT_ARGS);
-				}
+	node = &parser->nodes[parser->node_count++];
+	node->op = op;
+	node->str = (char*)NULL;
+	node->len = len;
+	node->left = node->right = node->next = (MHT_EXPR*)NULL;
 
-				sprintf(token1,"%s",token_ptr);
-				token_ptr = strtok((char*)NULL,"\t\n\r\0");
+	if (str!=(char*)NULL) {
+		node->str = parser->strs;
+		memcpy(node->str,str,len);
+		node->str[len] = '\0';
+		parser->strs += len+1;
+	}
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_MHTVAR_DIRECTIVE_WITHOUT_ARGS);
-				}
+	return (node);
+}
 
-				sprintf(token2,"%s",token_ptr);
-				return (mht_setvar(token1,token2));
-			}
 
+/*
+	expr := and { "||" and }
+*/
+MHT_EXPR *mht_expr_or( EXPR_PARSER *parser ) {
+	MHT_EXPR
+		*left = (MHT_EXPR*)NULL,
+		*node = (MHT_EXPR*)NULL;
 
-			/* exit */
-			else if (QUICK_STRCMP(mht_keyw,"mhtexit")==0) {
-				mht_exit();
-				exit(0);
-			}
+	if ((left=mht_expr_and(parser))==(MHT_EXPR*)NULL) {
+		return ((MHT_EXPR*)NULL);
+	}
 
+	for (;;) {
+		while (isspace((unsigned char)*parser->pos)) {
+			parser->pos++;
+		}
 
-			/* set to which file handle(s) the output should be printed */
-			else if (QUICK_STRCMP(mht_keyw,"file")==0) {
-				token_ptr = strtok((char*)NULL,"\t\n\r\0");
+		if (parser->pos[0]!='|' || parser->pos[1]!='|') {
+			return (left);
+		}
+		parser->pos += 2;
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_SETFILE_IO_FHANDLE_MISSING);
-				}
+		if ((node=mht_expr_node(parser,EXPR_OR,(char*)NULL,0))==(MHT_EXPR*)NULL) {
+			return ((MHT_EXPR*)NULL);
+		}
+		node->left = left;
 
-				sprintf(token1,"%s",token_ptr);
-				mht_expand(token1);
+		if ((node->right=mht_expr_and(parser))==(MHT_EXPR*)NULL) {
+			return ((MHT_EXPR*)NULL);
+		}
+		left = node;
+	}
+}
 
-				return (mht_setfile_io(mht_keyw,token1,(char*)NULL));
-			}
 
-			/* set MHT file I/O */
-			else if (QUICK_STRCMP(mht_keyw,"mhtfile")==0) {
-				token_ptr = strtok((char*)NULL," \t\n\r\0");
+/*
+	and := not { "&&" not }
+*/
+MHT_EXPR *mht_expr_and( EXPR_PARSER *parser ) {
+	MHT_EXPR
+		*left = (MHT_EXPR*)NULL,
+		*node = (MHT_EXPR*)NULL;
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_SETFILE_IO_OPERATION_MISSING);
-				}
+	if ((left=mht_expr_not(parser))==(MHT_EXPR*)NULL) {
+		return ((MHT_EXPR*)NULL);
+	}
 
-				sprintf(token1,"%s",token_ptr);
+	for (;;) {
+		while (isspace((unsigned char)*parser->pos)) {
+			parser->pos++;
+		}
 
-				token_ptr = strtok((char*)NULL," \t\n\r\0");
-				if (token_ptr==(char*)NULL) {
-					/* #mhtfile close doesn't need the file name as a 2nd/3rd parameter */
-					return (mht_setfile_io(token1,(char*)NULL,(char*)NULL));
-				}
+		if (parser->pos[0]!='&' || parser->pos[1]!='&') {
+			return (left);
+		}
+		parser->pos += 2;
 
-				sprintf(token2,"%s",token_ptr);
-				mht_expand(token2);
+		if ((node=mht_expr_node(parser,EXPR_AND,(char*)NULL,0))==(MHT_EXPR*)NULL) {
+			return ((MHT_EXPR*)NULL);
+		}
+		node->left = left;
 
-				token_ptr = strtok((char*)NULL,"\t\n\r\0");
-				if (token_ptr==(char*)NULL) {
-					/* #mhtfile type doesn't need a 3rd parameter */
-					return (mht_setfile_io(token1,token2,(char*)NULL));
-				}
+		if ((node->right=mht_expr_not(parser))==(MHT_EXPR*)NULL) {
+			return ((MHT_EXPR*)NULL);
+		}
+		left = node;
+	}
+}
 
-				sprintf(token3,"%s",token_ptr);
-				mht_expand(token3);
 
-				/* Finally, it could only be #mhtfile open */
-				return (mht_setfile_io(token1,token2,token3));
-			}
+/*
+	not := "!" not | cmp
+*/
+MHT_EXPR *mht_expr_not( EXPR_PARSER *parser ) {
+	MHT_EXPR *node = (MHT_EXPR*)NULL;
 
+	while (isspace((unsigned char)*parser->pos)) {
+		parser->pos++;
+	}
 
-			/* Echo a expanded line to stdout */
-			else if (QUICK_STRCMP(mht_keyw,"echo")==0) {
-				token_ptr = strtok((char*)NULL,"\n\r\0");
+	if (parser->pos[0]=='!' && parser->pos[1]!='=') {
+		parser->pos++;
 
-				if (token_ptr!=(char*)NULL) {
-					sprintf(tmp_str1,"%s",token_ptr);
-					fprintf(stdout,"%s",mht_expand(tmp_str1));
-				}
+		if ((node=mht_expr_node(parser,EXPR_NOT,(char*)NULL,0))==(MHT_EXPR*)NULL) {
+			return ((MHT_EXPR*)NULL);
+		}
 
-				return (MHT_OK);
-			}
+		node->left = mht_expr_not(parser);
+		return ((node->left!=(MHT_EXPR*)NULL) ? node : (MHT_EXPR*)NULL);
+	}
 
+	return (mht_expr_cmp(parser));
+}
 
-			/* Echo a expanded line to stdout with a trailing newline */
-			else if (QUICK_STRCMP(mht_keyw,"echoln")==0) {
-				token_ptr = strtok((char*)NULL,"\r\0");
 
-				/*
-				if (token_ptr!=(char*)NULL) {
-					sprintf(tmp_str1,"%s",token_ptr);
-					fprintf(stdout,"%s\n",mht_expand(tmp_str1));
-				}
-				else {
-					fprintf(stdout,"\n");
-				}
-				*/
+/*
+	cmp := operand [ ("=="|"!="|"<"|">"|"<="|">=") operand ]
+*/
+MHT_EXPR *mht_expr_cmp( EXPR_PARSER *parser ) {
+	MHT_EXPR
+		*left = (MHT_EXPR*)NULL,
+		*node = (MHT_EXPR*)NULL;
+	char *ptr = (char*)NULL;
+	int op = 0;
+
+	if ((left=mht_expr_operand(parser))==(MHT_EXPR*)NULL) {
+		return ((MHT_EXPR*)NULL);
+	}
 
-				if (token_ptr!=(char*)NULL) {
-					sprintf(tmp_str1,"%s",token_ptr);
-					mht_expand(tmp_str1);
+	for (ptr=parser->pos; isspace((unsigned char)*ptr); ptr++);
 
-					if (mht.killspace==1) {
-						fprintf(stdout,"%s",mht_killspace(tmp_str1));
-					}
-					else {
-						fprintf(stdout,"%s",tmp_str1);
-					}
-					/*fprintf(stdout,"\n");*/
-				}
-				else /*if (mht.killspace==0)*/ {
-					fprintf(stdout,"\n");
-				}
+	if (ptr[0]=='=' && ptr[1]=='=') {
+		op = EXPR_EQ;
+	}
+	else if (ptr[0]=='!' && ptr[1]=='=') {
+		op = EXPR_NE;
+	}
+	else if (ptr[0]=='<') {
+		op = (ptr[1]=='=') ? EXPR_LE : EXPR_LT;
+	}
+	else if (ptr[0]=='>') {
+		op = (ptr[1]=='=') ? EXPR_GE : EXPR_GT;
+	}
+	else {
+		return (left);
+	}
 
-				return (MHT_OK);
-			}
+	parser->pos = ptr + ((op==EXPR_LT || op==EXPR_GT) ? 1 : 2);
 
+	if ((node=mht_expr_node(parser,op,(char*)NULL,0))==(MHT_EXPR*)NULL) {
+		return ((MHT_EXPR*)NULL);
+	}
+	node->left = left;
+	node->right = mht_expr_operand(parser);
 
-			/*
-				Write an expanded line to the current MHT output stream,
-				even outside a block! The difference to #echo is, that
-				#echo writes to stdout, whereas #write can also write
-				to a file, if it was opened via #mhtfile before.
-			*/
-			else if (QUICK_STRCMP(mht_keyw,"write")==0) {
-				token_ptr = strtok((char*)NULL,"\n\r\0");
+	return ((node->right!=(MHT_EXPR*)NULL) ? node : (MHT_EXPR*)NULL);
+}
 
-				if (token_ptr!=(char*)NULL) {
-					sprintf(tmp_str1,"%s",token_ptr);
-					mht_expand(tmp_str1);
 
-					if (mht.killspace==1) {
-						mht_killspace(tmp_str1);
-					}
+/*
+	operand := "(" expr ")" | defined(name) | in(operand,operand,...)
+		| "string" | 'string' | <#macro...> | word
+*/
+MHT_EXPR *mht_expr_operand( EXPR_PARSER *parser ) {
+	MHT_EXPR
+		*node = (MHT_EXPR*)NULL,
+		*item = (MHT_EXPR*)NULL;
+	char
+		*start = (char*)NULL,
+		*ptr = (char*)NULL;
+	int
+		bracket = 0,
+		simple = 1;
 
-					mht_print_line(tmp_str1);
-				}
 
-				return (MHT_OK);
-			}
+	while (isspace((unsigned char)*parser->pos)) {
+		parser->pos++;
+	}
+	start = parser->pos;
 
+	/* "(" expr ")" */
+	if (*start=='(') {
+		parser->pos++;
+		node = mht_expr_or(parser);
 
-			/*
-				Write a expanded_ptr line to the current MHT output stream
-				with a trailing newline.
-			*/
-			else if (QUICK_STRCMP(mht_keyw,"writeln")==0) {
-				token_ptr = strtok((char*)NULL,"\r\0");
+		while (isspace((unsigned char)*parser->pos)) {
+			parser->pos++;
+		}
+		if (node==(MHT_EXPR*)NULL || *parser->pos!=')') {
+			return ((MHT_EXPR*)NULL);
+		}
+		parser->pos++;
 
-				if (token_ptr!=(char*)NULL) {
-					sprintf(tmp_str1,"%s",token_ptr);
-					mht_expand(tmp_str1);
+		return (node);
+	}
 
-					if (mht.killspace==1) {
-						mht_print_line(mht_killspace(tmp_str1));
-					}
-					else {
-						mht_print_line(tmp_str1);
-					}
-				}
-				else if (mht.killspace==0) {
-					mht_print_line("\n");
-				}
+	/* A quoted string */
+	if (*start=='"' || *start=='\'') {
+		if ((ptr=strchr(start+1,*start))==(char*)NULL) {
+			return ((MHT_EXPR*)NULL);
+		}
+		parser->pos = ptr+1;
 
-				return (MHT_OK);
-			}
+		return (mht_expr_node(parser,EXPR_LITERAL,start+1,ptr-start-1));
+	}
 
+	/* A macro reference, it is simple without arguments and inner macros */
+	if (start[0]=='<' && start[1]=='#') {
+		for (ptr=start; *ptr!='\0'; ptr++) {
+			if (*ptr=='<') bracket++;
+			if (*ptr=='>') bracket--;
+			if (*ptr=='|' || (*ptr=='<' && ptr!=start)) simple = 0;
+			if (bracket==0) break;
+		}
 
-			/*
-				Interrupt the MHT processing until a key is pressed.
-			*/
-			else if (QUICK_STRCMP(mht_keyw,"pause")==0) {
-				fprintf(stdout,"\nMHT paused: press return to continue...\n");
-				fgetc(stdin);
-				return (MHT_OK);
-			}
+		if (bracket!=0) {
+			return ((MHT_EXPR*)NULL);
+		}
+		parser->pos = ptr+1;
 
+		if (simple==1 && ptr-start>2 && start[2]!='#' && start[2]!='.') {
+			return (mht_expr_node(parser,EXPR_MACRO,start+2,ptr-start-2));
+		}
 
-			/*
-				Call a block n-times (looping)
-			*/
-			else if (QUICK_STRCMP(mht_keyw,"loop")==0) {
-				token_ptr = strtok((char*)NULL,"\t\n\r\0");
+		return (mht_expr_node(parser,EXPR_REF,start,ptr-start+1));
+	}
 
-				if (token_ptr==(char*)NULL) {
-					return (MHT_ERR_LOOP_DIRECTIVE_WITHOUT_ARGS);
-				}
+	/* A bare word */
+	for (ptr=start; *ptr!='\0' && !isspace((unsigned char)*ptr) && strchr("()!=<>&|,\"'",*ptr)==(char*)NULL; ptr++);
 
-				/*
-					Expand the name of the block to be processed and all
-					possible block parameters...
-				*/
-				sprintf(token1,"%s",token_ptr);
-				mht_expand(token1);
+	if (ptr==start) {
+		return ((MHT_EXPR*)NULL);
+	}
+	parser->pos = ptr;
 
-				param_start = strcspn(token1,"|:");
+	while (isspace((unsigned char)*ptr)) {
+		ptr++;
+	}
 
-				if (*(token1 + param_start)=='|') {
-					/* New form: block|param1|param2|... */
-					block_param_count = strsplit(token1,block_params,'|',MAX_ARG_COUNT);
-					/* Process the block with optional arguments */
-					mht_err = mht_loop(mht.out,block_params[0],block_params,block_param_count);
-				}
-				else if (*(token1 + param_start)==':') {
-					/* Old form: block : param1 param2 ... */
-					block_param_count = mht_get_block_params(token1,block_params);
-					/* Process the block with optional arguments */
-					mht_err = mht_loop(mht.out,block_params[0],block_params,block_param_count);
-				}
+	/* defined(name) or defined(<#name>) */
+	if (*ptr=='(' && parser->pos-start==7 && strncmp(start,"defined",7)==0) {
+		parser->pos = ptr+1;
 
-				return (mht_err);
-			}
+		if ((item=mht_expr_operand(parser))==(MHT_EXPR*)NULL || (item->op!=EXPR_LITERAL && item->op!=EXPR_MACRO)) {
+			return ((MHT_EXPR*)NULL);
 		}
-	}
-	else if ( (*tmp_line!='\0' && tmp_line!=(char*)NULL) && (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true==1) ) {
-		/*
-			The line doesn't start with a MHT directive! If we are
-			inside a MHT block, expand all macros, replace the umlauts
-			and print it to the current MHT output stream.
-		*/
-		mht_expand(tmp_line);
 
-		if (mht.conv_umlauts==1) {
-			mht_replace_umlauts(tmp_line);
+		while (isspace((unsigned char)*parser->pos)) {
+			parser->pos++;
 		}
+		if (*parser->pos!=')') {
+			return ((MHT_EXPR*)NULL);
+		}
+		parser->pos++;
+
+		item->op = EXPR_DEFINED;
+		return (item);
+	}
+
+	/* in(x,set,...) */
+	if (*ptr=='(' && parser->pos-start==2 && strncmp(start,"in",2)==0) {
+		parser->pos = ptr+1;
 
-		if (mht.killspace==1) {
-			mht_killspace(tmp_line);
+		if ((node=mht_expr_node(parser,EXPR_IN,(char*)NULL,0))==(MHT_EXPR*)NULL) {
+			return ((MHT_EXPR*)NULL);
+		}
+		if ((node->left=mht_expr_operand(parser))==(MHT_EXPR*)NULL) {
+			return ((MHT_EXPR*)NULL);
 		}
 
-		if (mht.writeoutput==1) {
-			mht_print_line(tmp_line);
+		for (;;) {
+			while (isspace((unsigned char)*parser->pos)) {
+				parser->pos++;
+			}
+
+			if (*parser->pos==')') {
+				parser->pos++;
+				return (node);
+			}
+			if (*parser->pos!=',') {
+				return ((MHT_EXPR*)NULL);
+			}
+			parser->pos++;
+
+			if ((item=mht_expr_operand(parser))==(MHT_EXPR*)NULL) {
+				return ((MHT_EXPR*)NULL);
+			}
+			item->next = node->right;
+			node->right = item;
 		}
 	}
 
-	return (MHT_OK);
+	return (mht_expr_node(parser,EXPR_LITERAL,start,parser->pos-start));
 }
 
 
 /*
-	After a line is processed, print it to the output sink(s).
+	Evaluate a compiled expression. Returns MHT_IF_TRUE, MHT_IF_FALSE or
+	MHT_IF_WRONG_ARG if a single value is neither true/1 nor false/0.
 */
-void mht_print_line( char *line ) {
-	unsigned int i = 0;
+int mht_expr_eval( MHT_EXPR *expr ) {
+	int result = MHT_IF_FALSE;
+	char *dummy_ptr = (char*)NULL;
 
-	if (mht.active_fhandle>0) {
-		/* Print to a specific file handle */
-		if (mht.fhandle_fptr[mht.active_fhandle]!=(FILE*)NULL) {
-			fprintf(mht.fhandle_fptr[mht.active_fhandle],"%s",line);
-		}
-	}
-	else if (mht.active_fhandle==0) {
-		/* Print to all open file handles */
-		for (i=1;i<=mht.fhandles;i++) {
-			if (mht.fhandle_fptr[i]!=(FILE*)NULL) {
-				fprintf(mht.fhandle_fptr[i],"%s",line);
+	switch (expr->op) {
+		case EXPR_ROOT:
+			return (mht_expr_eval(expr->left));
+
+		case EXPR_NOT:
+			result = mht_expr_eval(expr->left);
+			return ((result<0) ? result : !result);
+
+		case EXPR_AND:
+			if ((result=mht_expr_eval(expr->left))!=MHT_IF_TRUE) {
+				return (result);
 			}
-		}
-	}
-	else if (mht.active_fhandle<0) {
-		/*
-			No file handle registered, print to the output
-			sink, which is stdout unless other specified.
-		*/
-		if (mht.out!=(FILE*)NULL) {
-			fprintf(mht.out,"%s",line);
-		}
+			return (mht_expr_eval(expr->right));
+
+		case EXPR_OR:
+			if ((result=mht_expr_eval(expr->left))!=MHT_IF_FALSE) {
+				return (result);
+			}
+			return (mht_expr_eval(expr->right));
+
+		case EXPR_DEFINED:
+			/* The same as <#ifdef|name>, block parameters count as well */
+			if (mht_search_macro(expr->str,&dummy_ptr)==1 || mht_search_block_param(expr->str,&dummy_ptr)==1) {
+				return (MHT_IF_TRUE);
+			}
+			return (MHT_IF_FALSE);
 	}
+
+	return (mht_expr_compare(expr));
 }
 
 
 /*
-	Register a environment variable as a MHT macro.
+	Evaluate the comparisons, in() and single values of an expression.
+	The values live in the buffers of this function, macros without
+	inner macros are not even copied.
 */
-int mht_register_env( char *env_var, char *mht_macro ) {
+int mht_expr_compare( MHT_EXPR *expr ) {
 	char
-		*env_val = (char*)NULL;
+		left_buf[MAX_LEN],
+		right_buf[MAX_LEN],
+		*ptr = (char*)NULL,
+		*end = (char*)NULL,
+		*item_end = (char*)NULL;
+
+	MHT_SLICE
+		left,
+		right,
+		piece;
+
+	MHT_EXPR *item = (MHT_EXPR*)NULL;
+	int result = 0;
+
+
+	if (expr->op==EXPR_IN) {
+		mht_expr_value(expr->left,left_buf,&left);
+
+		/* Each item of the set might be a comma separated list itself */
+		for (item=expr->right; item!=(MHT_EXPR*)NULL; item=item->next) {
+			mht_expr_value(item,right_buf,&right);
+
+			for (ptr=right.ptr,end=right.ptr+right.len; ptr<=end; ptr=item_end+1) {
+				if ((item_end=memchr(ptr,',',end-ptr))==(char*)NULL) {
+					item_end = end;
+				}
+
+				piece.ptr = ptr;
+				piece.len = item_end-ptr;
+
+				while (piece.len>0 && isspace((unsigned char)*piece.ptr)) {
+					piece.ptr++;
+					piece.len--;
+				}
+				while (piece.len>0 && isspace((unsigned char)piece.ptr[piece.len-1])) {
+					piece.len--;
+				}
 
+				if (piece.len==left.len && memcmp(piece.ptr,left.ptr,left.len)==0) {
+					return (MHT_IF_TRUE);
+				}
+			}
+		}
+
+		return (MHT_IF_FALSE);
+	}
 
-	env_val = getenv(env_var);
+	if (expr->op<EXPR_EQ) {
+		mht_expr_value(expr,left_buf,&left);
+		return (mht_expr_truth(&left));
+	}
 
-	if ( (env_val!=(char*)NULL) && (env_var!=(char*)NULL) ) {
-		return (mht_register_macro(mht_macro,env_val));
+	mht_expr_value(expr->left,left_buf,&left);
+	mht_expr_value(expr->right,right_buf,&right);
+	result = mht_expr_cmp_values(&left,&right);
+
+	switch (expr->op) {
+		case EXPR_EQ:
+			return (result==0);
+		case EXPR_NE:
+			return (result!=0);
+		case EXPR_LT:
+			return (result<0);
+		case EXPR_GT:
+			return (result>0);
+		case EXPR_LE:
+			return (result<=0);
+		case EXPR_GE:
+			return (result>=0);
 	}
 
-	return (0);
+	return (MHT_IF_WRONG_ARG);
 }
 
 
 /*
-	Split the arguments of a #process directive of the form
-	block : param1 param2 param3 ...
-	and store the tokens in args.
+	Get the value of an operand. Undefined macros are empty, nested
+	expressions are "1" or "0".
 */
-int mht_get_block_params( char *str, char **args ) {
-	unsigned int
-		arg_count = 0;
-
-	char
-		*token_ptr = (char*)NULL;
+void mht_expr_value( MHT_EXPR *expr, char *buf, MHT_SLICE *value ) {
+	char *definition = (char*)NULL;
+	int result = 0;
+
+	value->ptr = "";
+	value->len = 0;
+
+	switch (expr->op) {
+		case EXPR_LITERAL:
+			value->ptr = expr->str;
+			value->len = expr->len;
+			return;
+
+		case EXPR_MACRO:
+			if (mht_call_builtin(expr->str)==(BUILTIN_INFO*)NULL) {
+				if (mht_search_macro(expr->str,&definition)!=1 && mht_search_block_param(expr->str,&definition)!=1) {
+					return;
+				}
 
+				/* Only definitions with inner macros have to be expanded */
+				if (strstr(definition,"<#")==(char*)NULL) {
+					value->ptr = definition;
+					value->len = (unsigned int)strlen(definition);
+					return;
+				}
 
-	token_ptr = strtok(str," :\t\n\r\0");
+				strncpy(buf,definition,MAX_LEN-1);
+				buf[MAX_LEN-1] = '\0';
+				mht_expand(buf);
+				value->ptr = buf;
+				value->len = (unsigned int)strlen(buf);
+				return;
+			}
 
-	while (token_ptr!=(char*)NULL) {
-		if (QUICK_STRCMP(token_ptr,":")!=0) {
-			args[arg_count++] = strdup(token_ptr);
-		}
-		token_ptr = strtok((char*)NULL," \t\n\r\0");
+			/* A builtin without arguments is expanded as usual */
+			sprintf(buf,"<#%s>",expr->str);
+			mht_expand(buf);
+			value->ptr = buf;
+			value->len = (unsigned int)strlen(buf);
+			return;
+
+		case EXPR_REF:
+			strncpy(buf,expr->str,MAX_LEN-1);
+			buf[MAX_LEN-1] = '\0';
+			mht_expand(buf);
+			value->ptr = buf;
+			value->len = (unsigned int)strlen(buf);
+			return;
 	}
 
-	return (arg_count);
+	result = mht_expr_eval(expr);
+	if (result>=0) {
+		value->ptr = (result==MHT_IF_TRUE) ? "1" : "0";
+		value->len = 1;
+	}
 }
 
 
 /*
-	Process a line with a #if, #elif, #else or #endif
-	directive and set the if_count correct. The argument
-	for the directive is already expanded_ptr!
+	The truth of a single value, as "#if value" always was.
 */
-int mht_set_if_count( char *if_directive, char *if_arg ) {
-	if (GET_IF_LEVEL==MAX_IF_COUNT-1) {
-		/* We have too many if levels (128 cascaded #if's should be enough!) */
-		return (MHT_ERR_IF_COUNT_TOO_MANY_LEVELS);
-	}
-
+int mht_expr_truth( MHT_SLICE *value ) {
+	char
+		*ptr = value->ptr,
+		word[8];
+	unsigned int
+		len = value->len,
+		i = 0;
 
-	/* A if block is splitted here */
-	if (QUICK_STRCMP(if_directive,"else")==0) {
-		/* An #else without an #if before is not allowed! */
-		if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if==0) {
-			return (MHT_ERR_IF_COUNT_IF_IS_MISSING);
-		}
+	while (len>0 && isspace((unsigned char)*ptr)) {
+		ptr++;
+		len--;
+	}
+	while (len>0 && isspace((unsigned char)ptr[len-1])) {
+		len--;
+	}
 
-		if ( (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true==0) && (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL-1 ].is_true==1) ) {
-			mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
-			mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 1;
-		}
-		else {
-			mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
-		}
+	if (len==0 || len>5) {
+		return (MHT_IF_WRONG_ARG);
+	}
 
-		return (MHT_OK);
+	for (i=0; i<len; i++) {
+		word[i] = tolower((unsigned char)ptr[i]);
 	}
+	word[len] = '\0';
 
+	if (QUICK_STRCMP(word,"true")==0 || QUICK_STRCMP(word,"1")==0) {
+		return (MHT_IF_TRUE);
+	}
+	if (QUICK_STRCMP(word,"false")==0 || QUICK_STRCMP(word,"0")==0) {
+		return (MHT_IF_FALSE);
+	}
 
-	/* Go down in the if stack */
-	else if (QUICK_STRCMP(if_directive,"endif")==0) {
-		/* An #endif without an #if before is not allowed! */
-		if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if==0) {
-			return (MHT_ERR_IF_COUNT_IF_IS_MISSING);
-		}
+	return (MHT_IF_WRONG_ARG);
+}
 
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
-		mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 0;
-		DEC_IF_LEVEL;
 
-		/* Oops, there was one #endif too much! */
-		if (GET_IF_LEVEL<0) {
-			return (MHT_ERR_IF_COUNT_TOO_MANY_ENDIF);
-		}
+/*
+	Compare two values, numerically if both are integers.
+*/
+int mht_expr_cmp_values( MHT_SLICE *a, MHT_SLICE *b ) {
+	long
+		value_a = 0,
+		value_b = 0;
+	int result = 0;
+
+	if (a->len>0 && b->len>0 && builtin_get_long(a,&value_a)==1 && builtin_get_long(b,&value_b)==1) {
+		return ((value_a<value_b) ? -1 : (value_a>value_b));
+	}
 
-		return (MHT_OK);
+	result = memcmp(a->ptr,b->ptr,(a->len<b->len) ? a->len : b->len);
+	if (result==0) {
+		return ((a->len<b->len) ? -1 : (a->len>b->len));
 	}
 
+	return ((result<0) ? -1 : 1);
+}
 
-	/* Set everything for "#if if_arg" or "#elif if_arg" */
-	else if ( (if_arg!=(char*)NULL) && ((QUICK_STRCMP(if_directive,"if")==0) || (QUICK_STRCMP(if_directive,"elif")==0)) ) {
-		strlwr(if_arg);
 
-		if (QUICK_STRCMP(if_directive,"if")==0) {
-			INC_IF_LEVEL;
-			mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if = 1;
+/*
+	Compile the expression of a #if or #elif line of a block.
+*/
+void mht_compile_if( LINE_BUFFER *line, char *directive ) {
+	MHT_EXPR *expr = (MHT_EXPR*)NULL;
+	unsigned int len = 0;
 
-			if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL-1 ].is_true==1) {
-				if ( (QUICK_STRCMP(if_arg,"true")==0) || (QUICK_STRCMP(if_arg,"1")==0) ) {
-					mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
-					mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 1;
-				}
-				else if ( (QUICK_STRCMP(if_arg,"false")==0) || ((QUICK_STRCMP(if_arg,"0")==0)) ) {
-					mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
-					mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 0;
-				}
-				else {
-					return (MHT_ERR_IF_COUNT_ARGUMENT_WRONG_ARG);
-				}
-			}
-		}
-		else if (QUICK_STRCMP(if_directive,"elif")==0) {
-			/* An #elif without an #if before is not allowed! */
-			if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].there_is_an_if==0) {
-				return (MHT_ERR_IF_COUNT_IF_IS_MISSING);
-			}
+	if (line->data!=(void*)NULL) {
+		return;
+	}
 
-			if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL-1 ].is_true==1) {
-				if ( (QUICK_STRCMP(if_arg,"true")==0) || (QUICK_STRCMP(if_arg,"1")==0) ) {
-					if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true==0) {
-						mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 1;
-						mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true = 1;
-					}
-					else if (mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].was_true==1) {
-						mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
-					}
-				}
-				else if ( (QUICK_STRCMP(if_arg,"false")==0) || (QUICK_STRCMP(if_arg,"0")==0) ) {
-					mht.if_context[ GET_IF_CONTEXT ].if_stack[ GET_IF_LEVEL ].is_true = 0;
-				}
-				else {
-					return (MHT_ERR_IF_COUNT_ARGUMENT_WRONG_ARG);
-				}
-			}
-		}
+	if (tolower((unsigned char)directive[0])=='i' && tolower((unsigned char)directive[1])=='f') {
+		len = 2;
 	}
-	else {
-		/* if_arg was missing */
-		return (MHT_ERR_IF_COUNT_IF_OR_ELIF_WITHOUT_ARG);
+	else if (directive[0]!='\0' && strncmp(directive+1,"lif",3)==0 && tolower((unsigned char)directive[0])=='e') {
+		len = 4;
 	}
 
-	return (MHT_OK);
+	if (len==0 || !isspace((unsigned char)directive[len])) {
+		return;
+	}
+
+	if ((expr=mht_expr_compile(directive+len))!=(MHT_EXPR*)NULL) {
+		line->data = expr;
+		line->type = (len==2) ? LINE_TYPE_IF : LINE_TYPE_ELIF;
+	}
 }
 
 
@@ -1557,11 +5700,11 @@ int mht_setvar( char *mhtvar, char *value ) {
 	/* Switch converting German umlauts on/off */
 	if (QUICK_STRCMP(mhtvar,"convumlauts")==0) {
 		if ( (QUICK_STRCMP(value,"true")==0) || (QUICK_STRCMP(value,"1")==0) ) {
-			mht.conv_umlauts = 1;
+			mht_filter_switch(MHT_FILTER_UMLAUTS,1);
 			return (MHT_OK);
 		}
 		else if ( (QUICK_STRCMP(value,"false")==0) || (QUICK_STRCMP(value,"0")==0) ) {
-			mht.conv_umlauts = 0;
+			mht_filter_switch(MHT_FILTER_UMLAUTS,0);
 			return (MHT_OK);
 		}
 		else {
@@ -1572,11 +5715,26 @@ int mht_setvar( char *mhtvar, char *value ) {
 	/* Switch killing leading and ending white spaces, and also \n\r */
 	else if (QUICK_STRCMP(mhtvar,"killspace")==0) {
 		if ( (QUICK_STRCMP(value,"true")==0) || (QUICK_STRCMP(value,"1")==0) ) {
-			mht.killspace = 1;
+			mht_filter_switch(MHT_FILTER_KILLSPACE,1);
+			return (MHT_OK);
+		}
+		else if ( (QUICK_STRCMP(value,"false")==0) || (QUICK_STRCMP(value,"0")==0) ) {
+			mht_filter_switch(MHT_FILTER_KILLSPACE,0);
+			return (MHT_OK);
+		}
+		else {
+			return (MHT_ERR_SETVAR_PARAM_UNRECOGNIZED);
+		}
+	}
+
+	/* Switch minifying the HTML output on/off */
+	else if (QUICK_STRCMP(mhtvar,"minify")==0) {
+		if ( (QUICK_STRCMP(value,"true")==0) || (QUICK_STRCMP(value,"1")==0) ) {
+			mht_filter_switch(MHT_FILTER_MINIFY,1);
 			return (MHT_OK);
 		}
 		else if ( (QUICK_STRCMP(value,"false")==0) || (QUICK_STRCMP(value,"0")==0) ) {
-			mht.killspace = 0;
+			mht_filter_switch(MHT_FILTER_MINIFY,0);
 			return (MHT_OK);
 		}
 		else {
@@ -1584,14 +5742,83 @@ int mht_setvar( char *mhtvar, char *value ) {
 		}
 	}
 
+	/* Set the filters of the current output (stream or file handle), e.g. "umlauts,killspace" */
+	else if (QUICK_STRCMP(mhtvar,"filter")==0) {
+		return (mht_filter_set(mht_filter_chain(),value));
+	}
+
+	/* Set the level of a compressed output 0-9, without one it is ignored */
+	else if (QUICK_STRCMP(mhtvar,"compress")==0) {
+		if (_str_len(value)!=1 || !isdigit(value[0])) {
+			return (MHT_ERR_SETVAR_PARAM_UNRECOGNIZED);
+		}
+
+		if (mht->sink!=(MHT_SINK*)NULL) {
+			sink_deflate_level(mht->sink,value[0]-'0');
+		}
+		return (MHT_OK);
+	}
+
+	/* Set the memory limit of the fragment cache in bytes, 0 switches it off */
+	else if (QUICK_STRCMP(mhtvar,"cachesize")==0) {
+		if (strspn(value,"0123456789")!=_str_len(value)) {
+			return (MHT_ERR_SETVAR_PARAM_UNRECOGNIZED);
+		}
+
+		mht->cache_limit = (size_t)atol(value);
+
+		/* Make room for the new limit */
+		while (mht->cache_last!=(CACHE_ENTRY*)NULL && mht->cache_used>mht->cache_limit) {
+			mht_cache_drop(mht->cache_last);
+		}
+		return (MHT_OK);
+	}
+
+	/* Switch folding of stable macros into the blocks on/off */
+	else if (QUICK_STRCMP(mhtvar,"fold")==0) {
+		if ( (QUICK_STRCMP(value,"true")==0) || (QUICK_STRCMP(value,"1")==0) ) {
+			mht->fold = 1;
+		}
+		else if ( (QUICK_STRCMP(value,"false")==0) || (QUICK_STRCMP(value,"0")==0) ) {
+			mht->fold = 0;
+		}
+		else {
+			return (MHT_ERR_SETVAR_PARAM_UNRECOGNIZED);
+		}
+		return (MHT_OK);
+	}
+
+	/* Switch escaping of tainted macros (CGI values) on/off */
+	else if (QUICK_STRCMP(mhtvar,"autoescape")==0) {
+		if ( (QUICK_STRCMP(value,"html")==0) || (QUICK_STRCMP(value,"true")==0) || (QUICK_STRCMP(value,"1")==0) ) {
+			mht->autoescape = STR_ESC_HTML;
+		}
+		else if (QUICK_STRCMP(value,"attr")==0) {
+			mht->autoescape = STR_ESC_ATTR;
+		}
+		else if (QUICK_STRCMP(value,"url")==0) {
+			mht->autoescape = STR_ESC_URL;
+		}
+		else if (QUICK_STRCMP(value,"js")==0) {
+			mht->autoescape = STR_ESC_JS;
+		}
+		else if ( (QUICK_STRCMP(value,"false")==0) || (QUICK_STRCMP(value,"0")==0) ) {
+			mht->autoescape = MHT_AUTOESCAPE_OFF;
+		}
+		else {
+			return (MHT_ERR_SETVAR_PARAM_UNRECOGNIZED);
+		}
+		return (MHT_OK);
+	}
+
 	/* Switch whether the expanded output should be written to the outpu stream(s) or not */
 	else if (QUICK_STRCMP(mhtvar,"writeoutput")==0) {
 		if ( (QUICK_STRCMP(value,"true")==0) || (QUICK_STRCMP(value,"1")==0) ) {
-			mht.writeoutput = 1;
+			mht->writeoutput = 1;
 			return (MHT_OK);
 		}
 		else if ( (QUICK_STRCMP(value,"false")==0) || (QUICK_STRCMP(value,"0")==0) ) {
-			mht.writeoutput = 0;
+			mht->writeoutput = 0;
 			return (MHT_OK);
 		}
 		else {
@@ -1619,15 +5846,19 @@ int mht_setfile_io( char *action, char *type, char *fname ) {
 
 	/* If type is NULL, and action is close, then close all file handles */
 	if (QUICK_STRCMP(action,"close")==0) {
-		for (i=1;i<=mht.fhandles;i++) {
-			if (mht.fhandle_fptr[i]!=(FILE*)NULL) {
-				fclose(mht.fhandle_fptr[i]);
-				mht.fhandle_fptr[i] = (FILE*)NULL;
+		for (i=1;i<=mht->fhandles;i++) {
+			mht_filter_end(&mht->fhandle_chain[i]);
+			mht->fhandle_chain[i].own = 0;
+			mht->fhandle_chain[i].filter_count = 0;
+
+			if (mht->fhandle_fptr[i]!=(FILE*)NULL) {
+				fclose(mht->fhandle_fptr[i]);
+				mht->fhandle_fptr[i] = (FILE*)NULL;
 			}
 		}
 
-		mht.write_to_file = 0;
-		mht.active_fhandle = -1;
+		mht->write_to_file = 0;
+		mht->active_fhandle = -1;
 
 		return (MHT_OK);
 	}
@@ -1635,8 +5866,8 @@ int mht_setfile_io( char *action, char *type, char *fname ) {
 	/* Check whether we know the given type. */
 	if (QUICK_STRCMP(type,"all")!=0) {
 		type_exists = 0;
-		for (i=0;i<=mht.fhandles;i++) {
-			if (QUICK_STRCMP(mht.fhandle_type[i],type)==0) {
+		for (i=0;i<=mht->fhandles;i++) {
+			if (QUICK_STRCMP(mht->fhandle_type[i],type)==0) {
 				type_exists = i;
 			}
 		}
@@ -1654,8 +5885,8 @@ int mht_setfile_io( char *action, char *type, char *fname ) {
 	if ( (type_exists==0) && (QUICK_STRCMP(type,"all")!=0) ) {
 		if (QUICK_STRCMP(action,"type")==0) {
 			/* Register the new type */
-			mht.fhandles++;
-			mht.fhandle_type[mht.fhandles] = strdup(type);
+			mht->fhandles++;
+			mht->fhandle_type[mht->fhandles] = strdup(type);
 		}
 		else {
 			/* Unknow action in this context */
@@ -1671,8 +5902,9 @@ int mht_setfile_io( char *action, char *type, char *fname ) {
 
 			/* Open a new file handle */
 			mht_trim(fname);
-			mht.fhandle_fptr[type_exists] = fopen(fname,"w");
-			if (mht.fhandle_fptr[type_exists]==(FILE*)NULL) {
+			mht_filter_end(&mht->fhandle_chain[type_exists]);
+			mht->fhandle_fptr[type_exists] = fopen(fname,"w");
+			if (mht->fhandle_fptr[type_exists]==(FILE*)NULL) {
 				/* Get the type of I/O error that occured while opening the file */
 				switch (errno) {
 					case -34:
@@ -1684,18 +5916,18 @@ int mht_setfile_io( char *action, char *type, char *fname ) {
 				}
 			}
 
-			mht.write_to_file = 1;
+			mht->write_to_file = 1;
 			return (MHT_OK);
 		}
 		else if (QUICK_STRCMP(action,"file")==0) {
 			/* Print to file handle(s) */
 			if (QUICK_STRCMP(type,"all")==0) {
 				/* Print to all file handles */
-				mht.active_fhandle = 0;
+				mht->active_fhandle = 0;
 			}
 			else {
 				/* Print to a specific file handle only */
-				mht.active_fhandle = type_exists;
+				mht->active_fhandle = type_exists;
 			}
 		}
 		else {
@@ -1708,7 +5940,9 @@ int mht_setfile_io( char *action, char *type, char *fname ) {
 }
 
 /*
-	Expand all MHT macros in a string by recursion.
+	Expand all MHT macros in a string by recursion. Beyond
+	MAX_EXPAND_DEPTH (e.g. a macro referring to itself) the macros are
+	left as they are.
 */
 char *mht_expand( char *input ) {
 	int
@@ -1728,10 +5962,14 @@ char *mht_expand( char *input ) {
 		tmp_macro[MAX_LEN],
 		*expanded_ptr = (char*)NULL,
 		expanded_macro[MAX_LEN],
-		*macro_args[MAX_ARG_COUNT],
-		*dummy_ptr = (char*)NULL;
+		*macro_args[MAX_ARG_COUNT];
+
+	unsigned int macro_flags = 0;
 
-	LINE_BUFFER *block = (LINE_BUFFER*)NULL;
+	BUILTIN_INFO *builtin = (BUILTIN_INFO*)NULL;
+	MHT_SLICE builtin_args[MAX_ARG_COUNT];
+	MHT_BUILDER builder;
+	HASH_ITEM *memo_item = (HASH_ITEM*)NULL;
 
 
 	str_ptr = input;
@@ -1744,6 +5982,11 @@ char *mht_expand( char *input ) {
 		return ((char*)NULL);
 	}
 
+	if (mht->expand_depth>=MAX_EXPAND_DEPTH) {
+		return (input);
+	}
+	mht->expand_depth++;
+
 	for (i=0; i<MAX_ARG_COUNT; i++) {
 		macro_args[i] = (char*)NULL;
 	}
@@ -1772,6 +6015,7 @@ char *mht_expand( char *input ) {
 				This is an error case: open macro "<#macro" found!
 				Return the input string as is untouched...
 			*/
+			mht->expand_depth--;
 			return (input);
 		}
 
@@ -1780,6 +6024,7 @@ char *mht_expand( char *input ) {
 
 		/* an error occurred: "<#macro" without closing bracket ">" */
 		if (bracket!=0) {
+			mht->expand_depth--;
 			return ((char*)NULL);
 		}
 
@@ -1803,211 +6048,29 @@ char *mht_expand( char *input ) {
 			is_delayed_macro = 0;
 		}
 
-		macro_arg_count = strsplit(tmp_macro,macro_args,'|',MAX_ARG_COUNT);
-
-		/* check whether it is a "standard" MHT macros */
-		if (QUICK_STRCMP("ifequal",macro_args[0])==0) {
-			mht_replace_unexpanded_params( macro_arg_count, macro_args );
-
-			/* <#ifequal|str1|str2|TRUE|FALSE> */
-			/* str1 AND str2 are NULL, <#null>, empty or undefined */
-			if ( (macro_args[1]==(char*)NULL && macro_args[2]==(char*)NULL) || ((_str_len(macro_args[1]))==0 && (_str_len(macro_args[2])==0)) ) {
-				if (macro_arg_count<=3) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[3];
-				}
-			}
-
-			/* str1 OR str2 are NULL, <#null>, empty or undefined */
-			else if (macro_args[1]==(char*)NULL || macro_args[2]==(char*)NULL || (_str_len(macro_args[1]))==0 || (_str_len(macro_args[2])==0)) {
-				if (macro_arg_count<=4) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[4];
-				}
-			}
-
-			/* str1==str2 */
-			else if (QUICK_STRCMP(macro_args[1],macro_args[2])==0) {
-				if (macro_arg_count<=3) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[3];
-				}
-			}
-			else {
-				/* str1!=str2 */
-				if (macro_arg_count<=4) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[4];
-				}
-			}
-
-			/*
-				If expanded_ptr is here NULL, the macro would remain unexpanded
-				in the output string. This shouldn't be the case, #ifequal should
-				alsways be expanded at least to an empty string!
-			*/
-			if (expanded_ptr==(char*)NULL) {
-				expanded_macro[0] = '\0';
-				expanded_ptr = expanded_macro;
-			}
-		}
-		else if (QUICK_STRCMP("ifdef",macro_args[0])==0) {
-			/* <#ifdef|str1|TRUE|FALSE> */
-
-			/* str1 is NULL or empty (bit stupid) */
-			if (macro_args[1]==(char*)NULL) {
-				expanded_ptr = (char*)NULL;
-			}
-			else {
-				mht_search_macro(macro_args[1],&dummy_ptr);
-
-				/*
-					If we did not find a definition for that macro,
-					it might be a block parameter!
-				*/
-				if (dummy_ptr==(char*)NULL) {
-					mht_search_block_param(macro_args[1],&dummy_ptr);
-				}
-
-				if (dummy_ptr!=(char*)NULL) {
-					/* str1 IS defined as a macro */
-					if (macro_arg_count<=2) {
-						expanded_ptr = (char*)NULL;
-					}
-					else {
-						expanded_ptr = macro_args[2];
-					}
-				}
-				else {
-					/* str1 is NOT defined as a macro */
-					if (macro_arg_count<=3) {
-						expanded_ptr = (char*)NULL;
-					}
-					else {
-						expanded_ptr = macro_args[3];
-					}
-				}
-			}
-
-			/*
-				If expanded_ptr is here NULL, the macro would remain unexpanded
-				in the output string. This shouldn't be the case, #ifdef should
-				alsways be expanded at least to an empty string!
-			*/
-			if (expanded_ptr==(char*)NULL) {
-				expanded_macro[0] = '\0';
-				expanded_ptr = expanded_macro;
-			}
-		}
-		else if (QUICK_STRCMP("isin",macro_args[0])==0) {
-			/* <#isin|str1|str2|TRUE|FALSE> */
-
-			/* str1 AND str2 are NULL, <#null>, empty or undefined */
-			if (macro_args[1]==(char*)NULL && macro_args[2]==(char*)NULL) {
-				if (macro_arg_count<=3) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[3];
-				}
-			}
-
-			/* str1 OR str2 are NULL, <#null>, empty or undefined */
-			else if (macro_args[1]==(char*)NULL || macro_args[2]==(char*)NULL) {
-				if (macro_arg_count<=4) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[4];
-				}
-			}
-
-			/* str1 IS in str2 */
-			else if (strstr(macro_args[2],macro_args[1])!=(char*)NULL) {
-				if (macro_arg_count<=3) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[3];
-				}
-			}
-			else {
-				/* str1 is NOT in str2 */
-				if (macro_arg_count<=4) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[4];
-				}
-			}
-
-			/*
-				If expanded_ptr is here NULL, the macro would remain unexpanded
-				in the output string. This shouldn't be the case, #isin should
-				alsways be expanded at least to an empty string!
-			*/
-			if (expanded_ptr==(char*)NULL) {
-				expanded_macro[0] = '\0';
-				expanded_ptr = expanded_macro;
-			}
+		/*
+			A pure macro expanded before with the same arguments is simply copied
+			(but not for a cached block, which has to see the macros it reads)
+		*/
+		memo_item = (HASH_ITEM*)NULL;
+		if (mht->memo_count>0 && is_delayed_macro==0 && mht->cache_depth==0) {
+			memo_item = get_hash_item(mht->memo,tmp_macro);
 		}
-		else if (QUICK_STRCMP("ifblock",macro_args[0])==0) {
-			/* <#checkblock|str1|TRUE|FALSE> */
-
-			/* str1 is NULL or empty (bit stupid) */
-			if (macro_args[1]==(char*)NULL) {
-				/* str1 is NOT a existing block */
-				if (macro_arg_count<=3) {
-					expanded_ptr = (char*)NULL;
-				}
-				else {
-					expanded_ptr = macro_args[3];
-				}
-			}
-			else {
-				block = mht_search_block(macro_args[1]);
 
-				if (block!=(LINE_BUFFER*)NULL) {
-					/* str1 IS a existing block */
-					if (macro_arg_count<=2) {
-						expanded_ptr = (char*)NULL;
-					}
-					else {
-						expanded_ptr = macro_args[2];
-					}
-				}
-				else {
-					/* str1 is NOT a existing block */
-					if (macro_arg_count<=3) {
-						expanded_ptr = (char*)NULL;
-					}
-					else {
-						expanded_ptr = macro_args[3];
-					}
-				}
-			}
+		macro_arg_count = (memo_item==(HASH_ITEM*)NULL) ? strsplit(tmp_macro,macro_args,'|',MAX_ARG_COUNT) : 0;
 
-			/*
-				If expanded_ptr is here NULL, the macro would remain unexpanded
-				in the output string. This shouldn't be the case, #checkblock
-				should alsways be expanded at least to an empty string!
-			*/
-			if (expanded_ptr==(char*)NULL) {
-				expanded_macro[0] = '\0';
-				expanded_ptr = expanded_macro;
-			}
+		if (memo_item!=(HASH_ITEM*)NULL) {
+			strcpy(expanded_macro,(char*)memo_item->data);
+			expanded_ptr = expanded_macro;
 		}
 		else if (is_delayed_macro==0) {
 			/* It should be a macro defined via #def by the user... */
-			if (mht_search_macro(macro_args[0],&expanded_ptr)==1) {
+			if (mht_search_macro_flags(macro_args[0],&expanded_ptr,&macro_flags)==1 && (macro_flags & MHT_PROVIDER_TAINTED) && mht->autoescape!=MHT_AUTOESCAPE_OFF) {
+				/* A tainted definition is escaped, but never expanded */
+				str_escape(expanded_macro,MAX_LEN,expanded_ptr,strlen(expanded_ptr),mht->autoescape);
+				expanded_ptr = expanded_macro;
+			}
+			else if (expanded_ptr!=(char*)NULL) {
 				/* Get the definition for the macro... */
 				sprintf(expanded_macro,"%s",expanded_ptr);
 
@@ -2024,6 +6087,11 @@ char *mht_expand( char *input ) {
 					("blabla <#macro1> blabla <#macro2> ...")
 				*/
 				expanded_ptr = mht_expand(expanded_macro);
+
+				/* ...and remember it for the rest of the render, if the macro is pure */
+				if (expanded_ptr!=(char*)NULL && strchr(tmp_macro,'<')==(char*)NULL && mht_memo_pure(macro_args[0],0)==1) {
+					mht_memo_store(tmp_macro,expanded_ptr);
+				}
 			}
 		}
 
@@ -2033,8 +6101,42 @@ char *mht_expand( char *input ) {
 			a block parameter. So go and check all current block parameters...
 		*/
 		if (expanded_ptr==(char*)NULL) {
-			if ((mht_search_block_param(macro_args[0],&expanded_ptr))==1) {
-				mht_expand(expanded_ptr);
+			if (mht->row_binding_count>0 && mht_search_row_binding(macro_args[0],&expanded_ptr)==1) {
+				/* The fields of a #table row are data, they are inserted as they are (or escaped) */
+				if (mht->cache_depth>0) {
+					mht_cache_read_param((HASH_ITEM*)NULL);
+				}
+				if (mht->autoescape!=MHT_AUTOESCAPE_OFF) {
+					str_escape(expanded_macro,MAX_LEN,expanded_ptr,strlen(expanded_ptr),mht->autoescape);
+					expanded_ptr = expanded_macro;
+				}
+			}
+			else if ((mht_search_block_param(macro_args[0],&expanded_ptr))==1) {
+				/* Expand a copy, the parameter itself stays as it is */
+				strncpy(expanded_macro,expanded_ptr,MAX_LEN-1);
+				expanded_macro[MAX_LEN-1] = '\0';
+				expanded_ptr = mht_expand(expanded_macro);
+			}
+		}
+
+		/*
+			Last but not least it might be a builtin macro. Macros and block
+			parameters hide a builtin of the same name, so the builtins added
+			later on don't break templates which define a macro e.g. "url".
+		*/
+		if (expanded_ptr==(char*)NULL && (builtin=mht_search_builtin(macro_args[0]))!=(BUILTIN_INFO*)NULL) {
+			for (i=0; i<(unsigned int)macro_arg_count; i++) {
+				builtin_args[i].ptr = (macro_args[i]!=(char*)NULL) ? macro_args[i] : "";
+				builtin_args[i].len = (unsigned int)strlen(builtin_args[i].ptr);
+			}
+
+			expanded_macro[0] = '\0';
+			builder.buf = expanded_macro;
+			builder.len = 0;
+			builder.size = MAX_LEN;
+
+			if (builtin->func(&builder,builtin_args,macro_arg_count,builtin->user_data)==1) {
+				expanded_ptr = expanded_macro;
 			}
 		}
 
@@ -2065,12 +6167,16 @@ char *mht_expand( char *input ) {
 
 		/* Reset the macro arguments, every macro has its own arguments! */
 		for (i=0; i<MAX_ARG_COUNT; i++) {
+			if (macro_args[i]!=(char*)NULL) {
+				free(macro_args[i]);
+			}
 			macro_args[i] = (char*)NULL;
 		}
 
 
 	} while (macro_found==1);
 
+	mht->expand_depth--;
 	return (input);
 }
 
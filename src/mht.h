@@ -12,6 +12,17 @@ int mht_register_macro( char *name, char *definition );
 /* Search for a macro and return its definition */
 int mht_search_macro( char *name, char **result );
 
+/* Attach a compiled macro dictionary as a read-only fallback for mht_search_macro */
+int mht_dict_attach( char *fname );
+
+/*
+	Mark a macro (or the macro of a provider) as tainted, i.e. its
+	definition comes from an untrusted source such as a CGI request.
+	With "#mhtvar autoescape html|attr|url|js" tainted macros are
+	escaped and not expanded any further. A new definition clears it.
+*/
+int mht_taint_macro( char *name );
+
 /* "Un-"register a macro */
 int mht_undef_macro( char *name );
 
@@ -21,6 +32,48 @@ int mht_undef_block( char *block_param );
 /* Open, read and process a text file */
 int mht_quickopen( FILE *out, char *fname );
 
+/*
+	Read a text file and keep it as the block block_name: the blocks of
+	the file are registered, the lines outside the blocks make up the
+	block block_name, which is processed by mht_process later on.
+*/
+int mht_load( char *fname, char *block_name );
+
+/* Get the name of the n-th file read by mht_quickopen, NULL after the last one */
+char *mht_get_file( unsigned int n );
+
+/*
+	Push the output to a sink (see sink.h) instead of the output stream,
+	NULL switches back to the stream. Returns the previous sink.
+*/
+struct MHT_SINK_S *mht_set_sink( struct MHT_SINK_S *sink );
+
+/*
+	Each render may have a state of its own (macros, blocks, settings),
+	see render.h. mht_state_new creates a state as after mht_init, the
+	current state is left as it is. mht_state_switch makes a state the
+	current one and returns the previous one.
+*/
+struct MHT_INFO_S *mht_state_new(void);
+struct MHT_INFO_S *mht_state_switch( struct MHT_INFO_S *state );
+void mht_state_free( struct MHT_INFO_S *state );
+
+/*
+	Let a state find the blocks and macros of another one, which are only
+	read then (see pool.h). NULL ends the sharing.
+*/
+void mht_state_share( struct MHT_INFO_S *state, struct MHT_INFO_S *shared );
+
+/*
+	A request scope: from mht_scope_begin on, the macros defined or
+	undefined (#def, #undef, CGI values...) are kept apart, over the
+	macros of the state. mht_scope_end drops them at once, the macros of
+	the state are as before then. Lookups read the scope first.
+*/
+void mht_scope_begin(void);
+void mht_scope_end(void);
+int mht_scope_active(void);
+
 /* Process a MHT block from a previously read text file */
 int mht_process( FILE *out, char *block_name );
 
@@ -30,5 +83,55 @@ int mht_process_with_params( FILE *out, char *blockname, char **block_params, in
 /* Register a environment variable as a MHT macro */
 int mht_register_env( char *env_var, char *mht_macro );
 
+/*
+	A provider computes the definition of a macro the first time the
+	macro is referenced. It returns the definition (either written to
+	buf or a pointer to a string that is copied), or NULL if the macro
+	should stay undefined. arg is the argument given on registration.
+*/
+typedef char *(*MHT_PROVIDER)( char *arg, char *buf, unsigned int size );
+
+#define MHT_PROVIDER_VOLATILE	1	/* The definition is computed again after mht_refresh_providers */
+#define MHT_PROVIDER_TAINTED	2	/* The definition is tainted, see mht_taint_macro */
+
+/* Register a provider for a macro */
+int mht_register_provider( char *name, MHT_PROVIDER provider, char *arg, unsigned int flags );
+
+/* Drop the definitions of all volatile providers, e.g. on a clock tick */
+void mht_refresh_providers(void);
+
+/*
+	An argument of a builtin macro. ptr is always terminated by '\0',
+	empty or missing arguments have a length of 0.
+*/
+typedef struct {
+	char *ptr;
+	unsigned int len;
+} MHT_SLICE;
+
+/* The output of a builtin macro, the expanded macro is appended to buf */
+typedef struct {
+	char *buf;
+	unsigned int len;
+	unsigned int size;
+} MHT_BUILDER;
+
+/*
+	A builtin macro <#name|arg1|arg2|...>. args[0] is the name of the
+	builtin, arg_count includes the name. The builtin appends its
+	expansion to out and returns 1, or returns 0 to leave the macro
+	unexpanded. user_data is the pointer given on registration.
+*/
+typedef int (*MHT_BUILTIN)( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data );
+
+/* Register a builtin macro, an existing builtin of the same name is replaced */
+int mht_register_builtin( char *name, MHT_BUILTIN func, void *user_data );
+
+/* Append a string to the output of a builtin macro */
+void mht_builder_append( MHT_BUILDER *out, char *str, unsigned int len );
+
+/* Process a MHT block for each row of a CSV/TSV file */
+int mht_process_table( FILE *out, char *block_name, char *fname, char sepchar, unsigned int options, unsigned long first, unsigned long last );
+
 /* Expand all MHT macros in a string by recursion. */
 char *mht_expand( char *input );
@@ -5,38 +5,40 @@
 #include <string.h>
 
 #include "mht.h"
+#include "dict.h"
+#include "sink.h"
+#include "serve.h"
+#include "zygote.h"
 
 
 /* Definitions: */
-#define	HELP_STRING		"This is mht2html, the Macro-Hyper-Text to HTML compiler.\nmht2html supports the following arguments:\n\n-h print this screen\n-v print the release version and compile date\n-p process a MHT file specified by the absolute path\n\nexample usage:\n$> mht2html -p /tmp/file.mht\n\nFor further information about MHT, email to info at weckert.org\n"
+#define	HELP_STRING		"This is mht2html, the Macro-Hyper-Text to HTML compiler.\nmht2html supports the following arguments:\n\n-h print this screen\n-v print the release version and compile date\n-p process a MHT file specified by the absolute path\n-d compile a file with key=value lines into a macro dictionary (see #dict)\n-serve serve the MHT files below a directory by HTTP\n-zygote fork the CGI requests of zcgi from a process which has read a prologue, - is the socket of the user\n\nexample usage:\n$> mht2html -p /tmp/file.mht\n$> mht2html -d /tmp/strings.txt /tmp/strings.dict\n$> mht2html -serve :8080 /var/www/mht\n$> mht2html -zygote - /var/www/mht/prologue.mht\n\nFor further information about MHT, email to info at weckert.org\n"
 
 
 /* Prototypes: */
 int main( int argc, char **argvv );
 void show_mht_error( int mht_error );
+void register_env_macros(void);
 
 
 int main( int argc, char **argv ) {
 	int
-		mht_error = 0;
+		mht_error = 0,
+		entries = 0;
 
 	char
 		*mht_version_msg = (char*)NULL;
 
+	MHT_SINK
+		*sink = (MHT_SINK*)NULL;
+
 
 	/* Process the command line arguments */
 	if (argc>=2) {
 		/* Initialize MHT */
 		mht_init();
 
-		/* Try to read the username, style path and user path from the environment. */
-#ifdef WIN32
-		mht_register_env("USERNAME","user");
-#else
-		mht_register_env("USER","user");
-#endif
-		mht_register_env("MHTUSERPATH","userpath");
-		mht_register_env("MHTSCRIPTPATH","scriptpath");
+		register_env_macros();
 
 		if (strcmp(argv[1],"-v")==0) {
 			mht_search_macro("mht_version_msg",&mht_version_msg);
@@ -49,8 +51,13 @@ int main( int argc, char **argv ) {
 
 		else if (strcmp(argv[1],"-p")==0) {
 			if (argc>=3) {
-				/* Process the MHT file */
+				/* Process the MHT file, the output is written in batches */
+				sink = sink_writev_new(stdout);
+				mht_set_sink(sink);
 				mht_error = mht_quickopen(stdout,argv[2]);
+				mht_set_sink((MHT_SINK*)NULL);
+				sink_finish(sink);
+				sink_free(sink);
 
 				if (mht_error!=0) {
 					show_mht_error(mht_error);
@@ -61,6 +68,40 @@ int main( int argc, char **argv ) {
 				fprintf(stdout,"%s",HELP_STRING);
 			}
 		}
+		else if (strcmp(argv[1],"-serve")==0) {
+			if (argc>=4) {
+				/* Serve the MHT files by HTTP, until the server is terminated */
+				serve_run(argv[2],argv[3],register_env_macros);
+			}
+			else {
+				fprintf(stdout,"%s",HELP_STRING);
+			}
+		}
+		else if (strcmp(argv[1],"-zygote")==0) {
+			if (argc>=3) {
+				/* Fork the CGI requests, until the zygote is terminated */
+				zygote_run(argv[2],(argc>=4) ? argv[3] : (char*)NULL);
+			}
+			else {
+				fprintf(stdout,"%s",HELP_STRING);
+			}
+		}
+		else if (strcmp(argv[1],"-d")==0) {
+			if (argc>=4) {
+				/* Compile a macro dictionary */
+				entries = dict_build(argv[2],argv[3]);
+
+				if (entries<0) {
+					fprintf(stdout,"Cannot compile %s into %s!\n",argv[2],argv[3]);
+				}
+				else {
+					fprintf(stdout,"%d macros written to %s\n",entries,argv[3]);
+				}
+			}
+			else {
+				fprintf(stdout,"%s",HELP_STRING);
+			}
+		}
 		else {
 			fprintf(stdout,"%s",HELP_STRING);
 		}
@@ -76,6 +117,20 @@ int main( int argc, char **argv ) {
 }
 
 
+/*
+	Try to read the username, style path and user path from the environment.
+*/
+void register_env_macros(void) {
+#ifdef WIN32
+	mht_register_env("USERNAME","user");
+#else
+	mht_register_env("USER","user");
+#endif
+	mht_register_env("MHTUSERPATH","userpath");
+	mht_register_env("MHTSCRIPTPATH","scriptpath");
+}
+
+
 void show_mht_error( int mht_error ) {
 	char
 		*mht_err_msg = (char*)NULL,
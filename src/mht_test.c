@@ -0,0 +1,943 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mht.h"
+#include "dict.h"
+#include "sink.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the directives, each template is rendered in a state
+	of its own.
+*/
+
+
+void setup_long_list(void) {
+	char list[12004];
+	int i = 0;
+
+	for (i=0; i<3000; i++) {
+		sprintf(list+i*4,"%03d,",i%1000);
+	}
+	list[i*4-1] = '\0';
+	mht_register_macro("list",list);
+}
+
+
+void test_foreach(void) {
+	char *output = (char*)NULL;
+	int mht_err = 0;
+
+	output = test_render(
+		"#begin row\n"
+		"[<#item>]\n"
+		"#end row\n"
+		"#foreach row|item|a,b,c\n",
+		NULL,&mht_err);
+	test_equal("#foreach list",output,"[a]\n[b]\n[c]\n");
+	test_check("#foreach list without errors",mht_err==0);
+	free(output);
+
+	output = test_render(
+		"#def list x;y\n"
+		"#def item hidden\n"
+		"#begin row\n"
+		"<#item>\n"
+		"#end row\n"
+		"#foreach row|item|$list|;\n"
+		"<#item>\n",
+		NULL,&mht_err);
+	test_equal("#foreach over a macro with a separator",output,"x\ny\nhidden\n");
+	free(output);
+
+	output = test_render(
+		"#def map.b 2\n"
+		"#def map.a 1\n"
+		"#begin row\n"
+		"<#key>=<#map.<#key>>\n"
+		"#end row\n"
+		"#foreach row|key|@map\n",
+		NULL,&mht_err);
+	test_equal("#foreach over a map",output,"a=1\nb=2\n");
+	free(output);
+
+	output = test_render(
+		"#begin row\n"
+		"<#a><#b>\n"
+		"#end row\n"
+		"#begin rows\n"
+		"#foreach row|b|1,2\n"
+		"#end rows\n"
+		"#foreach rows|a|x,y\n",
+		NULL,&mht_err);
+	test_equal("nested #foreach",output,"x1\nx2\ny1\ny2\n");
+	free(output);
+
+	output = test_render(
+		"#begin row\n"
+		"<#item>\n"
+		"#end row\n"
+		"#foreach row|item|$list\n",
+		setup_long_list,&mht_err);
+	test_check("#foreach over a list longer than a line",output!=(char*)NULL && strlen(output)==3000*4);
+	test_check("#foreach over a list longer than a line ends with the last item",output!=(char*)NULL && strcmp(output+strlen(output)-8,"998\n999\n")==0);
+	free(output);
+
+	output = test_render("#foreach row\n",NULL,&mht_err);
+	test_check("#foreach without parameters",mht_err!=0);
+	free(output);
+
+	output = test_render("#foreach nope|item|a\n",NULL,&mht_err);
+	test_check("#foreach of an unknown block",mht_err!=0);
+	free(output);
+}
+
+
+void test_table(void) {
+	struct MHT_INFO_S
+		*state = (struct MHT_INFO_S*)NULL,
+		*prev = (struct MHT_INFO_S*)NULL;
+
+	char
+		*output = (char*)NULL,
+		*message = (char*)NULL,
+		*template = (char*)NULL,
+		*fname = test_file("table.csv","name,qty\npear,3\n\"<#def x 1>\",<#qty>\napple,5\n",0);
+	int mht_err = 0;
+
+	template = (char*)malloc(2*strlen(fname)+256);
+
+	sprintf(template,
+		"#begin row\n"
+		"<#row.%%0>:<#row.name>=<#row.%%2>\n"
+		"#end row\n"
+		"#table row|%s|||header\n",fname);
+	output = test_render(template,NULL,&mht_err);
+	test_equal("#table with a header",output,"1:pear=3\n2:<#def x 1>=<#qty>\n3:apple=5\n");
+	test_check("#table without errors",mht_err==0);
+	free(output);
+
+	sprintf(template,
+		"#begin row\n"
+		"<#row.%%1>\n"
+		"#end row\n"
+		"#table row|%s|2|3\n",fname);
+	output = test_render(template,NULL,&mht_err);
+	test_equal("#table with a range of rows",output,"pear\n<#def x 1>\n");
+	free(output);
+
+	/* Field numbers beyond the row are unknown macros */
+	sprintf(template,
+		"#begin row\n"
+		"<#row.%%3>,<#row.%%4294967295>,<#row.%%18446744073709551617>,<#row.%%2x>\n"
+		"#end row\n"
+		"#table row|%s|2|2\n",fname);
+	output = test_render(template,NULL,&mht_err);
+	test_equal("#table with unknown fields",output,"<#row.%3>,<#row.%4294967295>,<#row.%18446744073709551617>,<#row.%2x>\n");
+	free(output);
+
+	/* A block which runs #table on itself */
+	sprintf(template,
+		"#begin row\n"
+		"#table row|%s|1|1\n"
+		"#end row\n"
+		"#table row|%s|1|1\n",fname,fname);
+	state = mht_state_new();
+	prev = mht_state_switch(state);
+	output = test_process(template,&mht_err);
+	test_check("#table too deep",mht_err!=0);
+	test_check("#table too deep, message",mht_search_macro("mht_err_msg",&message)==1 && strstr(message,"cascaded #table")!=(char*)NULL);
+	mht_state_switch(prev);
+	mht_state_free(state);
+	free(output);
+
+	output = test_render("#begin row\n#end row\n#table row|/nonexistent/none.csv\n",NULL,&mht_err);
+	test_check("#table of a missing file",mht_err!=0);
+	free(output);
+
+	free(template);
+}
+
+
+void test_json(void) {
+	char
+		*output = (char*)NULL,
+		*template = (char*)NULL,
+		*fname = test_file("doc.json","{\"items\": [{\"t\": \"one\"}, {\"t\": \"two\"}], \"s\": [\"a\", 2, null]}",0),
+		*other = test_file("other.json","{\"items\": [], \"s\": [\"b\"]}",0);
+	int mht_err = 0;
+
+	template = (char*)malloc(strlen(fname)+strlen(other)+256);
+
+	sprintf(template,
+		"#jsonsource d %s\n"
+		"#begin it\n"
+		"<#x.index>/<#x.count>: <#json|d|<#x>.t>\n"
+		"#end it\n"
+		"#begin sc\n"
+		"[<#y>]\n"
+		"#end sc\n"
+		"#foreach it|x|json:d:items\n"
+		"#foreach sc|y|json:d:s\n"
+		"<#json|d|missing|default> <#json|d|s[0]>\n",fname);
+	output = test_render(template,NULL,&mht_err);
+	test_equal("#jsonsource",output,"1/2: one\n2/2: two\n[a]\n[2]\n[]\ndefault a\n");
+	test_check("#jsonsource without errors",mht_err==0);
+	free(output);
+
+	/* The document iterated stays valid if the block opens the name again */
+	sprintf(template,
+		"#jsonsource d %s\n"
+		"#begin sc\n"
+		"#jsonsource d %s\n"
+		"[<#y>]\n"
+		"#end sc\n"
+		"#foreach sc|y|json:d:s\n"
+		"<#json|d|s[0]>\n",fname,other);
+	output = test_render(template,NULL,&mht_err);
+	test_equal("#jsonsource in a #foreach over the document",output,"[a]\n[2]\n[]\nb\n");
+	free(output);
+
+	output = test_render("#jsonsource d /nonexistent/none.json\n",NULL,&mht_err);
+	test_check("#jsonsource of a missing file",mht_err!=0);
+	free(output);
+
+	free(template);
+}
+
+
+void test_dict(void) {
+	char
+		*output = (char*)NULL,
+		*template = (char*)NULL,
+		*fname = test_path("strings.dict");
+	int mht_err = 0;
+
+	dict_build(test_file("strings.txt","title=Hello\nsite=Pegswood\n",0),fname);
+	template = (char*)malloc(strlen(fname)+256);
+
+	sprintf(template,
+		"#dict %s\n"
+		"#dict %s\n"
+		"#def site Mine\n"
+		"<#title> <#site> <#nope>\n",fname,fname);
+	output = test_render(template,NULL,&mht_err);
+	test_equal("#dict",output,"Hello Mine <#nope>\n");
+	test_check("#dict without errors",mht_err==0);
+	free(output);
+
+	output = test_render("#dict /nonexistent/none.dict\n",NULL,&mht_err);
+	test_check("#dict of a missing file",mht_err!=0);
+	free(output);
+
+	free(template);
+}
+
+
+void setup_env(void) {
+	char name[16];
+
+	/* The name of the variable is copied */
+	strcpy(name,"MHT_TEST_VAR");
+	setenv(name,"from env",1);
+	mht_register_env(name,"var");
+	strcpy(name,"PATH");
+}
+
+
+void test_providers(void) {
+	char *output = (char*)NULL;
+	struct MHT_INFO_S
+		*state = (struct MHT_INFO_S*)NULL,
+		*prev = (struct MHT_INFO_S*)NULL;
+
+	output = test_render("#undef time\n[<#time>]\n",NULL,(int*)NULL);
+	test_equal("#undef of a provider before its use",output,"[<#time>]\n");
+	free(output);
+
+	output = test_render("[<#null>]\n#undef null\n[<#null>]\n#def null x\n[<#null>]\n",NULL,(int*)NULL);
+	test_equal("#undef of a provider after its use",output,"[]\n[<#null>]\n[x]\n");
+	free(output);
+
+	output = test_render("[<#var>]\n",setup_env,(int*)NULL);
+	test_equal("environment variable",output,"[from env]\n");
+	free(output);
+
+	state = mht_state_new();
+	prev = mht_state_switch(state);
+
+	/* The volatile providers are asked again, but not after a #undef */
+	free(test_process("<#time><#short_date>\n#undef time\n",(int*)NULL));
+	mht_refresh_providers();
+	output = test_process("[<#time>]\n",(int*)NULL);
+	test_equal("#undef after mht_refresh_providers",output,"[<#time>]\n");
+	free(output);
+
+	output = test_process("<#short_date>\n",(int*)NULL);
+	test_check("volatile provider after mht_refresh_providers",output[0]!='<');
+	free(output);
+
+	/* An #undef in a request scope holds until the scope ends */
+	mht_scope_begin();
+	output = test_process("#undef long_date\n[<#long_date>]\n",(int*)NULL);
+	test_equal("#undef in a request scope",output,"[<#long_date>]\n");
+	free(output);
+	mht_scope_end();
+
+	mht_scope_begin();
+	output = test_process("[<#long_date>]\n",(int*)NULL);
+	test_check("provider in the next request scope",strcmp(output,"[<#long_date>]\n")!=0);
+	free(output);
+	mht_scope_end();
+
+	mht_state_switch(prev);
+	mht_state_free(state);
+}
+
+
+void setup_tainted(void) {
+	mht_register_macro("q","<b>,&x");
+	mht_taint_macro("q");
+	mht_register_macro("form.<i>","1");
+	mht_taint_macro("form.<i>");
+}
+
+
+void test_autoescape(void) {
+	char
+		*output = (char*)NULL,
+		*template = (char*)NULL,
+		*csv_name = test_file("escape.csv","<i>,a&b\n",0),
+		*json_name = test_file("escape.json","{\"s\": [\"<s>\"], \"t\": \"'t'\"}",0);
+
+	template = (char*)malloc(strlen(csv_name)+strlen(json_name)+512);
+
+	sprintf(template,
+		"#mhtvar autoescape html\n"
+		"#def own <u>\n"
+		"#jsonsource j %s\n"
+		"#begin item\n"
+		"<#x>\n"
+		"#end item\n"
+		"#begin row\n"
+		"<#row.%%1> <#row.%%2>\n"
+		"#end row\n"
+		"<#q> <#own>\n"
+		"#foreach item|x|$q\n"
+		"#foreach item|x|@form\n"
+		"#foreach item|x|json:j:s\n"
+		"#table row|%s\n"
+		"<#json|j|t>\n",json_name,csv_name);
+	output = test_render(template,setup_tainted,(int*)NULL);
+	test_equal("autoescape",output,
+		"&lt;b&gt;,&amp;x <u>\n"
+		"&lt;b&gt;\n"
+		"&amp;x\n"
+		"&lt;i&gt;\n"
+		"&lt;s&gt;\n"
+		"&lt;i&gt; a&amp;b\n"
+		"&#39;t&#39;\n");
+	free(output);
+
+	/* Without autoescape, the values are inserted as they are */
+	output = test_render(strchr(template,'\n')+1,setup_tainted,(int*)NULL);
+	test_equal("autoescape off",output,
+		"<b>,&x <u>\n"
+		"<b>\n"
+		"&x\n"
+		"<i>\n"
+		"<s>\n"
+		"<i> a&b\n"
+		"'t'\n");
+	free(output);
+
+	free(template);
+}
+
+
+void test_minify(void) {
+	char *output = (char*)NULL;
+
+	output = test_render(
+		"<p>  a  </p>\n"
+		"#mhtvar minify true\n"
+		"<p>  b  </p>   <!-- gone -->\n"
+		"<pre>  c  </pre>\n",
+		NULL,(int*)NULL);
+	test_equal("#mhtvar minify",output,"<p>  a  </p>\n<p> b </p>\n<pre>  c  </pre>");
+	free(output);
+}
+
+
+void test_filters(void) {
+	char *output = (char*)NULL;
+
+	output = test_render(
+		"#mhtvar filter killspace\n"
+		"   a   b   \n"
+		"#mhtvar filter none\n"
+		"   c   \n"
+		"#mhtvar killspace true\n"
+		"   d   \n"
+		"#mhtvar killspace false\n"
+		"#mhtvar filter killspace,minify\n"
+		"<p>  e  </p>\n"
+		"  <p>  f  </p>\n",
+		NULL,(int*)NULL);
+	test_equal("#mhtvar filter",output,"a   b    c   \nd <p> e </p> <p> f </p>");
+	free(output);
+}
+
+
+/*
+	The conditions of #if and their values.
+*/
+char *if_cases[][2] = {
+	{ "<#n> == 10", "T" },
+	{ "<#n>==10", "T" },
+	{ "<#n> < 9", "F" },
+	{ "<#n> > 9", "T" },
+	{ "<#n> >= 10", "T" },
+	{ "<#n> <= 9", "F" },
+	{ "010 == 10", "T" },
+	{ "-1 < 1", "T" },
+	{ "9 < 10", "T" },
+	{ "b < a", "F" },
+	{ "<#s> == abc", "T" },
+	{ "<#s> != \"abc\"", "F" },
+	{ "\"a b\" == \"a b\"", "T" },
+	{ "<#inner> == abc", "T" },
+	{ "<#nope> == x", "F" },
+	{ "defined(n)", "T" },
+	{ "defined(nope)", "F" },
+	{ "!defined(nope)", "T" },
+	{ "in(<#s>,x,abc,y)", "T" },
+	{ "in(b,<#list>)", "T" },
+	{ "in(c,<#list>)", "F" },
+	{ "<#n> == 10 && <#s> == x", "F" },
+	{ "<#n> == 10 || <#s> == x", "T" },
+	{ "(1 == 2 || 2 == 2) && !(3 == 4)", "T" },
+	{ "true", "T" },
+	{ "false", "F" },
+	{ "1", "T" },
+	{ "0", "F" }
+};
+
+
+void test_if(void) {
+	char
+		*output = (char*)NULL,
+		template[512];
+
+	int mht_err = 0;
+	unsigned int i = 0;
+
+
+	for (i=0; i<sizeof(if_cases)/sizeof(if_cases[0]); i++) {
+		sprintf(template,
+			"#def n 10\n"
+			"#def s abc\n"
+			"#def inner <#s>\n"
+			"#def list a,b\n"
+			"#if %s\n"
+			"T\n"
+			"#else\n"
+			"F\n"
+			"#endif\n",if_cases[i][0]);
+		output = test_render(template,NULL,(int*)NULL);
+		sprintf(template,"%s\n",if_cases[i][1]);
+		test_equal(if_cases[i][0],output,template);
+		free(output);
+	}
+
+	/* Compiled in a block, evaluated for each call */
+	output = test_render(
+		"#begin grade\n"
+		"#if <#grade.%1> >= 90\n"
+		"A\n"
+		"#elif <#grade.%1> >= 80 && <#grade.%1> < 90\n"
+		"B\n"
+		"#elif in(<#grade.%1>,0,1)\n"
+		"none\n"
+		"#else\n"
+		"#if <#grade.%1> < 50\n"
+		"fail\n"
+		"#else\n"
+		"C\n"
+		"#endif\n"
+		"#endif\n"
+		"#end grade\n"
+		"#process grade|95\n"
+		"#process grade|85\n"
+		"#process grade|1\n"
+		"#process grade|60\n"
+		"#process grade|7\n",
+		NULL,(int*)NULL);
+	test_equal("#elif and nested #if in a block",output,"A\nB\nnone\nC\nfail\n");
+	free(output);
+
+	/* A false level does not evaluate what it contains */
+	output = test_render(
+		"#if false\n"
+		"#if no expression\n"
+		"x\n"
+		"#endif\n"
+		"#endif\n"
+		"done\n",
+		NULL,&mht_err);
+	test_check("not evaluated in a false level",mht_err==0 && output!=(char*)NULL && strcmp(output,"done\n")==0);
+	free(output);
+
+	output = test_render("#if <#n> ==\nx\n#endif\n",NULL,&mht_err);
+	test_check("incomplete expression",mht_err!=0);
+	free(output);
+
+	output = test_render("#if ((1 == 1)\nx\n#endif\n",NULL,&mht_err);
+	test_check("unbalanced parentheses",mht_err!=0);
+	free(output);
+}
+
+
+/*
+	Process a loaded block into a string. Returns the output, to be
+	freed.
+*/
+char *process( char *block_name ) {
+	MHT_SINK *sink = sink_mem_new();
+	char *output = (char*)NULL;
+	size_t len = 0;
+
+	mht_set_sink(sink);
+	mht_process(stdout,block_name);
+	mht_set_sink((MHT_SINK*)NULL);
+
+	output = strdup(sink_mem_get(sink,&len));
+	sink_free(sink);
+
+	return (output);
+}
+
+
+void test_fold(void) {
+	struct MHT_INFO_S
+		*state = (struct MHT_INFO_S*)NULL,
+		*prev = (struct MHT_INFO_S*)NULL;
+
+	char
+		*template =
+			"#def site Example\n"
+			"#def title <#site> home\n"
+			"#def sep -\n"
+			"#begin page\n"
+			"<h1><#title></h1>\n"
+			"static 1\n"
+			"static 2 <#sep> <#page.%1>\n"
+			"<p><#site></p>\n"
+			"#end page\n"
+			"#process page|one\n"
+			"#def site Changed\n"
+			"#process page|two\n"
+			"#undef sep\n"
+			"#process page|three\n"
+			"#begin row\n"
+			"<#site>/<#title>\n"
+			"#end row\n"
+			"#foreach row|site|x,y\n"
+			"#process page|four\n",
+		*expected =
+			"<h1>Example home</h1>\nstatic 1\nstatic 2 - one\n<p>Example</p>\n"
+			"<h1>Changed home</h1>\nstatic 1\nstatic 2 - two\n<p>Changed</p>\n"
+			"<h1>Changed home</h1>\nstatic 1\nstatic 2 <#sep> three\n<p>Changed</p>\n"
+			"x/x home\ny/y home\n"
+			"<h1>Changed home</h1>\nstatic 1\nstatic 2 <#sep> four\n<p>Changed</p>\n",
+		*output = (char*)NULL,
+		*unfolded = (char*)_malloc(strlen(template)+32);
+
+
+	/* Folded blocks follow the macros they were folded with */
+	output = test_render(template,NULL,(int*)NULL);
+	test_equal("folded",output,expected);
+	free(output);
+
+	/* A folded macro refers to a macro which changes more than once */
+	output = test_render(
+		"#def x 1\n#def y [<#x>]\n#begin b\n<#y>\n#end b\n"
+		"#process b\n#def x 2\n#process b\n#def x 3\n#process b\n#undef x\n#process b\n",NULL,(int*)NULL);
+	test_equal("folded twice",output,"[1]\n[2]\n[3]\n[<#x>]\n");
+	free(output);
+
+	sprintf(unfolded,"#mhtvar fold false\n%s",template);
+	output = test_render(unfolded,NULL,(int*)NULL);
+	test_equal("not folded",output,expected);
+	free(output);
+	free(unfolded);
+
+	/* A loaded template, the macros change between the renders */
+	state = mht_state_new();
+	prev = mht_state_switch(state);
+	mht_load(test_file("fold.mht","#begin page\nname <#name>\n#end page\n#process page\n",0),"top");
+	mht_register_macro("name","first");
+
+	output = process("top");
+	test_equal("loaded template",output,"name first\n");
+	free(output);
+
+	mht_register_macro("name","second");
+	output = process("top");
+	test_equal("macro registered between renders",output,"name second\n");
+	free(output);
+
+	mht_undef_macro("name");
+	output = process("top");
+	test_equal("macro undefined between renders",output,"name <#name>\n");
+	free(output);
+
+	mht_state_switch(prev);
+	mht_state_free(state);
+}
+
+
+/*
+	A builtin with the number of its calls, so a cached block shows if
+	it was rendered again.
+*/
+int count_calls = 0;
+
+int builtin_count( MHT_BUILDER *out, MHT_SLICE *args, int arg_count, void *user_data ) {
+	char num[16];
+
+	sprintf(num,"%d",++count_calls);
+	mht_builder_append(out,num,(unsigned int)strlen(num));
+
+	return (1);
+}
+
+
+void setup_count(void) {
+	count_calls = 0;
+	mht_register_builtin("count",builtin_count,(void*)NULL);
+}
+
+
+void test_cache(void) {
+	struct MHT_INFO_S
+		*state = (struct MHT_INFO_S*)NULL,
+		*prev = (struct MHT_INFO_S*)NULL;
+
+	char *output = (char*)NULL;
+
+
+	/* The key is the block and its parameters, a macro read spoils it */
+	output = test_render(
+		"#def site A\n"
+		"#begin nav\n"
+		"nav <#site> <#nav.%1> <#count>\n"
+		"#end nav\n"
+		"#cache nav|x\n"
+		"#cache nav|x\n"
+		"#cache nav|y\n"
+		"#cache nav|x 60\n"
+		"#def site B\n"
+		"#cache nav|x\n"
+		"#cache nav|x\n"
+		"#process nav|x\n",setup_count,(int*)NULL);
+	test_equal("cached block",output,
+		"nav A x 1\nnav A x 1\nnav A y 2\nnav A x 1\n"
+		"nav B x 3\nnav B x 3\nnav B x 4\n");
+	free(output);
+
+	output = test_render(
+		"#begin greet\n"
+		"hi <#who> <#count>\n"
+		"#end greet\n"
+		"#cache greet\n"
+		"#def who W\n"
+		"#cache greet\n"
+		"#undef who\n"
+		"#cache greet\n",setup_count,(int*)NULL);
+	test_equal("macro defined and undefined",output,"hi <#who> 1\nhi W 2\nhi <#who> 3\n");
+	free(output);
+
+	/* Blocks with other effects than their output are rendered each time */
+	output = test_render(
+		"#begin set\n"
+		"<#count>\n"
+		"#def z 1\n"
+		"#end set\n"
+		"#cache set\n"
+		"#cache set\n",setup_count,(int*)NULL);
+	test_equal("block with #def",output,"1\n2\n");
+	free(output);
+
+	/* And blocks reading the loop variables of an enclosing #foreach */
+	output = test_render(
+		"#begin nav\n"
+		"nav <#site> <#count>\n"
+		"#end nav\n"
+		"#begin item\n"
+		"#cache nav\n"
+		"#end item\n"
+		"#foreach item|site|p,q,p\n",setup_count,(int*)NULL);
+	test_equal("block in a loop",output,"nav p 1\nnav q 2\nnav p 3\n");
+	free(output);
+
+	output = test_render(
+		"#mhtvar cachesize 0\n"
+		"#begin nav\n"
+		"<#count>\n"
+		"#end nav\n"
+		"#cache nav\n"
+		"#cache nav\n",setup_count,(int*)NULL);
+	test_equal("cache turned off",output,"1\n2\n");
+	free(output);
+
+	output = test_render(
+		"#begin nav\n"
+		"<#count>\n"
+		"#end nav\n"
+		"#cache nav 1\n"
+		"#cache nav 1\n",setup_count,(int*)NULL);
+	test_equal("time to live",output,"1\n1\n");
+	free(output);
+
+	/* The cache is kept between the renders of a loaded template */
+	state = mht_state_new();
+	prev = mht_state_switch(state);
+	setup_count();
+	mht_load(test_file("cache.mht","#begin nav\nnav <#site> <#count>\n#end nav\n#cache nav 1\n",0),"top");
+	mht_register_macro("site","A");
+
+	output = process("top");
+	test_equal("first render",output,"nav A 1\n");
+	free(output);
+
+	output = process("top");
+	test_equal("next render",output,"nav A 1\n");
+	free(output);
+
+	mht_register_macro("site","B");
+	output = process("top");
+	test_equal("macro registered between renders",output,"nav B 2\n");
+	free(output);
+
+	/* The time to live elapsed */
+	sleep(2);
+	output = process("top");
+	test_equal("expired entry",output,"nav B 3\n");
+	free(output);
+
+	mht_state_switch(prev);
+	mht_state_free(state);
+}
+
+
+void test_memo(void) {
+	struct MHT_INFO_S
+		*state = (struct MHT_INFO_S*)NULL,
+		*prev = (struct MHT_INFO_S*)NULL;
+
+	char *output = (char*)NULL;
+
+
+	/* A memoized expansion follows its arguments and the macros it read */
+	output = test_render(
+		"#def base http://a\n"
+		"#def url <#base>/<#.%1>\n"
+		"#def link <a href=\"<#url|<#.%1>>\"><#.%2></a>\n"
+		"<#url|x> <#url|x> <#url|y>\n"
+		"<#link|x|X> <#link|x|X>\n"
+		"#def base http://b\n"
+		"<#url|x> <#link|x|X>\n"
+		"#def url <#base>:<#.%1>\n"
+		"<#url|x> <#link|x|X>\n"
+		"#undef base\n"
+		"<#url|x>\n",NULL,(int*)NULL);
+	test_equal("memoized expansions",output,
+		"http://a/x http://a/x http://a/y\n"
+		"<a href=\"http://a/x\">X</a> <a href=\"http://a/x\">X</a>\n"
+		"http://b/x <a href=\"http://b/x\">X</a>\n"
+		"http://b:x <a href=\"http://b:x\">X</a>\n"
+		"<#base>:x\n");
+	free(output);
+
+	/* Macros using builtins are expanded each time */
+	output = test_render(
+		"#def n <#count>\n"
+		"#def m <#n>\n"
+		"<#n> <#n> <#m|a> <#m|a>\n",setup_count,(int*)NULL);
+	test_equal("builtin not memoized",output,"1 2 3 4\n");
+	free(output);
+
+	/* Nor macros reading loop variables */
+	output = test_render(
+		"#def url <#base>/<#.%1>\n"
+		"#begin row\n"
+		"<#url|x>\n"
+		"#end row\n"
+		"#foreach row|base|a,b\n",NULL,(int*)NULL);
+	test_equal("loop variable",output,"a/x\nb/x\n");
+	free(output);
+
+	/* The expansions with macros of a request scope are dropped with it */
+	state = mht_state_new();
+	prev = mht_state_switch(state);
+	mht_load(test_file("memo.mht","#def url <#base>/<#.%1>\n<#url|x> <#url|x>\n",0),"top");
+	mht_register_macro("base","a");
+
+	output = process("top");
+	test_equal("first render",output,"a/x a/x\n");
+	free(output);
+
+	mht_scope_begin();
+	mht_register_macro("base","b");
+	output = process("top");
+	test_equal("render in a scope",output,"b/x b/x\n");
+	free(output);
+	mht_scope_end();
+
+	output = process("top");
+	test_equal("render after the scope",output,"a/x a/x\n");
+	free(output);
+
+	mht_state_switch(prev);
+	mht_state_free(state);
+}
+
+
+/*
+	The value of a macro, "-" if it is undefined.
+*/
+char *lookup( char *name ) {
+	char *result = (char*)NULL;
+
+	return ((mht_search_macro(name,&result)==1 && result!=(char*)NULL) ? result : "-");
+}
+
+
+void test_scope(void) {
+	struct MHT_INFO_S
+		*state = (struct MHT_INFO_S*)NULL,
+		*prev = (struct MHT_INFO_S*)NULL;
+
+	char
+		*output = (char*)NULL,
+		*value = (char*)_malloc(20001),
+		name[32];
+
+	int
+		i = 0,
+		found = 0;
+
+
+	state = mht_state_new();
+	prev = mht_state_switch(state);
+	mht_load(test_file("scope.mht",
+		"#begin nav\n"
+		"nav <#site>\n"
+		"#end nav\n"
+		"site <#site> base <#base>\n"
+		"#cache nav\n"
+		"#def site T\n"
+		"#undef base\n",0),"top");
+	mht_register_macro("site","A");
+	mht_register_macro("base","/");
+
+	test_check("no scope",mht_scope_active()==0);
+
+	/* The macros of the scope hide those of the state */
+	mht_scope_begin();
+	test_check("scope active",mht_scope_active()==1);
+	mht_register_macro("site","B");
+	mht_register_macro("extra","x");
+	test_equal("macro of the scope",lookup("site"),"B");
+	test_equal("macro of the state",lookup("base"),"/");
+
+	output = process("top");
+	test_equal("render in a scope",output,"site B base /\nnav B\n");
+	free(output);
+	test_equal("#def in a scope",lookup("site"),"T");
+	test_equal("#undef in a scope",lookup("base"),"-");
+
+	mht_scope_end();
+	test_check("scope ended",mht_scope_active()==0);
+	test_equal("macro after the scope",lookup("site"),"A");
+	test_equal("undefined macro after the scope",lookup("base"),"/");
+	test_equal("new macro after the scope",lookup("extra"),"-");
+
+	/* The fragment cache does not keep what the scope defined */
+	mht_register_macro("base","/");
+	output = process("top");
+	test_equal("render after the scope",output,"site A base /\nnav A\n");
+	free(output);
+	test_equal("#def without a scope",lookup("site"),"T");
+
+	/* More macros and memory than the first chunk of the scope */
+	memset(value,'v',20000);
+	value[20000] = '\0';
+
+	mht_scope_begin();
+	for (i=0; i<5000; i++) {
+		sprintf(name,"m%d",i);
+		mht_register_macro(name,name);
+	}
+	mht_register_macro("long",value);
+	test_equal("many macros in a scope",lookup("m4999"),"m4999");
+	test_check("long macro in a scope",strcmp(lookup("long"),value)==0);
+
+	/* A new scope ends the current one */
+	mht_scope_begin();
+	test_equal("macro of the ended scope",lookup("m0"),"-");
+	mht_register_macro("m1","again");
+	mht_scope_end();
+
+	for (i=0; i<5000; i++) {
+		sprintf(name,"m%d",i);
+		if (strcmp(lookup(name),"-")!=0) {
+			found++;
+		}
+	}
+	test_check("macros dropped with the scope",found==0 && strcmp(lookup("long"),"-")==0);
+
+	/* The memory of a scope is used again */
+	mht_scope_begin();
+	mht_undef_macro("site");
+	test_equal("undefined in the next scope",lookup("site"),"-");
+	mht_scope_end();
+	test_equal("state after the next scope",lookup("site"),"T");
+
+	free(value);
+	mht_state_switch(prev);
+	mht_state_free(state);
+}
+
+
+int main( int argc, char **argv ) {
+	mht_init();
+
+	test_foreach();
+	test_table();
+	test_json();
+	test_dict();
+	test_providers();
+	test_autoescape();
+	test_minify();
+	test_filters();
+	test_if();
+	test_fold();
+	test_cache();
+	test_memo();
+	test_scope();
+
+	mht_exit();
+	return (test_result("mht_test"));
+}
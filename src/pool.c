@@ -0,0 +1,807 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "mht.h"
+#include "sink.h"
+#include "pool.h"
+#include "csv.h"
+#include "json.h"
+#include "mem.h"
+#include "str_util.h"
+
+
+/* Definitions: */
+#define POOL_MAX_THREADS	256
+#define POOL_DEQUE_SIZE		64			/* The initial size of the queue of a thread */
+#define POOL_PAGE_BLOCK		"mht_pool_page"	/* The block of a loaded template, see mht_load */
+#define POOL_RELOAD_SECS	1			/* The files of the templates are checked once a second */
+
+/* The pointers and counters read without locks */
+#define POOL_LOAD(var)			__atomic_load_n(&(var),__ATOMIC_SEQ_CST)
+#define POOL_STORE(var,value)	__atomic_store_n(&(var),(value),__ATOMIC_SEQ_CST)
+#define POOL_INC(var)			__atomic_add_fetch(&(var),1,__ATOMIC_SEQ_CST)
+
+
+/* Data structures: */
+
+/* A job submitted to a pool */
+typedef struct {
+	char *fname;
+	char **args;	/* The block name and the parameters, as for mht_process_with_params */
+	int arg_count;
+	MHT_SINK *sink;
+	void (*done)( int mht_err, void *user_data );
+	void *user_data;
+} POOL_JOB;
+
+/*
+	The queue of a thread, a ring buffer: the thread itself takes the
+	oldest job, a thief the newest one.
+*/
+typedef struct {
+	pthread_mutex_t lock;
+	POOL_JOB **jobs;
+	unsigned int head;	/* The slot of the oldest job */
+	unsigned int count;
+	unsigned int size;
+} POOL_DEQUE;
+
+/*
+	A snapshot of a template: the prologue and the template read into a
+	state, which is never changed once it is published. A snapshot which
+	was replaced is freed when no render started before is left.
+*/
+typedef struct POOL_SNAPSHOT_S pool_snapshot_ptr;
+typedef struct POOL_SNAPSHOT_S {
+	struct MHT_INFO_S *state;
+	unsigned long version;	/* Distinct for all snapshots of a pool */
+	unsigned long retired;	/* The epoch when the snapshot was replaced, 0 while it is current */
+	pool_snapshot_ptr *next;	/* The next replaced snapshot */
+} POOL_SNAPSHOT;
+
+/*
+	A template of a pool. The templates are never removed from the list
+	before mht_pool_free, so it is read without locks.
+*/
+typedef struct POOL_TEMPLATE_S pool_template_ptr;
+typedef struct POOL_TEMPLATE_S {
+	char *fname;
+	POOL_SNAPSHOT *snapshot;	/* The current snapshot, see POOL_LOAD */
+	unsigned long stamp;	/* The stamp of the files of the last load, see pool_stamp */
+	pool_template_ptr *next;
+} POOL_TEMPLATE;
+
+/* The state of a thread for a template, the current snapshot is shared */
+typedef struct POOL_STATE_S pool_state_ptr;
+typedef struct POOL_STATE_S {
+	POOL_TEMPLATE *template;
+	unsigned long version;	/* The version of the snapshot shared */
+	struct MHT_INFO_S *state;
+	pool_state_ptr *next;
+} POOL_STATE;
+
+typedef struct {
+	MHT_POOL *pool;
+	pthread_t thread;
+	POOL_STATE *states;
+	POOL_DEQUE deque;
+	unsigned int index;
+	unsigned long epoch;	/* The epoch the current job started in, 0 between jobs */
+} POOL_WORKER;
+
+struct MHT_POOL_S {
+	POOL_WORKER *workers;
+	unsigned int worker_count;
+	unsigned int thread_count;	/* The number of threads started */
+	unsigned int flags;
+	char *prologue;
+	void (*setup)(void);
+	pthread_mutex_t lock;	/* Locks the counters below */
+	pthread_cond_t work;	/* Signaled when a job is queued */
+	pthread_cond_t idle;	/* Signaled when all jobs are done */
+	unsigned long pending;	/* The number of queued jobs */
+	unsigned long outstanding;	/* The number of jobs submitted, but not done */
+	unsigned int next;	/* The thread of the next job submitted from outside the pool */
+	int stop;
+	pthread_cond_t tick;	/* Wakes the reload thread when the pool is stopped */
+	pthread_t reload_thread;
+	int reloading;	/* 1 if the reload thread was started */
+	pthread_mutex_t load_lock;	/* Locks the loads, the templates are read without */
+	POOL_TEMPLATE *templates;	/* See POOL_LOAD */
+	unsigned long epoch;	/* Incremented whenever a snapshot is replaced */
+	unsigned long version;	/* The last version given to a snapshot */
+	POOL_SNAPSHOT *retired;	/* The replaced snapshots, not freed yet */
+};
+
+
+/* The worker of the current thread, NULL outside of a pool */
+MHT_THREAD POOL_WORKER *pool_self = (POOL_WORKER*)NULL;
+
+
+/* Prototypes: */
+void *pool_thread( void *arg );
+POOL_JOB *pool_take( POOL_WORKER *worker );
+void pool_push( POOL_DEQUE *deque, POOL_JOB *job );
+POOL_JOB *pool_pop( POOL_DEQUE *deque, int steal );
+void pool_render( POOL_WORKER *worker, POOL_JOB *job );
+int pool_template( MHT_POOL *pool, char *fname, POOL_TEMPLATE **template, struct MHT_INFO_S **failed );
+struct MHT_INFO_S *pool_state( POOL_WORKER *worker, POOL_TEMPLATE *template );
+int pool_load( MHT_POOL *pool, char *fname, POOL_SNAPSHOT **snapshot );
+unsigned long pool_stamp( struct MHT_INFO_S *state );
+void pool_reload( MHT_POOL *pool );
+void *pool_reload_thread( void *arg );
+void pool_retire( MHT_POOL *pool, POOL_SNAPSHOT *snapshot );
+void pool_reclaim( MHT_POOL *pool, int all );
+void pool_free_snapshot( POOL_SNAPSHOT *snapshot );
+void pool_free_job( POOL_JOB *job );
+
+
+/*
+	Create a pool of nthreads threads, or one per CPU if nthreads is 0.
+	Returns NULL if the threads cannot be started.
+*/
+MHT_POOL *mht_pool_create( int nthreads, unsigned int flags, char *prologue, void (*setup)(void) ) {
+	MHT_POOL *pool = (MHT_POOL*)NULL;
+	POOL_WORKER *worker = (POOL_WORKER*)NULL;
+	unsigned int i = 0;
+
+
+	if (nthreads<=0) {
+		nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (nthreads<1) {
+		nthreads = 1;
+	}
+	if (nthreads>POOL_MAX_THREADS) {
+		nthreads = POOL_MAX_THREADS;
+	}
+
+	/* The tables shared by all threads are filled before */
+	str_escape_init();
+
+	pool = (MHT_POOL*)_calloc(1,sizeof(MHT_POOL));
+	pool->workers = (POOL_WORKER*)_calloc(nthreads,sizeof(POOL_WORKER));
+	pool->worker_count = nthreads;
+	pool->flags = flags;
+	pool->prologue = (prologue!=(char*)NULL) ? strdup(prologue) : (char*)NULL;
+	pool->setup = setup;
+	pool->epoch = 1;
+	pthread_mutex_init(&pool->lock,(pthread_mutexattr_t*)NULL);
+	pthread_mutex_init(&pool->load_lock,(pthread_mutexattr_t*)NULL);
+	pthread_cond_init(&pool->work,(pthread_condattr_t*)NULL);
+	pthread_cond_init(&pool->idle,(pthread_condattr_t*)NULL);
+	pthread_cond_init(&pool->tick,(pthread_condattr_t*)NULL);
+
+	for (i=0; i<pool->worker_count; i++) {
+		worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->index = i;
+		worker->deque.size = POOL_DEQUE_SIZE;
+		worker->deque.jobs = (POOL_JOB**)_calloc(worker->deque.size,sizeof(POOL_JOB*));
+		pthread_mutex_init(&worker->deque.lock,(pthread_mutexattr_t*)NULL);
+	}
+
+	for (i=0; i<pool->worker_count; i++) {
+		if (pthread_create(&pool->workers[i].thread,(pthread_attr_t*)NULL,pool_thread,&pool->workers[i])!=0) {
+			mht_pool_free(pool);
+			return ((MHT_POOL*)NULL);
+		}
+		pool->thread_count++;
+	}
+
+	if (flags & MHT_POOL_RELOAD) {
+		if (pthread_create(&pool->reload_thread,(pthread_attr_t*)NULL,pool_reload_thread,pool)!=0) {
+			mht_pool_free(pool);
+			return ((MHT_POOL*)NULL);
+		}
+		pool->reloading = 1;
+	}
+
+	return (pool);
+}
+
+
+/*
+	Queue a job, see pool.h. A job submitted by a thread of the pool
+	(e.g. by done) is queued for the thread itself, all others in turn.
+*/
+int mht_pool_submit( MHT_POOL *pool, char *fname, char *block_name, char **params, int param_count, MHT_SINK *sink, void (*done)( int mht_err, void *user_data ), void *user_data ) {
+	POOL_WORKER *worker = (POOL_WORKER*)NULL;
+	POOL_JOB *job = (POOL_JOB*)NULL;
+	int i = 0;
+
+
+	if (fname==(char*)NULL || param_count<0) {
+		return (0);
+	}
+
+	job = (POOL_JOB*)_calloc(1,sizeof(POOL_JOB));
+	job->fname = strdup(fname);
+	job->arg_count = param_count+1;
+	job->args = (char**)_calloc(job->arg_count,sizeof(char*));
+	job->args[0] = strdup((block_name!=(char*)NULL) ? block_name : POOL_PAGE_BLOCK);
+	for (i=0; i<param_count; i++) {
+		job->args[i+1] = strdup((params[i]!=(char*)NULL) ? params[i] : "");
+	}
+	job->sink = sink;
+	job->done = done;
+	job->user_data = user_data;
+
+	pthread_mutex_lock(&pool->lock);
+
+	if (pool->stop!=0) {
+		pthread_mutex_unlock(&pool->lock);
+		pool_free_job(job);
+		return (0);
+	}
+
+	if (pool_self!=(POOL_WORKER*)NULL && pool_self->pool==pool) {
+		worker = pool_self;
+	}
+	else {
+		worker = &pool->workers[pool->next++ % pool->worker_count];
+	}
+
+	/* Counted before it is queued, so that it is never done before */
+	pool->pending++;
+	pool->outstanding++;
+	pthread_mutex_unlock(&pool->lock);
+
+	pool_push(&worker->deque,job);
+	pthread_cond_signal(&pool->work);
+
+	return (1);
+}
+
+
+/*
+	Wait until all jobs submitted so far are done.
+*/
+void mht_pool_wait( MHT_POOL *pool ) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->outstanding>0) {
+		pthread_cond_wait(&pool->idle,&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+/*
+	Read the templates again whose files were modified, see pool.h.
+*/
+void mht_pool_reload( MHT_POOL *pool ) {
+	pthread_mutex_lock(&pool->load_lock);
+	pool_reload(pool);
+	pthread_mutex_unlock(&pool->load_lock);
+}
+
+
+/*
+	Stop the threads after all queued jobs are done, and free the pool
+	with its templates.
+*/
+void mht_pool_free( MHT_POOL *pool ) {
+	POOL_TEMPLATE *template = (POOL_TEMPLATE*)NULL;
+	unsigned int i = 0;
+
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_cond_broadcast(&pool->tick);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i=0; i<pool->thread_count; i++) {
+		pthread_join(pool->workers[i].thread,(void**)NULL);
+	}
+	if (pool->reloading==1) {
+		pthread_join(pool->reload_thread,(void**)NULL);
+	}
+
+	pool_reclaim(pool,1);
+	while ((template=pool->templates)!=(POOL_TEMPLATE*)NULL) {
+		pool->templates = template->next;
+		pool_free_snapshot(template->snapshot);
+		free(template->fname);
+		free(template);
+	}
+
+	for (i=0; i<pool->worker_count; i++) {
+		free(pool->workers[i].deque.jobs);
+		pthread_mutex_destroy(&pool->workers[i].deque.lock);
+	}
+
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->tick);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->load_lock);
+	if (pool->prologue!=(char*)NULL) {
+		free(pool->prologue);
+	}
+	free(pool->workers);
+	free(pool);
+}
+
+
+/*
+	The loop of a thread: take a job of its own queue, or steal one.
+	The thread ends when the pool is stopped and nothing is queued.
+*/
+void *pool_thread( void *arg ) {
+	POOL_WORKER *worker = (POOL_WORKER*)arg;
+	MHT_POOL *pool = worker->pool;
+	POOL_JOB *job = (POOL_JOB*)NULL;
+	POOL_STATE *state = (POOL_STATE*)NULL;
+
+#ifdef __linux__
+	cpu_set_t cpus;
+	long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if ((pool->flags & MHT_POOL_PIN) && cpu_count>0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(worker->index % cpu_count,&cpus);
+		pthread_setaffinity_np(pthread_self(),sizeof(cpus),&cpus);
+	}
+#endif
+
+	pool_self = worker;
+
+	for (;;) {
+		if ((job=pool_take(worker))!=(POOL_JOB*)NULL) {
+			/* The snapshots read from now on are not freed before the job is done */
+			POOL_STORE(worker->epoch,POOL_LOAD(pool->epoch));
+			pool_render(worker,job);
+			POOL_STORE(worker->epoch,0);
+
+			pool_free_job(job);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		if (pool->pending==0 && pool->stop!=0) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		/* A job counted as pending may not be queued yet, so check again */
+		if (pool->pending==0) {
+			pthread_cond_wait(&pool->work,&pool->lock);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	while ((state=worker->states)!=(POOL_STATE*)NULL) {
+		worker->states = state->next;
+		mht_state_share(state->state,(struct MHT_INFO_S*)NULL);
+		mht_state_free(state->state);
+		free(state);
+	}
+
+	/* The data files of #table and #jsonsource opened by the thread */
+	csv_close_all();
+	json_close_all();
+
+	return (NULL);
+}
+
+
+/*
+	Take the oldest job of the own queue, or steal the newest job of
+	another thread.
+*/
+POOL_JOB *pool_take( POOL_WORKER *worker ) {
+	MHT_POOL *pool = worker->pool;
+	POOL_JOB *job = pool_pop(&worker->deque,0);
+	unsigned int i = 0;
+
+
+	for (i=1; job==(POOL_JOB*)NULL && i<pool->worker_count; i++) {
+		job = pool_pop(&pool->workers[(worker->index+i) % pool->worker_count].deque,1);
+	}
+
+	if (job!=(POOL_JOB*)NULL) {
+		pthread_mutex_lock(&pool->lock);
+		pool->pending--;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return (job);
+}
+
+
+/*
+	Append a job to a queue, the queue grows if it is full.
+*/
+void pool_push( POOL_DEQUE *deque, POOL_JOB *job ) {
+	POOL_JOB **jobs = (POOL_JOB**)NULL;
+	unsigned int i = 0;
+
+
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count==deque->size) {
+		jobs = (POOL_JOB**)_calloc(deque->size*2,sizeof(POOL_JOB*));
+		for (i=0; i<deque->count; i++) {
+			jobs[i] = deque->jobs[(deque->head+i) % deque->size];
+		}
+		free(deque->jobs);
+		deque->jobs = jobs;
+		deque->head = 0;
+		deque->size *= 2;
+	}
+
+	deque->jobs[(deque->head+deque->count) % deque->size] = job;
+	deque->count++;
+
+	pthread_mutex_unlock(&deque->lock);
+}
+
+
+/*
+	Remove the oldest job of a queue, or the newest one if steal is 1.
+	Returns NULL if the queue is empty.
+*/
+POOL_JOB *pool_pop( POOL_DEQUE *deque, int steal ) {
+	POOL_JOB *job = (POOL_JOB*)NULL;
+
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count>0) {
+		if (steal==1) {
+			job = deque->jobs[(deque->head+deque->count-1) % deque->size];
+		}
+		else {
+			job = deque->jobs[deque->head];
+			deque->head = (deque->head+1) % deque->size;
+		}
+		deque->count--;
+	}
+
+	pthread_mutex_unlock(&deque->lock);
+
+	return (job);
+}
+
+
+/*
+	Render a job in the state of the thread for its template.
+*/
+void pool_render( POOL_WORKER *worker, POOL_JOB *job ) {
+	MHT_POOL *pool = worker->pool;
+	MHT_SINK *prev_sink = (MHT_SINK*)NULL;
+	POOL_TEMPLATE *template = (POOL_TEMPLATE*)NULL;
+	struct MHT_INFO_S
+		*failed = (struct MHT_INFO_S*)NULL,
+		*prev = (struct MHT_INFO_S*)NULL;
+
+	int mht_err = 0;
+
+
+	if ((mht_err=pool_template(pool,job->fname,&template,&failed))!=0) {
+		/* The error macros are in the state of the failed load */
+		prev = mht_state_switch(failed);
+		if (job->done!=NULL) {
+			job->done(mht_err,job->user_data);
+		}
+		mht_state_switch(prev);
+		mht_state_free(failed);
+	}
+	else {
+		prev = mht_state_switch(pool_state(worker,template));
+		mht_scope_begin();
+
+		prev_sink = mht_set_sink(job->sink);
+		mht_err = mht_process_with_params(stdout,job->args[0],job->args,job->arg_count);
+		mht_set_sink(prev_sink);
+
+		if (job->done!=NULL) {
+			job->done(mht_err,job->user_data);
+		}
+		mht_scope_end();
+		mht_state_switch(prev);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (--pool->outstanding==0) {
+		pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+/*
+	Get a template, it is loaded when used first. Only the first use
+	takes a lock. Returns the MHT error of the load, failed is the state
+	of the failed load then (to be freed).
+*/
+int pool_template( MHT_POOL *pool, char *fname, POOL_TEMPLATE **template, struct MHT_INFO_S **failed ) {
+	POOL_SNAPSHOT *snapshot = (POOL_SNAPSHOT*)NULL;
+	int mht_err = 0;
+
+
+	for ((*template)=POOL_LOAD(pool->templates); (*template)!=(POOL_TEMPLATE*)NULL && strcmp((*template)->fname,fname)!=0; (*template)=(*template)->next);
+
+	if ((*template)!=(POOL_TEMPLATE*)NULL) {
+		return (0);
+	}
+
+	pthread_mutex_lock(&pool->load_lock);
+
+	/* Another thread may have loaded it meanwhile */
+	for ((*template)=pool->templates; (*template)!=(POOL_TEMPLATE*)NULL && strcmp((*template)->fname,fname)!=0; (*template)=(*template)->next);
+
+	if ((*template)==(POOL_TEMPLATE*)NULL) {
+		if ((mht_err=pool_load(pool,fname,&snapshot))!=0) {
+			(*failed) = snapshot->state;
+			free(snapshot);
+		}
+		else {
+			(*template) = (POOL_TEMPLATE*)_calloc(1,sizeof(POOL_TEMPLATE));
+			(*template)->fname = strdup(fname);
+			(*template)->snapshot = snapshot;
+			(*template)->stamp = pool_stamp(snapshot->state);
+			(*template)->next = pool->templates;
+			POOL_STORE(pool->templates,(*template));
+		}
+	}
+
+	pthread_mutex_unlock(&pool->load_lock);
+
+	return (mht_err);
+}
+
+
+/*
+	Get the state of a thread for a template, it is created (by the
+	thread, so its memory is local to it) when used first. The current
+	snapshot of the template is shared by the state.
+*/
+struct MHT_INFO_S *pool_state( POOL_WORKER *worker, POOL_TEMPLATE *template ) {
+	POOL_STATE *state = (POOL_STATE*)NULL;
+	POOL_SNAPSHOT *snapshot = POOL_LOAD(template->snapshot);
+	struct MHT_INFO_S *prev = (struct MHT_INFO_S*)NULL;
+
+
+	for (state=worker->states; state!=(POOL_STATE*)NULL && state->template!=template; state=state->next);
+
+	if (state==(POOL_STATE*)NULL) {
+		state = (POOL_STATE*)_calloc(1,sizeof(POOL_STATE));
+		state->template = template;
+		state->state = mht_state_new();
+		state->next = worker->states;
+		worker->states = state;
+
+		prev = mht_state_switch(state->state);
+		if (worker->pool->setup!=NULL) {
+			worker->pool->setup();
+		}
+		mht_state_switch(prev);
+	}
+
+	if (state->version!=snapshot->version) {
+		mht_state_share(state->state,snapshot->state);
+		state->version = snapshot->version;
+	}
+
+	return (state->state);
+}
+
+
+/*
+	Read the prologue of the pool and a template into a new snapshot.
+	Returns the MHT error, the snapshot holds the state of the failed
+	load then.
+*/
+int pool_load( MHT_POOL *pool, char *fname, POOL_SNAPSHOT **snapshot ) {
+	struct MHT_INFO_S *prev = (struct MHT_INFO_S*)NULL;
+	MHT_SINK *sink = (MHT_SINK*)NULL;
+	int mht_err = 0;
+
+
+	(*snapshot) = (POOL_SNAPSHOT*)_calloc(1,sizeof(POOL_SNAPSHOT));
+	(*snapshot)->state = mht_state_new();
+	(*snapshot)->version = ++pool->version;
+
+	prev = mht_state_switch((*snapshot)->state);
+
+	/* The text of the prologue is dropped, only its macros and blocks are kept */
+	if (pool->prologue!=(char*)NULL) {
+		sink = sink_mem_new();
+		mht_set_sink(sink);
+		mht_err = mht_quickopen(stdout,pool->prologue);
+		mht_set_sink((MHT_SINK*)NULL);
+		sink_free(sink);
+	}
+
+	if (mht_err==0) {
+		mht_err = mht_load(fname,POOL_PAGE_BLOCK);
+	}
+
+	mht_state_switch(prev);
+
+	/* The state is only read by the threads from now on */
+	if (mht_err==0) {
+		mht_state_share((*snapshot)->state,(struct MHT_INFO_S*)NULL);
+	}
+
+	return (mht_err);
+}
+
+
+/*
+	The stamp of the files read into a state (including the prologue
+	and the #include files), it changes if one of them is modified.
+*/
+unsigned long pool_stamp( struct MHT_INFO_S *state ) {
+	struct MHT_INFO_S *prev = mht_state_switch(state);
+	struct stat st;
+	unsigned long stamp = 0;
+	unsigned int i = 0;
+	char *fname = (char*)NULL;
+
+
+	for (i=0; (fname=mht_get_file(i))!=(char*)NULL; i++) {
+		stamp *= 31;
+		if (stat(fname,&st)==0) {
+			stamp += (unsigned long)st.st_mtime*7+(unsigned long)st.st_size;
+		}
+		else {
+			stamp += 1;
+		}
+	}
+
+	mht_state_switch(prev);
+
+	return (stamp);
+}
+
+
+/*
+	Load the templates whose files were modified into new snapshots,
+	which replace the current ones. A template which cannot be loaded
+	keeps its snapshot until its files are modified again. The load
+	lock is held.
+*/
+void pool_reload( MHT_POOL *pool ) {
+	POOL_TEMPLATE *template = (POOL_TEMPLATE*)NULL;
+	POOL_SNAPSHOT
+		*snapshot = (POOL_SNAPSHOT*)NULL,
+		*old = (POOL_SNAPSHOT*)NULL;
+
+	unsigned long stamp = 0;
+
+
+	for (template=pool->templates; template!=(POOL_TEMPLATE*)NULL; template=template->next) {
+		if ((stamp=pool_stamp(template->snapshot->state))==template->stamp) {
+			continue;
+		}
+
+		if (pool_load(pool,template->fname,&snapshot)!=0) {
+			pool_free_snapshot(snapshot);
+			template->stamp = stamp;
+			continue;
+		}
+
+		/* The renders in progress keep the old snapshot */
+		old = template->snapshot;
+		POOL_STORE(template->snapshot,snapshot);
+		template->stamp = pool_stamp(snapshot->state);
+		pool_retire(pool,old);
+	}
+
+	pool_reclaim(pool,0);
+}
+
+
+/*
+	The loop of the reload thread (MHT_POOL_RELOAD).
+*/
+void *pool_reload_thread( void *arg ) {
+	MHT_POOL *pool = (MHT_POOL*)arg;
+	struct timespec until;
+
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->stop==0) {
+		until.tv_sec = time((time_t*)NULL)+POOL_RELOAD_SECS;
+		until.tv_nsec = 0;
+		if (pthread_cond_timedwait(&pool->tick,&pool->lock,&until)!=ETIMEDOUT || pool->stop!=0) {
+			continue;
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+		mht_pool_reload(pool);
+		pthread_mutex_lock(&pool->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return (NULL);
+}
+
+
+/*
+	Retire a replaced snapshot with a new epoch. A job which started
+	in an earlier epoch may still read it, a later one cannot.
+*/
+void pool_retire( MHT_POOL *pool, POOL_SNAPSHOT *snapshot ) {
+	snapshot->retired = POOL_INC(pool->epoch);
+	snapshot->next = pool->retired;
+	pool->retired = snapshot;
+}
+
+
+/*
+	Free the retired snapshots no job reads anymore, or all of them if
+	all is 1 (no thread is left). The load lock is held.
+*/
+void pool_reclaim( MHT_POOL *pool, int all ) {
+	POOL_SNAPSHOT
+		*snapshot = (POOL_SNAPSHOT*)NULL,
+		**prev = (POOL_SNAPSHOT**)NULL;
+
+	unsigned long
+		oldest = ~0UL,
+		epoch = 0;
+
+	unsigned int i = 0;
+
+
+	/* The oldest epoch a job in progress started in */
+	for (i=0; all==0 && i<pool->thread_count; i++) {
+		if ((epoch=POOL_LOAD(pool->workers[i].epoch))!=0 && epoch<oldest) {
+			oldest = epoch;
+		}
+	}
+
+	for (prev=&pool->retired; (snapshot=*prev)!=(POOL_SNAPSHOT*)NULL; ) {
+		if (snapshot->retired<=oldest) {
+			*prev = snapshot->next;
+			pool_free_snapshot(snapshot);
+		}
+		else {
+			prev = &snapshot->next;
+		}
+	}
+}
+
+
+/*
+	Free a snapshot, no render may read it anymore.
+*/
+void pool_free_snapshot( POOL_SNAPSHOT *snapshot ) {
+	mht_state_free(snapshot->state);
+	free(snapshot);
+}
+
+
+/*
+	Free a job, its sink belongs to the application.
+*/
+void pool_free_job( POOL_JOB *job ) {
+	int i = 0;
+
+	for (i=0; i<job->arg_count; i++) {
+		free(job->args[i]);
+	}
+	free(job->args);
+	free(job->fname);
+	free(job);
+}
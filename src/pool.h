@@ -0,0 +1,43 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/*
+	A pool of threads rendering MHT templates for an application. A
+	template is read once by mht_load, after the prologue of the pool
+	(if not NULL), into a snapshot: its macros and blocks are shared
+	read-only by all threads. Each thread has a state of its own for a
+	template (macros, settings, fragment cache), as after mht_init and
+	setup (if not NULL), which is called on the thread. A render has a
+	request scope (see mht_scope_begin), the macros it defines or
+	undefines are dropped afterwards. Each thread has a queue of its
+	own, an idle thread steals the jobs of the others.
+
+	mht_pool_submit renders the block block_name of the template fname
+	(the lines outside the blocks if NULL) with the parameters params to
+	sink, or to stdout if sink is NULL. The sink is neither finished nor
+	freed. done is called on the thread of the render with its MHT
+	error, 0 if none; the state of the render is still the current one
+	then (e.g. for the macro mht_err_msg). Returns 1 if the job was
+	queued, 0 otherwise.
+
+	mht_pool_reload reads the templates again whose files (including the
+	prologue and the #include files) were modified, the new snapshots
+	replace the old ones for the renders started afterwards. The renders
+	read the snapshots without locks, so they never wait for a reload.
+	With MHT_POOL_RELOAD, the files are checked once a second.
+
+	mht_pool_wait returns when all jobs submitted so far are done, it
+	must not be called by a thread of the pool. The variables of cgi.h
+	are not available in the threads of a pool.
+*/
+typedef struct MHT_POOL_S MHT_POOL;
+
+#define MHT_POOL_PIN		1		/* Pin each thread to a CPU */
+#define MHT_POOL_RELOAD		2		/* Reload modified templates, see mht_pool_reload */
+
+
+/* Prototypes: */
+MHT_POOL *mht_pool_create( int nthreads, unsigned int flags, char *prologue, void (*setup)(void) );
+int mht_pool_submit( MHT_POOL *pool, char *fname, char *block_name, char **params, int param_count, struct MHT_SINK_S *sink, void (*done)( int mht_err, void *user_data ), void *user_data );
+void mht_pool_reload( MHT_POOL *pool );
+void mht_pool_wait( MHT_POOL *pool );
+void mht_pool_free( MHT_POOL *pool );
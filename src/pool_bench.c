@@ -0,0 +1,130 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "mht.h"
+#include "sink.h"
+#include "pool.h"
+#include "mem.h"
+
+
+/*
+	The renders per second of a small page on a pool of 1, 2 and 4
+	threads and of one per CPU, against the page rendered by
+	mht_quickopen on the main thread, see "make bench". The output goes
+	to /dev/null. The threads only scale on as many CPUs as there are.
+
+		pool_bench [renders]
+*/
+
+
+char *bench_page =
+	"#def title Pool\n"
+	"#begin item\n"
+	"<li><#item.%1> is <#ifequal|<#item.%1>|two|TWO|other> <#upper|<#item.%2>></li>\n"
+	"#end item\n"
+	"<html><head><title><#title></title></head><body>\n"
+	"#loop item|i|1|10\n"
+	"#process item|one|a\n"
+	"#process item|two|b\n"
+	"</body></html>\n";
+
+
+double bench_now(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv,(struct timezone*)NULL);
+	return (tv.tv_sec+tv.tv_usec/1e6);
+}
+
+
+/*
+	Render the page renders times on a pool of nthreads threads.
+	Returns the renders per second.
+*/
+double bench_pool( char *fname, FILE *null, int nthreads, unsigned int renders ) {
+	MHT_POOL *pool = mht_pool_create(nthreads,0,(char*)NULL,NULL);
+	MHT_SINK *sink = sink_file_new(null);
+	double start = 0;
+	unsigned int i = 0;
+
+
+	/* The template is loaded by the first render */
+	mht_pool_submit(pool,fname,(char*)NULL,(char**)NULL,0,sink,NULL,NULL);
+	mht_pool_wait(pool);
+
+	start = bench_now();
+	for (i=0; i<renders; i++) {
+		mht_pool_submit(pool,fname,(char*)NULL,(char**)NULL,0,sink,NULL,NULL);
+	}
+	mht_pool_wait(pool);
+	start = bench_now()-start;
+
+	mht_pool_free(pool);
+	sink_free(sink);
+
+	return (renders/start);
+}
+
+
+int main( int argc, char **argv ) {
+	FILE
+		*fptr = (FILE*)NULL,
+		*null = fopen("/dev/null","w");
+
+	MHT_SINK *sink = (MHT_SINK*)NULL;
+	char fname[64];
+	int threads[] = { 1, 2, 4, 0 };
+	unsigned int
+		renders = (argc>1) ? (unsigned int)atoi(argv[1]) : 20000,
+		i = 0;
+
+	double start = 0;
+
+
+	sprintf(fname,"/tmp/pool_bench.%ld.mht",(long)getpid());
+	if (null==(FILE*)NULL || (fptr=fopen(fname,"w"))==(FILE*)NULL) {
+		return (1);
+	}
+	fputs(bench_page,fptr);
+	fclose(fptr);
+
+	threads[3] = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (renders==0) {
+		renders = 1;
+	}
+
+	mht_init();
+
+	printf("%u renders of a small page, %d CPU(s)\n",renders,threads[3]);
+
+	/* Read and rendered each time */
+	sink = sink_file_new(null);
+	mht_set_sink(sink);
+	start = bench_now();
+	for (i=0; i<renders/10; i++) {
+		mht_quickopen(stdout,fname);
+	}
+	start = bench_now()-start;
+	mht_set_sink((MHT_SINK*)NULL);
+	sink_free(sink);
+	printf("  mht_quickopen      %8.0f renders/s\n",(renders/10)/start);
+
+	for (i=0; i<sizeof(threads)/sizeof(int); i++) {
+		printf("  pool, %2d thread(s) %8.0f renders/s\n",threads[i],bench_pool(fname,null,threads[i],renders));
+	}
+
+	mht_exit();
+	fclose(null);
+	remove(fname);
+
+	return (0);
+}
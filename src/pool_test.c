@@ -0,0 +1,417 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <pthread.h>
+
+#include "mht.h"
+#include "sink.h"
+#include "pool.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the render pool: many jobs on a few threads have to
+	give the output of each render alone.
+*/
+
+
+#define JOBS		600
+
+typedef struct {
+	MHT_SINK *sink;
+	int mht_err;
+	char err_msg[256];
+} JOB;
+
+pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+int done_count = 0;
+
+
+/*
+	Called on the thread of a render, the state of the render is the
+	current one.
+*/
+void done( int mht_err, void *user_data ) {
+	JOB *job = (JOB*)user_data;
+	char *msg = (char*)NULL;
+
+	job->mht_err = mht_err;
+	if (mht_err!=0 && mht_search_macro("mht_err_msg",&msg)!=0) {
+		strncpy(job->err_msg,msg,sizeof(job->err_msg)-1);
+	}
+
+	pthread_mutex_lock(&done_lock);
+	done_count++;
+	pthread_mutex_unlock(&done_lock);
+}
+
+
+/*
+	Write a file of the test with a new modification time, so a reload
+	sees the change.
+*/
+char *rewrite( char *name, char *content ) {
+	static time_t mtime = 0;
+	struct utimbuf times;
+	char *path = test_file(name,content,0);
+
+	if (mtime==0) {
+		mtime = time((time_t*)NULL);
+	}
+	times.actime = times.modtime = ++mtime;
+	utime(path,&times);
+
+	return (path);
+}
+
+
+/*
+	The output of a job, "" if none.
+*/
+char *output( JOB *job ) {
+	size_t len = 0;
+	char *buf = sink_mem_get(job->sink,&len);
+
+	return ((buf!=(char*)NULL) ? buf : "");
+}
+
+
+void test_renders(void) {
+	MHT_POOL *pool = mht_pool_create(4,0,test_file("title.mht","#def title Pool\n",0),NULL);
+	JOB *jobs = (JOB*)_calloc(JOBS,sizeof(JOB));
+	char
+		*fname = test_file("page.mht",
+			"#begin item\n"
+			"<li><#item.%1> <#upper|<#item.%2>></li>\n"
+			"#end item\n"
+			"#begin page\n"
+			"<h1><#title></h1>\n"
+			"#process item|one|a\n"
+			"#if <#page.%1> == x\n"
+			"X\n"
+			"#else\n"
+			"not x: <#page.%1>\n"
+			"#endif\n"
+			"#end page\n"
+			"top\n"
+			"#process page|x\n",0),
+		*params[2][1] = { { "x" }, { "y" } },
+		*expected[3] = {
+			"top\n<h1>Pool</h1>\n<li>one A</li>\nX\n",
+			"<h1>Pool</h1>\n<li>one A</li>\nX\n",
+			"<h1>Pool</h1>\n<li>one A</li>\nnot x: y\n" },
+		name[64];
+
+	int
+		i = 0,
+		bad[3] = { 0, 0, 0 };
+
+
+	done_count = 0;
+	for (i=0; i<JOBS; i++) {
+		jobs[i].sink = sink_mem_new();
+		if (i%3==0) {
+			mht_pool_submit(pool,fname,(char*)NULL,(char**)NULL,0,jobs[i].sink,done,&jobs[i]);
+		}
+		else {
+			mht_pool_submit(pool,fname,"page",params[i%3-1],1,jobs[i].sink,done,&jobs[i]);
+		}
+	}
+	mht_pool_wait(pool);
+
+	test_check("all jobs done",done_count==JOBS);
+	for (i=0; i<3; i++) {
+		sprintf(name,"render %d",i);
+		test_equal(name,output(&jobs[i]),expected[i]);
+	}
+	for (i=0; i<JOBS; i++) {
+		if (jobs[i].mht_err!=0 || strcmp(output(&jobs[i]),expected[i%3])!=0) {
+			bad[i%3]++;
+		}
+		sink_free(jobs[i].sink);
+	}
+	test_check("renders of the template",bad[0]==0);
+	test_check("renders of a block",bad[1]==0);
+	test_check("renders of a block with other parameters",bad[2]==0);
+
+	free(jobs);
+	mht_pool_free(pool);
+}
+
+
+void test_scope(void) {
+	MHT_POOL *pool = mht_pool_create(1,0,(char*)NULL,NULL);
+	JOB jobs[2];
+	char *fname = test_file("scope.mht","v=<#v>\n#def v set\n",0);
+	int i = 0;
+
+
+	/* The macros a render defines are gone with it */
+	for (i=0; i<2; i++) {
+		memset(&jobs[i],0,sizeof(JOB));
+		jobs[i].sink = sink_mem_new();
+		mht_pool_submit(pool,fname,(char*)NULL,(char**)NULL,0,jobs[i].sink,done,&jobs[i]);
+	}
+	mht_pool_wait(pool);
+
+	test_equal("first render",output(&jobs[0]),"v=<#v>\n");
+	test_equal("next render on the thread",output(&jobs[1]),"v=<#v>\n");
+
+	for (i=0; i<2; i++) {
+		sink_free(jobs[i].sink);
+	}
+	mht_pool_free(pool);
+}
+
+
+void test_errors(void) {
+	MHT_POOL *pool = mht_pool_create(2,0,(char*)NULL,NULL);
+	JOB jobs[2];
+	char *fname = test_file("broken.mht","#end a\n",0);
+	int i = 0;
+
+
+	for (i=0; i<2; i++) {
+		memset(&jobs[i],0,sizeof(JOB));
+		jobs[i].sink = sink_mem_new();
+	}
+	mht_pool_submit(pool,test_path("none.mht"),(char*)NULL,(char**)NULL,0,jobs[0].sink,done,&jobs[0]);
+	mht_pool_submit(pool,fname,(char*)NULL,(char**)NULL,0,jobs[1].sink,done,&jobs[1]);
+	mht_pool_wait(pool);
+
+	test_check("missing template",jobs[0].mht_err!=0);
+	test_check("broken template",jobs[1].mht_err!=0 && jobs[1].err_msg[0]!='\0');
+
+	for (i=0; i<2; i++) {
+		sink_free(jobs[i].sink);
+	}
+	mht_pool_free(pool);
+}
+
+
+/*
+	Render a template of the pool once. Returns the output, to be freed.
+*/
+char *render( MHT_POOL *pool, char *fname ) {
+	JOB job;
+	char *str = (char*)NULL;
+
+	memset(&job,0,sizeof(JOB));
+	job.sink = sink_mem_new();
+	mht_pool_submit(pool,fname,(char*)NULL,(char**)NULL,0,job.sink,done,&job);
+	mht_pool_wait(pool);
+
+	str = strdup(output(&job));
+	sink_free(job.sink);
+
+	return (str);
+}
+
+
+void test_reload(void) {
+	MHT_POOL *pool = (MHT_POOL*)NULL;
+	char
+		*prologue = rewrite("prologue.mht","#def site 1\n"),
+		*fname = rewrite("reload.mht","page 1 site <#site>\n"),
+		*str = (char*)NULL;
+
+
+	pool = mht_pool_create(2,0,prologue,NULL);
+
+	str = render(pool,fname);
+	test_equal("before the reload",str,"page 1 site 1\n");
+	free(str);
+
+	rewrite("reload.mht","page 2 site <#site>\n");
+	str = render(pool,fname);
+	test_equal("no reload without mht_pool_reload",str,"page 1 site 1\n");
+	free(str);
+
+	mht_pool_reload(pool);
+	str = render(pool,fname);
+	test_equal("template reloaded",str,"page 2 site 1\n");
+	free(str);
+
+	rewrite("prologue.mht","#def site 2\n");
+	mht_pool_reload(pool);
+	str = render(pool,fname);
+	test_equal("prologue reloaded",str,"page 2 site 2\n");
+	free(str);
+
+	/* A broken template keeps the last snapshot */
+	rewrite("reload.mht","#end a\n");
+	mht_pool_reload(pool);
+	str = render(pool,fname);
+	test_equal("broken template not reloaded",str,"page 2 site 2\n");
+	free(str);
+
+	mht_pool_free(pool);
+}
+
+
+/*
+	The renders of test_live_reload: each job submits the next one when
+	it is done, until live_stop is set.
+*/
+MHT_POOL *live_pool = (MHT_POOL*)NULL;
+char *live_fname = (char*)NULL;
+int
+	live_stop = 0,
+	live_version = -1,
+	live_renders = 0,
+	live_bad = 0;
+
+
+void live_done( int mht_err, void *user_data ) {
+	MHT_SINK *sink = (MHT_SINK*)user_data;
+	size_t len = 0;
+	char *buf = sink_mem_get(sink,&len);
+	int
+		v1 = -1,
+		v2 = -2,
+		v3 = -3,
+		stop = 0;
+
+
+	/* A render sees one version of the template and the prologue */
+	if (mht_err!=0 || buf==(char*)NULL || sscanf(buf,"head %d site %d\nfoot %d\n",&v1,&v2,&v3)!=3 || v1!=v2 || v1!=v3) {
+		v1 = -1;
+	}
+	sink_free(sink);
+
+	pthread_mutex_lock(&done_lock);
+	if (v1<0) {
+		live_bad++;
+	}
+	else if (v1>live_version) {
+		live_version = v1;
+	}
+	live_renders++;
+	stop = live_stop;
+	pthread_mutex_unlock(&done_lock);
+
+	if (stop==0) {
+		sink = sink_mem_new();
+		mht_pool_submit(live_pool,live_fname,(char*)NULL,(char**)NULL,0,sink,live_done,sink);
+	}
+}
+
+
+/*
+	Write a version of the template and its prologue.
+*/
+void live_write( char *prologue, char *fname, int version ) {
+	char content[128];
+
+	sprintf(content,"#def site %d\n#begin foot\nfoot %d\n#end foot\n",version,version);
+	rewrite(prologue,content);
+	sprintf(content,"head %d site <#site>\n#process foot\n",version);
+	rewrite(fname,content);
+}
+
+
+/*
+	Wait until a render showed the version, at most seconds long.
+	Returns 1 if it did.
+*/
+int live_wait( int version, int seconds ) {
+	int
+		i = 0,
+		seen = 0;
+
+	for (i=0; i<seconds*100 && seen==0; i++) {
+		pthread_mutex_lock(&done_lock);
+		seen = (live_version>=version) ? 1 : 0;
+		pthread_mutex_unlock(&done_lock);
+
+		if (seen==0) {
+			usleep(10000);
+		}
+	}
+
+	return (seen);
+}
+
+
+void test_live_reload(void) {
+	MHT_SINK *sink = (MHT_SINK*)NULL;
+	char *str = (char*)NULL;
+	int
+		i = 0,
+		v = 0,
+		seen = 1;
+
+
+	live_write("live_prologue.mht","live.mht",0);
+	live_fname = test_path("live.mht");
+	live_pool = mht_pool_create(4,0,test_path("live_prologue.mht"),NULL);
+
+	/* The templates change while the threads render them */
+	for (i=0; i<16; i++) {
+		sink = sink_mem_new();
+		mht_pool_submit(live_pool,live_fname,(char*)NULL,(char**)NULL,0,sink,live_done,sink);
+	}
+	seen = live_wait(0,5);
+
+	for (v=1; v<=5 && seen==1; v++) {
+		live_write("live_prologue.mht","live.mht",v);
+		mht_pool_reload(live_pool);
+		seen = live_wait(v,5);
+	}
+
+	pthread_mutex_lock(&done_lock);
+	live_stop = 1;
+	pthread_mutex_unlock(&done_lock);
+	mht_pool_wait(live_pool);
+	mht_pool_free(live_pool);
+
+	test_check("each reload seen by the renders",seen==1 && live_version==5);
+	test_check("renders of one version each",live_renders>0 && live_bad==0);
+
+	/* MHT_POOL_RELOAD checks the files by itself */
+	live_pool = mht_pool_create(2,MHT_POOL_RELOAD,test_path("live_prologue.mht"),NULL);
+
+	str = render(live_pool,live_fname);
+	test_equal("before the change",str,"head 5 site 5\nfoot 5\n");
+	free(str);
+
+	live_write("live_prologue.mht","live.mht",6);
+	for (i=0; i<50; i++) {
+		str = render(live_pool,live_fname);
+		if (strcmp(str,"head 6 site 6\nfoot 6\n")==0) {
+			break;
+		}
+		free(str);
+		str = (char*)NULL;
+		usleep(100000);
+	}
+	test_check("reloaded without mht_pool_reload",str!=(char*)NULL);
+	free(str);
+
+	mht_pool_free(live_pool);
+}
+
+
+int main( int argc, char **argv ) {
+	mht_init();
+
+	test_renders();
+	test_scope();
+	test_errors();
+	test_reload();
+	test_live_reload();
+
+	mht_exit();
+
+	return (test_result("pool_test"));
+}
@@ -0,0 +1,289 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "mht.h"
+#include "sink.h"
+#include "render.h"
+#include "csv.h"
+#include "json.h"
+#include "mem.h"
+
+
+/* Definitions: */
+/*
+	The stack of a render, the pages are used when needed. The deepest
+	render MHT allows (128 nested #include, 64 nested blocks and 64
+	nested macros) takes about 4.5 MB. The lowest page is a guard page,
+	so an overflow crashes instead of overwriting the heap.
+*/
+#define MHT_RENDER_STACK	(8*1024*1024)
+
+
+/* Data structures: */
+
+/*
+	A render runs on a stack of its own and switches back to the
+	caller when the buffer of mht_render_next is full. The state, and
+	the tables and documents it opened, are switched with it.
+*/
+struct MHT_RENDER_S {
+	struct MHT_INFO_S *state;
+	CSV_TABLE *tables;	/* The tables opened by #table */
+	JSON_DOC *docs;		/* The documents opened by #jsonsource */
+	char *fname;
+	MHT_SINK *sink;
+	ucontext_t ctx;
+	ucontext_t caller;	/* The context of mht_render_next */
+	char *stack;
+	char *buf;			/* The buffer of mht_render_next */
+	size_t cap;
+	size_t len;
+	char *spill;		/* The output of a chunk that didn't fit into buf */
+	size_t spill_len;
+	size_t spill_pos;
+	size_t spill_size;
+	int running;		/* 1 while the render runs, its output is dropped otherwise (e.g. when it ends) */
+	int started;
+	int done;
+	int error;
+};
+
+
+/* Prototypes: */
+void mht_render_run(void);
+char *mht_render_stack_new(void);
+void mht_render_stack_free( char *stack );
+void mht_render_resume( MHT_RENDER *render );
+int mht_render_push( MHT_SINK *sink, char *ptr, size_t len );
+
+
+/* The render started by mht_render_next, see mht_render_run */
+MHT_THREAD MHT_RENDER *mht_render_current = (MHT_RENDER*)NULL;
+
+
+/*
+	Create a render for a MHT file, nothing is read before the first
+	call of mht_render_next. Returns NULL on errors.
+*/
+MHT_RENDER *mht_render_begin( char *fname ) {
+	MHT_RENDER *render = (MHT_RENDER*)_calloc(1,sizeof(MHT_RENDER));
+	struct MHT_INFO_S *prev = (struct MHT_INFO_S*)NULL;
+
+
+	if ((render->stack=mht_render_stack_new())==(char*)NULL || getcontext(&render->ctx)!=0) {
+		mht_render_stack_free(render->stack);
+		free(render);
+		return ((MHT_RENDER*)NULL);
+	}
+
+	render->ctx.uc_stack.ss_sp = render->stack+sysconf(_SC_PAGESIZE);
+	render->ctx.uc_stack.ss_size = MHT_RENDER_STACK-sysconf(_SC_PAGESIZE);
+	render->ctx.uc_link = &render->caller;
+	makecontext(&render->ctx,mht_render_run,0);
+
+	render->fname = strdup(fname);
+	render->sink = sink_new(mht_render_push,NULL,NULL,NULL,(void*)render,(MHT_SINK*)NULL);
+
+	render->state = mht_state_new();
+	prev = mht_state_switch(render->state);
+	mht_set_sink(render->sink);
+	mht_state_switch(prev);
+
+	return (render);
+}
+
+
+/*
+	Allocate the stack of a render, its lowest page is made inaccessible.
+	Returns NULL on errors.
+*/
+char *mht_render_stack_new(void) {
+	void *stack = (void*)NULL;
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (posix_memalign(&stack,(size_t)page,MHT_RENDER_STACK)!=0) {
+		return ((char*)NULL);
+	}
+
+	if (mprotect(stack,(size_t)page,PROT_NONE)!=0) {
+		free(stack);
+		return ((char*)NULL);
+	}
+
+	return ((char*)stack);
+}
+
+
+void mht_render_stack_free( char *stack ) {
+	if (stack!=(char*)NULL) {
+		mprotect(stack,(size_t)sysconf(_SC_PAGESIZE),PROT_READ|PROT_WRITE);
+		free(stack);
+	}
+}
+
+
+/*
+	Register a macro in the state of a render, e.g. a CGI variable.
+*/
+int mht_render_define( MHT_RENDER *render, char *name, char *definition ) {
+	struct MHT_INFO_S *prev = mht_state_switch(render->state);
+	int result = mht_register_macro(name,definition);
+
+	mht_state_switch(prev);
+
+	return (result);
+}
+
+
+size_t mht_render_next( MHT_RENDER *render, char *buf, size_t cap ) {
+	size_t len = 0;
+
+
+	/* The output left over from the last call comes first */
+	if (render->spill_pos<render->spill_len) {
+		len = render->spill_len-render->spill_pos;
+		len = (len<cap) ? len : cap;
+
+		memcpy(buf,render->spill+render->spill_pos,len);
+		render->spill_pos += len;
+
+		if (render->spill_pos==render->spill_len) {
+			render->spill_pos = 0;
+			render->spill_len = 0;
+		}
+	}
+
+	if (len==cap || render->done==1) {
+		return (len);
+	}
+
+	render->buf = buf;
+	render->cap = cap;
+	render->len = len;
+
+	render->running = 1;
+	render->started = 1;
+	mht_render_resume(render);
+	render->running = 0;
+
+	return (render->len);
+}
+
+
+/*
+	Free a render. A render ended before its output was read to the
+	end runs to its end first, without output, so that its unfinished
+	calls close the MHT file and free what they hold.
+*/
+int mht_render_end( MHT_RENDER *render ) {
+	CSV_TABLE *tables = (CSV_TABLE*)NULL;
+	JSON_DOC *docs = (JSON_DOC*)NULL;
+	int error = 0;
+
+
+	if (render->started==1 && render->done==0) {
+		mht_render_resume(render);
+	}
+	error = render->error;
+
+	tables = csv_switch(render->tables);
+	csv_close_all();
+	csv_switch(tables);
+
+	docs = json_switch(render->docs);
+	json_close_all();
+	json_switch(docs);
+
+	mht_state_free(render->state);
+	sink_free(render->sink);
+
+	free(render->spill);
+	mht_render_stack_free(render->stack);
+	free(render->fname);
+	free(render);
+
+	return (error);
+}
+
+
+/*
+	Switch to a render until it waits for the caller again, or ends.
+	The state, the tables and the documents of the thread are the
+	ones of the render meanwhile.
+*/
+void mht_render_resume( MHT_RENDER *render ) {
+	struct MHT_INFO_S *prev = mht_state_switch(render->state);
+	CSV_TABLE *tables = csv_switch(render->tables);
+	JSON_DOC *docs = json_switch(render->docs);
+
+
+	mht_render_current = render;
+	swapcontext(&render->caller,&render->ctx);
+	mht_render_current = (MHT_RENDER*)NULL;
+
+	render->tables = csv_switch(tables);
+	render->docs = json_switch(docs);
+	mht_state_switch(prev);
+}
+
+
+/*
+	The start of a render on its own stack, when it returns the
+	context switches back to mht_render_next (uc_link).
+*/
+void mht_render_run(void) {
+	MHT_RENDER *render = mht_render_current;
+
+	render->error = mht_quickopen(stdout,render->fname);
+	render->done = 1;
+}
+
+
+/*
+	The sink of a render: the output goes to the buffer of
+	mht_render_next, the rest of a chunk is kept for the next call.
+	Each chunk is copied before switching back to the caller, the
+	chunk may be in a buffer that another render uses meanwhile.
+*/
+int mht_render_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	MHT_RENDER *render = (MHT_RENDER*)sink->data;
+	size_t n = 0;
+
+
+	if (render->running==0) {
+		return (1);
+	}
+
+	n = render->cap-render->len;
+	n = (len<n) ? len : n;
+
+	memcpy(render->buf+render->len,ptr,n);
+	render->len += n;
+
+	if (n<len) {
+		if (render->spill_len+len-n>render->spill_size) {
+			render->spill_size = render->spill_len+len-n+4096;
+			render->spill = (char*)_realloc(render->spill,render->spill_size);
+		}
+
+		memcpy(render->spill+render->spill_len,ptr+n,len-n);
+		render->spill_len += len-n;
+	}
+
+	if (render->len==render->cap) {
+		swapcontext(&render->ctx,&render->caller);
+	}
+
+	return (1);
+}
@@ -0,0 +1,23 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/*
+	A render processes a MHT file piece by piece: mht_render_next writes
+	the next piece of the output to buf (at most cap bytes) and returns
+	its length, 0 at the end of the output. Between two calls the render
+	waits where it stopped, so a server can interleave many renders on
+	one thread, e.g. if the socket of a client is full.
+
+	Each render has a state of its own, as after mht_init, and its own
+	tables and documents (#table, #jsonsource). Renders must not be
+	nested (no mht_render_next inside a render). mht_render_end frees a
+	render and returns its MHT error, 0 if none. A render not read to
+	the end runs to its end then, without output.
+*/
+typedef struct MHT_RENDER_S MHT_RENDER;
+
+
+/* Prototypes: */
+MHT_RENDER *mht_render_begin( char *fname );
+int mht_render_define( MHT_RENDER *render, char *name, char *definition );
+size_t mht_render_next( MHT_RENDER *render, char *buf, size_t cap );
+int mht_render_end( MHT_RENDER *render );
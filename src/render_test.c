@@ -0,0 +1,201 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mht.h"
+#include "render.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the pull renderer: renders read in small pieces, alone
+	and interleaved, have to give the output of a render read at once.
+*/
+
+
+/*
+	A template reading a JSON document of its own under the name
+	every template uses.
+*/
+char *page( char *name, char *value ) {
+	char
+		json_name[64],
+		fname[64],
+		content[1024],
+		*json = (char*)NULL;
+
+	sprintf(json_name,"%s.json",name);
+	sprintf(content,"{\"v\": \"%s\"}",value);
+	json = test_file(json_name,content,0);
+
+	sprintf(content,
+		"#jsonsource doc %s\n"
+		"#def v %s\n"
+		"#begin row\n"
+		"<p>  <#v>  <#n>  <#json|doc|v>  </p>\n"
+		"#end row\n"
+		"#loop row|n|1|20\n"
+		"#write <b>  <#v>  <#v>  <#v>  </b>\n",json,value);
+
+	sprintf(fname,"%s.mht",name);
+	return (test_file(fname,content,0));
+}
+
+
+/*
+	Read a render to the end in pieces of cap bytes. Returns the
+	output, to be freed.
+*/
+char *read_all( MHT_RENDER *render, size_t cap ) {
+	char *output = (char*)_malloc(65536);
+	size_t
+		len = 0,
+		n = 0;
+
+	while ((n=mht_render_next(render,output+len,cap))>0) {
+		len += n;
+	}
+	output[len] = '\0';
+
+	return (output);
+}
+
+
+void test_interleaved(void) {
+	MHT_RENDER *renders[2];
+	char
+		*fnames[2],
+		*expected[2],
+		*output[2],
+		name[64];
+
+	size_t
+		len[2],
+		n = 0;
+
+	int
+		i = 0,
+		running = 2;
+
+
+	fnames[0] = page("a","alpha");
+	fnames[1] = page("b","beta-beta-beta");
+
+	for (i=0; i<2; i++) {
+		renders[i] = mht_render_begin(fnames[i]);
+		expected[i] = read_all(renders[i],65536);
+		test_check("render ends without errors",mht_render_end(renders[i])==0);
+
+		renders[i] = mht_render_begin(fnames[i]);
+		output[i] = (char*)_malloc(65536);
+		len[i] = 0;
+	}
+	test_contains("output",expected[0],"<p>  alpha  3  alpha  </p>");
+
+	/* Round robin in pieces of 3 bytes */
+	while (running>0) {
+		for (i=0; i<2; i++) {
+			if (renders[i]==(MHT_RENDER*)NULL) {
+				continue;
+			}
+			if ((n=mht_render_next(renders[i],output[i]+len[i],3))>0) {
+				len[i] += n;
+				continue;
+			}
+
+			output[i][len[i]] = '\0';
+			mht_render_end(renders[i]);
+			renders[i] = (MHT_RENDER*)NULL;
+			running--;
+		}
+	}
+
+	for (i=0; i<2; i++) {
+		sprintf(name,"interleaved render %d",i);
+		test_equal(name,output[i],expected[i]);
+		free(output[i]);
+		free(expected[i]);
+	}
+}
+
+
+/*
+	Returns the lowest free file descriptor.
+*/
+int free_fd(void) {
+	int fd = open("/dev/null",O_RDONLY);
+
+	close(fd);
+	return (fd);
+}
+
+
+void test_end(void) {
+	MHT_RENDER *render = (MHT_RENDER*)NULL;
+	char
+		*fname = page("c","gamma"),
+		buf[16];
+
+	int
+		fd = free_fd(),
+		i = 0;
+
+
+	/* Ended in the middle, the files of the render are closed */
+	for (i=0; i<10; i++) {
+		render = mht_render_begin(fname);
+		mht_render_next(render,buf,sizeof(buf));
+		mht_render_end(render);
+	}
+	test_check("unfinished renders close their files",free_fd()==fd);
+
+	/* Ended before the first piece */
+	render = mht_render_begin(fname);
+	test_check("render never started",mht_render_end(render)==0);
+
+	render = mht_render_begin(test_path("none.mht"));
+	mht_render_next(render,buf,sizeof(buf));
+	test_check("render of a missing file",mht_render_end(render)!=0);
+}
+
+
+/*
+	Blocks and macros which refer to themselves end at the nesting
+	limits, within the stack of the render.
+*/
+void test_deep(void) {
+	MHT_RENDER *render = (MHT_RENDER*)NULL;
+	char *output = (char*)NULL;
+
+	render = mht_render_begin(test_file("deep.mht","#begin b\n<#x>\n#loop b|n|1|1\n#end b\n#process b\n",0));
+	output = read_all(render,100);
+	test_check("blocks nested too deep",mht_render_end(render)!=0);
+	free(output);
+
+	render = mht_render_begin(test_file("self.mht","#def a x<#a>\n<#a>\n",0));
+	output = read_all(render,100);
+	test_check("macro referring to itself",mht_render_end(render)==0 && strstr(output,"xx<#a>\n")!=(char*)NULL);
+	free(output);
+}
+
+
+int main( int argc, char **argv ) {
+	mht_init();
+
+	test_interleaved();
+	test_end();
+	test_deep();
+
+	mht_exit();
+
+	return (test_result("render_test"));
+}
@@ -0,0 +1,1191 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "serve.h"
+#include "mht.h"
+#include "cgi.h"
+#include "sink.h"
+#include "mem.h"
+
+
+/* Definitions: */
+#define SERVE_MAX_HEAD		16384		/* The max. length of the request line and the headers */
+#define SERVE_MAX_BODY		1048576		/* The max. length of a request body */
+#define SERVE_MAX_EVENTS	128
+#define SERVE_MAX_WORKERS	64
+#define SERVE_MAX_CONNS		1024		/* The max. number of connections of a worker */
+#define SERVE_TIMEOUT		15			/* The seconds a connection may be idle */
+#define SERVE_PATH_LEN		1024
+#define SERVE_PAGE_BLOCK	"mht_serve_page"	/* The block of a loaded template, see mht_load */
+#define SERVE_SOFTWARE		"mht2html"
+
+
+/*
+	A template, loaded by the worker when it is requested first. Each
+	template has a state of its own, so the blocks of two templates
+	never clash. The template is loaded again if the file is changed.
+*/
+typedef struct SERVE_PAGE_S {
+	char *fname;
+	struct MHT_INFO_S *state;	/* The blocks of the template, NULL if not loaded */
+	time_t mtime;
+	time_t checked;		/* The second the file was checked for changes */
+	struct SERVE_PAGE_S *next;
+} SERVE_PAGE;
+
+
+/*
+	A connection of a client. The requests are read into in, the
+	responses are collected in out until they are written. The
+	connections of a worker are linked, to close those timed out.
+*/
+typedef struct SERVE_CONN_S {
+	int fd;
+	char *in;
+	size_t in_len;
+	size_t in_size;
+	char *out;
+	size_t out_len;
+	size_t out_pos;
+	size_t out_size;
+	int wait_out;		/* 1 if the connection waits to be writable */
+	int close;			/* 1 if the connection is closed after the responses */
+	char addr[INET6_ADDRSTRLEN];
+	char port[8];
+	time_t active;		/* The second something was last read or written */
+	time_t request_start;	/* The second the first byte of the pending request was read */
+	struct SERVE_CONN_S *prev;
+	struct SERVE_CONN_S *next;
+} SERVE_CONN;
+
+
+/*
+	The server, each worker process has its own copy.
+*/
+typedef struct {
+	char *docroot;
+	char *host;
+	char *port;
+	int listen_fd;
+	int epoll_fd;
+	SERVE_PAGE *pages;
+	SERVE_CONN *conns;
+	int conn_count;
+	int max_conns;
+	int timeout;
+	int accepting;		/* 1 if the listen socket is polled, 0 while max_conns are open */
+	void (*setup)(void);	/* Called for the state of each template */
+	time_t now;
+	char date[40];		/* The Date header of the second now */
+	volatile sig_atomic_t stop;	/* Set by SIGTERM/SIGINT in the master process */
+} SERVE_INFO;
+
+SERVE_INFO serve = { (char*)NULL, (char*)NULL, (char*)NULL, -1, -1, (SERVE_PAGE*)NULL, (SERVE_CONN*)NULL, 0, SERVE_MAX_CONNS, SERVE_TIMEOUT, 0, NULL, 0, "", 0 };
+
+
+/* Prototypes: */
+int serve_listen( char *addr );
+void serve_master( int workers );
+void serve_stop( int sig );
+void serve_worker(void);
+void serve_poll_listen( int on );
+void serve_accept(void);
+void serve_close( SERVE_CONN *conn );
+void serve_timeouts(void);
+void serve_read( SERVE_CONN *conn );
+void serve_input( SERVE_CONN *conn );
+int serve_flush( SERVE_CONN *conn );
+size_t serve_head_len( char *buf, size_t len );
+char *serve_header( char *head, char *name );
+void serve_request( SERVE_CONN *conn, char *head, char *body, size_t body_len );
+int serve_map( char *uri, char *fname, char *script_name );
+SERVE_PAGE *serve_page( char *fname, char **err_msg );
+void serve_render( SERVE_CONN *conn, SERVE_PAGE *page, char *query, char *body, size_t body_len, int head_only );
+void serve_response( SERVE_CONN *conn, char *status, char *headers, size_t header_len, char *body, size_t body_len, int head_only );
+void serve_error( SERVE_CONN *conn, char *status, char *msg );
+void serve_fail( SERVE_CONN *conn, char *fname, char *msg );
+void serve_append( SERVE_CONN *conn, char *str, size_t len );
+void serve_clock(void);
+
+
+/*
+	Serve the templates below docroot on addr ("host:port" or "port")
+	by HTTP/1.1, e.g. "mht2html -serve :8080 /var/www". A request for
+	/a/b.mht (or /a/b) renders docroot/a/b.mht, a directory its
+	index.mht. The macros of a request are the same cgi_init registers
+	for a CGI, and the headers written by a template are sent as for
+	cgi_response_end.
+
+	The templates stay loaded (see mht_load), each request processes
+	a loaded template only. One worker process per CPU (or as set in
+	MHTSERVEWORKERS) runs an epoll loop on the shared listen socket.
+	A worker keeps at most 1024 connections open (MHTSERVECONNS), and
+	closes a connection idle for 15 seconds (MHTSERVETIMEOUT) or one
+	which has not sent a complete request within twice that time. The
+	errors of the templates are written to stderr, the client gets a
+	500 response without the details. setup is called for the state of each template, e.g. to register
+	macros of the environment. Returns 0 if the server cannot start,
+	the workers never return.
+*/
+int serve_run( char *addr, char *docroot, void (*setup)(void) ) {
+	char
+		*workers_env = getenv("MHTSERVEWORKERS"),
+		*value = (char*)NULL;
+
+	long workers = 0;
+	struct sigaction sa;
+
+
+	serve.docroot = docroot;
+	serve.setup = setup;
+
+	if (serve_listen(addr)==0) {
+		fprintf(stdout,"Cannot listen on %s!\n",addr);
+		return (0);
+	}
+
+	workers = (workers_env!=(char*)NULL) ? atol(workers_env) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers<1) {
+		workers = 1;
+	}
+	if (workers>SERVE_MAX_WORKERS) {
+		workers = SERVE_MAX_WORKERS;
+	}
+
+	if ((value=getenv("MHTSERVECONNS"))!=(char*)NULL && atoi(value)>0) {
+		serve.max_conns = atoi(value);
+	}
+	if ((value=getenv("MHTSERVETIMEOUT"))!=(char*)NULL && atoi(value)>0) {
+		serve.timeout = atoi(value);
+	}
+
+	/* A client may close its connection before the response is written */
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE,&sa,(struct sigaction*)NULL);
+
+	fprintf(stdout,"Serving %s on %s with %ld worker(s)\n",docroot,addr,workers);
+	fflush(stdout);
+
+	if (workers==1) {
+		serve_worker();
+	}
+	else {
+		serve_master((int)workers);
+	}
+
+	return (1);
+}
+
+
+/*
+	Open the listen socket, addr is "host:port", ":port" or "port".
+	Returns 1 on success, 0 otherwise.
+*/
+int serve_listen( char *addr ) {
+	struct addrinfo
+		hints,
+		*res = (struct addrinfo*)NULL,
+		*ai = (struct addrinfo*)NULL;
+
+	char *colon = strrchr(addr,':');
+	int
+		fd = -1,
+		on = 1;
+
+
+	if (colon!=(char*)NULL) {
+		serve.host = (char*)_malloc(colon-addr+1);
+		memcpy(serve.host,addr,colon-addr);
+		serve.host[colon-addr] = '\0';
+		serve.port = strdup(colon+1);
+	}
+	else {
+		serve.host = strdup("");
+		serve.port = strdup(addr);
+	}
+
+	memset(&hints,0,sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if (getaddrinfo((*serve.host=='\0') ? (char*)NULL : serve.host,serve.port,&hints,&res)!=0) {
+		return (0);
+	}
+
+	for (ai=res; ai!=(struct addrinfo*)NULL; ai=ai->ai_next) {
+		if ((fd=socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol))<0) {
+			continue;
+		}
+
+		setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+
+		if (bind(fd,ai->ai_addr,ai->ai_addrlen)==0 && listen(fd,SOMAXCONN)==0) {
+			break;
+		}
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (fd<0) {
+		return (0);
+	}
+
+	fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+	serve.listen_fd = fd;
+
+	return (1);
+}
+
+
+/*
+	Start the workers and start them again if they die, until the
+	master process is terminated.
+*/
+void serve_master( int workers ) {
+	pid_t
+		pids[SERVE_MAX_WORKERS],
+		pid = 0;
+
+	int i = 0;
+	struct sigaction sa;
+
+
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler = serve_stop;
+	sigaction(SIGTERM,&sa,(struct sigaction*)NULL);
+	sigaction(SIGINT,&sa,(struct sigaction*)NULL);
+
+	for (i=0; i<workers; i++) {
+		pids[i] = 0;
+	}
+
+	while (serve.stop==0) {
+		for (i=0; i<workers; i++) {
+			if (pids[i]==0) {
+				if ((pids[i]=fork())==0) {
+					sa.sa_handler = SIG_DFL;
+					sigaction(SIGTERM,&sa,(struct sigaction*)NULL);
+					sigaction(SIGINT,&sa,(struct sigaction*)NULL);
+					serve_worker();
+				}
+				else if (pids[i]<0) {
+					pids[i] = 0;
+				}
+			}
+		}
+
+		if ((pid=wait((int*)NULL))>0) {
+			for (i=0; i<workers; i++) {
+				if (pids[i]==pid) {
+					pids[i] = 0;
+				}
+			}
+
+			/* Don't start workers again too fast, e.g. if a template crashes them */
+			sleep(1);
+		}
+	}
+
+	for (i=0; i<workers; i++) {
+		if (pids[i]>0) {
+			kill(pids[i],SIGTERM);
+		}
+	}
+	while (wait((int*)NULL)>0 || errno==EINTR);
+}
+
+
+void serve_stop( int sig ) {
+	serve.stop = 1;
+}
+
+
+/*
+	The event loop of a worker. The listen socket is shared by all
+	workers, only one of them is woken up for a new connection. The
+	loop wakes up each second to close the connections timed out.
+*/
+void serve_worker(void) {
+	struct epoll_event events[SERVE_MAX_EVENTS];
+	SERVE_CONN *conn = (SERVE_CONN*)NULL;
+	time_t checked = 0;
+	int
+		n = 0,
+		i = 0;
+
+
+	if ((serve.epoll_fd=epoll_create(SERVE_MAX_EVENTS))<0) {
+		exit(1);
+	}
+
+	serve_poll_listen(1);
+
+	for (;;) {
+		n = epoll_wait(serve.epoll_fd,events,SERVE_MAX_EVENTS,1000);
+		serve_clock();
+
+		if (n<0) {
+			if (errno==EINTR) {
+				continue;
+			}
+			exit(1);
+		}
+
+		for (i=0; i<n; i++) {
+			if ((conn=(SERVE_CONN*)events[i].data.ptr)==(SERVE_CONN*)NULL) {
+				serve_accept();
+			}
+			else if (events[i].events & EPOLLOUT) {
+				if (serve_flush(conn)<0) {
+					serve_close(conn);
+				}
+				else if (conn->wait_out==0) {
+					serve_input(conn);
+				}
+			}
+			else {
+				serve_read(conn);
+			}
+		}
+
+		if (serve.now!=checked) {
+			checked = serve.now;
+			serve_timeouts();
+		}
+	}
+}
+
+
+/*
+	Start (on is 1) or stop polling the listen socket. A worker with
+	max_conns connections leaves the new ones to the other workers, or
+	in the backlog until one of its connections is closed.
+*/
+void serve_poll_listen( int on ) {
+	struct epoll_event ev;
+
+
+	if (on==1) {
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+		ev.events |= EPOLLEXCLUSIVE;
+#endif
+		ev.data.ptr = NULL;
+		epoll_ctl(serve.epoll_fd,EPOLL_CTL_ADD,serve.listen_fd,&ev);
+	}
+	else {
+		/* An exclusive wakeup cannot be modified, only deleted */
+		epoll_ctl(serve.epoll_fd,EPOLL_CTL_DEL,serve.listen_fd,(struct epoll_event*)NULL);
+	}
+
+	serve.accepting = on;
+}
+
+
+/*
+	Accept all pending connections.
+*/
+void serve_accept(void) {
+	struct sockaddr_storage addr;
+	socklen_t addr_len = sizeof(addr);
+	struct epoll_event ev;
+	SERVE_CONN *conn = (SERVE_CONN*)NULL;
+	int
+		fd = -1,
+		on = 1;
+
+
+	while (serve.conn_count<serve.max_conns && (fd=accept(serve.listen_fd,(struct sockaddr*)&addr,&addr_len))>=0) {
+		fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+
+		conn = (SERVE_CONN*)_calloc(1,sizeof(SERVE_CONN));
+		conn->fd = fd;
+		conn->in_size = 4096;
+		conn->in = (char*)_malloc(conn->in_size);
+		conn->active = serve.now;
+		conn->request_start = serve.now;
+
+		conn->next = serve.conns;
+		if (serve.conns!=(SERVE_CONN*)NULL) {
+			serve.conns->prev = conn;
+		}
+		serve.conns = conn;
+		serve.conn_count++;
+
+		if (getnameinfo((struct sockaddr*)&addr,addr_len,conn->addr,sizeof(conn->addr),conn->port,sizeof(conn->port),NI_NUMERICHOST|NI_NUMERICSERV)!=0) {
+			strcpy(conn->addr,"");
+			strcpy(conn->port,"");
+		}
+
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		if (epoll_ctl(serve.epoll_fd,EPOLL_CTL_ADD,fd,&ev)!=0) {
+			serve_close(conn);
+		}
+
+		addr_len = sizeof(addr);
+	}
+
+	if (serve.conn_count>=serve.max_conns && serve.accepting==1) {
+		serve_poll_listen(0);
+	}
+}
+
+
+void serve_close( SERVE_CONN *conn ) {
+	if (conn->prev!=(SERVE_CONN*)NULL) {
+		conn->prev->next = conn->next;
+	}
+	else {
+		serve.conns = conn->next;
+	}
+	if (conn->next!=(SERVE_CONN*)NULL) {
+		conn->next->prev = conn->prev;
+	}
+	serve.conn_count--;
+
+	close(conn->fd);
+	free(conn->in);
+	if (conn->out!=(char*)NULL) {
+		free(conn->out);
+	}
+	free(conn);
+
+	if (serve.accepting==0 && serve.conn_count<serve.max_conns) {
+		serve_poll_listen(1);
+	}
+}
+
+
+/*
+	Close the connections idle for serve.timeout seconds. A request
+	begun is answered by 408 if it is not complete within twice that
+	time, so a slow client cannot keep a connection by sending a byte
+	now and then.
+*/
+void serve_timeouts(void) {
+	SERVE_CONN
+		*conn = (SERVE_CONN*)NULL,
+		*next = (SERVE_CONN*)NULL;
+
+
+	for (conn=serve.conns; conn!=(SERVE_CONN*)NULL; conn=next) {
+		next = conn->next;
+
+		if (conn->in_len>0 && conn->wait_out==0) {
+			if (serve.now-conn->request_start>=2*serve.timeout) {
+				serve_error(conn,"408 Request Timeout","The request was not complete in time.");
+				conn->close = 1;
+				if (serve_flush(conn)!=1) {
+					serve_close(conn);
+				}
+			}
+		}
+		else if (serve.now-conn->active>=serve.timeout) {
+			serve_close(conn);
+		}
+	}
+}
+
+
+/*
+	Read what the client has sent and answer the complete requests.
+*/
+void serve_read( SERVE_CONN *conn ) {
+	struct epoll_event ev;
+	ssize_t len = 0;
+
+
+	for (;;) {
+		if (conn->in_len==conn->in_size) {
+			if (conn->in_size>=SERVE_MAX_HEAD+SERVE_MAX_BODY) {
+				serve_close(conn);
+				return;
+			}
+			conn->in_size *= 2;
+			conn->in = (char*)_realloc(conn->in,conn->in_size);
+		}
+
+		len = read(conn->fd,conn->in+conn->in_len,conn->in_size-conn->in_len);
+
+		if (len>0) {
+			if (conn->in_len==0) {
+				conn->request_start = serve.now;
+			}
+			conn->in_len += len;
+			conn->active = serve.now;
+			continue;
+		}
+		if (len<0 && errno==EINTR) {
+			continue;
+		}
+		if (len<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) {
+			break;
+		}
+
+		/* The client has closed the connection, the requests read are answered nevertheless */
+		conn->close = 1;
+		break;
+	}
+
+	if (conn->wait_out==0) {
+		serve_input(conn);
+	}
+	else if (conn->close==1) {
+		/* Nothing more to read, only wait for the pending responses */
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLOUT;
+		ev.data.ptr = conn;
+		epoll_ctl(serve.epoll_fd,EPOLL_CTL_MOD,conn->fd,&ev);
+	}
+}
+
+
+/*
+	Answer the complete requests read so far, as long as the responses
+	can be written right away.
+*/
+void serve_input( SERVE_CONN *conn ) {
+	size_t
+		head_len = 0,
+		body_len = 0,
+		len = 0;
+
+	char
+		*value = (char*)NULL;
+
+	int
+		flush = 0;
+
+
+	while (conn->wait_out==0 && (head_len=serve_head_len(conn->in,conn->in_len))>0) {
+		body_len = 0;
+		conn->in[head_len-1] = '\0';
+
+		if ((value=serve_header(conn->in,"transfer-encoding"))!=(char*)NULL) {
+			serve_error(conn,"501 Not Implemented","Chunked request bodies are not supported.");
+			conn->close = 1;
+			len = conn->in_len;
+		}
+		else {
+			if ((value=serve_header(conn->in,"content-length"))!=(char*)NULL) {
+				body_len = (size_t)strtoul(value,(char**)NULL,10);
+			}
+
+			if (body_len>SERVE_MAX_BODY) {
+				serve_error(conn,"413 Payload Too Large","The request body is too large.");
+				conn->close = 1;
+				len = conn->in_len;
+			}
+			else if (conn->in_len<head_len+body_len) {
+				/* The body is not complete yet, the header is read again */
+				conn->in[head_len-1] = '\n';
+				break;
+			}
+			else {
+				serve_request(conn,conn->in,conn->in+head_len,body_len);
+				len = head_len+body_len;
+			}
+		}
+
+		memmove(conn->in,conn->in+len,conn->in_len-len);
+		conn->in_len -= len;
+		conn->request_start = serve.now;
+
+		if ((flush=serve_flush(conn))<0 || conn->close==1) {
+			break;
+		}
+	}
+
+	if (conn->in_len>=SERVE_MAX_HEAD && head_len==0) {
+		serve_error(conn,"431 Request Header Fields Too Large","The request header is too large.");
+		conn->close = 1;
+		flush = serve_flush(conn);
+	}
+
+	if (flush<0 || (conn->close==1 && conn->wait_out==0)) {
+		serve_close(conn);
+	}
+}
+
+
+/*
+	Write the responses collected so far. Returns 0 if all is written,
+	1 if the connection waits to be writable, -1 on errors.
+*/
+int serve_flush( SERVE_CONN *conn ) {
+	struct epoll_event ev;
+	ssize_t len = 0;
+
+
+	while (conn->out_pos<conn->out_len) {
+		len = write(conn->fd,conn->out+conn->out_pos,conn->out_len-conn->out_pos);
+
+		if (len>0) {
+			conn->out_pos += len;
+			conn->active = serve.now;
+		}
+		else if (len<0 && errno==EINTR) {
+			continue;
+		}
+		else if (len<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) {
+			if (conn->wait_out==0) {
+				memset(&ev,0,sizeof(ev));
+				ev.events = (conn->close==1) ? EPOLLOUT : EPOLLIN|EPOLLOUT;
+				ev.data.ptr = conn;
+				epoll_ctl(serve.epoll_fd,EPOLL_CTL_MOD,conn->fd,&ev);
+				conn->wait_out = 1;
+			}
+			return (1);
+		}
+		else {
+			return (-1);
+		}
+	}
+
+	conn->out_len = conn->out_pos = 0;
+
+	if (conn->wait_out==1) {
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		epoll_ctl(serve.epoll_fd,EPOLL_CTL_MOD,conn->fd,&ev);
+		conn->wait_out = 0;
+	}
+
+	return ((conn->close==1) ? -1 : 0);
+}
+
+
+/*
+	Returns the length of the request line and the headers including
+	the empty line, or 0 if they are not complete yet.
+*/
+size_t serve_head_len( char *buf, size_t len ) {
+	size_t i = 0;
+
+
+	for (i=0; i<len && i<SERVE_MAX_HEAD; i++) {
+		if (buf[i]=='\n') {
+			if (i+1<len && buf[i+1]=='\n') {
+				return (i+2);
+			}
+			if (i+2<len && buf[i+1]=='\r' && buf[i+2]=='\n') {
+				return (i+3);
+			}
+		}
+	}
+
+	return (0);
+}
+
+
+/*
+	Find a header (name in lower case) in the head of a request, which
+	is terminated by '\0'. Returns the value, which ends at the end of
+	its line, or NULL.
+*/
+char *serve_header( char *head, char *name ) {
+	char *line = (char*)NULL;
+	size_t len = strlen(name);
+
+
+	for (line=strchr(head,'\n'); line!=(char*)NULL; line=strchr(line,'\n')) {
+		line++;
+		if (strncasecmp(line,name,len)==0 && line[len]==':') {
+			line += len+1;
+			while (*line==' ' || *line=='\t') {
+				line++;
+			}
+			return (line);
+		}
+	}
+
+	return ((char*)NULL);
+}
+
+
+/*
+	Answer a request, the head is terminated by '\0' and is changed.
+	The headers are put into the environment as for a CGI (e.g.
+	HTTP_USER_AGENT), together with the CGI variables.
+*/
+void serve_request( SERVE_CONN *conn, char *head, char *body, size_t body_len ) {
+	char
+		*method = head,
+		*uri = (char*)NULL,
+		*protocol = (char*)NULL,
+		*query = (char*)NULL,
+		*line = (char*)NULL,
+		*next = (char*)NULL,
+		*value = (char*)NULL,
+		*ptr = (char*)NULL,
+		*server_name = (char*)NULL,
+		*connection = (char*)NULL,
+		*err_msg = (char*)NULL,
+		name[128],
+		fname[SERVE_PATH_LEN],
+		script_name[SERVE_PATH_LEN];
+
+	SERVE_PAGE *page = (SERVE_PAGE*)NULL;
+	int
+		http10 = 0,
+		i = 0;
+
+
+	connection = serve_header(head,"connection");
+
+	/* The request line: method, URI and protocol */
+	next = strchr(head,'\n');
+	*next++ = '\0';
+	if (next-head>=2 && next[-2]=='\r') {
+		next[-2] = '\0';
+	}
+
+	if ((uri=strchr(method,' '))==(char*)NULL || (protocol=strchr(uri+1,' '))==(char*)NULL || uri[1]!='/') {
+		serve_error(conn,"400 Bad Request","The request line is malformed.");
+		conn->close = 1;
+		return;
+	}
+	*uri++ = '\0';
+	*protocol++ = '\0';
+
+	if (strncmp(protocol,"HTTP/1.",7)!=0) {
+		serve_error(conn,"505 HTTP Version Not Supported","Only HTTP/1.x is supported.");
+		conn->close = 1;
+		return;
+	}
+	http10 = (strcmp(protocol,"HTTP/1.0")==0) ? 1 : 0;
+
+	/* HTTP/1.1 keeps the connection by default, HTTP/1.0 if asked for */
+	if (connection!=(char*)NULL && strncasecmp(connection,"close",5)==0) {
+		conn->close = 1;
+	}
+	else if (http10==1 && (connection==(char*)NULL || strncasecmp(connection,"keep-alive",10)!=0)) {
+		conn->close = 1;
+	}
+
+	if (strcmp(method,"GET")!=0 && strcmp(method,"HEAD")!=0 && strcmp(method,"POST")!=0) {
+		serve_error(conn,"405 Method Not Allowed","Unknown or not supported request method!");
+		return;
+	}
+
+	if (serve_map(uri,fname,script_name)==0) {
+		serve_error(conn,"404 Not Found","The requested template was not found.");
+		return;
+	}
+
+	/* The headers */
+	for (line=next; *line!='\0' && *line!='\r'; line=next) {
+		if ((next=strchr(line,'\n'))!=(char*)NULL) {
+			*next++ = '\0';
+		}
+		else {
+			next = line+strlen(line);
+		}
+
+		if ((value=strchr(line,':'))==(char*)NULL || value-line>=(int)sizeof(name)-6) {
+			continue;
+		}
+		*value++ = '\0';
+		while (*value==' ' || *value=='\t') {
+			value++;
+		}
+		if ((ptr=strchr(value,'\r'))!=(char*)NULL) {
+			*ptr = '\0';
+		}
+
+		if (strcasecmp(line,"content-type")==0 || strcasecmp(line,"content-length")==0) {
+			strcpy(name,"");
+		}
+		else {
+			strcpy(name,"HTTP_");
+		}
+		for (i=strlen(name),ptr=line; *ptr!='\0'; ptr++) {
+			name[i++] = (*ptr=='-') ? '_' : toupper((unsigned char)*ptr);
+		}
+		name[i] = '\0';
+
+		cgi_request_setenv(name,value);
+		if (strcmp(name,"HTTP_HOST")==0) {
+			server_name = value;
+		}
+	}
+
+	/* The CGI variables */
+	if ((query=strchr(uri,'?'))!=(char*)NULL) {
+		cgi_request_setenv("QUERY_STRING",query+1);
+	}
+	cgi_request_setenv("REQUEST_URI",uri);
+	cgi_request_setenv("REQUEST_METHOD",method);
+	cgi_request_setenv("SERVER_PROTOCOL",protocol);
+	cgi_request_setenv("SERVER_SOFTWARE",SERVE_SOFTWARE);
+	cgi_request_setenv("SERVER_PORT",serve.port);
+	cgi_request_setenv("DOCUMENT_ROOT",serve.docroot);
+	cgi_request_setenv("SCRIPT_FILENAME",fname);
+	cgi_request_setenv("SCRIPT_NAME",script_name);
+	cgi_request_setenv("REMOTE_ADDR",conn->addr);
+	cgi_request_setenv("REMOTE_PORT",conn->port);
+
+	if (server_name!=(char*)NULL && (ptr=strrchr(server_name,':'))!=(char*)NULL && strchr(ptr,']')==(char*)NULL) {
+		*ptr = '\0';
+	}
+	cgi_request_setenv("SERVER_NAME",(server_name!=(char*)NULL) ? server_name : ((*serve.host!='\0') ? serve.host : "localhost"));
+
+	if ((page=serve_page(fname,&err_msg))==(SERVE_PAGE*)NULL) {
+		if (err_msg==(char*)NULL) {
+			serve_error(conn,"404 Not Found","The requested template was not found.");
+		}
+		else {
+			serve_fail(conn,fname,err_msg);
+			free(err_msg);
+		}
+		cgi_request_reset();
+		return;
+	}
+
+	/* As cgi_init, the values of a POST are read from the body only, if it is form data */
+	if (strcmp(method,"POST")==0) {
+		value = getenv("CONTENT_TYPE");
+		if (value!=(char*)NULL && strncasecmp(value,"application/x-www-form-urlencoded",33)!=0) {
+			body_len = 0;
+		}
+		query = (char*)NULL;
+	}
+	else {
+		body_len = 0;
+	}
+
+	serve_render(conn,page,(query!=(char*)NULL) ? query+1 : (char*)NULL,body,body_len,(strcmp(method,"HEAD")==0) ? 1 : 0);
+}
+
+
+/*
+	Map the path of an URI to a template below the document root. The
+	path must not leave the document root, and the template must have
+	the extension ".mht", which may be left out. A directory maps to its
+	index.mht. Returns 1 if the template exists, 0 otherwise.
+*/
+int serve_map( char *uri, char *fname, char *script_name ) {
+	struct stat st;
+	size_t
+		len = strcspn(uri,"?#"),
+		i = 0,
+		j = 0;
+
+	unsigned int c = 0;
+
+
+	if (len>=SERVE_PATH_LEN/2 || strlen(serve.docroot)>=SERVE_PATH_LEN/2) {
+		return (0);
+	}
+
+	/* Decode %xx, '+' is no space in a path */
+	for (i=0,j=0; i<len; i++) {
+		if (uri[i]=='%' && i+2<len && isxdigit((unsigned char)uri[i+1]) && isxdigit((unsigned char)uri[i+2])) {
+			sscanf(uri+i+1,"%2x",&c);
+			script_name[j++] = (char)c;
+			i += 2;
+		}
+		else {
+			script_name[j++] = uri[i];
+		}
+	}
+	script_name[j] = '\0';
+
+	if (strlen(script_name)!=j || strstr(script_name,"/..")!=(char*)NULL || strchr(script_name,'\\')!=(char*)NULL) {
+		return (0);
+	}
+
+	sprintf(fname,"%s%s",serve.docroot,script_name);
+
+	if (stat(fname,&st)==0 && S_ISDIR(st.st_mode)) {
+		strcat(fname,(fname[strlen(fname)-1]=='/') ? "index.mht" : "/index.mht");
+		strcat(script_name,(script_name[j-1]=='/') ? "index.mht" : "/index.mht");
+	}
+	else if (j<4 || strcmp(script_name+j-4,".mht")!=0) {
+		strcat(fname,".mht");
+		strcat(script_name,".mht");
+	}
+
+	return ((stat(fname,&st)==0 && S_ISREG(st.st_mode)) ? 1 : 0);
+}
+
+
+/*
+	Get a loaded template, it is loaded (again) if needed. Returns NULL
+	if the template cannot be loaded, err_msg is set to the message of
+	the MHT error then (to be freed), or to NULL if there is no file.
+*/
+SERVE_PAGE *serve_page( char *fname, char **err_msg ) {
+	SERVE_PAGE *page = (SERVE_PAGE*)NULL;
+	struct MHT_INFO_S *prev = (struct MHT_INFO_S*)NULL;
+	struct stat st;
+	char *msg = (char*)NULL;
+	int mht_err = 0;
+
+
+	*err_msg = (char*)NULL;
+
+	for (page=serve.pages; page!=(SERVE_PAGE*)NULL && strcmp(page->fname,fname)!=0; page=page->next);
+
+	/* A file is checked for changes once a second */
+	if (page==(SERVE_PAGE*)NULL || page->checked!=serve.now) {
+		if (stat(fname,&st)!=0) {
+			return ((SERVE_PAGE*)NULL);
+		}
+
+		if (page==(SERVE_PAGE*)NULL) {
+			page = (SERVE_PAGE*)_calloc(1,sizeof(SERVE_PAGE));
+			page->fname = strdup(fname);
+			page->next = serve.pages;
+			serve.pages = page;
+		}
+		else if (page->state!=(struct MHT_INFO_S*)NULL && page->mtime!=st.st_mtime) {
+			mht_state_free(page->state);
+			page->state = (struct MHT_INFO_S*)NULL;
+		}
+
+		page->mtime = st.st_mtime;
+		page->checked = serve.now;
+	}
+
+	if (page->state==(struct MHT_INFO_S*)NULL) {
+		page->state = mht_state_new();
+		prev = mht_state_switch(page->state);
+
+		if (serve.setup!=NULL) {
+			serve.setup();
+		}
+
+		if ((mht_err=mht_load(fname,SERVE_PAGE_BLOCK))!=0) {
+			*err_msg = strdup((mht_search_macro("mht_err_msg",&msg)!=0) ? msg : "Cannot load the template.");
+		}
+
+		mht_state_switch(prev);
+
+		if (mht_err!=0) {
+			mht_state_free(page->state);
+			page->state = (struct MHT_INFO_S*)NULL;
+			return ((SERVE_PAGE*)NULL);
+		}
+	}
+
+	return (page);
+}
+
+
+/*
+	Render a loaded template for the current request, the variables of
+	the request are in the environment already. The macros of the
+	request are defined in a request scope over the macros of the
+	template, which is dropped with the variables afterwards.
+*/
+void serve_render( SERVE_CONN *conn, SERVE_PAGE *page, char *query, char *body, size_t body_len, int head_only ) {
+	struct MHT_INFO_S *prev = mht_state_switch(page->state);
+	MHT_SINK
+		*sink = sink_mem_new(),
+		*prev_sink = (MHT_SINK*)NULL;
+
+	char
+		*buf = (char*)NULL,
+		*page_body = (char*)NULL,
+		*content = (char*)NULL,
+		*msg = (char*)NULL;
+
+	size_t
+		len = 0,
+		header_len = 0;
+
+	int mht_err = 0;
+
+
+	mht_scope_begin();
+
+	if (query!=(char*)NULL) {
+		content = strdup(query);
+		cgi_request_values(content);
+		free(content);
+	}
+
+	if (body_len>0) {
+		content = (char*)_malloc(body_len+1);
+		memcpy(content,body,body_len);
+		content[body_len] = '\0';
+		cgi_request_values(content);
+		free(content);
+	}
+
+	cgi_register_env_vars();
+
+	prev_sink = mht_set_sink(sink);
+	mht_err = mht_process(stdout,SERVE_PAGE_BLOCK);
+	mht_set_sink(prev_sink);
+
+	if (mht_err!=0) {
+		serve_fail(conn,page->fname,(mht_search_macro("mht_err_msg",&msg)!=0) ? msg : "MHT error");
+	}
+	else {
+		buf = sink_mem_get(sink,&len);
+		page_body = cgi_response_body(buf,&header_len);
+		serve_response(conn,"200 OK",buf,header_len,page_body,len-(page_body-buf),head_only);
+	}
+
+	sink_free(sink);
+	cgi_request_reset();
+	mht_scope_end();
+	mht_state_switch(prev);
+}
+
+
+/*
+	Append a response. The headers written by a template are sent as
+	they are, except "Status:" which sets the status of the response.
+*/
+void serve_response( SERVE_CONN *conn, char *status, char *headers, size_t header_len, char *body, size_t body_len, int head_only ) {
+	char
+		*line = headers,
+		*end = (char*)NULL,
+		buf[256];
+
+	size_t len = 0;
+	int content_type = 0;
+
+
+	/* The status line is written last, a "Status:" header may change it */
+	for (; line<headers+header_len; line=end+1) {
+		if ((end=memchr(line,'\n',headers+header_len-line))==(char*)NULL) {
+			end = headers+header_len;
+		}
+		len = end-line;
+		if (len>0 && line[len-1]=='\r') {
+			len--;
+		}
+
+		if (len>7 && strncasecmp(line,"status:",7)==0 && len<sizeof(buf)) {
+			for (line+=7,len-=7; len>0 && *line==' '; line++,len--);
+			memcpy(buf,line,len);
+			buf[len] = '\0';
+			status = buf;
+		}
+	}
+
+	len = strlen(status);
+	serve_append(conn,"HTTP/1.1 ",9);
+	serve_append(conn,status,len);
+	serve_append(conn,"\r\nDate: ",8);
+	serve_append(conn,serve.date,strlen(serve.date));
+	serve_append(conn,"\r\nServer: " SERVE_SOFTWARE "\r\n",strlen("\r\nServer: " SERVE_SOFTWARE "\r\n"));
+
+	for (line=headers; line<headers+header_len; line=end+1) {
+		if ((end=memchr(line,'\n',headers+header_len-line))==(char*)NULL) {
+			end = headers+header_len;
+		}
+		len = end-line;
+		if (len>0 && line[len-1]=='\r') {
+			len--;
+		}
+
+		if (len==0 || strncasecmp(line,"status:",7)==0 || strncasecmp(line,"content-length:",15)==0 || strncasecmp(line,"connection:",11)==0) {
+			continue;
+		}
+		if (strncasecmp(line,"content-type:",13)==0) {
+			content_type = 1;
+		}
+
+		serve_append(conn,line,len);
+		serve_append(conn,"\r\n",2);
+	}
+
+	if (content_type==0) {
+		serve_append(conn,"Content-Type: text/html\r\n",25);
+	}
+
+	sprintf(buf,"Content-Length: %lu\r\nConnection: %s\r\n\r\n",(unsigned long)body_len,(conn->close==1) ? "close" : "keep-alive");
+	serve_append(conn,buf,strlen(buf));
+
+	if (head_only==0) {
+		serve_append(conn,body,body_len);
+	}
+}
+
+
+/*
+	Append an error response with a short message.
+*/
+void serve_error( SERVE_CONN *conn, char *status, char *msg ) {
+	char *body = (char*)_malloc(strlen(status)+strlen(msg)+3);
+
+
+	sprintf(body,"%s\n%s\n",status,msg);
+	serve_response(conn,status,"Content-Type: text/plain",24,body,strlen(body),0);
+	free(body);
+}
+
+
+/*
+	Append the 500 response of a template which cannot be loaded or
+	processed. The message may tell paths and contents of the server,
+	so it is only written to stderr.
+*/
+void serve_fail( SERVE_CONN *conn, char *fname, char *msg ) {
+	fprintf(stderr,"%s [%s]: %s: %s\n",SERVE_SOFTWARE,serve.date,fname,msg);
+	fflush(stderr);
+	serve_error(conn,"500 Internal Server Error","The template cannot be rendered.");
+}
+
+
+/*
+	Update the time of the current request and its Date header.
+*/
+void serve_clock(void) {
+	time_t now = time((time_t*)NULL);
+
+
+	if (now!=serve.now) {
+		serve.now = now;
+		strftime(serve.date,sizeof(serve.date),"%a, %d %b %Y %H:%M:%S GMT",gmtime(&now));
+	}
+}
+
+
+void serve_append( SERVE_CONN *conn, char *str, size_t len ) {
+	if (conn->out_len+len>conn->out_size) {
+		conn->out_size = (conn->out_len+len)*2+1024;
+		conn->out = (char*)_realloc(conn->out,conn->out_size);
+	}
+
+	memcpy(conn->out+conn->out_len,str,len);
+	conn->out_len += len;
+}
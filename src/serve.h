@@ -0,0 +1,7 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/*
+	Serve the MHT templates below docroot by HTTP on addr, see serve.c.
+	setup is called for the state of each template, it may be NULL.
+*/
+int serve_run( char *addr, char *docroot, void (*setup)(void) );
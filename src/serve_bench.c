@@ -0,0 +1,232 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "serve.h"
+#include "mht.h"
+#include "mem.h"
+
+
+/*
+	The requests per second of the HTTP server: a child process serves
+	a small page, the clients keep their connections and send the next
+	request when the response is read, see "make bench". The workers
+	are set by MHTSERVEWORKERS as for the server.
+
+		serve_bench [connections] [seconds]
+*/
+
+
+#define BENCH_BUF_LEN		65536
+
+typedef struct {
+	int fd;
+	char buf[BENCH_BUF_LEN];
+	size_t len;
+} BENCH_CONN;
+
+char *bench_page =
+	"#begin item\n"
+	"<p>Item <#i></p>\n"
+	"#end item\n"
+	"<html><head><title>Hello</title></head><body>\n"
+	"<h1>Hello <#name></h1>\n"
+	"#loop item|i|1|10\n"
+	"</body></html>\n";
+
+char *bench_request = "GET /index?name=World HTTP/1.1\r\nHost: localhost\r\nUser-Agent: serve_bench\r\n\r\n";
+
+
+double bench_now(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv,(struct timezone*)NULL);
+	return (tv.tv_sec+tv.tv_usec/1e6);
+}
+
+
+/*
+	The length of the first complete response in buf, 0 if there is
+	none yet.
+*/
+size_t bench_response_len( char *buf, size_t len ) {
+	char *ptr = (char*)NULL;
+	size_t
+		head_len = 0,
+		body_len = 0,
+		i = 0;
+
+
+	for (i=0; i+3<len; i++) {
+		if (memcmp(buf+i,"\r\n\r\n",4)==0) {
+			head_len = i+4;
+			break;
+		}
+	}
+	if (head_len==0) {
+		return (0);
+	}
+
+	for (ptr=buf; ptr<buf+head_len; ptr=strchr(ptr,'\n')+1) {
+		if (strncasecmp(ptr,"Content-Length:",15)==0) {
+			body_len = (size_t)strtoul(ptr+15,(char**)NULL,10);
+			break;
+		}
+	}
+
+	return ((len>=head_len+body_len) ? head_len+body_len : 0);
+}
+
+
+int main( int argc, char **argv ) {
+	struct sockaddr_in addr;
+	struct epoll_event
+		ev,
+		events[64];
+
+	BENCH_CONN
+		*conns = (BENCH_CONN*)NULL,
+		*conn = (BENCH_CONN*)NULL;
+
+	FILE *fptr = (FILE*)NULL;
+	char
+		docroot[64],
+		fname[80],
+		server_addr[32];
+
+	size_t len = 0;
+	ssize_t got = 0;
+	double
+		seconds = (argc>2) ? atof(argv[2]) : 3,
+		start = 0,
+		end = 0;
+
+	unsigned long
+		done = 0,
+		bad = 0;
+
+	int
+		conn_count = (argc>1) ? atoi(argv[1]) : 16,
+		n = 0,
+		port = 20000+(int)(getpid()%20000),
+		epoll_fd = -1,
+		i = 0,
+		j = 0;
+
+	pid_t pid = 0;
+
+
+	if (conn_count<1) {
+		conn_count = 1;
+	}
+
+	sprintf(docroot,"/tmp/serve_bench.%ld",(long)getpid());
+	mkdir(docroot,0700);
+	sprintf(fname,"%s/index.mht",docroot);
+	if ((fptr=fopen(fname,"w"))==(FILE*)NULL) {
+		return (1);
+	}
+	fputs(bench_page,fptr);
+	fclose(fptr);
+
+	sprintf(server_addr,"127.0.0.1:%d",port);
+	signal(SIGPIPE,SIG_IGN);
+
+	fflush(stdout);
+	if ((pid=fork())==0) {
+		freopen("/dev/null","w",stdout);
+		mht_init();
+		serve_run(server_addr,docroot,NULL);
+		_exit(1);
+	}
+
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	epoll_fd = epoll_create(conn_count);
+	conns = (BENCH_CONN*)_calloc(conn_count,sizeof(BENCH_CONN));
+
+	for (i=0; i<conn_count; i++) {
+		conns[i].fd = socket(AF_INET,SOCK_STREAM,0);
+
+		/* The server may not listen yet */
+		for (j=0; j<100 && connect(conns[i].fd,(struct sockaddr*)&addr,sizeof(addr))!=0; j++) {
+			usleep(20000);
+		}
+
+		memset(&ev,0,sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = &conns[i];
+		epoll_ctl(epoll_fd,EPOLL_CTL_ADD,conns[i].fd,&ev);
+	}
+
+	start = bench_now();
+	end = start+seconds;
+
+	for (i=0; i<conn_count; i++) {
+		write(conns[i].fd,bench_request,strlen(bench_request));
+	}
+
+	while (bench_now()<end) {
+		n = epoll_wait(epoll_fd,events,64,100);
+
+		for (i=0; i<n; i++) {
+			conn = (BENCH_CONN*)events[i].data.ptr;
+
+			if ((got=read(conn->fd,conn->buf+conn->len,BENCH_BUF_LEN-conn->len))<=0) {
+				bad++;
+				epoll_ctl(epoll_fd,EPOLL_CTL_DEL,conn->fd,&events[i]);
+				continue;
+			}
+			conn->len += (size_t)got;
+
+			while ((len=bench_response_len(conn->buf,conn->len))>0) {
+				if (strncmp(conn->buf,"HTTP/1.1 200",12)!=0) {
+					bad++;
+				}
+				memmove(conn->buf,conn->buf+len,conn->len-len);
+				conn->len -= len;
+				done++;
+
+				write(conn->fd,bench_request,strlen(bench_request));
+			}
+		}
+	}
+
+	seconds = bench_now()-start;
+	printf("%d connections, %.1f s\n",conn_count,seconds);
+	printf("  keep-alive  %8.0f req/s  (%lu requests, %lu bad)\n",done/seconds,done,bad);
+
+	for (i=0; i<conn_count; i++) {
+		close(conns[i].fd);
+	}
+	free(conns);
+	close(epoll_fd);
+
+	kill(pid,SIGTERM);
+	waitpid(pid,(int*)NULL,0);
+
+	remove(fname);
+	rmdir(docroot);
+
+	return ((bad>0) ? 1 : 0);
+}
@@ -0,0 +1,302 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "serve.h"
+#include "mht.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the HTTP server: a child process serves the templates
+	of the test directory, the test is the client.
+*/
+
+
+int port = 0;
+
+
+/*
+	Open a connection to the server, reads time out after msec.
+*/
+int connect_server( int msec ) {
+	struct sockaddr_in addr;
+	struct timeval tv;
+	int
+		fd = socket(AF_INET,SOCK_STREAM,0),
+		i = 0;
+
+
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+	/* The server may not listen yet */
+	for (i=0; i<100 && connect(fd,(struct sockaddr*)&addr,sizeof(addr))!=0; i++) {
+		usleep(20000);
+	}
+
+	tv.tv_sec = msec/1000;
+	tv.tv_usec = (msec%1000)*1000;
+	setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+
+	return (fd);
+}
+
+
+/*
+	Read the response until the server closes the connection (or the
+	read times out). Returns the response, to be freed.
+*/
+char *response( int fd ) {
+	char *output = (char*)_calloc(1,1);
+	char buf[4096];
+	size_t output_len = 0;
+	ssize_t n = 0;
+
+
+
+	while ((n=read(fd,buf,sizeof(buf)))>0) {
+		output = (char*)_realloc(output,output_len+n+1);
+		memcpy(output+output_len,buf,n);
+		output_len += n;
+		output[output_len] = '\0';
+	}
+
+	return (output);
+}
+
+
+/*
+	Send a request (or a part of one), and read the response until the
+	server closes the connection. Returns the response, to be freed.
+*/
+char *request( char *raw, size_t len ) {
+	char *output = (char*)NULL;
+	int fd = connect_server(6000);
+
+
+	write(fd,raw,(len>0) ? len : strlen(raw));
+	output = response(fd);
+	close(fd);
+
+	return (output);
+}
+
+
+/*
+	Count the occurrences of part in str.
+*/
+int count( char *str, char *part ) {
+	int n = 0;
+
+	while ((str=strstr(str,part))!=(char*)NULL) {
+		n++;
+		str++;
+	}
+
+	return (n);
+}
+
+
+void test_requests(void) {
+	char *output = (char*)NULL;
+
+
+	output = request("GET /index.mht?name=A HTTP/1.1\r\nConnection: close\r\n\r\n",0);
+	test_contains("status",output,"HTTP/1.1 200 OK\r\n");
+	test_contains("page",output,"\r\n\r\nhello A\n");
+	free(output);
+
+	/* The extension and index.mht may be left out */
+	output = request("GET /?name=B HTTP/1.0\r\n\r\n",0);
+	test_contains("directory",output,"hello B\n");
+	free(output);
+
+	/* Pipelined requests on one connection */
+	output = request(
+		"GET /index?name=C HTTP/1.1\r\nHost: localhost\r\n\r\n"
+		"GET /index?name=D HTTP/1.1\r\n\r\n"
+		"GET /index HTTP/1.1\r\nConnection: close\r\n\r\n",0);
+	test_check("pipelined requests",count(output,"HTTP/1.1 200 OK")==3);
+	test_contains("first pipelined request",output,"hello C\n");
+	test_contains("second pipelined request",output,"hello D\n");
+	test_contains("the macros of a request are gone with it",output,"\r\n\r\nhello <#name>\n");
+	free(output);
+
+	output = request("POST /index HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: 6\r\nConnection: close\r\n\r\nname=E",0);
+	test_contains("post",output,"hello E\n");
+	free(output);
+
+	output = request("HEAD /index HTTP/1.0\r\n\r\n",0);
+	test_check("head",output!=(char*)NULL && strstr(output,"200 OK")!=(char*)NULL && strstr(output,"hello")==(char*)NULL);
+	free(output);
+}
+
+
+void test_errors(void) {
+	char
+		*output = (char*)NULL,
+		*big = (char*)NULL;
+
+
+	output = request("GET /none HTTP/1.0\r\n\r\n",0);
+	test_contains("missing template",output,"404 Not Found");
+	free(output);
+
+	output = request("GET /a/../../etc/passwd HTTP/1.0\r\n\r\n",0);
+	test_contains("outside the document root",output,"404 Not Found");
+	free(output);
+
+	output = request("DELETE /index HTTP/1.0\r\n\r\n",0);
+	test_contains("unknown method",output,"405 Method Not Allowed");
+	free(output);
+
+	output = request("GET /index HTTP/2.0\r\n\r\n",0);
+	test_contains("unknown protocol",output,"505 HTTP Version Not Supported");
+	free(output);
+
+	/* An empty request line, at the very start of the buffer */
+	output = request("\n\n",2);
+	test_contains("empty request line",output,"400 Bad Request");
+	free(output);
+
+	output = request("\r\n\r\n",4);
+	test_contains("empty request line with CR",output,"400 Bad Request");
+	free(output);
+
+	output = request("GET /index HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n",0);
+	test_contains("chunked body",output,"501 Not Implemented");
+	free(output);
+
+	output = request("POST /index HTTP/1.1\r\nContent-Length: 99999999\r\n\r\n",0);
+	test_contains("body too large",output,"413 Payload Too Large");
+	free(output);
+
+	big = (char*)_malloc(20000);
+	strcpy(big,"GET /index HTTP/1.1\r\nX-Big: ");
+	memset(big+strlen(big),'a',20000-strlen(big)-1);
+	big[19999] = '\0';
+	output = request(big,0);
+	test_contains("header too large",output,"431 Request Header Fields Too Large");
+	free(output);
+	free(big);
+
+	/* The details of a template error are logged, not sent */
+	output = request("GET /broken HTTP/1.0\r\n\r\n",0);
+	test_contains("template error",output,"500 Internal Server Error");
+	test_check("template error without details",strstr(output,"secret")==(char*)NULL && strstr(output,"not found")==(char*)NULL);
+	free(output);
+
+	/* The server is still there */
+	output = request("GET /index?name=F HTTP/1.0\r\n\r\n",0);
+	test_contains("request after the errors",output,"hello F\n");
+	free(output);
+}
+
+
+/*
+	The server runs with a timeout of 2 seconds and 2 connections.
+*/
+void test_limits(void) {
+	char *output = (char*)NULL;
+	time_t start = 0;
+	int
+		idle1 = -1,
+		idle2 = -1,
+		fd = -1;
+
+
+	start = time((time_t*)NULL);
+	output = request("",0);
+	test_check("idle connection closed",*output=='\0' && time((time_t*)NULL)-start<5);
+	free(output);
+
+	output = request("GET /index HTTP/1.1\r\n",0);
+	test_contains("incomplete request",output,"408 Request Timeout");
+	free(output);
+
+	/* A third connection waits until one of the others is closed */
+	idle1 = connect_server(300);
+	idle2 = connect_server(300);
+	usleep(100000);
+	fd = connect_server(300);
+	write(fd,"GET /index?name=G HTTP/1.0\r\n\r\n",strlen("GET /index?name=G HTTP/1.0\r\n\r\n"));
+	output = response(fd);
+	test_equal("connection cap",output,"");
+	free(output);
+
+	close(idle1);
+	output = response(fd);
+	test_contains("connection after the cap",output,"hello G\n");
+	free(output);
+
+	close(idle2);
+	close(fd);
+}
+
+
+int main( int argc, char **argv ) {
+	char
+		*fname = test_file("index.mht","hello <#name>\n",0),
+		*docroot = strdup(fname),
+		*log = test_path("serve.log"),
+		addr[32],
+		buf[4096];
+
+	FILE *fptr = (FILE*)NULL;
+	pid_t pid = 0;
+
+
+	test_file("broken.mht","#include /secret/none.mht\n",0);
+	*strrchr(docroot,'/') = '\0';
+	port = 20000+(int)(getpid()%20000);
+	sprintf(addr,"127.0.0.1:%d",port);
+
+	signal(SIGPIPE,SIG_IGN);
+
+	if ((pid=fork())==0) {
+		freopen("/dev/null","w",stdout);
+		freopen(log,"w",stderr);
+		setenv("MHTSERVEWORKERS","1",1);
+		setenv("MHTSERVETIMEOUT","2",1);
+		setenv("MHTSERVECONNS","2",1);
+		mht_init();
+		serve_run(addr,docroot,NULL);
+		_exit(1);
+	}
+
+	test_requests();
+	test_errors();
+	test_limits();
+
+	kill(pid,SIGTERM);
+	waitpid(pid,(int*)NULL,0);
+
+	buf[0] = '\0';
+	if ((fptr=fopen(log,"rb"))!=(FILE*)NULL) {
+		buf[fread(buf,1,sizeof(buf)-1,fptr)] = '\0';
+		fclose(fptr);
+	}
+	test_contains("template error logged",buf,"broken.mht");
+	free(docroot);
+
+	return (test_result("serve_test"));
+}
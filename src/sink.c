@@ -0,0 +1,1024 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <zlib.h>
+
+#include "sink.h"
+#include "mem.h"
+#include "str_util.h"
+
+
+#define SINK_WRITEV_IOVS	64			/* The max. number of segments of a batch */
+#define SINK_WRITEV_ARENA	16384		/* The buffer for the copied chunks of a batch */
+#define SINK_WRITEV_BATCH	32768		/* A batch is written when it has this many bytes */
+
+/*
+	The data of a writev sink. Referenced chunks (e.g. static template
+	text) are written from where they are, the other ones are copied
+	to the arena. A batch is written with one writev call.
+*/
+typedef struct {
+	FILE *fptr;
+	struct iovec iov[SINK_WRITEV_IOVS];
+	unsigned int iov_count;
+	size_t bytes;			/* The bytes of the batch */
+	char arena[SINK_WRITEV_ARENA];
+	size_t arena_len;
+} SINK_WRITEV;
+
+
+/* Prototypes: */
+int sink_file_push( MHT_SINK *sink, char *ptr, size_t len );
+int sink_file_flush( MHT_SINK *sink );
+int sink_mem_push( MHT_SINK *sink, char *ptr, size_t len );
+int sink_mem_flush( MHT_SINK *sink );
+void sink_mem_release( MHT_SINK *sink );
+int sink_deflate_push( MHT_SINK *sink, char *ptr, size_t len );
+int sink_deflate_run( MHT_SINK *sink, int flush );
+int sink_deflate_flush( MHT_SINK *sink );
+int sink_deflate_finish( MHT_SINK *sink );
+void sink_deflate_release( MHT_SINK *sink );
+int sink_minify_push( MHT_SINK *sink, char *ptr, size_t len );
+int sink_minify_emit( MHT_SINK *sink, char *ptr, size_t len );
+char *sink_minify_scan( char *ptr, char *end );
+int sink_minify_flush( MHT_SINK *sink );
+int sink_minify_finish( MHT_SINK *sink );
+void sink_minify_release( MHT_SINK *sink );
+int sink_replace_push( MHT_SINK *sink, char *ptr, size_t len );
+void sink_replace_release( MHT_SINK *sink );
+int sink_killspace_push( MHT_SINK *sink, char *ptr, size_t len );
+int sink_writev_push( MHT_SINK *sink, char *ptr, size_t len );
+int sink_writev_ref( MHT_SINK *sink, char *ptr, size_t len );
+int sink_writev_add( SINK_WRITEV *wv, char *ptr, size_t len );
+int sink_writev_flush( MHT_SINK *sink );
+void sink_writev_release( MHT_SINK *sink );
+
+
+#define SINK_DEFLATE_CHUNK	16384
+
+
+/* The data of a deflate sink */
+typedef struct {
+	z_stream zs;
+	int level;
+	unsigned char out[SINK_DEFLATE_CHUNK];	/* The compressed output, passed on when full or flushed */
+} SINK_DEFLATE;
+
+
+#define SINK_MINIFY_BUF				4096
+
+/* The states of the minifier */
+#define SINK_MINIFY_TEXT			0
+#define SINK_MINIFY_LT				1	/* After '<', until the kind of the tag is known */
+#define SINK_MINIFY_TAG				2
+#define SINK_MINIFY_RAW				3	/* In pre, textarea, script or style, the content is kept */
+#define SINK_MINIFY_COMMENT			4
+#define SINK_MINIFY_KEEP_COMMENT	5	/* A conditional comment <!--[if ...]> or a SSI <!--#...--> */
+
+#define SINK_MINIFY_SPACE(c)		((c)==' ' || (c)=='\t' || (c)=='\n' || (c)=='\r' || (c)=='\f')
+
+/* The data of a minifying sink, all of it is kept between two chunks */
+typedef struct {
+	int state;
+	char space;			/* The pending whitespace of a run, '\0', ' ' or '\n' */
+	char quote;			/* The quote of the attribute value in a tag, or '\0' */
+	char hold[16];		/* The start of a tag, until its kind is known */
+	unsigned int hold_len;
+	char raw[16];		/* The end tag of a pre, textarea, script or style element, e.g. "</pre" */
+	unsigned int raw_len;	/* 0 unless the current tag starts such an element */
+	unsigned int match;		/* The chars of raw matched, or the '-' in a row in a comment */
+	char out[SINK_MINIFY_BUF];
+	size_t out_len;
+} SINK_MINIFY;
+
+/* The data of a replacing sink */
+typedef struct {
+	char *strs[256];	/* The replacement of each char, or NULL */
+	char *buf;			/* The chunk with the chars replaced */
+	size_t size;
+} SINK_REPLACE;
+
+
+/* The elements whose content is kept */
+char *sink_minify_raw[] = { "pre", "textarea", "script", "style", (char*)NULL };
+
+
+/*
+	Create a sink. flush, finish and release may be NULL if the
+	sink buffers nothing or has no data to free.
+*/
+MHT_SINK *sink_new( int (*push)( MHT_SINK*, char*, size_t ), int (*flush)( MHT_SINK* ), int (*finish)( MHT_SINK* ), void (*release)( MHT_SINK* ), void *data, MHT_SINK *next ) {
+	MHT_SINK *sink = (MHT_SINK*)_malloc(sizeof(MHT_SINK));
+
+	sink->push = push;
+	sink->ref = NULL;
+	sink->flush = flush;
+	sink->finish = finish;
+	sink->release = release;
+	sink->data = data;
+	sink->next = next;
+
+	return (sink);
+}
+
+
+int sink_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	if (len==0) {
+		return (1);
+	}
+
+	return (sink->push(sink,ptr,len));
+}
+
+
+/*
+	Push a chunk that stays valid until the sink is flushed, so
+	that a sink can keep a reference instead of a copy.
+*/
+int sink_push_ref( MHT_SINK *sink, char *ptr, size_t len ) {
+	if (len==0) {
+		return (1);
+	}
+
+	return ((sink->ref!=NULL) ? sink->ref(sink,ptr,len) : sink->push(sink,ptr,len));
+}
+
+
+/*
+	Flush a sink and all sinks after it.
+*/
+int sink_flush( MHT_SINK *sink ) {
+	int ok = 1;
+
+	for (; sink!=(MHT_SINK*)NULL; sink=sink->next) {
+		if (sink->flush!=NULL && sink->flush(sink)==0) {
+			ok = 0;
+		}
+	}
+
+	return (ok);
+}
+
+
+/*
+	Finish a sink and all sinks after it, at the end of the output.
+*/
+int sink_finish( MHT_SINK *sink ) {
+	int ok = 1;
+
+	for (; sink!=(MHT_SINK*)NULL; sink=sink->next) {
+		if (sink->finish!=NULL) {
+			if (sink->finish(sink)==0) {
+				ok = 0;
+			}
+		}
+		else if (sink->flush!=NULL && sink->flush(sink)==0) {
+			ok = 0;
+		}
+	}
+
+	return (ok);
+}
+
+
+/*
+	Free a sink, but not the sinks after it.
+*/
+void sink_free( MHT_SINK *sink ) {
+	if (sink==(MHT_SINK*)NULL) {
+		return;
+	}
+
+	if (sink->release!=NULL) {
+		sink->release(sink);
+	}
+
+	free(sink);
+}
+
+
+/*
+	A sink writing to a stream, the stream is not closed.
+*/
+MHT_SINK *sink_file_new( FILE *fptr ) {
+	return (sink_new(sink_file_push,sink_file_flush,NULL,NULL,(void*)fptr,(MHT_SINK*)NULL));
+}
+
+
+int sink_file_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	return (fwrite(ptr,1,len,(FILE*)sink->data)==len);
+}
+
+
+int sink_file_flush( MHT_SINK *sink ) {
+	return (fflush((FILE*)sink->data)==0);
+}
+
+
+/*
+	A sink collecting all the output in memory, see sink_mem_get.
+*/
+MHT_SINK *sink_mem_new(void) {
+	SINK_MEM *mem = (SINK_MEM*)_malloc(sizeof(SINK_MEM));
+
+	mem->size = 4096;
+	mem->len = 0;
+	mem->buf = (char*)_malloc(mem->size);
+	mem->buf[0] = '\0';
+
+	return (sink_new(sink_mem_push,NULL,NULL,sink_mem_release,(void*)mem,(MHT_SINK*)NULL));
+}
+
+
+int sink_mem_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	SINK_MEM *mem = (SINK_MEM*)sink->data;
+
+	if (mem->len+len>=mem->size) {
+		while (mem->len+len>=mem->size) {
+			mem->size *= 2;
+		}
+		mem->buf = (char*)_realloc(mem->buf,mem->size);
+	}
+
+	memcpy(mem->buf+mem->len,ptr,len);
+	mem->len += len;
+	mem->buf[mem->len] = '\0';
+
+	return (1);
+}
+
+
+void sink_mem_release( MHT_SINK *sink ) {
+	SINK_MEM *mem = (SINK_MEM*)sink->data;
+
+	free(mem->buf);
+	free(mem);
+}
+
+
+/*
+	Return the output collected by a memory sink, terminated by '\0'.
+	The buffer belongs to the sink.
+*/
+char *sink_mem_get( MHT_SINK *sink, size_t *len ) {
+	SINK_MEM *mem = (SINK_MEM*)sink->data;
+
+	if (len!=(size_t*)NULL) {
+		(*len) = mem->len;
+	}
+
+	return (mem->buf);
+}
+
+
+/*
+	A sink compressing the output with zlib and passing it on to next,
+	as gzip stream (gzip is 1) or as zlib stream (the HTTP encoding
+	"deflate"). level is 0 (no compression) to 9, or -1 for the default
+	of zlib. Returns NULL if zlib fails.
+*/
+MHT_SINK *sink_deflate_new( MHT_SINK *next, int level, int gzip ) {
+	SINK_DEFLATE *def = (SINK_DEFLATE*)_malloc(sizeof(SINK_DEFLATE));
+
+
+	def->zs.zalloc = Z_NULL;
+	def->zs.zfree = Z_NULL;
+	def->zs.opaque = Z_NULL;
+	def->level = level;
+
+	/* 16 added to the window bits writes a gzip header and trailer */
+	if (deflateInit2(&def->zs,level,Z_DEFLATED,(gzip!=0) ? 15+16 : 15,8,Z_DEFAULT_STRATEGY)!=Z_OK) {
+		free(def);
+		return ((MHT_SINK*)NULL);
+	}
+
+	def->zs.next_out = def->out;
+	def->zs.avail_out = SINK_DEFLATE_CHUNK;
+
+	return (sink_new(sink_deflate_push,sink_deflate_flush,sink_deflate_finish,sink_deflate_release,(void*)def,next));
+}
+
+
+int sink_deflate_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	SINK_DEFLATE *def = (SINK_DEFLATE*)sink->data;
+
+	def->zs.next_in = (Bytef*)ptr;
+	def->zs.avail_in = (uInt)len;
+
+	return (sink_deflate_run(sink,Z_NO_FLUSH));
+}
+
+
+/*
+	Compress the pending input, the output is passed on whenever the
+	output buffer is full, and at the end unless flush is Z_NO_FLUSH.
+*/
+int sink_deflate_run( MHT_SINK *sink, int flush ) {
+	SINK_DEFLATE *def = (SINK_DEFLATE*)sink->data;
+	int err = Z_OK;
+
+
+	for (;;) {
+		err = deflate(&def->zs,flush);
+
+		if (err!=Z_OK && err!=Z_STREAM_END && err!=Z_BUF_ERROR) {
+			return (0);
+		}
+
+		if (def->zs.avail_out==0 || (flush!=Z_NO_FLUSH && def->zs.avail_out<SINK_DEFLATE_CHUNK)) {
+			if (sink_push(sink->next,(char*)def->out,SINK_DEFLATE_CHUNK-def->zs.avail_out)==0) {
+				return (0);
+			}
+			def->zs.next_out = def->out;
+			def->zs.avail_out = SINK_DEFLATE_CHUNK;
+			continue;
+		}
+
+		/* zlib has room left, so all the input is consumed (and flushed) */
+		if (def->zs.avail_in==0 || err==Z_STREAM_END) {
+			return (1);
+		}
+	}
+}
+
+
+/*
+	Make everything compressed so far decodable by the client,
+	at the cost of a few bytes.
+*/
+int sink_deflate_flush( MHT_SINK *sink ) {
+	SINK_DEFLATE *def = (SINK_DEFLATE*)sink->data;
+
+	def->zs.next_in = (Bytef*)NULL;
+	def->zs.avail_in = 0;
+
+	return (sink_deflate_run(sink,Z_SYNC_FLUSH));
+}
+
+
+int sink_deflate_finish( MHT_SINK *sink ) {
+	SINK_DEFLATE *def = (SINK_DEFLATE*)sink->data;
+
+	def->zs.next_in = (Bytef*)NULL;
+	def->zs.avail_in = 0;
+
+	return (sink_deflate_run(sink,Z_FINISH));
+}
+
+
+void sink_deflate_release( MHT_SINK *sink ) {
+	SINK_DEFLATE *def = (SINK_DEFLATE*)sink->data;
+
+	deflateEnd(&def->zs);
+	free(def);
+}
+
+
+/*
+	Change the compression level of all deflate sinks in a chain, e.g.
+	by "#mhtvar compress 9" in a template. Returns 0 if there is none.
+*/
+int sink_deflate_level( MHT_SINK *sink, int level ) {
+	SINK_DEFLATE *def = (SINK_DEFLATE*)NULL;
+	int
+		found = 0,
+		err = Z_OK;
+
+
+	for (; sink!=(MHT_SINK*)NULL; sink=sink->next) {
+		if (sink->push!=sink_deflate_push) {
+			continue;
+		}
+
+		def = (SINK_DEFLATE*)sink->data;
+		found = 1;
+
+		if (def->level==level) {
+			continue;
+		}
+
+		/* The input so far is compressed with the old level */
+		def->zs.next_in = (Bytef*)NULL;
+		def->zs.avail_in = 0;
+		sink_deflate_run(sink,Z_BLOCK);
+
+		while ((err=deflateParams(&def->zs,level,Z_DEFAULT_STRATEGY))==Z_BUF_ERROR && def->zs.avail_out==0) {
+			sink_push(sink->next,(char*)def->out,SINK_DEFLATE_CHUNK);
+			def->zs.next_out = def->out;
+			def->zs.avail_out = SINK_DEFLATE_CHUNK;
+		}
+
+		if (err==Z_OK) {
+			def->level = level;
+		}
+	}
+
+	return (found);
+}
+
+
+/*
+	A sink minifying HTML: runs of whitespace are collapsed into one
+	blank (or newline), comments are removed, and the content of pre,
+	textarea, script and style elements is left alone. Attribute values
+	in quotes are kept as well. The state is carried from chunk to
+	chunk, so a tag or comment may be split anywhere.
+*/
+MHT_SINK *sink_minify_new( MHT_SINK *next ) {
+	SINK_MINIFY *min = (SINK_MINIFY*)_malloc(sizeof(SINK_MINIFY));
+
+	min->state = SINK_MINIFY_TEXT;
+	min->space = '\0';
+	min->quote = '\0';
+	min->hold_len = 0;
+	min->raw_len = 0;
+	min->match = 0;
+	min->out_len = 0;
+
+	return (sink_new(sink_minify_push,sink_minify_flush,sink_minify_finish,sink_minify_release,(void*)min,next));
+}
+
+
+int sink_minify_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	SINK_MINIFY *min = (SINK_MINIFY*)sink->data;
+	char
+		*end = ptr+len,
+		*run = (char*)NULL,
+		**raw = (char**)NULL,
+		c = '\0';
+
+	unsigned int i = 0;
+	int ok = 1;
+
+
+	while (ptr<end) {
+		switch (min->state) {
+			case SINK_MINIFY_TEXT:
+				if ((run=sink_minify_scan(ptr,end))>ptr) {
+					if (min->space!='\0') {
+						ok &= sink_minify_emit(sink,&min->space,1);
+						min->space = '\0';
+					}
+					ok &= sink_minify_emit(sink,ptr,run-ptr);
+					ptr = run;
+					break;
+				}
+
+				c = *ptr++;
+				if (c=='<') {
+					min->hold[0] = c;
+					min->hold_len = 1;
+					min->state = SINK_MINIFY_LT;
+				}
+				else if (SINK_MINIFY_SPACE(c)) {
+					min->space = (c=='\n' || min->space=='\n') ? '\n' : ' ';
+				}
+				else {
+					if (min->space!='\0') {
+						ok &= sink_minify_emit(sink,&min->space,1);
+						min->space = '\0';
+					}
+					ok &= sink_minify_emit(sink,&c,1);
+				}
+				break;
+
+			case SINK_MINIFY_LT:
+				c = *ptr;
+
+				/* "<!--" is a comment, the whitespace before stays pending */
+				if (min->hold_len<4 && c=="<!--"[min->hold_len]) {
+					min->hold[min->hold_len++] = c;
+					ptr++;
+					break;
+				}
+				if (min->hold_len==4 && memcmp(min->hold,"<!--",4)==0) {
+					min->hold_len = 0;
+					min->match = 0;
+					if (c=='[' || c=='#') {
+						if (min->space!='\0') {
+							ok &= sink_minify_emit(sink,&min->space,1);
+							min->space = '\0';
+						}
+						ok &= sink_minify_emit(sink,"<!--",4);
+						min->state = SINK_MINIFY_KEEP_COMMENT;
+					}
+					else {
+						min->state = SINK_MINIFY_COMMENT;
+					}
+					break;
+				}
+
+				/* The name of the tag */
+				if (min->hold_len<sizeof(min->hold) && (isalnum((unsigned char)c) || (min->hold_len==1 && c=='/'))) {
+					min->hold[min->hold_len++] = c;
+					ptr++;
+					break;
+				}
+
+				if (min->space!='\0') {
+					ok &= sink_minify_emit(sink,&min->space,1);
+					min->space = '\0';
+				}
+				ok &= sink_minify_emit(sink,min->hold,min->hold_len);
+
+				if (min->hold_len==1) {
+					/* A '<' without a tag, e.g. "a < b" */
+					min->state = SINK_MINIFY_TEXT;
+				}
+				else {
+					/* The end tag, in lower case, if the content has to be kept */
+					min->raw_len = 0;
+					if (min->hold[1]!='/' && min->hold[1]!='!' && min->hold_len+1<sizeof(min->raw)) {
+						strcpy(min->raw,"</");
+						for (i=1; i<min->hold_len; i++) {
+							min->raw[i+1] = (char)tolower((unsigned char)min->hold[i]);
+						}
+						min->raw[i+1] = '\0';
+
+						for (raw=sink_minify_raw; *raw!=(char*)NULL; raw++) {
+							if (strcmp(min->raw+2,*raw)==0) {
+								min->raw_len = strlen(min->raw);
+								break;
+							}
+						}
+					}
+					min->quote = '\0';
+					min->state = SINK_MINIFY_TAG;
+				}
+				min->hold_len = 0;
+				break;
+
+			case SINK_MINIFY_TAG:
+				if (min->quote!='\0') {
+					/* Attribute values are kept */
+					if ((run=(char*)memchr(ptr,min->quote,end-ptr))==(char*)NULL) {
+						run = end;
+					}
+					else {
+						run++;
+						min->quote = '\0';
+					}
+					ok &= sink_minify_emit(sink,ptr,run-ptr);
+					ptr = run;
+					break;
+				}
+
+				/* Names and unquoted values */
+				for (run=ptr; run<end && !SINK_MINIFY_SPACE(*run) && *run!='>' && *run!='"' && *run!='\''; run++);
+				if (run>ptr) {
+					if (min->space!='\0') {
+						ok &= sink_minify_emit(sink,&min->space,1);
+						min->space = '\0';
+					}
+					ok &= sink_minify_emit(sink,ptr,run-ptr);
+					ptr = run;
+					break;
+				}
+
+				c = *ptr++;
+				if (SINK_MINIFY_SPACE(c)) {
+					min->space = ' ';
+				}
+				else if (c=='>') {
+					min->space = '\0';
+					ok &= sink_minify_emit(sink,&c,1);
+					min->match = 0;
+					min->state = (min->raw_len>0) ? SINK_MINIFY_RAW : SINK_MINIFY_TEXT;
+				}
+				else {
+					if (min->space!='\0') {
+						ok &= sink_minify_emit(sink,&min->space,1);
+						min->space = '\0';
+					}
+					if (c=='"' || c=='\'') {
+						min->quote = c;
+					}
+					ok &= sink_minify_emit(sink,&c,1);
+				}
+				break;
+
+			case SINK_MINIFY_RAW:
+				if (min->match==0) {
+					run = memscan2(ptr,end,'<','<');
+					ok &= sink_minify_emit(sink,ptr,run-ptr);
+					if ((ptr=run)==end) {
+						break;
+					}
+				}
+
+				/* Search for the end tag, the content is kept anyway */
+				c = *ptr;
+				if (tolower((unsigned char)c)==min->raw[min->match]) {
+					ok &= sink_minify_emit(sink,&c,1);
+					ptr++;
+
+					if (++min->match==min->raw_len) {
+						min->raw_len = 0;
+						min->match = 0;
+						min->state = SINK_MINIFY_TAG;
+					}
+				}
+				else if (min->match>0) {
+					/* Try again from c, it might be a '<' */
+					min->match = 0;
+				}
+				else {
+					ok &= sink_minify_emit(sink,&c,1);
+					ptr++;
+				}
+				break;
+
+			case SINK_MINIFY_COMMENT:
+			case SINK_MINIFY_KEEP_COMMENT:
+				if (min->match==0) {
+					run = memscan2(ptr,end,'-','-');
+					if (min->state==SINK_MINIFY_KEEP_COMMENT) {
+						ok &= sink_minify_emit(sink,ptr,run-ptr);
+					}
+					if ((ptr=run)==end) {
+						break;
+					}
+				}
+
+				c = *ptr++;
+				if (min->state==SINK_MINIFY_KEEP_COMMENT) {
+					ok &= sink_minify_emit(sink,&c,1);
+				}
+
+				if (c=='-') {
+					min->match++;
+				}
+				else if (c=='>' && min->match>=2) {
+					min->match = 0;
+					min->state = SINK_MINIFY_TEXT;
+				}
+				else {
+					min->match = 0;
+				}
+				break;
+		}
+	}
+
+	return (ok);
+}
+
+
+/*
+	Append minified output to the buffer, which is passed on when full.
+*/
+int sink_minify_emit( MHT_SINK *sink, char *ptr, size_t len ) {
+	SINK_MINIFY *min = (SINK_MINIFY*)sink->data;
+	int ok = 1;
+
+
+	if (min->out_len+len>SINK_MINIFY_BUF) {
+		ok = sink_push(sink->next,min->out,min->out_len);
+		min->out_len = 0;
+
+		if (len>SINK_MINIFY_BUF) {
+			return (ok & sink_push(sink->next,ptr,len));
+		}
+	}
+
+	memcpy(min->out+min->out_len,ptr,len);
+	min->out_len += len;
+
+	return (ok);
+}
+
+
+/*
+	Return a pointer to the first whitespace or '<' in [ptr,end), or end.
+	Runs of text are skipped a word at a time.
+*/
+char *sink_minify_scan( char *ptr, char *end ) {
+	unsigned long
+		word = 0,
+		pattern_lt = WORD_ONES*(unsigned char)'<';
+
+
+	while (ptr+sizeof(unsigned long)<=end) {
+		memcpy(&word,ptr,sizeof(unsigned long));
+		/* Any byte below '!' could be whitespace */
+		if (HASLESS(word,'!') | HASZERO(word^pattern_lt)) {
+			break;
+		}
+		ptr += sizeof(unsigned long);
+	}
+
+	while (ptr<end && *ptr!='<' && !SINK_MINIFY_SPACE(*ptr)) {
+		ptr++;
+	}
+
+	return (ptr);
+}
+
+
+/*
+	Pass the minified output on. A pending whitespace or the start
+	of a tag is kept, it depends on what comes next.
+*/
+int sink_minify_flush( MHT_SINK *sink ) {
+	SINK_MINIFY *min = (SINK_MINIFY*)sink->data;
+	int ok = 1;
+
+	if (min->out_len>0) {
+		ok = sink_push(sink->next,min->out,min->out_len);
+		min->out_len = 0;
+	}
+
+	return (ok);
+}
+
+
+int sink_minify_finish( MHT_SINK *sink ) {
+	SINK_MINIFY *min = (SINK_MINIFY*)sink->data;
+
+	if (min->state==SINK_MINIFY_LT) {
+		if (min->space!='\0') {
+			sink_minify_emit(sink,&min->space,1);
+		}
+		sink_minify_emit(sink,min->hold,min->hold_len);
+	}
+
+	min->state = SINK_MINIFY_TEXT;
+	min->space = '\0';
+	min->hold_len = 0;
+	min->raw_len = 0;
+	min->match = 0;
+
+	return (sink_minify_flush(sink));
+}
+
+
+void sink_minify_release( MHT_SINK *sink ) {
+	free(sink->data);
+}
+
+
+/*
+	A sink replacing single chars by strings, e.g. umlauts by their
+	HTML entities. Each chunk is passed on as one chunk, chunks without
+	any of the chars are passed on as they are.
+*/
+MHT_SINK *sink_replace_new( MHT_SINK *next, char *chars, char **strs, unsigned int count ) {
+	SINK_REPLACE *rep = (SINK_REPLACE*)_malloc(sizeof(SINK_REPLACE));
+	unsigned int i = 0;
+
+
+	for (i=0; i<256; i++) {
+		rep->strs[i] = (char*)NULL;
+	}
+	for (i=0; i<count; i++) {
+		rep->strs[(unsigned char)chars[i]] = strs[i];
+	}
+
+	rep->buf = (char*)NULL;
+	rep->size = 0;
+
+	return (sink_new(sink_replace_push,NULL,NULL,sink_replace_release,(void*)rep,next));
+}
+
+
+int sink_replace_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	SINK_REPLACE *rep = (SINK_REPLACE*)sink->data;
+	char
+		*out = (char*)NULL,
+		*str = (char*)NULL;
+
+	size_t
+		i = 0,
+		out_len = 0;
+
+
+	for (i=0; i<len && rep->strs[(unsigned char)ptr[i]]==(char*)NULL; i++);
+
+	if (i==len) {
+		return (sink_push(sink->next,ptr,len));
+	}
+
+	/* The length of the chunk with the chars replaced */
+	for (out_len=i; i<len; i++) {
+		str = rep->strs[(unsigned char)ptr[i]];
+		out_len += (str!=(char*)NULL) ? strlen(str) : 1;
+	}
+
+	if (out_len>rep->size) {
+		rep->size = out_len;
+		rep->buf = (char*)_realloc(rep->buf,rep->size);
+	}
+
+	for (i=0,out=rep->buf; i<len; i++) {
+		if ((str=rep->strs[(unsigned char)ptr[i]])!=(char*)NULL) {
+			while (*str!='\0') {
+				*out++ = *str++;
+			}
+		}
+		else {
+			*out++ = ptr[i];
+		}
+	}
+
+	return (sink_push(sink->next,rep->buf,out_len));
+}
+
+
+void sink_replace_release( MHT_SINK *sink ) {
+	SINK_REPLACE *rep = (SINK_REPLACE*)sink->data;
+
+	if (rep->buf!=(char*)NULL) {
+		free(rep->buf);
+	}
+	free(rep);
+}
+
+
+/*
+	A sink cutting off the leading and trailing whitespace of each
+	line, and ending it with a blank instead, this puts a page on a
+	single line. The end of a chunk ends a line as well, as MHT
+	passes on the output a line at a time.
+*/
+MHT_SINK *sink_killspace_new( MHT_SINK *next ) {
+	return (sink_new(sink_killspace_push,NULL,NULL,NULL,(void*)NULL,next));
+}
+
+
+int sink_killspace_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	char
+		*end = ptr+len,
+		*eol = (char*)NULL;
+
+	int ok = 1;
+
+
+	while (ptr<end) {
+		if ((eol=(char*)memchr(ptr,'\n',end-ptr))==(char*)NULL) {
+			eol = end;
+		}
+
+		/* Only the line in between is passed on */
+		len = eol-ptr;
+		while (len>0 && isspace((unsigned char)*ptr)) {
+			ptr++;
+			len--;
+		}
+		while (len>0 && isspace((unsigned char)ptr[len-1])) {
+			len--;
+		}
+
+		if (len>0) {
+			ok &= sink_push(sink->next,ptr,len);
+			ok &= sink_push(sink->next," ",1);
+		}
+
+		ptr = (eol<end) ? eol+1 : end;
+	}
+
+	return (ok);
+}
+
+
+/*
+	A sink writing to the file descriptor of a stream in batches with
+	writev, see SINK_WRITEV. The stream is flushed before each batch,
+	so the output written to it before the sink comes first.
+*/
+MHT_SINK *sink_writev_new( FILE *fptr ) {
+	SINK_WRITEV *wv = (SINK_WRITEV*)_malloc(sizeof(SINK_WRITEV));
+	MHT_SINK *sink = (MHT_SINK*)NULL;
+
+	wv->fptr = fptr;
+	wv->iov_count = 0;
+	wv->bytes = 0;
+	wv->arena_len = 0;
+
+	sink = sink_new(sink_writev_push,sink_writev_flush,NULL,sink_writev_release,(void*)wv,(MHT_SINK*)NULL);
+	sink->ref = sink_writev_ref;
+
+	return (sink);
+}
+
+
+int sink_writev_push( MHT_SINK *sink, char *ptr, size_t len ) {
+	SINK_WRITEV *wv = (SINK_WRITEV*)sink->data;
+	int ok = 1;
+
+	/* Large chunks are written from where they are */
+	if (len>SINK_WRITEV_ARENA/4) {
+		ok &= sink_writev_add(wv,ptr,len);
+		ok &= sink_writev_flush(sink);
+		return (ok);
+	}
+
+	if (wv->arena_len+len>SINK_WRITEV_ARENA) {
+		ok &= sink_writev_flush(sink);
+	}
+
+	memcpy(wv->arena+wv->arena_len,ptr,len);
+	ok &= sink_writev_add(wv,wv->arena+wv->arena_len,len);
+	wv->arena_len += len;
+
+	if (wv->iov_count==SINK_WRITEV_IOVS || wv->bytes>=SINK_WRITEV_BATCH) {
+		ok &= sink_writev_flush(sink);
+	}
+
+	return (ok);
+}
+
+
+int sink_writev_ref( MHT_SINK *sink, char *ptr, size_t len ) {
+	SINK_WRITEV *wv = (SINK_WRITEV*)sink->data;
+
+	sink_writev_add(wv,ptr,len);
+
+	if (wv->iov_count==SINK_WRITEV_IOVS || wv->bytes>=SINK_WRITEV_BATCH) {
+		return (sink_writev_flush(sink));
+	}
+
+	return (1);
+}
+
+
+/*
+	Add a segment to the batch, there must be room for it. A segment
+	following the last one in memory extends it.
+*/
+int sink_writev_add( SINK_WRITEV *wv, char *ptr, size_t len ) {
+	struct iovec *last = (wv->iov_count>0) ? &wv->iov[wv->iov_count-1] : (struct iovec*)NULL;
+
+	if (last!=(struct iovec*)NULL && (char*)last->iov_base+last->iov_len==ptr) {
+		last->iov_len += len;
+	}
+	else {
+		wv->iov[wv->iov_count].iov_base = (void*)ptr;
+		wv->iov[wv->iov_count].iov_len = len;
+		wv->iov_count++;
+	}
+
+	wv->bytes += len;
+
+	return (1);
+}
+
+
+/*
+	Write the batch, the segments are advanced after a partial write.
+*/
+int sink_writev_flush( MHT_SINK *sink ) {
+	SINK_WRITEV *wv = (SINK_WRITEV*)sink->data;
+	struct iovec *iov = wv->iov;
+	unsigned int count = wv->iov_count;
+	ssize_t written = 0;
+	int ok = 1;
+
+
+	if (count>0 && fflush(wv->fptr)!=0) {
+		ok = 0;
+	}
+
+	while (count>0 && ok==1) {
+		written = writev(fileno(wv->fptr),iov,(int)count);
+
+		if (written<0) {
+			if (errno==EINTR) {
+				continue;
+			}
+			ok = 0;
+			break;
+		}
+
+		while (count>0 && (size_t)written>=iov->iov_len) {
+			written -= (ssize_t)iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count>0) {
+			iov->iov_base = (char*)iov->iov_base+written;
+			iov->iov_len -= (size_t)written;
+		}
+	}
+
+	wv->iov_count = 0;
+	wv->bytes = 0;
+	wv->arena_len = 0;
+
+	return (ok);
+}
+
+
+void sink_writev_release( MHT_SINK *sink ) {
+	free(sink->data);
+}
@@ -0,0 +1,43 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/* Data structures: */
+
+/*
+	An output sink receives the rendered output in chunks. A sink
+	may transform the chunks and pass them on to the next sink.
+*/
+typedef struct MHT_SINK_S mht_sink_ptr;
+typedef struct MHT_SINK_S {
+	int (*push)( mht_sink_ptr *sink, char *ptr, size_t len );	/* Write len bytes, returns 0 on errors */
+	int (*ref)( mht_sink_ptr *sink, char *ptr, size_t len );	/* As push, but ptr stays valid until the next flush, NULL if the sink has no use for that */
+	int (*flush)( mht_sink_ptr *sink );		/* Pass all buffered output on, returns 0 on errors */
+	int (*finish)( mht_sink_ptr *sink );	/* As flush, at the end of the output (e.g. the trailer of a compressed stream) */
+	void (*release)( mht_sink_ptr *sink );	/* Free the data of the sink */
+	void *data;
+	mht_sink_ptr *next;
+} MHT_SINK;
+
+/* The data of a memory sink */
+typedef struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} SINK_MEM;
+
+
+/* Prototypes: */
+MHT_SINK *sink_new( int (*push)( MHT_SINK*, char*, size_t ), int (*flush)( MHT_SINK* ), int (*finish)( MHT_SINK* ), void (*release)( MHT_SINK* ), void *data, MHT_SINK *next );
+int sink_push( MHT_SINK *sink, char *ptr, size_t len );
+int sink_push_ref( MHT_SINK *sink, char *ptr, size_t len );
+int sink_flush( MHT_SINK *sink );
+int sink_finish( MHT_SINK *sink );
+void sink_free( MHT_SINK *sink );
+MHT_SINK *sink_file_new( FILE *fptr );
+MHT_SINK *sink_mem_new(void);
+char *sink_mem_get( MHT_SINK *sink, size_t *len );
+MHT_SINK *sink_deflate_new( MHT_SINK *next, int level, int gzip );
+int sink_deflate_level( MHT_SINK *sink, int level );
+MHT_SINK *sink_minify_new( MHT_SINK *next );
+MHT_SINK *sink_replace_new( MHT_SINK *next, char *chars, char **strs, unsigned int count );
+MHT_SINK *sink_killspace_new( MHT_SINK *next );
+MHT_SINK *sink_writev_new( FILE *fptr );
@@ -0,0 +1,127 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mht.h"
+#include "sink.h"
+#include "mem.h"
+
+
+/*
+	The cost of compressing the output: a table page of 3000 rows is
+	rendered runs times uncompressed, and with deflate levels 1, 6
+	and 9, see "make bench". Prints the size and the CPU time of a
+	page for each.
+
+		sink_bench [runs]
+*/
+
+
+#define BENCH_ROWS		3000
+
+char *bench_template =
+	"<html><head><title>Table</title></head><body>\n"
+	"<table class=\"list\">\n"
+	"#begin row\n"
+	"  <tr class=\"row\"><td class=\"id\"><#id></td><td class=\"name\">Item number <#id></td><td class=\"price\">12.<#id></td></tr>\n"
+	"#end row\n"
+	"#foreach row|id|$ids\n"
+	"</table>\n"
+	"</body></html>\n";
+
+
+/*
+	Render the page runs times at a level, -2 is uncompressed. Returns
+	the size of the page, seconds is set to the CPU time of a page.
+*/
+size_t bench_render( char *fname, int level, unsigned int runs, double *seconds ) {
+	MHT_SINK
+		*mem = (MHT_SINK*)NULL,
+		*def = (MHT_SINK*)NULL;
+
+	size_t len = 0;
+	unsigned int i = 0;
+	clock_t start = clock();
+
+
+	for (i=0; i<runs; i++) {
+		mem = sink_mem_new();
+		def = (level==-2) ? mem : sink_deflate_new(mem,level,1);
+
+		mht_set_sink(def);
+		mht_quickopen(stdout,fname);
+		mht_set_sink((MHT_SINK*)NULL);
+		sink_finish(def);
+
+		sink_mem_get(mem,&len);
+		if (def!=mem) {
+			sink_free(def);
+		}
+		sink_free(mem);
+	}
+
+	*seconds = (double)(clock()-start)/CLOCKS_PER_SEC/runs;
+	return (len);
+}
+
+
+int main( int argc, char **argv ) {
+	FILE *fptr = (FILE*)NULL;
+	char
+		fname[64],
+		*ids = (char*)_malloc(BENCH_ROWS*6+1);
+
+	int levels[] = { -2, 1, 6, 9 };
+	unsigned int
+		runs = (argc>1) ? (unsigned int)atoi(argv[1]) : 20,
+		i = 0,
+		len = 0;
+
+	size_t size = 0;
+	double seconds = 0;
+
+
+	sprintf(fname,"/tmp/sink_bench.%ld.mht",(long)getpid());
+	if ((fptr=fopen(fname,"w"))==(FILE*)NULL) {
+		return (1);
+	}
+	fputs(bench_template,fptr);
+	fclose(fptr);
+
+	for (i=0; i<BENCH_ROWS; i++) {
+		len += sprintf(ids+len,"%05u,",i);
+	}
+	ids[len-1] = '\0';
+
+	mht_init();
+	mht_register_macro("ids",ids);
+
+	if (runs==0) {
+		runs = 1;
+	}
+
+	printf("%u rows, %u runs\n",BENCH_ROWS,runs);
+	for (i=0; i<sizeof(levels)/sizeof(int); i++) {
+		size = bench_render(fname,levels[i],runs,&seconds);
+		if (levels[i]==-2) {
+			printf("  uncompressed  %8lu bytes  %6.1f ms/page\n",(unsigned long)size,seconds*1000);
+		}
+		else {
+			printf("  level %d       %8lu bytes  %6.1f ms/page\n",levels[i],(unsigned long)size,seconds*1000);
+		}
+	}
+
+	mht_exit();
+	remove(fname);
+	free(ids);
+
+	return (0);
+}
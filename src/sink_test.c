@@ -0,0 +1,342 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "sink.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the output sinks, each chain ends in a memory sink.
+*/
+
+
+/*
+	Decompress a gzip or zlib stream, the output is NULL if the stream
+	is broken, or incomplete and complete is 1. Returns the output, to
+	be freed.
+*/
+char *inflate_all( char *buf, size_t len, int complete ) {
+	z_stream zs;
+	char *out = (char*)NULL;
+	size_t size = 4*len+1024;
+	int err = Z_OK;
+
+
+	memset(&zs,0,sizeof(zs));
+	if (inflateInit2(&zs,15+32)!=Z_OK) {
+		return ((char*)NULL);
+	}
+
+	out = (char*)_malloc(size);
+	zs.next_in = (Bytef*)buf;
+	zs.avail_in = (uInt)len;
+	zs.next_out = (Bytef*)out;
+	zs.avail_out = (uInt)(size-1);
+
+	while ((err=inflate(&zs,Z_NO_FLUSH))==Z_OK && zs.avail_out==0) {
+		out = (char*)_realloc(out,size*2);
+		zs.next_out = (Bytef*)out+size-1;
+		zs.avail_out = (uInt)size;
+		size *= 2;
+	}
+
+	if ((complete==1 && err!=Z_STREAM_END) || (complete==0 && err!=Z_OK && err!=Z_BUF_ERROR)) {
+		free(out);
+		out = (char*)NULL;
+	}
+	else {
+		out[zs.total_out] = '\0';
+	}
+
+	inflateEnd(&zs);
+	return (out);
+}
+
+
+/*
+	A page of n table rows.
+*/
+char *page_rows( unsigned int n ) {
+	char *page = (char*)_malloc(n*64+64);
+	unsigned int
+		i = 0,
+		len = 0;
+
+	len = sprintf(page,"<html><body><table>\n");
+	for (i=0; i<n; i++) {
+		len += sprintf(page+len,"<tr><td>%u</td><td>item %u</td><td>%u.%02u</td></tr>\n",i,i*7%1000,i%97,i%100);
+	}
+	sprintf(page+len,"</table></body></html>\n");
+
+	return (page);
+}
+
+
+void test_deflate(void) {
+	MHT_SINK
+		*mem = (MHT_SINK*)NULL,
+		*def = (MHT_SINK*)NULL;
+
+	char
+		*page = page_rows(3000),
+		*buf = (char*)NULL,
+		*output = (char*)NULL;
+
+	size_t
+		len = 0,
+		i = 0,
+		page_len = strlen(page);
+
+	int gzip = 0;
+
+
+	for (gzip=0; gzip<=1; gzip++) {
+		mem = sink_mem_new();
+		def = sink_deflate_new(mem,-1,gzip);
+		test_check("deflate sink",def!=(MHT_SINK*)NULL);
+		if (def==(MHT_SINK*)NULL) {
+			sink_free(mem);
+			continue;
+		}
+
+		/* In chunks of odd sizes */
+		for (i=0; i<page_len; i+=777) {
+			sink_push(def,page+i,(page_len-i<777) ? page_len-i : 777);
+		}
+		sink_finish(def);
+
+		buf = sink_mem_get(mem,&len);
+		test_check((gzip==1) ? "gzip magic" : "zlib header",(gzip==1) ? ((unsigned char)buf[0]==0x1f && (unsigned char)buf[1]==0x8b) : ((unsigned char)buf[0]&0x0f)==8);
+		test_check("compressed",len<page_len/4);
+
+		output = inflate_all(buf,len,1);
+		test_check((gzip==1) ? "gzip round trip" : "deflate round trip",output!=(char*)NULL && strcmp(output,page)==0);
+		if (output!=(char*)NULL) {
+			free(output);
+		}
+
+		sink_free(def);
+		sink_free(mem);
+	}
+
+	free(page);
+}
+
+
+void test_deflate_flush(void) {
+	MHT_SINK
+		*mem = sink_mem_new(),
+		*def = sink_deflate_new(mem,6,1);
+
+	char
+		*buf = (char*)NULL,
+		*output = (char*)NULL;
+
+	size_t len = 0;
+
+
+	/* A flush makes the output so far decodable */
+	sink_push(def,"<p>first</p>",12);
+	sink_flush(def);
+	buf = sink_mem_get(mem,&len);
+	output = inflate_all(buf,len,0);
+	test_equal("flushed output",output,"<p>first</p>");
+	if (output!=(char*)NULL) {
+		free(output);
+	}
+
+	/* The level may change in the middle of the stream */
+	test_check("level of the chain",sink_deflate_level(def,1)==1);
+	test_check("no deflate sink in the chain",sink_deflate_level(mem,1)==0);
+
+	sink_push(def,"<p>second</p>",13);
+	sink_finish(def);
+	buf = sink_mem_get(mem,&len);
+	output = inflate_all(buf,len,1);
+	test_equal("output after a new level",output,"<p>first</p><p>second</p>");
+	if (output!=(char*)NULL) {
+		free(output);
+	}
+
+	sink_free(def);
+	sink_free(mem);
+}
+
+
+/*
+	Minify an input pushed in chunks of chunk bytes, 0 pushes all of
+	it at once. Returns the output, to be freed.
+*/
+char *minify( char *input, size_t chunk ) {
+	MHT_SINK
+		*mem = sink_mem_new(),
+		*min = sink_minify_new(mem);
+
+	char *output = (char*)NULL;
+	size_t
+		len = strlen(input),
+		i = 0;
+
+
+	if (chunk==0) {
+		chunk = len;
+	}
+	for (i=0; i<len; i+=chunk) {
+		sink_push(min,input+i,(len-i<chunk) ? len-i : chunk);
+	}
+	sink_finish(min);
+
+	output = strdup(sink_mem_get(mem,&len));
+	sink_free(min);
+	sink_free(mem);
+
+	return (output);
+}
+
+
+void test_minify(void) {
+	char
+		*input =
+			"<p>  a \n\n  b  </p>\n"
+			"<!-- x --><!--[if IE]>y<![endif]--><!--#include file=\"a\" -->\n"
+			"<pre>  k\n  l</pre> <a title=\"x   y\">  z</a>\n"
+			"<script> a  =  1; </script>",
+		*expected =
+			"<p> a\nb </p>\n"
+			"<!--[if IE]>y<![endif]--><!--#include file=\"a\" -->\n"
+			"<pre>  k\n  l</pre> <a title=\"x   y\"> z</a>\n"
+			"<script> a  =  1; </script>",
+		*output = (char*)NULL,
+		name[64];
+
+	size_t chunk = 0;
+
+
+	output = minify(input,0);
+	test_equal("minified",output,expected);
+	free(output);
+
+	/* Tags, comments and raw elements may be split anywhere */
+	for (chunk=1; chunk<=7; chunk++) {
+		sprintf(name,"minified in chunks of %lu",(unsigned long)chunk);
+		output = minify(input,chunk);
+		test_equal(name,output,expected);
+		free(output);
+	}
+
+	output = minify("<textarea>  a  </textarea>  <b>  </b>",0);
+	test_equal("textarea",output,"<textarea>  a  </textarea> <b> </b>");
+	free(output);
+}
+
+
+void test_filters(void) {
+	MHT_SINK
+		*mem = sink_mem_new(),
+		*kill = sink_killspace_new(mem),
+		*rep = (MHT_SINK*)NULL;
+
+	char
+		*strs[2] = { "&lt;", "&amp;" },
+		*buf = (char*)NULL;
+
+	size_t len = 0;
+
+
+	/* As "#mhtvar filter umlauts,killspace" chains them */
+	rep = sink_replace_new(kill,"<&",strs,2);
+
+	sink_push(rep,"  plain text  \n",15);
+	sink_push(rep,"\n",1);
+	sink_push(rep," a<b & c \n  last",16);
+	sink_finish(rep);
+
+	buf = sink_mem_get(mem,&len);
+	test_equal("replace and killspace",buf,"plain text a&lt;b &amp; c last ");
+
+	sink_free(rep);
+	sink_free(kill);
+	sink_free(mem);
+}
+
+
+void test_writev(void) {
+	FILE *fptr = (FILE*)NULL;
+	MHT_SINK
+		*wv = (MHT_SINK*)NULL,
+		*mem = sink_mem_new();
+
+	char
+		*path = test_path("writev.out"),
+		*expected = (char*)NULL,
+		*output = (char*)NULL,
+		line[32],
+		big[6000];
+
+	size_t len = 0;
+	long size = 0;
+	unsigned int i = 0;
+
+
+	if ((fptr=fopen(path,"w+"))==(FILE*)NULL) {
+		test_check("writev file",0);
+		return;
+	}
+
+	/* The output written to the stream before comes first */
+	fputs("head\n",fptr);
+	sink_push(mem,"head\n",5);
+
+	wv = sink_writev_new(fptr);
+	memset(big,'x',sizeof(big));
+
+	/* Copied and referenced chunks, more than a batch of either */
+	for (i=0; i<3000; i++) {
+		len = sprintf(line,"line %u\n",i);
+		sink_push(wv,line,len);
+		sink_push(mem,line,len);
+
+		if (i%100==0) {
+			sink_push_ref(wv,"static text\n",12);
+			sink_push(mem,"static text\n",12);
+		}
+		if (i%1000==0) {
+			sink_push(wv,big,sizeof(big));
+			sink_push(mem,big,sizeof(big));
+		}
+	}
+	sink_finish(wv);
+
+	expected = sink_mem_get(mem,&len);
+
+	fseek(fptr,0,SEEK_END);
+	size = ftell(fptr);
+	rewind(fptr);
+
+	output = (char*)_malloc(size+1);
+	output[fread(output,1,size,fptr)] = '\0';
+	fclose(fptr);
+
+	test_check("writev size",(size_t)size==len);
+	test_check("writev output",strcmp(output,expected)==0);
+
+	free(output);
+	sink_free(wv);
+	sink_free(mem);
+}
+
+
+int main( int argc, char **argv ) {
+	test_deflate();
+	test_deflate_flush();
+	test_minify();
+	test_filters();
+	test_writev();
+
+	return (test_result("sink_test"));
+}
@@ -3,12 +3,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <ctype.h>
 
 #include "str_util.h"
 #include "mem.h"
 #include "mht_defs.h"
 
+
+/*
+	The length of the escape sequence of each char in each escape mode,
+	0 if the char is copied as is. Initialized by str_escape_init.
+*/
+unsigned char str_esc_len[STR_ESC_MODES][256];
+int str_esc_initialized = 0;
+
+char str_hex_digits[] = "0123456789ABCDEF";
+
+
+/* Prototypes: */
+unsigned int str_escape_char( unsigned char c, int mode, char *buf );
+
 /*
 	Insert "insert_str" into "dest_str" at pos "insert_pos" by replacing
 	"replace_len" chars. "end_len" is the length textblock at the end that
@@ -130,3 +145,284 @@ int _str_len( char *str ) {
 	if (str==(char*)NULL) return (0);
 	return (strlen(str));
 }
+
+
+/*
+	Return a pointer to the first char a or b in [ptr,end), or end.
+	Runs without a or b are skipped a word at a time.
+*/
+char *memscan2( char *ptr, char *end, char a, char b ) {
+	unsigned long
+		word = 0,
+		pattern_a = WORD_ONES*(unsigned char)a,
+		pattern_b = WORD_ONES*(unsigned char)b;
+
+	while (ptr+sizeof(unsigned long)<=end) {
+		memcpy(&word,ptr,sizeof(unsigned long));
+		if (HASZERO(word^pattern_a) | HASZERO(word^pattern_b)) {
+			break;
+		}
+		ptr += sizeof(unsigned long);
+	}
+
+	while (ptr<end && *ptr!=a && *ptr!=b) {
+		ptr++;
+	}
+
+	return (ptr);
+}
+
+
+/*
+	Fill the table of the escape sequence lengths.
+*/
+void str_escape_init(void) {
+	unsigned int c = 0;
+	int mode = 0;
+	char buf[8];
+
+	for (mode=0; mode<STR_ESC_MODES; mode++) {
+		for (c=0; c<256; c++) {
+			str_esc_len[mode][c] = (unsigned char)str_escape_char((unsigned char)c,mode,buf);
+		}
+	}
+
+	str_esc_initialized = 1;
+}
+
+
+/*
+	Write the escape sequence of c into buf and return its length, or
+	return 0 if c needs no escaping in this mode.
+*/
+unsigned int str_escape_char( unsigned char c, int mode, char *buf ) {
+	switch (mode) {
+		case STR_ESC_HTML:
+		case STR_ESC_ATTR:
+			switch (c) {
+				case '&':
+					memcpy(buf,"&amp;",5);
+					return (5);
+				case '<':
+					memcpy(buf,"&lt;",4);
+					return (4);
+				case '>':
+					memcpy(buf,"&gt;",4);
+					return (4);
+				case '"':
+					memcpy(buf,"&quot;",6);
+					return (6);
+				case '\'':
+					memcpy(buf,"&#39;",5);
+					return (5);
+			}
+
+			if (mode==STR_ESC_ATTR && (c<=' ' || c=='`' || c=='=')) {
+				return ((unsigned int)sprintf(buf,"&#%d;",(int)c));
+			}
+			return (0);
+
+		case STR_ESC_JS:
+			if (c<' ' || strchr("\\'\"<>&/",c)!=(char*)NULL) {
+				buf[0] = '\\';
+				buf[1] = 'x';
+				buf[2] = str_hex_digits[c>>4];
+				buf[3] = str_hex_digits[c&15];
+				return (4);
+			}
+			return (0);
+
+		case STR_ESC_URL:
+		case STR_ESC_QUERY:
+			if (isalnum(c) && c<128) {
+				return (0);
+			}
+			if (mode==STR_ESC_URL && (c=='-' || c=='_' || c=='.' || c=='~')) {
+				return (0);
+			}
+			if (mode==STR_ESC_QUERY && c==' ') {
+				buf[0] = '+';
+				return (1);
+			}
+			buf[0] = '%';
+			buf[1] = str_hex_digits[c>>4];
+			buf[2] = str_hex_digits[c&15];
+			return (3);
+	}
+
+	return (0);
+}
+
+
+/*
+	Find the first char between ptr and end that has to be escaped.
+	The HTML and JavaScript modes test a word at a time and skip the
+	runs which need no escaping (as memscan2), the URL modes escape
+	too many chars for this to pay off.
+*/
+char *str_escape_scan( char *ptr, char *end, int mode ) {
+	unsigned long word = 0;
+
+	if (str_esc_initialized==0) {
+		str_escape_init();
+	}
+
+	if (mode==STR_ESC_HTML) {
+		while (ptr+sizeof(unsigned long)<=end) {
+			memcpy(&word,ptr,sizeof(unsigned long));
+			if (HASBYTE(word,'&') | HASBYTE(word,'<') | HASBYTE(word,'>') | HASBYTE(word,'"') | HASBYTE(word,'\'')) {
+				break;
+			}
+			ptr += sizeof(unsigned long);
+		}
+	}
+	else if (mode==STR_ESC_ATTR) {
+		while (ptr+sizeof(unsigned long)<=end) {
+			memcpy(&word,ptr,sizeof(unsigned long));
+			if (HASLESS(word,'!') | HASBYTE(word,'&') | HASBYTE(word,'<') | HASBYTE(word,'>') | HASBYTE(word,'"') | HASBYTE(word,'\'') | HASBYTE(word,'`') | HASBYTE(word,'=')) {
+				break;
+			}
+			ptr += sizeof(unsigned long);
+		}
+	}
+	else if (mode==STR_ESC_JS) {
+		while (ptr+sizeof(unsigned long)<=end) {
+			memcpy(&word,ptr,sizeof(unsigned long));
+			if (HASLESS(word,' ') | HASBYTE(word,'\\') | HASBYTE(word,'\'') | HASBYTE(word,'"') | HASBYTE(word,'<') | HASBYTE(word,'>') | HASBYTE(word,'&') | HASBYTE(word,'/')) {
+				break;
+			}
+			ptr += sizeof(unsigned long);
+		}
+	}
+
+	while (ptr<end && str_esc_len[mode][(unsigned char)*ptr]==0) {
+		ptr++;
+	}
+
+	return (ptr);
+}
+
+
+/*
+	The exact length of src after escaping, without the terminating '\0'.
+*/
+size_t str_escape_len( char *src, size_t len, int mode ) {
+	char
+		*ptr = src,
+		*end = src+len;
+	size_t result = len;
+
+	while ((ptr=str_escape_scan(ptr,end,mode))<end) {
+		result += str_esc_len[mode][(unsigned char)*ptr]-1;
+		ptr++;
+	}
+
+	return (result);
+}
+
+
+/*
+	Escape len chars of src into dst, which has room for size chars
+	including the terminating '\0'. The runs which need no escaping are
+	copied as a whole. If dst is too small, the result is truncated
+	before the first escape sequence that does not fit. Returns the
+	length of the result.
+*/
+size_t str_escape( char *dst, size_t size, char *src, size_t len, int mode ) {
+	char
+		*ptr = src,
+		*run = src,
+		*end = src+len,
+		*out = dst,
+		*out_end = dst+size-1;
+	unsigned int esc_len = 0;
+
+	if (size==0) {
+		return (0);
+	}
+
+	while (run<end) {
+		ptr = str_escape_scan(run,end,mode);
+
+		if ((size_t)(ptr-run) > (size_t)(out_end-out)) {
+			ptr = run+(out_end-out);
+		}
+		memcpy(out,run,ptr-run);
+		out += ptr-run;
+
+		if (ptr>=end || out>=out_end) {
+			break;
+		}
+
+		esc_len = str_esc_len[mode][(unsigned char)*ptr];
+		if (esc_len > (unsigned int)(out_end-out)) {
+			break;
+		}
+		str_escape_char((unsigned char)*ptr,mode,out);
+		out += esc_len;
+		run = ptr+1;
+	}
+
+	*out = '\0';
+
+	return (out-dst);
+}
+
+
+/*
+	A fast 128 bit hash of a buffer (not for security), e.g. for ETags.
+	Four lanes each take every 4th 32 bit word; they don't depend on each
+	other, so the compiler can keep all of them in one vector register.
+	The lanes are mixed at the end. The result depends on the byte order.
+*/
+#define STR_HASH_ROTL(x,r)	(((x) << (r)) | ((x) >> (32-(r))))
+
+void str_hash128( char *ptr, size_t len, unsigned int *h ) {
+	unsigned int
+		w[4],
+		i = 0;
+
+	char *end = ptr+len;
+
+
+	h[0] = 0x9e3779b1U ^ (unsigned int)len;
+	h[1] = 0x85ebca77U;
+	h[2] = 0xc2b2ae3dU;
+	h[3] = 0x27d4eb2fU;
+
+	while (ptr+sizeof(w)<=end) {
+		memcpy(w,ptr,sizeof(w));
+		ptr += sizeof(w);
+
+		for (i=0; i<4; i++) {
+			h[i] += w[i] * 0x85ebca77U;
+			h[i] = STR_HASH_ROTL(h[i],13);
+			h[i] *= 0x9e3779b1U;
+		}
+	}
+
+	/* The tail is padded with zeros, the length is part of the hash */
+	if (ptr<end) {
+		memset(w,0,sizeof(w));
+		memcpy(w,ptr,end-ptr);
+
+		for (i=0; i<4; i++) {
+			h[i] += w[i] * 0x85ebca77U;
+			h[i] = STR_HASH_ROTL(h[i],13);
+			h[i] *= 0x9e3779b1U;
+		}
+	}
+
+	for (i=0; i<4; i++) {
+		h[i] ^= h[i] >> 16;
+		h[i] *= 0x85ebca6bU;
+		h[i] ^= h[i] >> 13;
+		h[i] *= 0xc2b2ae35U;
+		h[i] ^= h[i] >> 16;
+	}
+
+	h[0] += h[1]+h[2]+h[3];
+	h[1] += h[0];
+	h[2] += h[0];
+	h[3] += h[0];
+}
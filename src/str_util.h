@@ -4,4 +4,32 @@ char *strinsert( char *dest_str, char *insert_str, unsigned int replace_len, cha
 char *strlwr( char *str );
 int strsplit( char *str, char **args, char sepchar, unsigned int max_arg_count );
 int _str_len( char *str );
+char *memscan2( char *ptr, char *end, char a, char b );
+void str_escape_init(void);
+char *str_escape_scan( char *ptr, char *end, int mode );
+size_t str_escape_len( char *src, size_t len, int mode );
+size_t str_escape( char *dst, size_t size, char *src, size_t len, int mode );
+void str_hash128( char *ptr, size_t len, unsigned int *h );
+
+/* Escape modes of str_escape */
+#define STR_ESC_HTML		0	/* & < > " ' as entities */
+#define STR_ESC_ATTR		1	/* As STR_ESC_HTML, also ` = spaces and control chars, safe in unquoted attributes */
+#define STR_ESC_JS			2	/* \ ' " < > & / and control chars as \xHH, safe in JavaScript strings */
+#define STR_ESC_URL			3	/* All but A-Z a-z 0-9 - _ . ~ as %HH */
+#define STR_ESC_QUERY		4	/* As STR_ESC_URL, but ' ' as '+' and only A-Z a-z 0-9 unescaped */
+#define STR_ESC_MODES		5
+
+/*
+	Test all chars of a word at once: HASZERO(x) is non-zero,
+	if one of the bytes of the word x is zero.
+*/
+#define WORD_ONES			((unsigned long)-1/0xff)
+#define WORD_HIGHS			(WORD_ONES*0x80)
+#define HASZERO(x)			(((x)-WORD_ONES) & ~(x) & WORD_HIGHS)
+
+/* HASLESS(x,n) is non-zero, if one of the bytes of x is less than n (n<=128) */
+#define HASLESS(x,n)		(((x)-WORD_ONES*(n)) & ~(x) & WORD_HIGHS)
+
+/* HASBYTE(x,c) is non-zero, if one of the bytes of x is c */
+#define HASBYTE(x,c)		HASZERO((x)^(WORD_ONES*(unsigned char)(c)))
 
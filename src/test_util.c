@@ -0,0 +1,202 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "test_util.h"
+#include "mht.h"
+#include "sink.h"
+#include "mem.h"
+
+
+/* Definitions: */
+#define TEST_MAX_PATHS		256
+
+
+/* Global vars: */
+unsigned int
+	test_passed = 0,
+	test_failed = 0,
+	test_path_count = 0;
+
+char
+	test_dir[64] = "",
+	*test_paths[TEST_MAX_PATHS];
+
+
+/*
+	Count a case, a failed one is reported.
+*/
+void test_check( char *name, int ok ) {
+	if (ok) {
+		test_passed++;
+	}
+	else {
+		test_failed++;
+		fprintf(stderr,"FAIL: %s\n",name);
+	}
+}
+
+
+/*
+	A case whose result has to be the expected string.
+*/
+void test_equal( char *name, char *got, char *expected ) {
+	if (got!=(char*)NULL && strcmp(got,expected)==0) {
+		test_passed++;
+	}
+	else {
+		test_failed++;
+		fprintf(stderr,"FAIL: %s\n  expected: \"%s\"\n  got:      \"%s\"\n",name,expected,(got!=(char*)NULL) ? got : "(null)");
+	}
+}
+
+
+/*
+	A case whose result has to contain a string.
+*/
+void test_contains( char *name, char *got, char *part ) {
+	if (got!=(char*)NULL && strstr(got,part)!=(char*)NULL) {
+		test_passed++;
+	}
+	else {
+		test_failed++;
+		fprintf(stderr,"FAIL: %s\n  expected to contain: \"%s\"\n  got: \"%s\"\n",name,part,(got!=(char*)NULL) ? got : "(null)");
+	}
+}
+
+
+/*
+	Return the path of a file of the test, the file is removed by
+	test_result.
+*/
+char *test_path( char *name ) {
+	char *path = (char*)NULL;
+	unsigned int i = 0;
+
+	if (test_dir[0]=='\0') {
+		sprintf(test_dir,"/tmp/mht_test.%ld",(long)getpid());
+		mkdir(test_dir,0700);
+	}
+
+	path = (char*)_malloc(strlen(test_dir)+strlen(name)+2);
+	sprintf(path,"%s/%s",test_dir,name);
+
+	for (i=0; i<test_path_count; i++) {
+		if (strcmp(test_paths[i],path)==0) {
+			free(path);
+			return (test_paths[i]);
+		}
+	}
+
+	if (test_path_count<TEST_MAX_PATHS) {
+		test_paths[test_path_count++] = path;
+	}
+	return (path);
+}
+
+
+/*
+	Write a file of the test, returns its path. The content may
+	contain '\0' if len is given, otherwise len is 0.
+*/
+char *test_file( char *name, char *content, size_t len ) {
+	FILE *fptr = (FILE*)NULL;
+	char *path = test_path(name);
+
+	if ((fptr=fopen(path,"wb"))!=(FILE*)NULL) {
+		fwrite(content,1,(len>0) ? len : strlen(content),fptr);
+		fclose(fptr);
+	}
+
+	return (path);
+}
+
+
+/*
+	Render a template in the current state. Returns the output, to be
+	freed.
+*/
+char *test_process( char *template, int *mht_err ) {
+	MHT_SINK *sink = sink_mem_new();
+	char
+		*fname = test_file("render.mht",template,0),
+		*output = (char*)NULL,
+		*buf = (char*)NULL;
+
+	size_t len = 0;
+	int err = 0;
+
+
+	mht_set_sink(sink);
+	err = mht_quickopen(stdout,fname);
+	mht_set_sink((MHT_SINK*)NULL);
+	sink_finish(sink);
+
+	buf = sink_mem_get(sink,&len);
+	output = (char*)_malloc(len+1);
+	memcpy(output,buf,len);
+	output[len] = '\0';
+
+	sink_free(sink);
+
+	if (mht_err!=(int*)NULL) {
+		*mht_err = err;
+	}
+	return (output);
+}
+
+
+/*
+	Render a template in a state of its own, setup (if not NULL) is
+	called for the state first. Returns the output, to be freed.
+*/
+char *test_render( char *template, void (*setup)(void), int *mht_err ) {
+	struct MHT_INFO_S
+		*state = mht_state_new(),
+		*prev = mht_state_switch(state);
+
+	char *output = (char*)NULL;
+
+
+	if (setup!=NULL) {
+		setup();
+	}
+
+	output = test_process(template,mht_err);
+
+	mht_state_switch(prev);
+	mht_state_free(state);
+
+	return (output);
+}
+
+
+/*
+	Print the result of a test and remove its files. Returns the exit
+	code of the test.
+*/
+int test_result( char *test_name ) {
+	unsigned int i = 0;
+
+	for (i=0; i<test_path_count; i++) {
+		unlink(test_paths[i]);
+		free(test_paths[i]);
+	}
+	test_path_count = 0;
+
+	if (test_dir[0]!='\0') {
+		rmdir(test_dir);
+	}
+
+	fprintf(stdout,"%s: %u passed, %u failed\n",test_name,test_passed,test_failed);
+	return ((test_failed>0) ? 1 : 0);
+}
@@ -0,0 +1,18 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/*
+	The helpers of the tests, see "make test". Each *_test.c is a
+	program which runs its cases and exits with 1 if a case failed.
+	The files of a test are written to a directory of its own, which
+	is removed by test_result.
+*/
+
+/* Prototypes: */
+void test_check( char *name, int ok );
+void test_equal( char *name, char *got, char *expected );
+void test_contains( char *name, char *got, char *part );
+char *test_path( char *name );
+char *test_file( char *name, char *content, size_t len );
+char *test_process( char *template, int *mht_err );
+char *test_render( char *template, void (*setup)(void), int *mht_err );
+int test_result( char *test_name );
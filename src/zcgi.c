@@ -0,0 +1,194 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+/*
+	The launcher of the MHT zygote (see zygote.c), installed as the CGI
+	instead of a program linked with libcgimht. It passes its environment,
+	stdin, stdout and stderr to the zygote, which renders the request in
+	a forked child, and exits with the status of the child.
+
+	The socket of the zygote is ZCGI_SOCKET in the directory of the user,
+	or as set in MHTZYGOTE. The environment holds the cookies and the
+	stdin the POST data of the request, so the launcher only connects if
+	no one else can have made the socket: its directory must belong to
+	the user or root, and must not be writable by others.
+*/
+
+
+/* Definitions: */
+#define ZCGI_SOCKET		"/tmp/mht-%lu/zygote"	/* As the default of the zygote */
+#define ZCGI_FDS		3
+
+
+extern char **environ;
+
+
+/* Prototypes: */
+int main( int argc, char **argv );
+int zcgi_dir( char *path );
+void zcgi_unavailable(void);
+
+
+int main( int argc, char **argv ) {
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct iovec iov[2];
+	struct cmsghdr *cmsg = (struct cmsghdr*)NULL;
+
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(ZCGI_FDS*sizeof(int))];
+	} control;
+
+	char
+		*path = getenv("MHTZYGOTE"),
+		*env = (char*)NULL,
+		*ptr = (char*)NULL,
+		default_path[64];
+
+	unsigned char
+		header[4],
+		reply[4];
+
+	size_t
+		env_len = 0,
+		len = 0;
+
+	ssize_t n = 0;
+	int
+		fds[ZCGI_FDS] = { 0, 1, 2 },
+		fd = -1,
+		i = 0;
+
+
+	if (path==(char*)NULL) {
+		sprintf(default_path,ZCGI_SOCKET,(unsigned long)getuid());
+		path = default_path;
+	}
+
+	if (zcgi_dir(path)==0) {
+		zcgi_unavailable();
+		return (1);
+	}
+
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path,path,sizeof(addr.sun_path)-1);
+
+	if ((fd=socket(AF_UNIX,SOCK_STREAM,0))<0 || connect(fd,(struct sockaddr*)&addr,sizeof(addr))!=0) {
+		zcgi_unavailable();
+		return (1);
+	}
+
+	/* The environment: "NAME=value" strings, each ending with '\0' */
+	for (i=0; environ[i]!=(char*)NULL; i++) {
+		env_len += strlen(environ[i])+1;
+	}
+	env = (char*)malloc(env_len+1);
+	for (i=0,ptr=env; environ[i]!=(char*)NULL; i++) {
+		strcpy(ptr,environ[i]);
+		ptr += strlen(ptr)+1;
+	}
+
+	header[0] = (unsigned char)(env_len>>24);
+	header[1] = (unsigned char)(env_len>>16);
+	header[2] = (unsigned char)(env_len>>8);
+	header[3] = (unsigned char)env_len;
+
+	/* The file descriptors are attached to the header */
+	memset(&msg,0,sizeof(msg));
+	memset(&control,0,sizeof(control));
+	iov[0].iov_base = header;
+	iov[0].iov_len = sizeof(header);
+	iov[1].iov_base = env;
+	iov[1].iov_len = env_len;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(ZCGI_FDS*sizeof(int));
+	memcpy(CMSG_DATA(cmsg),fds,ZCGI_FDS*sizeof(int));
+
+	while ((n=sendmsg(fd,&msg,0))<0 && errno==EINTR);
+	if (n<(ssize_t)sizeof(header)) {
+		zcgi_unavailable();
+		return (1);
+	}
+
+	/* A large environment may be sent in pieces */
+	for (len=n-sizeof(header); len<env_len; len+=n) {
+		if ((n=write(fd,env+len,env_len-len))<0 && errno==EINTR) {
+			n = 0;
+		}
+		else if (n<=0) {
+			return (1);
+		}
+	}
+
+	/* Wait for the child of the zygote, the output is written by it */
+	for (len=0; len<sizeof(reply); len+=n) {
+		if ((n=read(fd,reply+len,sizeof(reply)-len))<0 && errno==EINTR) {
+			n = 0;
+		}
+		else if (n<=0) {
+			return (1);
+		}
+	}
+
+	return (reply[3]);
+}
+
+
+/*
+	Check the directory of the socket path, see zygote_dir in zygote.c.
+	Returns 1 if the directory is private, 0 otherwise.
+*/
+int zcgi_dir( char *path ) {
+	struct stat st;
+	char dir[1024];
+	size_t len = (strrchr(path,'/')!=(char*)NULL) ? (size_t)(strrchr(path,'/')-path) : 0;
+
+
+	if (len>=sizeof(dir)) {
+		return (0);
+	}
+	if (len==0) {
+		strcpy(dir,(path[0]=='/') ? "/" : ".");
+	}
+	else {
+		memcpy(dir,path,len);
+		dir[len] = '\0';
+	}
+
+	if (lstat(dir,&st)!=0 || !S_ISDIR(st.st_mode) || (st.st_uid!=getuid() && st.st_uid!=0) || (st.st_mode&022)!=0) {
+		return (0);
+	}
+
+	return (1);
+}
+
+
+/*
+	The zygote is not running, or its socket is not safe to use.
+*/
+void zcgi_unavailable(void) {
+	fprintf(stdout,"Status: 503 Service Unavailable\nContent-type: text/plain\n\nThe MHT zygote is not running.\n");
+}
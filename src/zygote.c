@@ -0,0 +1,362 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#define _GNU_SOURCE		/* struct ucred of SO_PEERCRED */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "zygote.h"
+#include "mht.h"
+#include "cgi.h"
+#include "sink.h"
+#include "mem.h"
+
+
+/* Definitions: */
+#define ZYGOTE_MAX_ENV		1048576		/* The max. length of the environment of a request */
+#define ZYGOTE_FDS			3			/* stdin, stdout and stderr of the CGI */
+#define ZYGOTE_DIR			"/tmp/mht-%lu"	/* The directory of the socket of a user, see zcgi.c */
+#define ZYGOTE_SOCKET		"zygote"
+
+
+extern char **environ;
+
+
+/* Prototypes: */
+int zygote_dir( char *path, int create );
+int zygote_peer( int conn, uid_t uid );
+void zygote_child( int conn );
+int zygote_recv( int conn, char **env, size_t *env_len, int *fds );
+int zygote_read( int fd, char *buf, size_t len );
+
+
+/*
+	The zygote of a CGI: a resident process which has read the prologue
+	of a site (macros, blocks, dictionaries) once, and forks a child for
+	each request. The child renders the request as a CGI would, but with
+	the warm heap of the zygote instead of a cold start.
+
+	A request comes from the launcher (see zcgi.c), which is started by
+	the web server as the CGI. It passes its environment and its stdin,
+	stdout and stderr over the Unix socket path, and waits for the exit
+	status of the child. The template of a request is PATH_TRANSLATED
+	(e.g. a handler for *.mht) or SCRIPT_FILENAME.
+
+	A child renders any template a request names, with the rights of
+	the zygote. The socket is therefore only open to the user of the
+	zygote, or to the user set in MHTZYGOTEUID (mode 0660 then, the web
+	server has to be in the group of the zygote), and its directory must
+	not be writable by others, or the socket could be replaced. If path
+	is NULL or "-", the socket is ZYGOTE_SOCKET in the directory of the
+	user ZYGOTE_DIR, which is created if needed.
+
+	Returns 0 if the zygote cannot start, it never returns otherwise.
+*/
+int zygote_run( char *path, char *prologue ) {
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	char
+		*msg = (char*)NULL,
+		*uid_env = getenv("MHTZYGOTEUID"),
+		default_path[64];
+
+	uid_t uid = (uid_env!=(char*)NULL) ? (uid_t)atol(uid_env) : getuid();
+	mode_t mask = 0;
+	int
+		fd = -1,
+		conn = -1,
+		create = 0,
+		mht_err = 0;
+
+
+	if (prologue!=(char*)NULL && (mht_err=mht_quickopen(stdout,prologue))!=0) {
+		fprintf(stdout,"Cannot read the prologue %s: %s\n",prologue,(mht_search_macro("mht_err_msg",&msg)!=0) ? msg : "");
+		return (0);
+	}
+
+	if (path==(char*)NULL || strcmp(path,"-")==0) {
+		sprintf(default_path,ZYGOTE_DIR "/" ZYGOTE_SOCKET,(unsigned long)getuid());
+		path = default_path;
+		create = 1;
+	}
+
+	if (zygote_dir(path,create)==0) {
+		fprintf(stdout,"The directory of %s must belong to the user of the zygote (or root) and must not be writable by others!\n",path);
+		return (0);
+	}
+
+	if (strlen(path)>=sizeof(addr.sun_path) || (fd=socket(AF_UNIX,SOCK_STREAM,0))<0) {
+		return (0);
+	}
+
+	memset(&addr,0,sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path,path);
+	unlink(path);
+
+	/* The socket is never open to others, not even between bind and chmod */
+	mask = umask(077);
+	if (bind(fd,(struct sockaddr*)&addr,sizeof(addr))!=0 || chmod(path,(uid!=getuid()) ? 0660 : 0600)!=0 || listen(fd,SOMAXCONN)!=0) {
+		umask(mask);
+		fprintf(stdout,"Cannot listen on %s!\n",path);
+		close(fd);
+		return (0);
+	}
+	umask(mask);
+
+	/* The children are reaped by the system, the zygote never waits for them */
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	sigaction(SIGCHLD,&sa,(struct sigaction*)NULL);
+	sigaction(SIGPIPE,&sa,(struct sigaction*)NULL);
+
+	fprintf(stdout,"Zygote listening on %s\n",path);
+	fflush(stdout);
+
+	for (;;) {
+		if ((conn=accept(fd,(struct sockaddr*)NULL,(socklen_t*)NULL))<0) {
+			if (errno==EINTR || errno==ECONNABORTED) {
+				continue;
+			}
+			return (0);
+		}
+
+		if (zygote_peer(conn,uid)==0) {
+			close(conn);
+			continue;
+		}
+
+		/* The request is read by the child, the zygote only accepts */
+		if (fork()==0) {
+			close(fd);
+			zygote_child(conn);
+		}
+		close(conn);
+	}
+}
+
+
+/*
+	Check the directory of the socket path: it has to belong to the
+	user or root, and must not be writable by group or others. It is
+	created (mode 0700) if create is 1. Returns 1 if the directory is
+	private, 0 otherwise.
+*/
+int zygote_dir( char *path, int create ) {
+	struct stat st;
+	char dir[1024];
+	size_t len = (strrchr(path,'/')!=(char*)NULL) ? (size_t)(strrchr(path,'/')-path) : 0;
+
+
+	if (len>=sizeof(dir)) {
+		return (0);
+	}
+	if (len==0) {
+		strcpy(dir,(path[0]=='/') ? "/" : ".");
+	}
+	else {
+		memcpy(dir,path,len);
+		dir[len] = '\0';
+	}
+
+	if (create==1 && mkdir(dir,0700)!=0 && errno!=EEXIST) {
+		return (0);
+	}
+
+	if (lstat(dir,&st)!=0 || !S_ISDIR(st.st_mode) || (st.st_uid!=getuid() && st.st_uid!=0) || (st.st_mode&022)!=0) {
+		return (0);
+	}
+
+	return (1);
+}
+
+
+/*
+	Check the user of the process on the other end of a connection.
+	Returns 1 if it is uid, 0 otherwise.
+*/
+int zygote_peer( int conn, uid_t uid ) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(conn,SOL_SOCKET,SO_PEERCRED,&cred,&len)!=0 || len!=sizeof(cred)) {
+		return (0);
+	}
+
+	return ((cred.uid==uid) ? 1 : 0);
+}
+
+
+/*
+	Render a request in a forked child and send the exit status.
+*/
+void zygote_child( int conn ) {
+	char
+		*env = (char*)NULL,
+		*ptr = (char*)NULL,
+		*fname = (char*)NULL,
+		*msg = (char*)NULL,
+		**vars = (char**)NULL;
+
+	size_t
+		env_len = 0,
+		count = 0;
+
+	int
+		fds[ZYGOTE_FDS],
+		status = 1,
+		mht_err = 0,
+		i = 0;
+
+	MHT_SINK *sink = (MHT_SINK*)NULL;
+	unsigned char reply[4];
+
+
+	if (zygote_recv(conn,&env,&env_len,fds)==0) {
+		_exit(1);
+	}
+
+	/* The environment of the launcher replaces the one of the zygote */
+	for (ptr=env; ptr<env+env_len; ptr+=strlen(ptr)+1) {
+		count++;
+	}
+	vars = (char**)_malloc((count+1)*sizeof(char*));
+	for (ptr=env,count=0; ptr<env+env_len; ptr+=strlen(ptr)+1) {
+		vars[count++] = ptr;
+	}
+	vars[count] = (char*)NULL;
+	environ = vars;
+
+	for (i=0; i<ZYGOTE_FDS; i++) {
+		dup2(fds[i],i);
+		if (fds[i]>=ZYGOTE_FDS) {
+			close(fds[i]);
+		}
+	}
+	clearerr(stdin);
+	clearerr(stdout);
+
+	if ((fname=getenv("PATH_TRANSLATED"))==(char*)NULL && (fname=getenv("SCRIPT_FILENAME"))==(char*)NULL) {
+		cgi_err_msg("No template given!");
+	}
+	else {
+		cgi_init();
+
+		/* Rendered as by mht2html -p, the output is written in batches */
+		sink = sink_writev_new(stdout);
+		mht_set_sink(sink);
+		mht_err = mht_quickopen(stdout,fname);
+		mht_set_sink((MHT_SINK*)NULL);
+		sink_finish(sink);
+		sink_free(sink);
+
+		if (mht_err!=0) {
+			cgi_err_msg((mht_search_macro("mht_err_msg",&msg)!=0) ? msg : "MHT error");
+		}
+		else {
+			status = 0;
+		}
+	}
+
+	fflush(stdout);
+
+	reply[0] = reply[1] = reply[2] = 0;
+	reply[3] = (unsigned char)status;
+	write(conn,reply,4);
+	_exit(status);
+}
+
+
+/*
+	Read a request of the launcher: the length of the environment (4
+	bytes, big endian) with the file descriptors attached, followed by
+	the "NAME=value" strings of the environment, each ending with '\0'.
+	Returns 1 on success, 0 otherwise.
+*/
+int zygote_recv( int conn, char **env, size_t *env_len, int *fds ) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg = (struct cmsghdr*)NULL;
+	unsigned char header[4];
+	ssize_t len = 0;
+	int i = 0;
+
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(ZYGOTE_FDS*sizeof(int))];
+	} control;
+
+
+	memset(&msg,0,sizeof(msg));
+	iov.iov_base = header;
+	iov.iov_len = sizeof(header);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	while ((len=recvmsg(conn,&msg,0))<0 && errno==EINTR);
+
+	if (len<=0 || (cmsg=CMSG_FIRSTHDR(&msg))==(struct cmsghdr*)NULL || cmsg->cmsg_level!=SOL_SOCKET
+		|| cmsg->cmsg_type!=SCM_RIGHTS || cmsg->cmsg_len!=CMSG_LEN(ZYGOTE_FDS*sizeof(int))) {
+		return (0);
+	}
+
+	memcpy(fds,CMSG_DATA(cmsg),ZYGOTE_FDS*sizeof(int));
+
+	/* The rest of the header may come later */
+	if (len<(ssize_t)sizeof(header) && zygote_read(conn,(char*)header+len,sizeof(header)-len)==0) {
+		return (0);
+	}
+
+	*env_len = ((size_t)header[0]<<24)|((size_t)header[1]<<16)|((size_t)header[2]<<8)|header[3];
+	if (*env_len>ZYGOTE_MAX_ENV) {
+		return (0);
+	}
+
+	*env = (char*)_malloc(*env_len+1);
+	if (zygote_read(conn,*env,*env_len)==0) {
+		return (0);
+	}
+	(*env)[*env_len] = '\0';
+
+	for (i=0; i<ZYGOTE_FDS; i++) {
+		if (fds[i]<0) {
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+
+/*
+	Read exactly len bytes, returns 1 on success, 0 otherwise.
+*/
+int zygote_read( int fd, char *buf, size_t len ) {
+	ssize_t n = 0;
+
+	while (len>0) {
+		if ((n=read(fd,buf,len))<0 && errno==EINTR) {
+			continue;
+		}
+		if (n<=0) {
+			return (0);
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return (1);
+}
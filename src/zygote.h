@@ -0,0 +1,8 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+/*
+	Run the zygote of a CGI on the Unix socket path (NULL or "-" for the
+	socket of the user), after the prologue (if not NULL) is read, see
+	zygote.c and zcgi.c.
+*/
+int zygote_run( char *path, char *prologue );
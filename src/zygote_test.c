@@ -0,0 +1,174 @@
+/* Copyright (C) 2003 Thomas Weckert */
+
+#ifndef WIN32
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "zygote.h"
+#include "mht.h"
+#include "mem.h"
+#include "test_util.h"
+
+
+/*
+	The tests of the zygote: zygotes run in child processes, the
+	requests are sent by the launcher zcgi, as by a web server.
+*/
+
+
+/*
+	Start a zygote on path, uid is the user allowed to connect, or NULL
+	for the user of the zygote. Returns its process.
+*/
+pid_t zygote( char *path, char *uid ) {
+	pid_t pid = 0;
+
+	if ((pid=fork())==0) {
+		freopen("/dev/null","w",stdout);
+		if (uid!=(char*)NULL) {
+			setenv("MHTZYGOTEUID",uid,1);
+		}
+		mht_init();
+		zygote_run(path,(char*)NULL);
+		_exit(1);
+	}
+
+	return (pid);
+}
+
+
+/*
+	Run the launcher for a template with a query. Returns the output,
+	to be freed.
+*/
+char *launch( char *path, char *fname, char *query ) {
+	char
+		*output = (char*)_calloc(1,1),
+		buf[4096];
+
+	size_t output_len = 0;
+	ssize_t n = 0;
+	int
+		fds[2],
+		i = 0;
+
+	pid_t pid = 0;
+	struct stat st;
+
+
+	/* The zygote may not listen yet */
+	for (i=0; i<100 && stat(path,&st)!=0; i++) {
+		usleep(20000);
+	}
+
+	pipe(fds);
+	if ((pid=fork())==0) {
+		dup2(fds[1],1);
+		close(fds[0]);
+		close(fds[1]);
+		setenv("MHTZYGOTE",path,1);
+		setenv("PATH_TRANSLATED",fname,1);
+		setenv("REQUEST_METHOD","GET",1);
+		setenv("QUERY_STRING",query,1);
+		execl("./zcgi","zcgi",(char*)NULL);
+		_exit(1);
+	}
+	close(fds[1]);
+
+	while ((n=read(fds[0],buf,sizeof(buf)))>0) {
+		output = (char*)_realloc(output,output_len+n+1);
+		memcpy(output+output_len,buf,n);
+		output_len += n;
+		output[output_len] = '\0';
+	}
+	close(fds[0]);
+	waitpid(pid,(int*)NULL,0);
+
+	return (output);
+}
+
+
+void test_requests( char *fname ) {
+	struct stat st;
+	char
+		*path = test_path("zygote"),
+		*output = (char*)NULL;
+
+	pid_t pid = zygote(path,(char*)NULL);
+
+
+	output = launch(path,fname,"name=Z");
+	test_contains("request",output,"hello Z\n");
+	free(output);
+
+	output = launch(path,fname,"name=Y");
+	test_contains("next request",output,"hello Y\n");
+	free(output);
+
+	test_check("socket of the user only",stat(path,&st)==0 && (st.st_mode&0777)==0600);
+
+	kill(pid,SIGTERM);
+	waitpid(pid,(int*)NULL,0);
+}
+
+
+void test_access( char *fname ) {
+	char
+		*dir = test_path("open"),
+		*open_path = test_path("open/zygote"),
+		*path = test_path("other"),
+		*output = (char*)NULL,
+		uid[32];
+
+	int status = 0;
+	pid_t pid = 0;
+
+
+	/* A directory others may write to */
+	mkdir(dir,0777);
+	chmod(dir,0777);
+
+	pid = zygote(open_path,(char*)NULL);
+	waitpid(pid,&status,0);
+	test_check("zygote in a directory of others",WIFEXITED(status) && WEXITSTATUS(status)==1);
+
+	/* The socket of someone else there */
+	test_file("open/zygote","",0);
+	output = launch(open_path,fname,"name=X");
+	test_contains("launcher in a directory of others",output,"503 Service Unavailable");
+	free(output);
+	unlink(open_path);
+	rmdir(dir);
+
+	/* Only the user set may connect */
+	sprintf(uid,"%lu",(unsigned long)getuid()+1);
+	pid = zygote(path,uid);
+
+	output = launch(path,fname,"name=W");
+	test_check("other user",strstr(output,"hello")==(char*)NULL);
+	free(output);
+
+	kill(pid,SIGTERM);
+	waitpid(pid,(int*)NULL,0);
+}
+
+
+int main( int argc, char **argv ) {
+	char *fname = test_file("page.mht","Content-type: text/plain\n\nhello <#name>\n",0);
+
+	signal(SIGPIPE,SIG_IGN);
+
+	test_requests(fname);
+	test_access(fname);
+
+	return (test_result("zygote_test"));
+}